@@ -0,0 +1,518 @@
+#include "apsp.h"
+#include "cpu_sssp.h"
+#include "trace.h"
+
+/*--------------------------------------------------------------------------------*/
+
+typedef void (*tile_fn)(cl_float *dist, cl_uint *pred, cl_uint n, cl_uint i0, cl_uint i1,
+			cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1);
+
+typedef struct _tile_kernels {
+  tile_fn relax;                //Diagonal, row and column tiles.
+  tile_fn product;              //Everything else.
+} tile_kernels;
+
+typedef struct _apsp_ctx {
+  graph *g;
+  cl_uint n;
+  cl_float *dist;
+  cl_uint *pred;
+  cl_uint k;            //Current block round.
+  cl_uint num_blocks;
+  tile_kernels tiles;
+} apsp_ctx;
+
+//Row i of the matrix holds i's out-edges, which are scattered over the
+//in-edge CSR; so initialise by destination column instead.
+static void init_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  apsp_ctx *ctx = (apsp_ctx *)arg;
+  cl_uint n = ctx->n, i, j;
+  for(i = begin; i < end; i++) {
+    for(j = 0; j < n; j++) {
+      ctx->dist[(size_t)i*n + j] = i == j ? 0 : INFINITY;
+      ctx->pred[(size_t)i*n + j] = i == j ? i : j;
+    }
+  }
+}
+
+static void edges_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  apsp_ctx *ctx = (apsp_ctx *)arg;
+  cl_uint n = ctx->n, j, e;
+  for(j = begin; j < end; j++) {
+    vertex node = ctx->g->vertices[j];
+    for(e = node.index; e < node.index + node.num_edges; e++) {
+      cl_uint i = ctx->g->edges[e].source;
+      size_t at = (size_t)i*n + j;
+      if(ctx->g->edges[e].weight < ctx->dist[at]) {
+	ctx->dist[at] = ctx->g->edges[e].weight;
+	ctx->pred[at] = i;
+      }
+    }
+  }
+}
+
+void apsp_init(thread_pool *pool, graph *g, cl_float *dist, cl_uint *pred) {
+  apsp_ctx ctx;
+  ctx.g = g;
+  ctx.n = g->num_vertices;
+  ctx.dist = dist;
+  ctx.pred = pred;
+  thread_pool_for(pool, 0, ctx.n, 16, init_range, &ctx);
+  thread_pool_for(pool, 0, ctx.n, CPU_GRAIN, edges_range, &ctx);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Relaxes tile rows [i0, i1) x columns [j0, j1) through the intermediate
+//vertices [k0, k1), in Floyd-Warshall order.  Used for the diagonal, row and
+//column tiles, whose inputs change as t advances.
+static void relax_tile(cl_float *dist, cl_uint *pred, cl_uint n, cl_uint i0, cl_uint i1,
+		       cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1) {
+  cl_uint i, j, t;
+  for(t = k0; t < k1; t++) {
+    const cl_float *through = dist + (size_t)t*n;
+    const cl_uint *through_pred = pred + (size_t)t*n;
+    for(i = i0; i < i1; i++) {
+      cl_float *row = dist + (size_t)i*n;
+      cl_uint *pred_row = pred + (size_t)i*n;
+      cl_float dit = row[t];
+      if(!(dit < INFINITY))
+	continue;
+      for(j = j0; j < j1; j++) {
+	cl_float cand = dit + through[j];
+	if(cand < row[j]) {
+	  row[j] = cand;
+	  pred_row[j] = through_pred[j];
+	}
+      }
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define APSP_X86
+#include <immintrin.h>
+
+//Same as relax_tile, eight columns at a time.
+__attribute__((target("avx2")))
+static void relax_tile_avx2(cl_float *dist, cl_uint *pred, cl_uint n, cl_uint i0, cl_uint i1,
+			    cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1) {
+  cl_uint i, j, t;
+  for(t = k0; t < k1; t++) {
+    const cl_float *through = dist + (size_t)t*n;
+    const cl_uint *through_pred = pred + (size_t)t*n;
+    for(i = i0; i < i1; i++) {
+      cl_float *row = dist + (size_t)i*n;
+      cl_uint *pred_row = pred + (size_t)i*n;
+      cl_float dit = row[t];
+      if(!(dit < INFINITY))
+	continue;
+      __m256 a = _mm256_set1_ps(dit);
+      for(j = j0; j + 8 <= j1; j += 8) {
+	__m256 cand = _mm256_add_ps(a, _mm256_loadu_ps(through + j));
+	__m256 cur = _mm256_loadu_ps(row + j);
+	__m256 better = _mm256_cmp_ps(cand, cur, _CMP_LT_OQ);
+	__m256 p = _mm256_blendv_ps(_mm256_loadu_ps((const float *)(pred_row + j)),
+				    _mm256_loadu_ps((const float *)(through_pred + j)), better);
+	_mm256_storeu_ps(row + j, _mm256_blendv_ps(cur, cand, better));
+	_mm256_storeu_ps((float *)(pred_row + j), p);
+      }
+      for(; j < j1; j++) {
+	cl_float cand = dit + through[j];
+	if(cand < row[j]) {
+	  row[j] = cand;
+	  pred_row[j] = through_pred[j];
+	}
+      }
+    }
+  }
+}
+
+//Tiles off block row and column k are a plain min-plus product
+//C = min(C, A (x) B), with A and B fixed; so each 4 x 8 block of C stays in
+//registers across all of [k0, k1).  Leftover rows and columns go through
+//relax_tile_avx2, which gives the same answer since A and B do not change.
+__attribute__((target("avx2")))
+static void product_tile_avx2(cl_float *dist, cl_uint *pred, cl_uint n, cl_uint i0, cl_uint i1,
+			      cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1) {
+  cl_uint i, j, t, r;
+  cl_uint j_end = j0 + (j1 - j0)/8*8;
+  for(i = i0; i + 4 <= i1; i += 4) {
+    const cl_float *a_rows[4];
+    for(r = 0; r < 4; r++)
+      a_rows[r] = dist + (size_t)(i + r)*n;
+    for(j = j0; j < j_end; j += 8) {
+      __m256 c[4], p[4];
+      for(r = 0; r < 4; r++) {
+	c[r] = _mm256_loadu_ps(dist + (size_t)(i + r)*n + j);
+	p[r] = _mm256_loadu_ps((const float *)(pred + (size_t)(i + r)*n + j));
+      }
+      for(t = k0; t < k1; t++) {
+	__m256 b = _mm256_loadu_ps(dist + (size_t)t*n + j);
+	__m256 bp = _mm256_loadu_ps((const float *)(pred + (size_t)t*n + j));
+	for(r = 0; r < 4; r++) {
+	  __m256 cand = _mm256_add_ps(_mm256_broadcast_ss(a_rows[r] + t), b);
+	  __m256 better = _mm256_cmp_ps(cand, c[r], _CMP_LT_OQ);
+	  c[r] = _mm256_blendv_ps(c[r], cand, better);
+	  p[r] = _mm256_blendv_ps(p[r], bp, better);
+	}
+      }
+      for(r = 0; r < 4; r++) {
+	_mm256_storeu_ps(dist + (size_t)(i + r)*n + j, c[r]);
+	_mm256_storeu_ps((float *)(pred + (size_t)(i + r)*n + j), p[r]);
+      }
+    }
+    if(j_end < j1)
+      relax_tile_avx2(dist, pred, n, i, i + 4, j_end, j1, k0, k1);
+  }
+  if(i < i1)
+    relax_tile_avx2(dist, pred, n, i, i1, j0, j1, k0, k1);
+}
+
+__attribute__((target("avx512f")))
+static void relax_tile_avx512(cl_float *dist, cl_uint *pred, cl_uint n, cl_uint i0, cl_uint i1,
+			      cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1) {
+  cl_uint i, j, t;
+  for(t = k0; t < k1; t++) {
+    const cl_float *through = dist + (size_t)t*n;
+    const cl_uint *through_pred = pred + (size_t)t*n;
+    for(i = i0; i < i1; i++) {
+      cl_float *row = dist + (size_t)i*n;
+      cl_uint *pred_row = pred + (size_t)i*n;
+      cl_float dit = row[t];
+      if(!(dit < INFINITY))
+	continue;
+      __m512 a = _mm512_set1_ps(dit);
+      for(j = j0; j < j1; j += 16) {
+	__mmask16 lanes = j1 - j >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (j1 - j)) - 1);
+	__m512 cand = _mm512_add_ps(a, _mm512_maskz_loadu_ps(lanes, through + j));
+	__m512 cur = _mm512_maskz_loadu_ps(lanes, row + j);
+	__mmask16 better = _mm512_mask_cmp_ps_mask(lanes, cand, cur, _CMP_LT_OQ);
+	_mm512_mask_storeu_ps(row + j, better, cand);
+	_mm512_mask_storeu_epi32(pred_row + j, better,
+				 _mm512_maskz_loadu_epi32(better, through_pred + j));
+      }
+    }
+  }
+}
+
+//As product_tile_avx2 with 8 x 16 register blocks; the 32 zmm registers
+//hold all eight distance and predecessor rows.
+__attribute__((target("avx512f")))
+static void product_tile_avx512(cl_float *dist, cl_uint *pred, cl_uint n, cl_uint i0, cl_uint i1,
+				cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1) {
+  cl_uint i, j, t, r;
+  cl_uint j_end = j0 + (j1 - j0)/16*16;
+  for(i = i0; i + 8 <= i1; i += 8) {
+    const cl_float *a_rows[8];
+    for(r = 0; r < 8; r++)
+      a_rows[r] = dist + (size_t)(i + r)*n;
+    for(j = j0; j < j_end; j += 16) {
+      __m512 c[8];
+      __m512i p[8];
+      for(r = 0; r < 8; r++) {
+	c[r] = _mm512_loadu_ps(dist + (size_t)(i + r)*n + j);
+	p[r] = _mm512_loadu_si512(pred + (size_t)(i + r)*n + j);
+      }
+      for(t = k0; t < k1; t++) {
+	__m512 b = _mm512_loadu_ps(dist + (size_t)t*n + j);
+	__m512i bp = _mm512_loadu_si512(pred + (size_t)t*n + j);
+	for(r = 0; r < 8; r++) {
+	  __m512 cand = _mm512_add_ps(_mm512_set1_ps(a_rows[r][t]), b);
+	  __mmask16 better = _mm512_cmp_ps_mask(cand, c[r], _CMP_LT_OQ);
+	  c[r] = _mm512_mask_mov_ps(c[r], better, cand);
+	  p[r] = _mm512_mask_mov_epi32(p[r], better, bp);
+	}
+      }
+      for(r = 0; r < 8; r++) {
+	_mm512_storeu_ps(dist + (size_t)(i + r)*n + j, c[r]);
+	_mm512_storeu_si512(pred + (size_t)(i + r)*n + j, p[r]);
+      }
+    }
+    if(j_end < j1)
+      relax_tile_avx512(dist, pred, n, i, i + 8, j_end, j1, k0, k1);
+  }
+  if(i < i1)
+    relax_tile_avx512(dist, pred, n, i, i1, j0, j1, k0, k1);
+}
+#endif
+
+static tile_kernels kernels_for(apsp_kernel kernel) {
+  tile_kernels k;
+  k.relax = k.product = relax_tile;
+#ifdef APSP_X86
+  if(kernel == APSP_KERNEL_AVX2) {
+    k.relax = relax_tile_avx2;
+    k.product = product_tile_avx2;
+  } else if(kernel == APSP_KERNEL_AVX512) {
+    k.relax = relax_tile_avx512;
+    k.product = product_tile_avx512;
+  }
+#endif
+  return k;
+}
+
+int apsp_kernel_supported(apsp_kernel kernel) {
+  switch(kernel) {
+  case APSP_KERNEL_AUTO:
+  case APSP_KERNEL_SCALAR:
+    return 1;
+#ifdef APSP_X86
+  case APSP_KERNEL_AVX2:
+    return __builtin_cpu_supports("avx2");
+  case APSP_KERNEL_AVX512:
+    return __builtin_cpu_supports("avx512f");
+#endif
+  default:
+    return 0;
+  }
+}
+
+apsp_kernel apsp_select_kernel(apsp_kernel requested) {
+  if(requested != APSP_KERNEL_AUTO)
+    return requested;
+  if(apsp_kernel_supported(APSP_KERNEL_AVX512))
+    return APSP_KERNEL_AVX512;
+  if(apsp_kernel_supported(APSP_KERNEL_AVX2))
+    return APSP_KERNEL_AVX2;
+  return APSP_KERNEL_SCALAR;
+}
+
+const char *apsp_kernel_name(apsp_kernel kernel) {
+  switch(kernel) {
+  case APSP_KERNEL_SCALAR:  return "scalar";
+  case APSP_KERNEL_AVX2:    return "avx2";
+  case APSP_KERNEL_AVX512:  return "avx512";
+  default:                  return "auto";
+  }
+}
+
+static inline cl_uint block_end(cl_uint b, cl_uint n) {
+  cl_uint end = (b + 1)*APSP_CPU_BLOCK;
+  return end < n ? end : n;
+}
+
+//Tiles [0, num_blocks) are block row k, [num_blocks, 2*num_blocks) block column k.
+static void row_column_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  apsp_ctx *ctx = (apsp_ctx *)arg;
+  cl_uint k = ctx->k, n = ctx->n, b;
+  for(b = begin; b < end; b++) {
+    cl_uint other = b % ctx->num_blocks;
+    if(other == k)
+      continue;
+    if(b < ctx->num_blocks)
+      ctx->tiles.relax(ctx->dist, ctx->pred, n, k*APSP_CPU_BLOCK, block_end(k, n),
+		       other*APSP_CPU_BLOCK, block_end(other, n), k*APSP_CPU_BLOCK, block_end(k, n));
+    else
+      ctx->tiles.relax(ctx->dist, ctx->pred, n, other*APSP_CPU_BLOCK, block_end(other, n),
+		       k*APSP_CPU_BLOCK, block_end(k, n), k*APSP_CPU_BLOCK, block_end(k, n));
+  }
+}
+
+static void remaining_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  apsp_ctx *ctx = (apsp_ctx *)arg;
+  cl_uint k = ctx->k, n = ctx->n, b;
+  for(b = begin; b < end; b++) {
+    cl_uint bi = b / ctx->num_blocks, bj = b % ctx->num_blocks;
+    if(bi == k || bj == k)
+      continue;
+    ctx->tiles.product(ctx->dist, ctx->pred, n, bi*APSP_CPU_BLOCK, block_end(bi, n),
+		       bj*APSP_CPU_BLOCK, block_end(bj, n), k*APSP_CPU_BLOCK, block_end(k, n));
+  }
+}
+
+void cpu_floyd_warshall(thread_pool *pool, apsp_kernel kernel, cl_uint n, cl_float *dist,
+			cl_uint *pred) {
+  apsp_ctx ctx;
+  ctx.g = NULL;
+  ctx.n = n;
+  ctx.dist = dist;
+  ctx.pred = pred;
+  ctx.tiles = kernels_for(apsp_select_kernel(kernel));
+  ctx.num_blocks = (n + APSP_CPU_BLOCK - 1)/APSP_CPU_BLOCK;
+  for(ctx.k = 0; ctx.k < ctx.num_blocks; ctx.k++) {
+    cl_uint k0 = ctx.k*APSP_CPU_BLOCK, k1 = block_end(ctx.k, n);
+    ctx.tiles.relax(dist, pred, n, k0, k1, k0, k1, k0, k1);
+    thread_pool_for(pool, 0, 2*ctx.num_blocks, 1, row_column_range, &ctx);
+    thread_pool_for(pool, 0, ctx.num_blocks*ctx.num_blocks, 1, remaining_range, &ctx);
+  }
+}
+
+typedef struct _min_plus_ctx {
+  cl_uint n;
+  cl_float *dist;
+  cl_uint *pred;
+  cl_uint i0, i1, j0, j1, k0, k1;
+  cl_uint column_blocks;
+  tile_kernels tiles;
+} min_plus_ctx;
+
+static void min_plus_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  min_plus_ctx *ctx = (min_plus_ctx *)arg;
+  cl_uint b;
+  for(b = begin; b < end; b++) {
+    cl_uint i = ctx->i0 + b/ctx->column_blocks*APSP_CPU_BLOCK;
+    cl_uint j = ctx->j0 + b%ctx->column_blocks*APSP_CPU_BLOCK;
+    cl_uint i_end = i + APSP_CPU_BLOCK < ctx->i1 ? i + APSP_CPU_BLOCK : ctx->i1;
+    cl_uint j_end = j + APSP_CPU_BLOCK < ctx->j1 ? j + APSP_CPU_BLOCK : ctx->j1;
+    ctx->tiles.product(ctx->dist, ctx->pred, ctx->n, i, i_end, j, j_end, ctx->k0, ctx->k1);
+  }
+}
+
+void cpu_min_plus(thread_pool *pool, apsp_kernel kernel, cl_uint n, cl_float *dist, cl_uint *pred,
+		  cl_uint i0, cl_uint i1, cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1) {
+  min_plus_ctx ctx;
+  ctx.n = n;
+  ctx.dist = dist;
+  ctx.pred = pred;
+  ctx.i0 = i0;
+  ctx.i1 = i1;
+  ctx.j0 = j0;
+  ctx.j1 = j1;
+  ctx.k0 = k0;
+  ctx.k1 = k1;
+  ctx.column_blocks = (j1 - j0 + APSP_CPU_BLOCK - 1)/APSP_CPU_BLOCK;
+  ctx.tiles = kernels_for(apsp_select_kernel(kernel));
+  cl_uint row_blocks = (i1 - i0 + APSP_CPU_BLOCK - 1)/APSP_CPU_BLOCK;
+  thread_pool_for(pool, 0, row_blocks*ctx.column_blocks, 1, min_plus_range, &ctx);
+}
+
+//Runs every kernel this CPU supports on copies of the same matrix, checks
+//each against the scalar loop and prints its rate.  One min-plus step is an
+//add and a compare, so n^3 steps count as 2n^3 operations.
+int apsp_benchmark(thread_pool *pool, cl_uint n, const cl_float *dist, const cl_uint *pred) {
+  size_t cells = (size_t)n*n;
+  cl_float *reference = (cl_float *)malloc(sizeof(cl_float)*cells);
+  cl_uint *reference_pred = (cl_uint *)malloc(sizeof(cl_uint)*cells);
+  cl_float *work = (cl_float *)malloc(sizeof(cl_float)*cells);
+  cl_uint *work_pred = (cl_uint *)malloc(sizeof(cl_uint)*cells);
+  apsp_kernel kernels[] = {APSP_KERNEL_SCALAR, APSP_KERNEL_AVX2, APSP_KERNEL_AVX512};
+  cl_uint i;
+  int mismatches = 0;
+  if(!reference || !reference_pred || !work || !work_pred) {
+    problem("A %u x %u benchmark does not fit in memory.\n", n, n);
+    exit(-1);
+  }
+  for(i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++) {
+    struct timeval start, end, delta;
+    cl_float *d = i ? work : reference;
+    cl_uint *p = i ? work_pred : reference_pred;
+    if(!apsp_kernel_supported(kernels[i])) {
+      printf("%-8s not supported on this CPU\n", apsp_kernel_name(kernels[i]));
+      continue;
+    }
+    memcpy(d, dist, sizeof(cl_float)*cells);
+    memcpy(p, pred, sizeof(cl_uint)*cells);
+    gettimeofday(&start, NULL);
+    cpu_floyd_warshall(pool, kernels[i], n, d, p);
+    gettimeofday(&end, NULL);
+    delta = tv_delta(start, end);
+    double seconds = delta.tv_sec + delta.tv_usec*1e-6;
+    double ops = 2.0*n*(double)n*n;
+    int same = !i || (!memcmp(d, reference, sizeof(cl_float)*cells) &&
+		      !memcmp(p, reference_pred, sizeof(cl_uint)*cells));
+    printf("%-8s %ld.%06ld  %7.2f Gop/s%s\n", apsp_kernel_name(kernels[i]),
+	   (long int)delta.tv_sec, (long int)delta.tv_usec,
+	   seconds > 0 ? ops/seconds*1e-9 : 0.0, same ? "" : "  MISMATCH");
+    mismatches += !same;
+  }
+  free(reference);
+  free(reference_pred);
+  free(work);
+  free(work_pred);
+  return mismatches;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//The device works on the matrix padded to a multiple of APSP_BLOCK; padding
+//vertices have no edges, so they never shorten anything.  All 3 x num_blocks
+//launches are queued back to back and the result is read once.
+void opencl_floyd_warshall(opencl_env *env, cl_uint n, cl_float *dist, cl_uint *pred) {
+  cl_int err;
+  cl_command_queue commands = env->commands;
+  cl_uint num_blocks = (n + APSP_BLOCK - 1)/APSP_BLOCK;
+  cl_uint padded = num_blocks*APSP_BLOCK, i, k;
+  size_t cells = (size_t)padded*padded;
+  cl_kernel diagonal_kernel, row_column_kernel, remaining_kernel;
+  diagonal_kernel = clCreateKernel(env->program, "FloydDiagonal", &err);
+  check_failure(err);
+  row_column_kernel = clCreateKernel(env->program, "FloydRowColumn", &err);
+  check_failure(err);
+  remaining_kernel = clCreateKernel(env->program, "FloydRemaining", &err);
+  check_failure(err);
+
+  cl_mem _dist, _pred;
+  _dist = clCreateBuffer(env->context, CL_MEM_READ_WRITE, sizeof(cl_float)*cells, NULL, NULL);
+  _pred = clCreateBuffer(env->context, CL_MEM_READ_WRITE, sizeof(cl_uint)*cells, NULL, NULL);
+  if(!_dist || !_pred) {
+    problem("Failed to allocate device memory for a %u x %u matrix.\n", padded, padded);
+    exit(-1);
+  }
+
+  //Copy the n x n matrix in with the padded row pitch, then fill the
+  //padding strips (right of it and below it) with INFINITY.
+  size_t origin[] = {0, 0, 0};
+  size_t region[] = {sizeof(cl_float)*n, n, 1};
+  err  = clEnqueueWriteBufferRect(commands, _dist, CL_TRUE, origin, origin, region,
+				  sizeof(cl_float)*padded, 0, sizeof(cl_float)*n, 0, dist, 0, NULL,
+				  trace_event(env->trace, "WriteDistances", 0, sizeof(cl_float)*n*n));
+  err |= clEnqueueWriteBufferRect(commands, _pred, CL_TRUE, origin, origin, region,
+				  sizeof(cl_uint)*padded, 0, sizeof(cl_uint)*n, 0, pred, 0, NULL,
+				  trace_event(env->trace, "WritePreds", 0, sizeof(cl_uint)*n*n));
+  check_failure(err);
+  if(padded > n) {
+    cl_uint extra = padded - n;
+    cl_float *infinities = (cl_float *)malloc(sizeof(cl_float)*extra*padded);
+    for(i = 0; i < extra*padded; i++)
+      infinities[i] = INFINITY;
+    size_t strip_origin[] = {sizeof(cl_float)*n, 0, 0};
+    size_t strip_region[] = {sizeof(cl_float)*extra, n, 1};
+    err  = clEnqueueWriteBufferRect(commands, _dist, CL_TRUE, strip_origin, origin, strip_region,
+				    sizeof(cl_float)*padded, 0, sizeof(cl_float)*extra, 0,
+				    infinities, 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(commands, _dist, CL_TRUE, sizeof(cl_float)*n*padded,
+				sizeof(cl_float)*extra*padded, infinities, 0, NULL, NULL);
+    check_failure(err);
+    free(infinities);
+  }
+
+  cl_kernel kernels[] = {diagonal_kernel, row_column_kernel, remaining_kernel};
+  for(i = 0; i < 3; i++) {
+    err  = clSetKernelArg(kernels[i], 0, sizeof(cl_mem), &_dist);
+    err |= clSetKernelArg(kernels[i], 1, sizeof(cl_mem), &_pred);
+    err |= clSetKernelArg(kernels[i], 2, sizeof(cl_uint), &padded);
+    check_failure(err);
+  }
+  size_t local[] = {APSP_BLOCK, APSP_BLOCK};
+  size_t diagonal_global[] = {APSP_BLOCK, APSP_BLOCK};
+  size_t row_column_global[] = {padded, 2*APSP_BLOCK};
+  size_t remaining_global[] = {padded, padded};
+  for(k = 0; k < num_blocks; k++) {
+    err  = clSetKernelArg(diagonal_kernel, 3, sizeof(cl_uint), &k);
+    err |= clEnqueueNDRangeKernel(commands, diagonal_kernel, 2, NULL, diagonal_global, local,
+				  0, NULL, trace_event(env->trace, "FloydDiagonal", k, 0));
+    err |= clSetKernelArg(row_column_kernel, 3, sizeof(cl_uint), &k);
+    err |= clEnqueueNDRangeKernel(commands, row_column_kernel, 2, NULL, row_column_global, local,
+				  0, NULL, trace_event(env->trace, "FloydRowColumn", k, 0));
+    err |= clSetKernelArg(remaining_kernel, 3, sizeof(cl_uint), &k);
+    err |= clEnqueueNDRangeKernel(commands, remaining_kernel, 2, NULL, remaining_global, local,
+				  0, NULL, trace_event(env->trace, "FloydRemaining", k, 0));
+    check_failure(err);
+  }
+
+  err  = clEnqueueReadBufferRect(commands, _dist, CL_TRUE, origin, origin, region,
+				 sizeof(cl_float)*padded, 0, sizeof(cl_float)*n, 0, dist, 0, NULL,
+				 trace_event(env->trace, "ReadDistances", num_blocks, sizeof(cl_float)*n*n));
+  err |= clEnqueueReadBufferRect(commands, _pred, CL_TRUE, origin, origin, region,
+				 sizeof(cl_uint)*padded, 0, sizeof(cl_uint)*n, 0, pred, 0, NULL,
+				 trace_event(env->trace, "ReadPreds", num_blocks, sizeof(cl_uint)*n*n));
+  check_failure(err);
+  trace_flush(env->trace);
+
+  clReleaseKernel(diagonal_kernel);
+  clReleaseKernel(row_column_kernel);
+  clReleaseKernel(remaining_kernel);
+  clReleaseMemObject(_dist);
+  clReleaseMemObject(_pred);
+}
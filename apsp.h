@@ -0,0 +1,48 @@
+#ifndef APSP_H
+#define APSP_H
+
+#include "sssp.h"
+#include "threadpool.h"
+
+/*
+ * Dense all-pairs shortest paths by blocked Floyd-Warshall.  Matrices are
+ * n x n, row-major: dist[i*n + j] is the distance from i to j and
+ * pred[i*n + j] the vertex before j on that path (j itself while j is
+ * unreached, as in the single-source engines).
+ *
+ * Round k of the blocked scheme finishes diagonal tile (k, k), then the
+ * tiles in block row and column k against it, then every other tile
+ * against those; O(n^3) work like the textbook loop, but tile-local.
+ */
+
+#define APSP_BLOCK 16           //Device tile, one work-item per entry.
+#define APSP_CPU_BLOCK 64       //CPU tile, sized to stay in L1/L2.
+
+//CPU tile kernels.  AUTO picks the widest one the CPU supports at run time;
+//all of them give bit-identical results.
+typedef enum {
+  APSP_KERNEL_AUTO,
+  APSP_KERNEL_SCALAR,
+  APSP_KERNEL_AVX2,
+  APSP_KERNEL_AVX512
+} apsp_kernel;
+
+//Fills dist/pred for g: 0 on the diagonal, the lightest edge i->j, else INFINITY.
+void apsp_init(thread_pool *pool, graph *g, cl_float *dist, cl_uint *pred);
+
+int apsp_kernel_supported(apsp_kernel kernel);
+apsp_kernel apsp_select_kernel(apsp_kernel requested);
+const char *apsp_kernel_name(apsp_kernel kernel);
+
+void cpu_floyd_warshall(thread_pool *pool, apsp_kernel kernel, cl_uint n, cl_float *dist,
+			cl_uint *pred);
+//Relaxes rows [i0, i1) x columns [j0, j1) of an n x n matrix through the
+//vertices [k0, k1), which must lie outside both ranges: a plain min-plus
+//product, split into tiles over the pool.
+void cpu_min_plus(thread_pool *pool, apsp_kernel kernel, cl_uint n, cl_float *dist, cl_uint *pred,
+		  cl_uint i0, cl_uint i1, cl_uint j0, cl_uint j1, cl_uint k0, cl_uint k1);
+//Times each supported kernel on a copy of dist/pred; returns how many disagreed with scalar.
+int apsp_benchmark(thread_pool *pool, cl_uint n, const cl_float *dist, const cl_uint *pred);
+void opencl_floyd_warshall(opencl_env *env, cl_uint n, cl_float *dist, cl_uint *pred);
+
+#endif
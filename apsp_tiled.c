@@ -0,0 +1,544 @@
+#include "apsp_tiled.h"
+#include "trace.h"
+
+/*--------------------------------------------------------------------------------*/
+
+int apsp_matrix_alloc(apsp_matrix *m, cl_uint n, const char *filename) {
+  size_t cells = n ? (size_t)n*n : 1;
+  memset(m, 0, sizeof(apsp_matrix));
+  if(!filename) {
+    m->dist = (cl_float *)malloc(sizeof(cl_float)*cells);
+    m->pred = (cl_uint *)malloc(sizeof(cl_uint)*cells);
+    if(!m->dist || !m->pred) {
+      problem("A %u x %u distance matrix does not fit in memory; --apsp-matrix keeps it "
+	      "in a file.\n", n, n);
+      apsp_matrix_free(m);
+      return -1;
+    }
+    return 0;
+  }
+
+  size_t size = (sizeof(cl_float) + sizeof(cl_uint))*cells;
+  int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  //Reserve the blocks now: a sparse file that runs out of disk later
+  //would fault in the middle of the solve instead.
+#ifdef __APPLE__
+  int failed = fd < 0 || ftruncate(fd, (off_t)size) < 0;
+#else
+  int failed = fd < 0 || posix_fallocate(fd, 0, (off_t)size) != 0;
+#endif
+  if(failed) {
+    problem("Could not create a %llu byte matrix file %s\n", (unsigned long long)size, filename);
+    if(fd >= 0) {
+      close(fd);
+      unlink(filename);
+    }
+    return -1;
+  }
+  void *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(image == MAP_FAILED) {
+    problem("Could not map %s\n", filename);
+    return -1;
+  }
+  m->mapping = image;
+  m->mapping_size = size;
+  m->dist = (cl_float *)image;
+  m->pred = (cl_uint *)(m->dist + cells);
+  return 0;
+}
+
+void apsp_matrix_free(apsp_matrix *m) {
+  if(m->mapping) {
+    munmap(m->mapping, m->mapping_size);
+  } else {
+    free(m->dist);
+    free(m->pred);
+  }
+  memset(m, 0, sizeof(apsp_matrix));
+}
+
+/*--------------------------------------------------------------------------------*/
+
+cl_ulong opencl_apsp_memory(opencl_env *env, cl_ulong *max_alloc) {
+  cl_ulong global_mem;
+  cl_int err;
+  err  = clGetDeviceInfo(env->device_id, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, NULL);
+  err |= clGetDeviceInfo(env->device_id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), max_alloc, NULL);
+  check_failure(err);
+  return global_mem/4*3;
+}
+
+cl_ulong host_apsp_memory(void) {
+  long pages = sysconf(_SC_PHYS_PAGES), page_size = sysconf(_SC_PAGESIZE);
+  if(pages <= 0 || page_size <= 0)
+    return (cl_ulong)1 << 30;
+  return (cl_ulong)pages*page_size/2;
+}
+
+//A slot holds a tile's distances and preds, 8 bytes per cell.
+cl_uint apsp_tile_size(cl_uint n, cl_ulong budget, cl_ulong max_alloc, cl_uint granule,
+		       cl_uint *row_tiles) {
+  cl_ulong padded = (n + (cl_ulong)granule - 1)/granule*granule;
+  cl_ulong cell = sizeof(cl_float) + sizeof(cl_uint);
+  *row_tiles = 1;
+  if(padded*padded*cell <= budget && padded*padded*sizeof(cl_float) <= max_alloc)
+    return 0;
+  cl_ulong slot_cells = budget/(cell*(APSP_TILE_SLOTS + APSP_ROW_TILES));
+  if(slot_cells > max_alloc/sizeof(cl_float))
+    slot_cells = max_alloc/sizeof(cl_float);
+  cl_ulong tile = (cl_ulong)sqrt((double)slot_cells)/granule*granule;
+  if(tile < granule)
+    tile = granule;
+  if(tile > padded)
+    tile = padded;
+  cl_ulong num_blocks = (n + tile - 1)/tile;
+  cl_ulong fit = budget/(cell*tile*tile);
+  cl_ulong rows = fit > APSP_TILE_SLOTS + 1 ? fit - APSP_TILE_SLOTS : 1;
+  if(rows > num_blocks - 1)
+    rows = num_blocks > 1 ? num_blocks - 1 : 1;
+  *row_tiles = (cl_uint)rows;
+  return (cl_uint)tile;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _tile_slot {
+  cl_float *dist;               //CPU slots
+  cl_uint *pred;
+  cl_mem _dist;                 //device slots
+  cl_mem _pred;
+  cl_event loaded;              //last load into the slot
+  cl_event computed;            //last kernel or copy that touched it
+  cl_event stored;              //last store out of it
+} tile_slot;
+
+typedef struct _tiled_ctx {
+  thread_pool *pool;
+  opencl_env *env;
+  apsp_kernel kernel;
+  cl_uint n;
+  cl_uint tile;
+  cl_uint num_blocks;
+  cl_float *dist;
+  cl_uint *pred;
+  tile_slot *slots;
+  cl_uint num_slots;
+  cl_uint round;
+  cl_ulong bytes_moved;
+  //CPU: products run as the bottom-right quadrant of a 2T x 2T matrix.
+  cl_float *work;
+  cl_uint *work_pred;
+  //Device
+  cl_command_queue transfers;
+  cl_kernel diagonal_kernel;
+  cl_kernel row_column_kernel;
+  cl_kernel remaining_kernel;
+  cl_kernel product_kernel;
+  cl_float *infinities;         //a tile of INFINITY, for padding edge tiles
+  tile_slot *pending;           //store queued after the next load
+  cl_uint pending_bi;
+  cl_uint pending_bj;
+} tiled_ctx;
+
+static inline cl_uint tile_extent(const tiled_ctx *ctx, cl_uint b) {
+  cl_uint rest = ctx->n - b*ctx->tile;
+  return rest < ctx->tile ? rest : ctx->tile;
+}
+
+//Hands over the caller's reference to e.
+static inline void set_event(cl_event *slot, cl_event e) {
+  if(*slot)
+    clReleaseEvent(*slot);
+  *slot = e;
+}
+
+static void keep_event(trace_file *t, cl_event e, const char *name, cl_uint round, cl_ulong bytes) {
+  cl_event *traced = trace_event(t, name, round, bytes);
+  if(traced) {
+    clRetainEvent(e);
+    *traced = e;
+  }
+}
+
+static cl_uint add_wait(cl_event *waits, cl_uint num_waits, cl_event e) {
+  if(e)
+    waits[num_waits++] = e;
+  return num_waits;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static void enqueue_store(tiled_ctx *ctx, tile_slot *s, cl_uint bi, cl_uint bj) {
+  cl_uint rows = tile_extent(ctx, bi), cols = tile_extent(ctx, bj), n = ctx->n, t = ctx->tile;
+  cl_event done;
+  cl_int err;
+  size_t host_origin[] = {sizeof(cl_float)*bj*t, (size_t)bi*t, 0};
+  size_t origin[] = {0, 0, 0};
+  size_t region[] = {sizeof(cl_float)*cols, rows, 1};
+  err  = clEnqueueReadBufferRect(ctx->transfers, s->_dist, CL_FALSE, origin, host_origin, region,
+				 sizeof(cl_float)*t, 0, sizeof(cl_float)*n, 0, ctx->dist,
+				 s->computed ? 1 : 0, s->computed ? &s->computed : NULL, NULL);
+  err |= clEnqueueReadBufferRect(ctx->transfers, s->_pred, CL_FALSE, origin, host_origin, region,
+				 sizeof(cl_uint)*t, 0, sizeof(cl_uint)*n, 0, ctx->pred, 0, NULL, &done);
+  check_failure(err);
+  keep_event(ctx->env->trace, done, "StoreTile", ctx->round, (cl_ulong)rows*cols*8);
+  set_event(&s->stored, done);
+}
+
+static void flush_store(tiled_ctx *ctx) {
+  if(ctx->pending)
+    enqueue_store(ctx, ctx->pending, ctx->pending_bi, ctx->pending_bj);
+  ctx->pending = NULL;
+}
+
+//Anything about to overwrite s, or read the host tile a queued store
+//writes, has to let that store go first.
+static void before_write(tiled_ctx *ctx, tile_slot *s) {
+  if(ctx->pending == s)
+    flush_store(ctx);
+}
+
+static void load_tile(tiled_ctx *ctx, tile_slot *s, cl_uint bi, cl_uint bj) {
+  cl_uint rows = tile_extent(ctx, bi), cols = tile_extent(ctx, bj), n = ctx->n, t = ctx->tile, r;
+  size_t at = (size_t)bi*t*n + (size_t)bj*t;
+  ctx->bytes_moved += (cl_ulong)rows*cols*8;
+  if(!ctx->env) {
+    if(rows < t || cols < t)
+      for(r = 0; r < t*t; r++)
+	s->dist[r] = INFINITY;
+    for(r = 0; r < rows; r++) {
+      memcpy(s->dist + (size_t)r*t, ctx->dist + at + (size_t)r*n, sizeof(cl_float)*cols);
+      memcpy(s->pred + (size_t)r*t, ctx->pred + at + (size_t)r*n, sizeof(cl_uint)*cols);
+    }
+    return;
+  }
+
+  before_write(ctx, s);
+  if(ctx->pending && ctx->pending_bi == bi && ctx->pending_bj == bj)
+    flush_store(ctx);
+  cl_event done;
+  cl_int err = 0;
+  cl_uint wait = s->computed ? 1 : 0;
+  size_t host_origin[] = {sizeof(cl_float)*bj*t, (size_t)bi*t, 0};
+  size_t origin[] = {0, 0, 0};
+  size_t region[] = {sizeof(cl_float)*cols, rows, 1};
+  //The transfer queue is in order, so only its first command has to wait.
+  if(rows < t || cols < t) {
+    err |= clEnqueueWriteBuffer(ctx->transfers, s->_dist, CL_FALSE, 0, sizeof(cl_float)*t*t,
+				ctx->infinities, wait, wait ? &s->computed : NULL, NULL);
+    wait = 0;
+  }
+  err |= clEnqueueWriteBufferRect(ctx->transfers, s->_dist, CL_FALSE, origin, host_origin, region,
+				  sizeof(cl_float)*t, 0, sizeof(cl_float)*n, 0, ctx->dist,
+				  wait, wait ? &s->computed : NULL, NULL);
+  err |= clEnqueueWriteBufferRect(ctx->transfers, s->_pred, CL_FALSE, origin, host_origin, region,
+				  sizeof(cl_uint)*t, 0, sizeof(cl_uint)*n, 0, ctx->pred, 0, NULL, &done);
+  check_failure(err);
+  keep_event(ctx->env->trace, done, "LoadTile", ctx->round, (cl_ulong)rows*cols*8);
+  set_event(&s->loaded, done);
+  //The store before this load can go now; it overlaps the next product.
+  flush_store(ctx);
+}
+
+static void store_tile(tiled_ctx *ctx, tile_slot *s, cl_uint bi, cl_uint bj) {
+  cl_uint rows = tile_extent(ctx, bi), cols = tile_extent(ctx, bj), n = ctx->n, t = ctx->tile, r;
+  size_t at = (size_t)bi*t*n + (size_t)bj*t;
+  ctx->bytes_moved += (cl_ulong)rows*cols*8;
+  if(!ctx->env) {
+    for(r = 0; r < rows; r++) {
+      memcpy(ctx->dist + at + (size_t)r*n, s->dist + (size_t)r*t, sizeof(cl_float)*cols);
+      memcpy(ctx->pred + at + (size_t)r*n, s->pred + (size_t)r*t, sizeof(cl_uint)*cols);
+    }
+    return;
+  }
+  flush_store(ctx);
+  ctx->pending = s;
+  ctx->pending_bi = bi;
+  ctx->pending_bj = bj;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Waits for whatever last loaded the slots involved, and for the last store
+//out of the one written.
+static cl_uint kernel_waits(tiled_ctx *ctx, cl_event *waits, tile_slot *written, tile_slot *a,
+			    tile_slot *b) {
+  cl_uint num_waits = 0;
+  before_write(ctx, written);
+  num_waits = add_wait(waits, num_waits, written->loaded);
+  num_waits = add_wait(waits, num_waits, written->stored);
+  if(a)
+    num_waits = add_wait(waits, num_waits, a->loaded);
+  if(b)
+    num_waits = add_wait(waits, num_waits, b->loaded);
+  return num_waits;
+}
+
+static void kernel_done(cl_event done, tile_slot *written, tile_slot *a, tile_slot *b) {
+  if(a) {
+    clRetainEvent(done);
+    set_event(&a->computed, done);
+  }
+  if(b) {
+    clRetainEvent(done);
+    set_event(&b->computed, done);
+  }
+  set_event(&written->computed, done);
+}
+
+static void copy_tile(tiled_ctx *ctx, tile_slot *to, tile_slot *from) {
+  size_t cells = (size_t)ctx->tile*ctx->tile;
+  if(!ctx->env) {
+    memcpy(to->dist, from->dist, sizeof(cl_float)*cells);
+    memcpy(to->pred, from->pred, sizeof(cl_uint)*cells);
+    return;
+  }
+  cl_event waits[4], done;
+  cl_uint num_waits = kernel_waits(ctx, waits, to, from, NULL);
+  cl_int err;
+  err  = clEnqueueCopyBuffer(ctx->env->commands, from->_dist, to->_dist, 0, 0,
+			     sizeof(cl_float)*cells, num_waits, num_waits ? waits : NULL, NULL);
+  err |= clEnqueueCopyBuffer(ctx->env->commands, from->_pred, to->_pred, 0, 0,
+			     sizeof(cl_uint)*cells, 0, NULL, &done);
+  check_failure(err);
+  kernel_done(done, to, from, NULL);
+}
+
+//Floyd-Warshall over the slot alone, as opencl_floyd_warshall does over a
+//whole matrix.
+static void close_tile(tiled_ctx *ctx, tile_slot *s) {
+  if(!ctx->env) {
+    cpu_floyd_warshall(ctx->pool, ctx->kernel, ctx->tile, s->dist, s->pred);
+    return;
+  }
+  cl_event waits[4], done = NULL;
+  cl_uint num_waits = kernel_waits(ctx, waits, s, NULL, NULL), k, i;
+  cl_uint t = ctx->tile, num_blocks = t/APSP_BLOCK;
+  cl_int err = 0;
+  cl_kernel kernels[] = {ctx->diagonal_kernel, ctx->row_column_kernel, ctx->remaining_kernel};
+  size_t local[] = {APSP_BLOCK, APSP_BLOCK};
+  size_t diagonal_global[] = {APSP_BLOCK, APSP_BLOCK};
+  size_t row_column_global[] = {t, 2*APSP_BLOCK};
+  size_t remaining_global[] = {t, t};
+  for(i = 0; i < 3; i++) {
+    err |= clSetKernelArg(kernels[i], 0, sizeof(cl_mem), &s->_dist);
+    err |= clSetKernelArg(kernels[i], 1, sizeof(cl_mem), &s->_pred);
+    err |= clSetKernelArg(kernels[i], 2, sizeof(cl_uint), &t);
+  }
+  for(k = 0; k < num_blocks; k++) {
+    err |= clSetKernelArg(ctx->diagonal_kernel, 3, sizeof(cl_uint), &k);
+    err |= clEnqueueNDRangeKernel(ctx->env->commands, ctx->diagonal_kernel, 2, NULL,
+				  diagonal_global, local, k ? 0 : num_waits,
+				  k || !num_waits ? NULL : waits, NULL);
+    err |= clSetKernelArg(ctx->row_column_kernel, 3, sizeof(cl_uint), &k);
+    err |= clEnqueueNDRangeKernel(ctx->env->commands, ctx->row_column_kernel, 2, NULL,
+				  row_column_global, local, 0, NULL, NULL);
+    err |= clSetKernelArg(ctx->remaining_kernel, 3, sizeof(cl_uint), &k);
+    err |= clEnqueueNDRangeKernel(ctx->env->commands, ctx->remaining_kernel, 2, NULL,
+				  remaining_global, local, 0, NULL,
+				  k + 1 == num_blocks ? &done : NULL);
+  }
+  check_failure(err);
+  keep_event(ctx->env->trace, done, "CloseTile", ctx->round, 0);
+  kernel_done(done, s, NULL, NULL);
+}
+
+//c = min(c, a (x) b), preds from b.
+static void product_tile(tiled_ctx *ctx, tile_slot *c, tile_slot *a, tile_slot *b) {
+  cl_uint t = ctx->tile, r;
+  if(!ctx->env) {
+    size_t w = 2*(size_t)t;
+    for(r = 0; r < t; r++) {
+      memcpy(ctx->work + (t + r)*w, a->dist + (size_t)r*t, sizeof(cl_float)*t);
+      memcpy(ctx->work + r*w + t, b->dist + (size_t)r*t, sizeof(cl_float)*t);
+      memcpy(ctx->work_pred + r*w + t, b->pred + (size_t)r*t, sizeof(cl_uint)*t);
+      memcpy(ctx->work + (t + r)*w + t, c->dist + (size_t)r*t, sizeof(cl_float)*t);
+      memcpy(ctx->work_pred + (t + r)*w + t, c->pred + (size_t)r*t, sizeof(cl_uint)*t);
+    }
+    cpu_min_plus(ctx->pool, ctx->kernel, 2*t, ctx->work, ctx->work_pred, t, 2*t, t, 2*t, 0, t);
+    for(r = 0; r < t; r++) {
+      memcpy(c->dist + (size_t)r*t, ctx->work + (t + r)*w + t, sizeof(cl_float)*t);
+      memcpy(c->pred + (size_t)r*t, ctx->work_pred + (t + r)*w + t, sizeof(cl_uint)*t);
+    }
+    return;
+  }
+  cl_event waits[4], done;
+  cl_uint num_waits = kernel_waits(ctx, waits, c, a, b);
+  cl_int err;
+  size_t local[] = {APSP_BLOCK, APSP_BLOCK};
+  size_t global[] = {t, t};
+  err  = clSetKernelArg(ctx->product_kernel, 0, sizeof(cl_mem), &c->_dist);
+  err |= clSetKernelArg(ctx->product_kernel, 1, sizeof(cl_mem), &c->_pred);
+  err |= clSetKernelArg(ctx->product_kernel, 2, sizeof(cl_mem), &a->_dist);
+  err |= clSetKernelArg(ctx->product_kernel, 3, sizeof(cl_mem), &b->_dist);
+  err |= clSetKernelArg(ctx->product_kernel, 4, sizeof(cl_mem), &b->_pred);
+  err |= clSetKernelArg(ctx->product_kernel, 5, sizeof(cl_uint), &t);
+  err |= clEnqueueNDRangeKernel(ctx->env->commands, ctx->product_kernel, 2, NULL, global, local,
+				num_waits, num_waits ? waits : NULL, &done);
+  check_failure(err);
+  keep_event(ctx->env->trace, done, "FloydProduct", ctx->round, 0);
+  kernel_done(done, c, a, b);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static void setup_slots(tiled_ctx *ctx) {
+  size_t cells = (size_t)ctx->tile*ctx->tile;
+  cl_uint i;
+  cl_int err;
+  ctx->slots = (tile_slot *)calloc(ctx->num_slots, sizeof(tile_slot));
+  if(!ctx->slots) {
+    problem("Failed to allocate the tile slots.\n");
+    exit(-1);
+  }
+  if(!ctx->env) {
+    ctx->work = (cl_float *)malloc(sizeof(cl_float)*4*cells);
+    ctx->work_pred = (cl_uint *)malloc(sizeof(cl_uint)*4*cells);
+    if(!ctx->work || !ctx->work_pred) {
+      problem("Failed to allocate %u x %u tiles.\n", ctx->tile, ctx->tile);
+      exit(-1);
+    }
+    for(i = 0; i < ctx->num_slots; i++) {
+      ctx->slots[i].dist = (cl_float *)malloc(sizeof(cl_float)*cells);
+      ctx->slots[i].pred = (cl_uint *)malloc(sizeof(cl_uint)*cells);
+      if(!ctx->slots[i].dist || !ctx->slots[i].pred) {
+	problem("Failed to allocate %u x %u tiles.\n", ctx->tile, ctx->tile);
+	exit(-1);
+      }
+    }
+    return;
+  }
+
+  opencl_env *env = ctx->env;
+  ctx->transfers = clCreateCommandQueue(env->context, env->device_id,
+					env->trace ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+  check_failure(err);
+  ctx->diagonal_kernel = clCreateKernel(env->program, "FloydDiagonal", &err);
+  check_failure(err);
+  ctx->row_column_kernel = clCreateKernel(env->program, "FloydRowColumn", &err);
+  check_failure(err);
+  ctx->remaining_kernel = clCreateKernel(env->program, "FloydRemaining", &err);
+  check_failure(err);
+  ctx->product_kernel = clCreateKernel(env->program, "FloydProduct", &err);
+  check_failure(err);
+  ctx->infinities = (cl_float *)malloc(sizeof(cl_float)*cells);
+  if(!ctx->infinities) {
+    problem("Failed to allocate %u x %u tiles.\n", ctx->tile, ctx->tile);
+    exit(-1);
+  }
+  for(i = 0; i < cells; i++)
+    ctx->infinities[i] = INFINITY;
+  for(i = 0; i < ctx->num_slots; i++) {
+    ctx->slots[i]._dist = clCreateBuffer(env->context, CL_MEM_READ_WRITE, sizeof(cl_float)*cells,
+					 NULL, NULL);
+    ctx->slots[i]._pred = clCreateBuffer(env->context, CL_MEM_READ_WRITE, sizeof(cl_uint)*cells,
+					 NULL, NULL);
+    if(!ctx->slots[i]._dist || !ctx->slots[i]._pred) {
+      problem("Failed to allocate device memory for %u %u x %u tiles.\n", ctx->num_slots,
+	      ctx->tile, ctx->tile);
+      exit(-1);
+    }
+  }
+}
+
+static void release_slots(tiled_ctx *ctx) {
+  cl_uint i;
+  for(i = 0; i < ctx->num_slots; i++) {
+    tile_slot *s = &ctx->slots[i];
+    free(s->dist);
+    free(s->pred);
+    if(s->_dist)
+      clReleaseMemObject(s->_dist);
+    if(s->_pred)
+      clReleaseMemObject(s->_pred);
+    set_event(&s->loaded, NULL);
+    set_event(&s->computed, NULL);
+    set_event(&s->stored, NULL);
+  }
+  free(ctx->slots);
+  free(ctx->work);
+  free(ctx->work_pred);
+  free(ctx->infinities);
+  if(ctx->env) {
+    clReleaseKernel(ctx->diagonal_kernel);
+    clReleaseKernel(ctx->row_column_kernel);
+    clReleaseKernel(ctx->remaining_kernel);
+    clReleaseKernel(ctx->product_kernel);
+    clReleaseCommandQueue(ctx->transfers);
+  }
+}
+
+void tiled_floyd_warshall(thread_pool *pool, opencl_env *env, apsp_kernel kernel, cl_uint n,
+			  cl_float *dist, cl_uint *pred, cl_uint tile, cl_uint row_tiles,
+			  tiled_stats *stats) {
+  tiled_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.pool = pool;
+  ctx.env = env;
+  ctx.kernel = kernel;
+  ctx.n = n;
+  ctx.tile = tile;
+  ctx.num_blocks = (n + tile - 1)/tile;
+  ctx.dist = dist;
+  ctx.pred = pred;
+  ctx.num_slots = APSP_TILE_SLOTS + row_tiles;
+  setup_slots(&ctx);
+
+  tile_slot *diag = &ctx.slots[0], *column = &ctx.slots[1], *work = &ctx.slots[3];
+  tile_slot *rows = &ctx.slots[APSP_TILE_SLOTS];
+  cl_uint *others = (cl_uint *)malloc(sizeof(cl_uint)*ctx.num_blocks);
+  cl_uint next = 0, k, b, x, y, first;
+  for(k = 0; k < ctx.num_blocks; k++) {
+    cl_uint num_others = 0;
+    ctx.round = k;
+    load_tile(&ctx, diag, k, k);
+    close_tile(&ctx, diag);
+    store_tile(&ctx, diag, k, k);
+    for(b = 0; b < ctx.num_blocks; b++)
+      if(b != k)
+	others[num_others++] = b;
+    for(first = 0; first < num_others; first += row_tiles) {
+      cl_uint chunk = num_others - first < row_tiles ? num_others - first : row_tiles;
+      for(x = 0; x < chunk; x++) {
+	tile_slot *w = &work[next++ % 2];
+	load_tile(&ctx, w, k, others[first + x]);
+	copy_tile(&ctx, &rows[x], w);
+	product_tile(&ctx, &rows[x], diag, w);
+	store_tile(&ctx, &rows[x], k, others[first + x]);
+      }
+      for(y = 0; y < num_others; y++) {
+	cl_uint i = others[y];
+	tile_slot *col = &column[y % 2];
+	if(first) {
+	  load_tile(&ctx, col, i, k);
+	} else {
+	  tile_slot *w = &work[next++ % 2];
+	  load_tile(&ctx, w, i, k);
+	  copy_tile(&ctx, col, w);
+	  product_tile(&ctx, col, w, diag);
+	  store_tile(&ctx, col, i, k);
+	}
+	for(x = 0; x < chunk; x++) {
+	  tile_slot *w = &work[next++ % 2];
+	  load_tile(&ctx, w, i, others[first + x]);
+	  product_tile(&ctx, w, col, &rows[x]);
+	  store_tile(&ctx, w, i, others[first + x]);
+	}
+      }
+    }
+  }
+  if(env) {
+    flush_store(&ctx);
+    clFinish(env->commands);
+    clFinish(ctx.transfers);
+    trace_flush(env->trace);
+  }
+  if(stats) {
+    stats->tile = tile;
+    stats->row_tiles = row_tiles;
+    stats->bytes_moved = ctx.bytes_moved;
+  }
+  free(others);
+  release_slots(&ctx);
+}
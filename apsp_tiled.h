@@ -0,0 +1,71 @@
+#ifndef APSP_TILED_H
+#define APSP_TILED_H
+
+#include "apsp.h"
+
+/*
+ * Out-of-core blocked Floyd-Warshall, for matrices that do not fit the
+ * device (or, on the CPU, the memory budget).  The n x n matrices stay on
+ * the host, in memory or mapped from a file, and T x T tiles stream through
+ * a fixed set of slots in working memory.  Round K:
+ *
+ *   D = (K, K)                 closed in place
+ *   (K, J) = min(., D (x) .)   row tiles, then kept resident
+ *   (I, K) = min(., . (x) D)   column tiles, one per block row I
+ *   (I, J) = min(., (I, K) (x) (K, J))
+ *
+ * Since D is closed, a row or column tile needs one product with it rather
+ * than a Floyd-Warshall pass; the product reads the tile it replaces, so it
+ * goes into a copy.  Row tiles are held row_tiles at a time and block rows
+ * are swept once per chunk of them, reloading only their column tile, so
+ * every other tile crosses the bus once in and once out per round.
+ *
+ * On the device, tiles move on a second, transfer queue and consecutive
+ * tiles alternate between two slots; each store is queued after the next
+ * load, so the next tile comes in while the current one is computed.  Edge
+ * tiles are padded with INFINITY, which never shortens anything.
+ */
+
+//Slots besides the row tiles: D, two column tiles and two working tiles.
+#define APSP_TILE_SLOTS 5
+//Row tiles the tile size is first chosen to leave room for.
+#define APSP_ROW_TILES 4
+
+//dist and pred, in memory or mapped from a file.
+typedef struct _apsp_matrix {
+  cl_float *dist;
+  cl_uint *pred;
+  void *mapping;
+  size_t mapping_size;
+} apsp_matrix;
+
+typedef struct _tiled_stats {
+  cl_uint tile;
+  cl_uint row_tiles;
+  cl_ulong bytes_moved;         //tile loads and stores
+} tiled_stats;
+
+//Allocates the n x n matrices, or maps filename (created or truncated to
+//dist followed by pred, row-major) when it is not NULL.  Returns 0, or -1
+//after reporting the problem.
+int apsp_matrix_alloc(apsp_matrix *m, cl_uint n, const char *filename);
+void apsp_matrix_free(apsp_matrix *m);
+
+//Working memory for tiles: most of the device's (and its largest buffer in
+//*max_alloc), or half the host's.
+cl_ulong opencl_apsp_memory(opencl_env *env, cl_ulong *max_alloc);
+cl_ulong host_apsp_memory(void);
+
+//Tile size, a multiple of granule, for solving n vertices within budget
+//bytes, no buffer over max_alloc; 0 when the whole (padded) matrix fits.
+//Sets *row_tiles to how many row tiles are held at once.
+cl_uint apsp_tile_size(cl_uint n, cl_ulong budget, cl_ulong max_alloc, cl_uint granule,
+		       cl_uint *row_tiles);
+
+//Runs on env when it is not NULL, else on the pool with kernel.  tile is a
+//multiple of APSP_BLOCK on the device.
+void tiled_floyd_warshall(thread_pool *pool, opencl_env *env, apsp_kernel kernel, cl_uint n,
+			  cl_float *dist, cl_uint *pred, cl_uint tile, cl_uint row_tiles,
+			  tiled_stats *stats);
+
+#endif
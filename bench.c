@@ -0,0 +1,241 @@
+#include "bench.h"
+#include "cpu_sssp.h"
+#include "opencl_sssp.h"
+
+/*--------------------------------------------------------------------------------*/
+
+#define NUM_FAMILIES 3
+#define NUM_MODES 3
+#define MAX_TARGETS 3
+//Tries at drawing a source with out-edges before taking what came up.
+#define SOURCE_TRIES 64
+
+static const graph_family families[NUM_FAMILIES] = { GEN_UNIFORM, GEN_RMAT, GEN_GRID };
+static const char *mode_names[NUM_MODES] = { "sweep", "frontier", "delta" };
+
+//An engine to measure: the CPU pool, or a device built for one layout.
+typedef struct _bench_target {
+  const char *engine;
+  const char *layout;
+  opencl_env *env;
+} bench_target;
+
+typedef struct _bench_result {
+  double median_seconds;
+  double p95_seconds;
+  double edges_per_second;
+  cl_ulong edges_relaxed;
+  cl_uint rounds;
+} bench_result;
+
+/*--------------------------------------------------------------------------------*/
+
+static int doublecomp(const void *a, const void *b) {
+  double f = *(const double *)a, s = *(const double *)b;
+  return (f > s) - (f < s);
+}
+
+static int ulongcomp(const void *a, const void *b) {
+  cl_ulong f = *(const cl_ulong *)a, s = *(const cl_ulong *)b;
+  return (f > s) - (f < s);
+}
+
+static void run_once(const bench_config *config, bench_target *t, cl_uint mode, graph *g,
+		     cl_uint source, cl_float delta, cl_float *distances, cl_uint *preds,
+		     sssp_stats *stats) {
+  if(t->env) {
+    if(mode == 0)
+      opencl_sssp(t->env, g, source, 0, INFINITY, distances, preds, stats);
+    else if(mode == 1)
+      opencl_frontier_sssp(t->env, g, source, INFINITY, distances, preds, stats);
+    else
+      opencl_delta_stepping(t->env, g, source, delta, INFINITY, distances, preds, stats);
+  } else {
+    if(mode == 0)
+      cpu_bellman_ford(config->pool, g, source, INFINITY, distances, preds, stats);
+    else if(mode == 1)
+      cpu_frontier_sssp(config->pool, g, source, INFINITY, distances, preds, stats);
+    else
+      cpu_delta_stepping(config->pool, g, source, delta, INFINITY, distances, preds, stats);
+  }
+}
+
+//Median and nearest-rank p95 over the repeats; the rate is taken per run.
+static void measure(const bench_config *config, bench_target *t, cl_uint mode, graph *g,
+		    const cl_uint *sources, cl_float delta, cl_float *distances, cl_uint *preds,
+		    bench_result *result) {
+  cl_uint r, repeat = config->repeat;
+  double *seconds = (double *)malloc(sizeof(double)*repeat);
+  double *rates = (double *)malloc(sizeof(double)*repeat);
+  cl_ulong *edges = (cl_ulong *)malloc(sizeof(cl_ulong)*repeat);
+  cl_ulong *rounds = (cl_ulong *)malloc(sizeof(cl_ulong)*repeat);
+  struct timeval start, end, delta_t;
+  sssp_stats stats;
+
+  run_once(config, t, mode, g, sources[0], delta, distances, preds, &stats);
+  for(r = 0; r < repeat; r++) {
+    gettimeofday(&start, NULL);
+    run_once(config, t, mode, g, sources[r], delta, distances, preds, &stats);
+    gettimeofday(&end, NULL);
+    delta_t = tv_delta(start, end);
+    seconds[r] = delta_t.tv_sec + delta_t.tv_usec*1e-6;
+    edges[r] = stats.edges_scanned;
+    rounds[r] = stats.rounds;
+    rates[r] = seconds[r] > 0 ? stats.edges_scanned/seconds[r] : 0;
+  }
+  qsort(seconds, repeat, sizeof(double), doublecomp);
+  qsort(rates, repeat, sizeof(double), doublecomp);
+  qsort(edges, repeat, sizeof(cl_ulong), ulongcomp);
+  qsort(rounds, repeat, sizeof(cl_ulong), ulongcomp);
+  result->median_seconds = seconds[repeat/2];
+  result->p95_seconds = seconds[(repeat*95 + 99)/100 - 1];
+  result->edges_per_second = rates[repeat/2];
+  result->edges_relaxed = edges[repeat/2];
+  result->rounds = (cl_uint)rounds[repeat/2];
+  free(seconds);
+  free(rates);
+  free(edges);
+  free(rounds);
+}
+
+//Seeded sources, the same for every engine and mode on a graph.  A source
+//without out-edges would finish at once, so a few redraws are allowed.
+static void pick_sources(const bench_config *config, graph *g, cl_uint *sources) {
+  cl_ulong state = config->seed;
+  cl_uint r, tries;
+  for(r = 0; r < config->repeat; r++) {
+    for(tries = 0; tries < SOURCE_TRIES; tries++) {
+      sources[r] = (cl_uint)(gen_next(&state) % g->num_vertices);
+      if(g->out_vertices[sources[r]].num_edges)
+	break;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static void write_header(const bench_config *config, FILE *out) {
+  if(config->format == BENCH_CSV) {
+    fprintf(out, "family,scale,vertices,edges,engine,layout,mode,repeat,median_seconds,"
+	    "p95_seconds,edges_relaxed,edges_per_second,rounds\n");
+    return;
+  }
+  fprintf(out, "{\n  \"seed\": %llu,\n  \"threads\": %u,\n  \"edge_factor\": %u,\n"
+	  "  \"repeat\": %u,\n  \"results\": [",
+	  (unsigned long long)config->seed, thread_pool_size(config->pool),
+	  config->edge_factor, config->repeat);
+}
+
+static void write_result(const bench_config *config, FILE *out, int first, graph_family family,
+			 cl_uint scale, graph *g, bench_target *t, cl_uint mode,
+			 bench_result *result) {
+  if(config->format == BENCH_CSV) {
+    fprintf(out, "%s,%u,%u,%u,%s,%s,%s,%u,%.6f,%.6f,%llu,%.0f,%u\n", family_name(family), scale,
+	    g->num_vertices, g->num_edges, t->engine, t->layout, mode_names[mode], config->repeat,
+	    result->median_seconds, result->p95_seconds,
+	    (unsigned long long)result->edges_relaxed, result->edges_per_second, result->rounds);
+    return;
+  }
+  fprintf(out, "%s\n    {\"family\": \"%s\", \"scale\": %u, \"vertices\": %u, \"edges\": %u, "
+	  "\"engine\": \"%s\", \"layout\": \"%s\", \"mode\": \"%s\", \"median_seconds\": %.6f, "
+	  "\"p95_seconds\": %.6f, \"edges_relaxed\": %llu, \"edges_per_second\": %.0f, "
+	  "\"rounds\": %u}",
+	  first ? "" : ",", family_name(family), scale, g->num_vertices, g->num_edges, t->engine,
+	  t->layout, mode_names[mode], result->median_seconds, result->p95_seconds,
+	  (unsigned long long)result->edges_relaxed, result->edges_per_second, result->rounds);
+}
+
+//Both layouts are separate programs (-DWIDE_EDGES), so each gets its own
+//environment.  Returns how many targets there are.
+static cl_uint setup_targets(const bench_config *config, bench_target *targets,
+			     opencl_env *envs) {
+  cl_uint count = 0, i;
+  targets[count].engine = "cpu";
+  targets[count].layout = "host";
+  targets[count++].env = NULL;
+  if(!config->kernel_file)
+    return count;
+  for(i = 0; i < 2; i++) {
+    edge_layout layout = i ? LAYOUT_WIDE : LAYOUT_PACKED;
+    cl_int err = opencl_setup(&envs[i], CL_DEVICE_TYPE_GPU, config->kernel_file, layout, NULL,
+					 config->kernel_cache);
+    if(err != CL_SUCCESS) {
+      problem("No OpenCL GPU available (%s), benchmarking the CPU engine only.\n",
+	      GetErrorString(err));
+      break;
+    }
+    targets[count].engine = "opencl";
+    targets[count].layout = i ? "wide" : "packed";
+    targets[count++].env = &envs[i];
+  }
+  return count;
+}
+
+int run_bench(const bench_config *config) {
+  bench_target targets[MAX_TARGETS];
+  opencl_env envs[2];
+  cl_uint num_targets = setup_targets(config, targets, envs), f, s, t, m;
+  cl_uint *sources = (cl_uint *)malloc(sizeof(cl_uint)*config->repeat);
+  FILE *out = fopen(config->out_file, "w");
+  struct timeval start, end, delta;
+  int first = 1, err = 0;
+  if(!out) {
+    problem("Could not create %s\n", config->out_file);
+    err = -1;
+  } else {
+    write_header(config, out);
+  }
+
+  for(f = 0; !err && f < NUM_FAMILIES; f++) {
+    for(s = 0; s < config->num_scales; s++) {
+      graph g;
+      gettimeofday(&start, NULL);
+      if(generate_graph(config->pool, families[f], config->scales[s], config->edge_factor,
+			config->seed, &g))
+	continue;
+      build_out_edges(&g);
+      gettimeofday(&end, NULL);
+      delta = tv_delta(start, end);
+      printf("%s scale %u: %u vertices, %u edges, generated in %ld.%06ld\n",
+	     family_name(families[f]), config->scales[s], g.num_vertices, g.num_edges,
+	     (long int)delta.tv_sec, (long int)delta.tv_usec);
+      cl_float bucket_width = default_delta(&g);
+      cl_float *distances = (cl_float *)malloc(sizeof(cl_float)*g.num_vertices);
+      cl_uint *preds = (cl_uint *)malloc(sizeof(cl_uint)*g.num_vertices);
+      pick_sources(config, &g, sources);
+      for(t = 0; t < num_targets; t++) {
+	for(m = 0; m < NUM_MODES; m++) {
+	  bench_result result;
+	  measure(config, &targets[t], m, &g, sources, bucket_width, distances, preds, &result);
+	  printf("  %-6s %-6s %-8s median %.6f s, p95 %.6f s, %.3g edges/s\n", targets[t].engine,
+		 targets[t].layout, mode_names[m], result.median_seconds, result.p95_seconds,
+		 result.edges_per_second);
+	  write_result(config, out, first, families[f], config->scales[s], &g, &targets[t], m,
+		       &result);
+	  first = 0;
+	}
+      }
+      printf(BAR);
+      fflush(out);
+      free(distances);
+      free(preds);
+      free_graph(&g);
+    }
+  }
+
+  if(out) {
+    if(config->format == BENCH_JSON)
+      fprintf(out, "\n  ]\n}\n");
+    if(fclose(out) && !err) {
+      problem("Could not write %s\n", config->out_file);
+      err = -1;
+    }
+  }
+  if(!err)
+    printf("Wrote %s\n", config->out_file);
+  for(t = 0; t < num_targets; t++)
+    if(targets[t].env)
+      opencl_release(targets[t].env);
+  free(sources);
+  return err;
+}
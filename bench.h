@@ -0,0 +1,41 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "sssp.h"
+#include "threadpool.h"
+#include "generate.h"
+
+/*
+ * Benchmark suite.  For every generator family and scale, the graph is
+ * generated from the seed and each engine runs each mode (sweep, frontier,
+ * delta) repeat times from the same seeded sources, after one untimed
+ * warm-up.  The CPU engine always runs; the OpenCL engine runs once per
+ * edge layout when a GPU is there.  Per configuration the output has the
+ * median and p95 wall time and the edges relaxed per second, as one JSON
+ * document or as CSV with a header row.  GPU times are end to end: buffer
+ * setup, upload, solve and read-back.
+ */
+
+#define BENCH_DEFAULT_REPEAT 5
+#define BENCH_DEFAULT_SEED 1
+#define BENCH_MAX_SCALES 16
+
+typedef enum { BENCH_JSON, BENCH_CSV } bench_format;
+
+typedef struct _bench_config {
+  thread_pool *pool;
+  const char *kernel_file;      //NULL to skip the OpenCL engine.
+  const char *kernel_cache;     //Compiled kernel cache directory, or NULL.
+  const cl_uint *scales;
+  cl_uint num_scales;
+  cl_uint edge_factor;
+  cl_ulong seed;
+  cl_uint repeat;
+  bench_format format;
+  const char *out_file;
+} bench_config;
+
+//Returns 0, or -1 if out_file could not be written.
+int run_bench(const bench_config *config);
+
+#endif
@@ -0,0 +1,786 @@
+#include "ch.h"
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _arc_list {
+  ch_arc *arcs;
+  cl_uint count;
+  cl_uint capacity;
+} arc_list;
+
+typedef struct _shortcut {
+  cl_uint from;
+  cl_uint to;
+  cl_float weight;
+} shortcut;
+
+//The remaining graph while contracting: out[v]/in[v] hold v's arcs to
+//vertices not contracted yet, shortcuts included.  When v is contracted
+//they are exactly its up and down arcs and are kept as such.
+typedef struct _ch_builder {
+  arc_list *out;
+  arc_list *in;
+  cl_uint *deleted;             //contracted neighbours
+  cl_uint *level;
+  cl_float *edge_term;          //from the last simulated contraction
+  cl_float *priority;
+  dijkstra_heap order;
+  cl_float *dist;               //witness search
+  cl_uint *wanted;              //== stamp for the targets of the current search
+  cl_uint stamp;
+  cl_uint *touched;
+  cl_uint num_touched;
+  dijkstra_heap witness;
+  shortcut *pending;            //what the last contract() call found
+  cl_uint num_pending;
+  cl_uint pending_capacity;
+  cl_uint num_shortcuts;
+} ch_builder;
+
+static inline cl_ulong mix64(cl_ulong h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static cl_ulong hash_words(cl_ulong h, const void *data, size_t size) {
+  const unsigned char *p = (const unsigned char *)data;
+  size_t i;
+  cl_uint w;
+  for(i = 0; i + 4 <= size; i += 4) {
+    memcpy(&w, p + i, 4);
+    h = (h ^ mix64(w + 1)) * 0x9e3779b97f4a7c15ULL;
+  }
+  for(; i < size; i++)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return mix64(h ^ size);
+}
+
+//Field by field: edge has padding that is never written.
+static cl_ulong graph_hash(const graph *g) {
+  cl_ulong h = mix64(((cl_ulong)g->num_vertices << 32) | g->num_edges);
+  cl_uint v, i;
+  for(v = 0; v < g->num_vertices; v++) {
+    vertex node = g->vertices[v];
+    h = hash_words(h, &node.num_edges, sizeof(cl_uint));
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      h = hash_words(h, &g->edges[i].source, sizeof(cl_uint));
+      h = hash_words(h, &g->edges[i].weight, sizeof(cl_float));
+    }
+  }
+  return h;
+}
+
+static void append_arc(arc_list *l, cl_uint other, cl_float weight, cl_uint middle) {
+  if(l->count == l->capacity) {
+    l->capacity = l->capacity ? 2*l->capacity : 4;
+    l->arcs = (ch_arc *)realloc(l->arcs, sizeof(ch_arc)*l->capacity);
+    if(!l->arcs) {
+      problem("Failed to allocate the hierarchy.\n");
+      exit(-1);
+    }
+  }
+  l->arcs[l->count].other = other;
+  l->arcs[l->count].weight = weight;
+  l->arcs[l->count].middle = middle;
+  l->count++;
+}
+
+static void remove_arc(arc_list *l, cl_uint other) {
+  cl_uint i;
+  for(i = 0; i < l->count; i++)
+    if(l->arcs[i].other == other) {
+      l->arcs[i] = l->arcs[--l->count];
+      return;
+    }
+}
+
+static ch_arc *find_arc(arc_list *l, cl_uint other) {
+  cl_uint i;
+  for(i = 0; i < l->count; i++)
+    if(l->arcs[i].other == other)
+      return &l->arcs[i];
+  return NULL;
+}
+
+//u -> w of weight through middle, unless an arc at least as short is there.
+static void add_shortcut(ch_builder *b, cl_uint u, cl_uint w, cl_float weight, cl_uint middle) {
+  ch_arc *arc = find_arc(&b->out[u], w);
+  if(arc) {
+    if(arc->weight <= weight)
+      return;
+    arc->weight = weight;
+    arc->middle = middle;
+    arc = find_arc(&b->in[w], u);
+    arc->weight = weight;
+    arc->middle = middle;
+    return;
+  }
+  append_arc(&b->out[u], w, weight, middle);
+  append_arc(&b->in[w], u, weight, middle);
+  b->num_shortcuts++;
+}
+
+static int compare_arcs(const void *a, const void *b) {
+  const ch_arc *x = (const ch_arc *)a, *y = (const ch_arc *)b;
+  if(x->other != y->other)
+    return x->other < y->other ? -1 : 1;
+  return x->weight < y->weight ? -1 : x->weight > y->weight;
+}
+
+//Out-arcs sorted by head so parallel arcs collapse to the shortest; self
+//loops never lie on a shortest path.
+static void init_builder(ch_builder *b, graph *g) {
+  cl_uint n = g->num_vertices, size = n ? n : 1, u, i;
+  memset(b, 0, sizeof(ch_builder));
+  b->out = (arc_list *)calloc(size, sizeof(arc_list));
+  b->in = (arc_list *)calloc(size, sizeof(arc_list));
+  b->deleted = (cl_uint *)calloc(size, sizeof(cl_uint));
+  b->level = (cl_uint *)calloc(size, sizeof(cl_uint));
+  b->edge_term = (cl_float *)malloc(sizeof(cl_float)*size);
+  b->priority = (cl_float *)malloc(sizeof(cl_float)*size);
+  b->dist = (cl_float *)malloc(sizeof(cl_float)*size);
+  b->touched = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  b->wanted = (cl_uint *)calloc(size, sizeof(cl_uint));
+  b->order.heap = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  b->order.slot = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  b->witness.heap = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  b->witness.slot = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  if(!b->out || !b->in || !b->deleted || !b->level || !b->edge_term || !b->priority || !b->dist ||
+     !b->touched || !b->wanted || !b->order.heap || !b->order.slot || !b->witness.heap || !b->witness.slot) {
+    problem("Failed to allocate the hierarchy.\n");
+    exit(-1);
+  }
+  for(u = 0; u < n; u++) {
+    b->dist[u] = INFINITY;
+    b->order.slot[u] = NOT_QUEUED;
+    b->witness.slot[u] = NOT_QUEUED;
+  }
+  for(u = 0; u < n; u++) {
+    vertex node = g->out_vertices[u];
+    arc_list *l = &b->out[u];
+    for(i = node.index; i < node.index + node.num_edges; i++)
+      if(g->out_edges[i].dest != u)
+	append_arc(l, g->out_edges[i].dest, g->out_edges[i].weight, CH_NO_MIDDLE);
+    if(l->count > 1)
+      qsort(l->arcs, l->count, sizeof(ch_arc), compare_arcs);
+    cl_uint kept = 0;
+    for(i = 0; i < l->count; i++)
+      if(!kept || l->arcs[i].other != l->arcs[kept - 1].other)
+	l->arcs[kept++] = l->arcs[i];
+    l->count = kept;
+    for(i = 0; i < kept; i++)
+      append_arc(&b->in[l->arcs[i].other], u, l->arcs[i].weight, CH_NO_MIDDLE);
+  }
+}
+
+static void free_builder(ch_builder *b) {
+  free(b->out);
+  free(b->in);
+  free(b->deleted);
+  free(b->level);
+  free(b->edge_term);
+  free(b->priority);
+  free(b->dist);
+  free(b->touched);
+  free(b->wanted);
+  free(b->order.heap);
+  free(b->order.slot);
+  free(b->witness.heap);
+  free(b->witness.slot);
+  free(b->pending);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Dijkstra from u in the remaining graph without v, until the wanted vertices
+//are settled, the queue passes limit or CH_WITNESS_SETTLED vertices are done.
+static void witness_search(ch_builder *b, cl_uint u, cl_uint v, cl_float limit,
+			   cl_uint num_wanted) {
+  dijkstra_heap *h = &b->witness;
+  cl_uint settled = 0, i;
+  b->dist[u] = 0;
+  b->touched[b->num_touched++] = u;
+  decrease_key(h, b->dist, u);
+  while(h->size && settled < CH_WITNESS_SETTLED && num_wanted) {
+    cl_uint x = pop_min(h, b->dist);
+    cl_float dx = b->dist[x];
+    arc_list *l = &b->out[x];
+    if(dx > limit)
+      break;
+    settled++;
+    if(b->wanted[x] == b->stamp)
+      num_wanted--;
+    for(i = 0; i < l->count; i++) {
+      cl_uint y = l->arcs[i].other;
+      cl_float nd = dx + l->arcs[i].weight;
+      if(y == v || !(nd < b->dist[y]))
+	continue;
+      if(b->dist[y] == INFINITY)
+	b->touched[b->num_touched++] = y;
+      b->dist[y] = nd;
+      decrease_key(h, b->dist, y);
+    }
+  }
+}
+
+static void reset_witness(ch_builder *b) {
+  cl_uint k;
+  for(k = 0; k < b->num_touched; k++) {
+    b->dist[b->touched[k]] = INFINITY;
+    b->witness.slot[b->touched[k]] = NOT_QUEUED;
+  }
+  b->num_touched = 0;
+  b->witness.size = 0;
+}
+
+//Works out the shortcuts contracting v needs into pending and returns how
+//many there are.
+static cl_uint contract(ch_builder *b, cl_uint v) {
+  arc_list *in = &b->in[v], *out = &b->out[v];
+  cl_uint i, k;
+  b->num_pending = 0;
+  for(i = 0; i < in->count; i++) {
+    cl_uint u = in->arcs[i].other;
+    cl_float wu = in->arcs[i].weight, limit = -1;
+    cl_uint num_wanted = 0;
+    b->stamp++;
+    for(k = 0; k < out->count; k++)
+      if(out->arcs[k].other != u) {
+	b->wanted[out->arcs[k].other] = b->stamp;
+	num_wanted++;
+	if(wu + out->arcs[k].weight > limit)
+	  limit = wu + out->arcs[k].weight;
+      }
+    if(!num_wanted)
+      continue;
+    witness_search(b, u, v, limit, num_wanted);
+    for(k = 0; k < out->count; k++) {
+      cl_uint w = out->arcs[k].other;
+      cl_float via = wu + out->arcs[k].weight;
+      if(w == u || b->dist[w] <= via)
+	continue;
+      if(b->num_pending == b->pending_capacity) {
+	b->pending_capacity = b->pending_capacity ? 2*b->pending_capacity : 64;
+	b->pending = (shortcut *)realloc(b->pending, sizeof(shortcut)*b->pending_capacity);
+	if(!b->pending) {
+	  problem("Failed to allocate the hierarchy.\n");
+	  exit(-1);
+	}
+      }
+      b->pending[b->num_pending].from = u;
+      b->pending[b->num_pending].to = w;
+      b->pending[b->num_pending].weight = via;
+      b->num_pending++;
+    }
+    reset_witness(b);
+  }
+  return b->num_pending;
+}
+
+//Twice the edge difference (shortcuts added less arcs removed), plus the
+//neighbours already contracted and the depth of the hierarchy below v, so
+//the contraction spreads evenly rather than eating into one region.
+static inline cl_float score(const ch_builder *b, cl_uint v) {
+  return 2*b->edge_term[v] + (cl_float)b->deleted[v] + (cl_float)b->level[v];
+}
+
+static cl_float priority(ch_builder *b, cl_uint v) {
+  cl_uint removed = b->in[v].count + b->out[v].count;
+  b->edge_term[v] = (cl_float)contract(b, v) - (cl_float)removed;
+  return score(b, v);
+}
+
+//A contracted neighbour only changes the cheap terms; the edge difference
+//is refreshed when w reaches the top of the queue.
+static void update_neighbour(ch_builder *b, cl_uint v, cl_uint w) {
+  b->deleted[w]++;
+  if(b->level[w] < b->level[v] + 1)
+    b->level[w] = b->level[v] + 1;
+  b->priority[w] = score(b, w);
+  update_key(&b->order, b->priority, w);
+}
+
+//Takes v out of the remaining graph; its lists become its up/down arcs.
+static void detach(ch_builder *b, cl_uint v) {
+  arc_list *in = &b->in[v], *out = &b->out[v];
+  cl_uint i;
+  for(i = 0; i < out->count; i++)
+    remove_arc(&b->in[out->arcs[i].other], v);
+  for(i = 0; i < in->count; i++)
+    remove_arc(&b->out[in->arcs[i].other], v);
+  for(i = 0; i < out->count; i++)
+    update_neighbour(b, v, out->arcs[i].other);
+  for(i = 0; i < in->count; i++)
+    if(!find_arc(out, in->arcs[i].other))
+      update_neighbour(b, v, in->arcs[i].other);
+}
+
+static void flatten(arc_list *lists, cl_uint n, cl_uint **first, ch_arc **arcs, cl_uint *count) {
+  cl_uint v, total = 0;
+  *first = (cl_uint *)malloc(sizeof(cl_uint)*(n + 1));
+  for(v = 0; v < n; v++) {
+    (*first)[v] = total;
+    total += lists[v].count;
+  }
+  (*first)[n] = total;
+  *arcs = (ch_arc *)malloc(sizeof(ch_arc)*(total ? total : 1));
+  if(!*first || !*arcs) {
+    problem("Failed to allocate the hierarchy.\n");
+    exit(-1);
+  }
+  for(v = 0; v < n; v++) {
+    if(lists[v].count)
+      memcpy(*arcs + (*first)[v], lists[v].arcs, sizeof(ch_arc)*lists[v].count);
+    free(lists[v].arcs);
+  }
+  *count = total;
+}
+
+static void alloc_side(ch_side *side, cl_uint n) {
+  cl_uint v, size = n ? n : 1;
+  side->dist = (cl_float *)malloc(sizeof(cl_float)*size);
+  side->pred = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  side->pred_middle = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  side->touched = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  side->heap.heap = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  side->heap.slot = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  if(!side->dist || !side->pred || !side->pred_middle || !side->touched || !side->heap.heap ||
+     !side->heap.slot) {
+    problem("Failed to allocate the hierarchy search.\n");
+    exit(-1);
+  }
+  for(v = 0; v < n; v++) {
+    side->dist[v] = INFINITY;
+    side->pred[v] = v;
+    side->heap.slot[v] = NOT_QUEUED;
+  }
+  side->num_touched = 0;
+  side->heap.size = 0;
+  side->heap.edges_scanned = 0;
+}
+
+static void alloc_query(hierarchy *h) {
+  alloc_side(&h->forward, h->num_vertices);
+  alloc_side(&h->backward, h->num_vertices);
+  h->chain = (cl_uint *)malloc(sizeof(cl_uint)*(h->num_vertices + 1));
+  h->unpack = (cl_uint *)malloc(sizeof(cl_uint)*3*(h->num_vertices + 1));
+  if(!h->chain || !h->unpack) {
+    problem("Failed to allocate the hierarchy search.\n");
+    exit(-1);
+  }
+}
+
+int build_hierarchy(graph *g, hierarchy *h) {
+  ch_builder b;
+  cl_uint n = g->num_vertices, v, next = 0;
+  memset(h, 0, sizeof(hierarchy));
+  for(v = 0; v < g->num_edges; v++)
+    if(g->edges[v].weight < 0) {
+      problem("Contraction Hierarchies need non-negative weights.\n");
+      return -1;
+    }
+  init_builder(&b, g);
+  h->num_vertices = n;
+  h->graph_hash = graph_hash(g);
+  h->rank = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+  if(!h->rank) {
+    problem("Failed to allocate the hierarchy.\n");
+    exit(-1);
+  }
+  for(v = 0; v < n; v++) {
+    b.priority[v] = priority(&b, v);
+    update_key(&b.order, b.priority, v);
+  }
+  //Lazy updates: a vertex whose fresh priority no longer beats the next
+  //one goes back into the queue instead.
+  while(b.order.size) {
+    v = b.order.heap[0];
+    cl_float fresh = priority(&b, v);
+    if(fresh > b.priority[v]) {
+      b.priority[v] = fresh;
+      update_key(&b.order, b.priority, v);
+      if(b.order.heap[0] != v)
+	continue;
+    }
+    //priority() just simulated v on the graph as it still is.
+    pop_min(&b.order, b.priority);
+    for(cl_uint k = 0; k < b.num_pending; k++)
+      add_shortcut(&b, b.pending[k].from, b.pending[k].to, b.pending[k].weight, v);
+    h->rank[v] = next++;
+    detach(&b, v);
+  }
+  h->num_shortcuts = b.num_shortcuts;
+  flatten(b.out, n, &h->up_first, &h->up, &h->num_up);
+  flatten(b.in, n, &h->down_first, &h->down, &h->num_down);
+  free_builder(&b);
+  alloc_query(h);
+  return 0;
+}
+
+void free_hierarchy(hierarchy *h) {
+  ch_side *sides[2] = {&h->forward, &h->backward};
+  int k;
+  for(k = 0; k < 2; k++) {
+    free(sides[k]->dist);
+    free(sides[k]->pred);
+    free(sides[k]->pred_middle);
+    free(sides[k]->touched);
+    free(sides[k]->heap.heap);
+    free(sides[k]->heap.slot);
+  }
+  free(h->chain);
+  free(h->unpack);
+  free(h->rank);
+  free(h->up_first);
+  free(h->up);
+  free(h->down_first);
+  free(h->down);
+  memset(h, 0, sizeof(hierarchy));
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static cl_ulong hierarchy_checksum(const hierarchy *h) {
+  cl_ulong c = mix64(h->num_vertices);
+  size_t n1 = (size_t)h->num_vertices + 1;
+  c = hash_words(c, h->rank, sizeof(cl_uint)*h->num_vertices);
+  c = hash_words(c, h->up_first, sizeof(cl_uint)*n1);
+  c = hash_words(c, h->up, sizeof(ch_arc)*h->num_up);
+  c = hash_words(c, h->down_first, sizeof(cl_uint)*n1);
+  c = hash_words(c, h->down, sizeof(ch_arc)*h->num_down);
+  return c;
+}
+
+//Written to a temporary file and renamed into place, like the graph cache.
+int write_hierarchy(const char *filename, const hierarchy *h) {
+  char temp_name[PATH_MAX];
+  size_t n1 = (size_t)h->num_vertices + 1;
+  ch_header header;
+  FILE *out;
+  int failed;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CH_MAGIC, sizeof(CH_MAGIC));
+  header.version = CH_VERSION;
+  header.num_vertices = h->num_vertices;
+  header.num_up = h->num_up;
+  header.num_down = h->num_down;
+  header.graph_hash = h->graph_hash;
+  header.checksum = hierarchy_checksum(h);
+  snprintf(temp_name, sizeof(temp_name), "%s.tmp.%d", filename, (int)getpid());
+  if(!(out = fopen(temp_name, "wb"))) {
+    problem("Could not create %s\n", temp_name);
+    return CH_ERROR;
+  }
+  failed = fwrite(&header, sizeof(header), 1, out) != 1 ||
+    fwrite(h->rank, sizeof(cl_uint), h->num_vertices, out) != h->num_vertices ||
+    fwrite(h->up_first, sizeof(cl_uint), n1, out) != n1 ||
+    fwrite(h->up, sizeof(ch_arc), h->num_up, out) != h->num_up ||
+    fwrite(h->down_first, sizeof(cl_uint), n1, out) != n1 ||
+    fwrite(h->down, sizeof(ch_arc), h->num_down, out) != h->num_down;
+  if(fclose(out))
+    failed = 1;
+  if(failed || rename(temp_name, filename) < 0) {
+    problem("Could not write %s\n", filename);
+    unlink(temp_name);
+    return CH_ERROR;
+  }
+  return CH_OK;
+}
+
+int load_hierarchy(const char *filename, graph *g, hierarchy *h) {
+  ch_header header;
+  FILE *in = fopen(filename, "rb");
+  size_t n1;
+  int failed;
+  memset(h, 0, sizeof(hierarchy));
+  if(!in) {
+    problem("Could not open hierarchy %s\n", filename);
+    return CH_ERROR;
+  }
+  if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, CH_MAGIC, sizeof(CH_MAGIC)) ||
+     header.version != CH_VERSION) {
+    problem("%s is not a version %d hierarchy\n", filename, CH_VERSION);
+    fclose(in);
+    return CH_ERROR;
+  }
+  if(header.num_vertices != g->num_vertices || header.graph_hash != graph_hash(g)) {
+    problem("%s is stale: it was built from another graph or vertex order\n", filename);
+    fclose(in);
+    return CH_STALE;
+  }
+  n1 = (size_t)header.num_vertices + 1;
+  h->num_vertices = header.num_vertices;
+  h->num_up = header.num_up;
+  h->num_down = header.num_down;
+  h->graph_hash = header.graph_hash;
+  h->rank = (cl_uint *)malloc(sizeof(cl_uint)*n1);
+  h->up_first = (cl_uint *)malloc(sizeof(cl_uint)*n1);
+  h->up = (ch_arc *)malloc(sizeof(ch_arc)*(h->num_up ? h->num_up : 1));
+  h->down_first = (cl_uint *)malloc(sizeof(cl_uint)*n1);
+  h->down = (ch_arc *)malloc(sizeof(ch_arc)*(h->num_down ? h->num_down : 1));
+  if(!h->rank || !h->up_first || !h->up || !h->down_first || !h->down) {
+    problem("Failed to allocate the hierarchy.\n");
+    exit(-1);
+  }
+  failed = fread(h->rank, sizeof(cl_uint), h->num_vertices, in) != h->num_vertices ||
+    fread(h->up_first, sizeof(cl_uint), n1, in) != n1 ||
+    fread(h->up, sizeof(ch_arc), h->num_up, in) != h->num_up ||
+    fread(h->down_first, sizeof(cl_uint), n1, in) != n1 ||
+    fread(h->down, sizeof(ch_arc), h->num_down, in) != h->num_down ||
+    fgetc(in) != EOF;
+  fclose(in);
+  if(failed || hierarchy_checksum(h) != header.checksum ||
+     h->up_first[h->num_vertices] != h->num_up || h->down_first[h->num_vertices] != h->num_down) {
+    problem("%s failed its checksum\n", filename);
+    free(h->rank);
+    free(h->up_first);
+    free(h->up);
+    free(h->down_first);
+    free(h->down);
+    memset(h, 0, sizeof(hierarchy));
+    return CH_ERROR;
+  }
+  h->num_shortcuts = 0;
+  for(cl_uint i = 0; i < h->num_up; i++)
+    h->num_shortcuts += h->up[i].middle != CH_NO_MIDDLE;
+  for(cl_uint i = 0; i < h->num_down; i++)
+    h->num_shortcuts += h->down[i].middle != CH_NO_MIDDLE;
+  alloc_query(h);
+  return CH_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static void reset_side(ch_side *side) {
+  cl_uint k;
+  for(k = 0; k < side->num_touched; k++) {
+    cl_uint v = side->touched[k];
+    side->dist[v] = INFINITY;
+    side->pred[v] = v;
+    side->heap.slot[v] = NOT_QUEUED;
+  }
+  side->num_touched = 0;
+  side->heap.size = 0;
+}
+
+static inline void reach(ch_side *side, cl_uint v, cl_float d, cl_uint pred, cl_uint middle) {
+  if(side->dist[v] == INFINITY)
+    side->touched[side->num_touched++] = v;
+  side->dist[v] = d;
+  side->pred[v] = pred;
+  side->pred_middle[v] = middle;
+  decrease_key(&side->heap, side->dist, v);
+}
+
+//Settles the side's next vertex and relaxes its arcs upward.  Stall on
+//demand: if a higher vertex the search already reached leads back down to
+//it for less, its distance is not final and nothing is relaxed from it.
+//Returns the vertex, with *stalled set accordingly.
+static cl_uint climb(hierarchy *h, ch_side *side, int forward, int *stalled) {
+  const cl_uint *first = forward ? h->up_first : h->down_first;
+  const cl_uint *back_first = forward ? h->down_first : h->up_first;
+  const ch_arc *arcs = forward ? h->up : h->down, *back = forward ? h->down : h->up;
+  cl_uint u = pop_min(&side->heap, side->dist), i;
+  cl_float du = side->dist[u];
+  for(i = back_first[u]; i < back_first[u + 1]; i++)
+    if(side->dist[back[i].other] + back[i].weight < du) {
+      *stalled = 1;
+      return u;
+    }
+  *stalled = 0;
+  side->heap.edges_scanned += first[u + 1] - first[u];
+  for(i = first[u]; i < first[u + 1]; i++) {
+    cl_float nd = du + arcs[i].weight;
+    if(nd < side->dist[arcs[i].other])
+      reach(side, arcs[i].other, nd, u, arcs[i].middle);
+  }
+  return u;
+}
+
+static const ch_arc *arc_to(const cl_uint *first, const ch_arc *arcs, cl_uint v, cl_uint other) {
+  cl_uint i;
+  for(i = first[v]; i < first[v + 1]; i++)
+    if(arcs[i].other == other)
+      return &arcs[i];
+  return NULL;
+}
+
+//Appends the vertices after u on the arc u -> w through middle.  A shortcut
+//via m is u -> m (in down[m]) then m -> w (in up[m]); the stack holds the
+//segments still to expand, leftmost on top.
+static cl_uint unpack_arc(hierarchy *h, cl_uint u, cl_uint w, cl_uint middle, cl_uint *path,
+			  cl_uint len) {
+  cl_uint *stack = h->unpack, top = 0;
+  stack[0] = u;
+  stack[1] = w;
+  stack[2] = middle;
+  top = 1;
+  while(top) {
+    top--;
+    u = stack[3*top];
+    w = stack[3*top + 1];
+    middle = stack[3*top + 2];
+    if(middle == CH_NO_MIDDLE) {
+      if(len < h->num_vertices)
+	path[len++] = w;
+      continue;
+    }
+    const ch_arc *second = arc_to(h->up_first, h->up, middle, w);
+    const ch_arc *first = arc_to(h->down_first, h->down, middle, u);
+    stack[3*top] = middle;
+    stack[3*top + 1] = w;
+    stack[3*top + 2] = second->middle;
+    top++;
+    stack[3*top] = u;
+    stack[3*top + 1] = middle;
+    stack[3*top + 2] = first->middle;
+    top++;
+  }
+  return len;
+}
+
+//Source ... meet from the forward preds, then meet ... target from the
+//backward ones.
+static cl_uint unpack_path(hierarchy *h, cl_uint source, cl_uint meet, cl_uint target,
+			   cl_uint *path) {
+  ch_side *f = &h->forward, *b = &h->backward;
+  cl_uint len = 0, hops = 0, x;
+  for(x = meet; x != source; x = f->pred[x])
+    h->chain[hops++] = x;
+  path[len++] = source;
+  for(x = source; hops; x = h->chain[hops]) {
+    hops--;
+    len = unpack_arc(h, x, h->chain[hops], f->pred_middle[h->chain[hops]], path, len);
+  }
+  for(x = meet; x != target; x = b->pred[x])
+    len = unpack_arc(h, x, b->pred[x], b->pred_middle[x], path, len);
+  return len;
+}
+
+cl_float ch_query(hierarchy *h, cl_uint source, cl_uint target, cl_uint *path,
+		  cl_uint *path_length, sssp_stats *stats) {
+  ch_side *f = &h->forward, *b = &h->backward;
+  cl_float best = INFINITY;
+  cl_uint settled = 0, meet = source;
+  int stalled;
+  reset_side(f);
+  reset_side(b);
+  f->heap.edges_scanned = 0;
+  b->heap.edges_scanned = 0;
+  reach(f, source, 0, source, CH_NO_MIDDLE);
+  reach(b, target, 0, target, CH_NO_MIDDLE);
+  //Each side climbs until its queue top alone reaches the best meeting.
+  for(;;) {
+    int go_f = f->heap.size && f->dist[f->heap.heap[0]] < best;
+    int go_b = b->heap.size && b->dist[b->heap.heap[0]] < best;
+    if(!go_f && !go_b)
+      break;
+    int forward = go_f && (!go_b || f->dist[f->heap.heap[0]] <= b->dist[b->heap.heap[0]]);
+    ch_side *side = forward ? f : b, *other = forward ? b : f;
+    cl_uint u = climb(h, side, forward, &stalled);
+    settled++;
+    if(other->dist[u] < INFINITY && side->dist[u] + other->dist[u] < best) {
+      best = side->dist[u] + other->dist[u];
+      meet = u;
+    }
+  }
+  *path_length = best < INFINITY ? unpack_path(h, source, meet, target, path) : 0;
+  if(stats) {
+    stats->rounds = settled;
+    stats->edges_scanned = f->heap.edges_scanned + b->heap.edges_scanned;
+  }
+  return best;
+}
+
+typedef struct _bucket_entry {
+  cl_uint vertex;
+  cl_uint target;
+  cl_float dist;
+} bucket_entry;
+
+void ch_table(hierarchy *h, const cl_uint *sources, cl_uint num_sources, const cl_uint *targets,
+	      cl_uint num_targets, cl_float *table, sssp_stats *stats) {
+  ch_side *f = &h->forward, *b = &h->backward;
+  cl_uint n = h->num_vertices, count = 0, capacity = 1024, settled = 0, i, j, k;
+  bucket_entry *entries = (bucket_entry *)malloc(sizeof(bucket_entry)*capacity);
+  bucket_entry *sorted;
+  cl_uint *first = (cl_uint *)calloc((size_t)n + 1, sizeof(cl_uint));
+  cl_ulong scanned = 0;
+  int stalled;
+  if(!entries || !first) {
+    problem("Failed to allocate the table buckets.\n");
+    exit(-1);
+  }
+  for(k = 0; k < (size_t)num_sources*num_targets; k++)
+    table[k] = INFINITY;
+
+  //Every vertex a target's backward search settles records how far the
+  //target is from it.
+  for(j = 0; j < num_targets; j++) {
+    reset_side(b);
+    b->heap.edges_scanned = 0;
+    reach(b, targets[j], 0, targets[j], CH_NO_MIDDLE);
+    while(b->heap.size) {
+      cl_uint v = climb(h, b, 0, &stalled);
+      settled++;
+      if(stalled)
+	continue;
+      if(count == capacity) {
+	capacity *= 2;
+	entries = (bucket_entry *)realloc(entries, sizeof(bucket_entry)*capacity);
+	if(!entries) {
+	  problem("Failed to allocate the table buckets.\n");
+	  exit(-1);
+	}
+      }
+      entries[count].vertex = v;
+      entries[count].target = j;
+      entries[count].dist = b->dist[v];
+      count++;
+      first[v + 1]++;
+    }
+    scanned += b->heap.edges_scanned;
+  }
+  for(i = 0; i < n; i++)
+    first[i + 1] += first[i];
+  sorted = (bucket_entry *)malloc(sizeof(bucket_entry)*(count ? count : 1));
+  if(!sorted) {
+    problem("Failed to allocate the table buckets.\n");
+    exit(-1);
+  }
+  for(k = 0; k < count; k++)
+    sorted[first[entries[k].vertex]++] = entries[k];
+  for(i = n; i > 0; i--)
+    first[i] = first[i - 1];
+  first[0] = 0;
+  free(entries);
+
+  //Every vertex a source's forward search settles closes the paths through
+  //it to each target in its bucket.
+  for(i = 0; i < num_sources; i++) {
+    cl_float *row = table + (size_t)i*num_targets;
+    reset_side(f);
+    f->heap.edges_scanned = 0;
+    reach(f, sources[i], 0, sources[i], CH_NO_MIDDLE);
+    while(f->heap.size) {
+      cl_uint v = climb(h, f, 1, &stalled);
+      settled++;
+      if(stalled)
+	continue;
+      for(k = first[v]; k < first[v + 1]; k++)
+	if(f->dist[v] + sorted[k].dist < row[sorted[k].target])
+	  row[sorted[k].target] = f->dist[v] + sorted[k].dist;
+    }
+    scanned += f->heap.edges_scanned;
+  }
+  free(sorted);
+  free(first);
+  if(stats) {
+    stats->rounds = settled;
+    stats->edges_scanned = scanned;
+  }
+}
@@ -0,0 +1,113 @@
+#ifndef CH_H
+#define CH_H
+
+#include "sssp.h"
+#include "heap.h"
+
+/*
+ * Contraction Hierarchies.  Preprocessing contracts the vertices one at a
+ * time, least important first: each in-neighbour u / out-neighbour w pair
+ * of the contracted vertex v gets a shortcut u -> w of the two arcs' weight
+ * unless a witness search finds a path that is no longer without v.  The
+ * next vertex is the one whose contraction adds the fewest shortcuts for
+ * the arcs it removes, weighed against how many of its neighbours are gone
+ * already and how deep the hierarchy under it is.  Priorities are checked
+ * again when a vertex comes to the top of the queue.
+ *
+ * rank[v] is v's place in that order.  The hierarchy keeps, per vertex,
+ * the arcs to higher-ranked vertices:
+ *
+ *   up[v]    v -> w, searched forward from a source
+ *   down[v]  w -> v, searched backward from a target
+ *
+ * and a query is a bidirectional Dijkstra that only climbs, pruned by
+ * stall-on-demand.  A shortcut records the vertex it bypasses, so paths
+ * unpack into original arcs: u -> w via v is down[v] to u, then up[v] to w.
+ *
+ * Hierarchy file, host order:
+ *
+ *   ch_header
+ *   cl_uint rank[num_vertices]
+ *   cl_uint up_first[num_vertices + 1], ch_arc up[num_up]
+ *   cl_uint down_first[num_vertices + 1], ch_arc down[num_down]
+ *
+ * graph_hash fingerprints the in-edge CSR, in internal numbers, that the
+ * hierarchy was built from; a file built from another graph or vertex order
+ * is stale.  checksum covers everything after the header.
+ */
+
+#define CH_MAGIC "OPBFCH"
+#define CH_VERSION 1
+//Witness searches give up after settling this many vertices and keep the
+//shortcut; it is only ever redundant, never wrong.
+#define CH_WITNESS_SETTLED 100
+#define CH_NO_MIDDLE CL_UINT_MAX
+
+#define CH_OK 0
+#define CH_ERROR -1
+#define CH_STALE 1
+
+typedef struct _ch_arc {
+  cl_uint other;                //the higher-ranked end, w in both up[v] and down[v]
+  cl_float weight;
+  cl_uint middle;               //vertex a shortcut bypasses, or CH_NO_MIDDLE
+} ch_arc;
+
+typedef struct _ch_header {
+  char magic[8];
+  cl_uint version;
+  cl_uint num_vertices;
+  cl_uint num_up;
+  cl_uint num_down;
+  cl_ulong graph_hash;
+  cl_ulong checksum;
+} ch_header;
+
+typedef struct _ch_side {
+  cl_float *dist;
+  cl_uint *pred;
+  cl_uint *pred_middle;         //middle of the arc pred came over
+  cl_uint *touched;
+  cl_uint num_touched;
+  dijkstra_heap heap;
+} ch_side;
+
+typedef struct _hierarchy {
+  cl_uint num_vertices;
+  cl_uint num_up;
+  cl_uint num_down;
+  cl_uint num_shortcuts;
+  cl_ulong graph_hash;
+  cl_uint *rank;
+  cl_uint *up_first;
+  ch_arc *up;
+  cl_uint *down_first;
+  ch_arc *down;
+  ch_side forward;              //query state
+  ch_side backward;
+  cl_uint *chain;               //forward hops of the path being unpacked
+  cl_uint *unpack;              //shortcuts still to expand, 3 words each
+} hierarchy;
+
+//Needs build_out_edges(g).  Returns 0, or -1 when some weight is negative.
+int build_hierarchy(graph *g, hierarchy *h);
+//CH_OK, CH_STALE when the file was built from another graph, or CH_ERROR
+//(reported).
+int load_hierarchy(const char *filename, graph *g, hierarchy *h);
+int write_hierarchy(const char *filename, const hierarchy *h);
+void free_hierarchy(hierarchy *h);
+
+//Returns the source -> target distance, INFINITY when unreachable.  path
+//(room for num_vertices) gets source ... target with every shortcut
+//unpacked, and path_length its count, 0 when unreachable.  stats->rounds
+//counts settled vertices.
+cl_float ch_query(hierarchy *h, cl_uint source, cl_uint target, cl_uint *path,
+		  cl_uint *path_length, sssp_stats *stats);
+
+//Many-to-many: table[i*num_targets + j] is the distance from sources[i] to
+//targets[j].  One backward search per target fills per-vertex buckets, then
+//one forward search per source reads them.
+void ch_table(hierarchy *h, const cl_uint *sources, cl_uint num_sources, const cl_uint *targets,
+	      cl_uint num_targets, cl_float *table, sssp_stats *stats);
+
+#endif
@@ -0,0 +1,244 @@
+#!/bin/sh
+#
+# Checks every solver mode against a reference on generated graphs.
+#
+#   grid     a seeded lattice with random weights, a few long arcs, coordinates
+#            and one isolated vertex, written as DIMACS.  Each mode's answer
+#            for a few sources is compared with Dijkstra run here in awk, and
+#            every pred must close its vertex's distance over a real arc.
+#   --generate  uniform and rmat graphs; every single-source mode and vertex
+#            order must give the sweep's distances.
+#
+# Weights are integers, so every engine's distances are exact.
+#
+# usage: ./check.sh [sssp]       (make check)
+#        ENGINE=opencl ./check.sh  checks the device engines instead of the CPU
+
+SSSP=${1:-./sssp}
+ENGINE=${ENGINE:-cpu}
+SIDE=24
+SEED=7
+BOUND=400
+TARGETS=1,30,200,333,575,576
+
+DIR=$(mktemp -d "${TMPDIR:-/tmp}/sssp-check.XXXXXX") || exit 1
+trap 'rm -rf "$DIR"' EXIT
+GRAPH=$DIR/grid.gr
+N=$((SIDE*SIDE + 1))
+SOURCES="0 300 $((N - 1))"
+passed=0
+failed=0
+
+pass() {
+  passed=$((passed + 1))
+  echo "ok   $*"
+}
+
+fail() {
+  failed=$((failed + 1))
+  echo "FAIL $*"
+}
+
+#Runs the solver quietly on the engine under test; its log goes to $DIR/log.
+run() {
+  "$SSSP" -e "$ENGINE" "$@" > "$DIR/log" 2>&1
+}
+
+#"v distance" per line from an --out file, or the reached list of --bound.
+distances() {
+  awk '!/^c/ { print $1, $2 }' "$1"
+}
+
+#The reference rows within distance $2.
+within() {
+  awk -v bound="$2" '$2 != "inf" && $2 + 0 <= bound + 0' "$1"
+}
+
+#A side x side grid, 4-neighbour arcs both ways, plus side*4 random arcs.
+#"a u v w" is the arc v -> u, as the loader reads it (see dimacs.h).
+awk -v side=$SIDE -v seed=$SEED -v gr="$GRAPH" -v co="$DIR/grid.co" '
+function arc(to, from) {
+  if(to != from)
+    arcs[m++] = to " " from " " (int(rand()*100) + 1)
+}
+BEGIN {
+  srand(seed);
+  n = side*side + 1;
+  for(r = 0; r < side; r++)
+    for(c = 0; c < side; c++) {
+      v = r*side + c + 1;
+      if(c + 1 < side) { arc(v, v + 1); arc(v + 1, v); }
+      if(r + 1 < side) { arc(v, v + side); arc(v + side, v); }
+      print "v", v, c*100, r*100 > co;
+    }
+  print "v", n, 0, 0 > co;
+  for(i = 0; i < side*4; i++)
+    arc(int(rand()*side*side) + 1, int(rand()*side*side) + 1);
+  print "p sp", n, m > gr;
+  for(i = 0; i < m; i++)
+    print "a", arcs[i] > gr;
+}'
+
+#Dijkstra from $1 over the grid: "v distance" per vertex, 0-based.
+reference() {
+  awk -v s="$1" '
+$1 == "p" { n = $3 }
+$1 == "a" { k = deg[$3]++; to[$3, k] = $2 - 1; weight[$3, k] = $4 }
+END {
+  for(v = 0; v < n; v++)
+    d[v] = -1;
+  d[s] = 0;
+  for(;;) {
+    best = -1;
+    for(v = 0; v < n; v++)
+      if(!done[v] && d[v] >= 0 && (best < 0 || d[v] < d[best]))
+	best = v;
+    if(best < 0)
+      break;
+    done[best] = 1;
+    for(k = 0; k < deg[best + 1]; k++) {
+      u = to[best + 1, k];
+      if(d[u] < 0 || d[best] + weight[best + 1, k] < d[u])
+	d[u] = d[best] + weight[best + 1, k];
+    }
+  }
+  for(v = 0; v < n; v++)
+    print v, d[v] < 0 ? "inf" : d[v];
+}' "$GRAPH"
+}
+
+#Every reached vertex but the source has an arc pred -> v with
+#d[pred] + w == d[v].  Prints the first vertex that does not.
+bad_pred() {
+  awk -v s="$1" '
+FNR == NR { if($1 == "a") { key = ($3 - 1) " " ($2 - 1); if(!(key in w) || $4 < w[key]) w[key] = $4 } next }
+!/^c/ { d[$1] = $2; p[$1] = $3 }
+END {
+  for(v in d)
+    if(d[v] != "inf" && v != s && d[p[v]] + w[p[v] " " v] != d[v]) {
+      print v;
+      exit;
+    }
+}' "$GRAPH" "$2"
+}
+
+#Checks the --out file of the last run against the reference from source $1;
+#$2 names the run.
+check_out() {
+  distances "$DIR/out" > "$DIR/got"
+  bad=$(bad_pred $1 "$DIR/out")
+  if ! cmp -s "$DIR/ref" "$DIR/got"; then
+    fail "$2: distances differ"
+  elif [ -n "$bad" ]; then
+    fail "$2: pred of $bad is not on a shortest path"
+  else
+    pass "$2"
+  fi
+}
+
+#"target distance" from the point-to-point modes' path lines.
+p2p_distances() {
+  sed -n 's/^Path [0-9]* -> \([0-9]*\): distance \([0-9.e+]*\),.*/\1 \2/p
+	  s/^Path [0-9]* -> \([0-9]*\): unreachable.*/\1 inf/p' "$DIR/log"
+}
+
+#Row $1 of an n x n --apsp-out file as "v distance".
+apsp_row() {
+  od -An -v -f -j $(($1*N*4)) -N $((N*4)) "$2" |
+    awk '{ for(i = 1; i <= NF; i++) print v++, ($i == "inf" ? "inf" : $i + 0) }'
+}
+
+#Each source runs on a different number of CPU threads: 1, 3, then 5.
+threads=1
+for s in $SOURCES; do
+  reference $s > "$DIR/ref"
+  for m in sweep frontier delta; do
+    for o in none rcm hilbert; do
+      what="grid $m -o $o source $s"
+      if ! run -m $m -o $o -t $threads -g "$GRAPH" --coords "$DIR/grid.co" -s $s --out "$DIR/out"; then
+	fail "$what: exit status"
+	continue
+      fi
+      check_out $s "$what"
+      within "$DIR/ref" $BOUND > "$DIR/bounded"
+      if ! run -m $m -o $o -t $threads -g "$GRAPH" --coords "$DIR/grid.co" -s $s --bound $BOUND \
+	   --out "$DIR/out"; then
+	fail "$what --bound $BOUND: exit status"
+      elif distances "$DIR/out" | cmp -s "$DIR/bounded" -; then
+	pass "$what --bound $BOUND"
+      else
+	fail "$what --bound $BOUND: reached set differs"
+      fi
+    done
+  done
+  #The CPU engine has no push rounds and ignores --direction.
+  for d in pull push; do
+    what="grid frontier --direction $d source $s"
+    if run -m frontier --direction $d -g "$GRAPH" -s $s --out "$DIR/out"; then
+      check_out $s "$what"
+    else
+      fail "$what: exit status"
+    fi
+  done
+  threads=$((threads + 2))
+
+  awk -v t=",$TARGETS," 'index(t, "," $1 ",")' "$DIR/ref" > "$DIR/ref_targets"
+  for m in bidir astar ch; do
+    what="grid $m source $s"
+    if ! run -m $m -g "$GRAPH" -s $s --path $TARGETS; then
+      fail "$what: exit status"
+    elif p2p_distances | cmp -s "$DIR/ref_targets" -; then
+      pass "$what"
+    else
+      fail "$what: distances differ"
+    fi
+  done
+done
+
+#All pairs: the source rows against the reference, and the tiled solve (1 MB
+#of working memory) byte for byte against the in-core one.
+if run -m apsp -o none -g "$GRAPH" --apsp-out "$DIR/apsp.bin" &&
+   run -m johnson -o none -g "$GRAPH" --apsp-out "$DIR/johnson.bin" &&
+   run -m apsp -o none -g "$GRAPH" --apsp-memory 1 --apsp-out "$DIR/tiled.bin"; then
+  for s in $SOURCES; do
+    reference $s > "$DIR/ref"
+    for m in apsp johnson; do
+      if apsp_row $s "$DIR/$m.bin" | cmp -s "$DIR/ref" -; then
+	pass "grid $m row $s"
+      else
+	fail "grid $m row $s: distances differ"
+      fi
+    done
+  done
+  if cmp -s "$DIR/apsp.bin" "$DIR/tiled.bin"; then
+    pass "grid apsp --apsp-memory 1"
+  else
+    fail "grid apsp --apsp-memory 1: differs from the in-core matrix"
+  fi
+else
+  fail "grid apsp/johnson: exit status"
+fi
+
+for family in uniform rmat; do
+  gen="--generate $family:10 --seed $SEED"
+  if ! run -m sweep $gen -s 0 --out "$DIR/sweep"; then
+    fail "$family sweep: exit status"
+    continue
+  fi
+  distances "$DIR/sweep" > "$DIR/ref"
+  for m in sweep frontier delta; do
+    for o in none rcm degree; do
+      what="$family $m -o $o"
+      if ! run -m $m -o $o $gen -s 0 --out "$DIR/out"; then
+	fail "$what: exit status"
+      elif distances "$DIR/out" | cmp -s "$DIR/ref" -; then
+	pass "$what"
+      else
+	fail "$what: distances differ from the sweep"
+      fi
+    done
+  done
+done
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
@@ -0,0 +1,670 @@
+#include "cpu_sssp.h"
+
+/*--------------------------------------------------------------------------------*/
+
+//The distance array is read by every thread and written only by the owner of
+//each vertex, exactly like UpdateVertex.  Relaxed atomics keep that race defined.
+static inline cl_float load_distance(cl_float *d) {
+  cl_float v;
+  __atomic_load(d, &v, __ATOMIC_RELAXED);
+  return v;
+}
+
+static inline void store_distance(cl_float *d, cl_float v) {
+  __atomic_store(d, &v, __ATOMIC_RELAXED);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _init_ctx {
+  cl_uint source;
+  cl_float *distances;
+  cl_uint *preds;
+} init_ctx;
+
+static void init_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  init_ctx *ctx = (init_ctx *)arg;
+  cl_uint v;
+  for(v = begin; v < end; v++) {
+    ctx->distances[v] = v == ctx->source ? 0 : INFINITY;
+    ctx->preds[v] = v;
+  }
+}
+
+void cpu_init_distances(thread_pool *pool, cl_uint num_vertices, cl_uint source,
+			cl_float *distances, cl_uint *preds) {
+  init_ctx ctx = {source, distances, preds};
+  thread_pool_for(pool, 0, num_vertices, CPU_GRAIN*16, init_range, &ctx);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _update_ctx {
+  graph *g;
+  cl_float *distances;
+  cl_uint *preds;
+  cl_float bound;
+  cl_uint update;
+} update_ctx;
+
+//Same relaxation as the UpdateVertex kernel: pull over v's in-edges and keep
+//the first strictly smaller candidate.
+static void update_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  update_ctx *ctx = (update_ctx *)arg;
+  edge *edges = ctx->g->edges;
+  vertex *vertices = ctx->g->vertices;
+  cl_float *distances = ctx->distances;
+  cl_uint v, i, did_update = 0;
+  for(v = begin; v < end; v++) {
+    cl_float min = load_distance(&distances[v]);
+    cl_uint pred = ctx->preds[v];
+    cl_uint first = vertices[v].index;
+    cl_uint last = first + vertices[v].num_edges;
+    int changed = 0;
+    for(i = first; i < last; i++) {
+      cl_float temp = load_distance(&distances[edges[i].source]);
+      if(temp < INFINITY) {
+	temp = edges[i].weight + temp;
+	if(min > temp && temp <= ctx->bound) {
+	  min = temp;
+	  pred = edges[i].source;
+	  changed = 1;
+	}
+      }
+    }
+    if(changed) {
+      store_distance(&distances[v], min);
+      ctx->preds[v] = pred;
+      did_update = 1;
+    }
+  }
+  if(did_update)
+    __atomic_store_n(&ctx->update, 1, __ATOMIC_RELAXED);
+}
+
+cl_uint cpu_update_vertices(thread_pool *pool, graph *g, cl_float bound, cl_float *distances,
+			    cl_uint *preds) {
+  update_ctx ctx = {g, distances, preds, bound, 0};
+  thread_pool_for(pool, 0, g->num_vertices, CPU_GRAIN, update_range, &ctx);
+  return ctx.update;
+}
+
+//Returns the number of rounds run, counting the final one that changed nothing.
+cl_uint cpu_bellman_ford(thread_pool *pool, graph *g, cl_uint source, cl_float bound,
+			 cl_float *distances, cl_uint *preds, sssp_stats *stats) {
+  cl_uint i;
+  cpu_init_distances(pool, g->num_vertices, source, distances, preds);
+  for(i = 0; i < g->num_vertices; i++) {
+    if(!cpu_update_vertices(pool, g, bound, distances, preds)) {
+      i++;
+      break;
+    }
+  }
+  if(stats) {
+    stats->rounds = i;
+    stats->edges_scanned = (cl_ulong)i*g->num_edges;
+  }
+  return i;
+}
+
+//Bellman-Ford from a virtual source with a 0-weight edge to every vertex,
+//which is where every distance starts.  Shortest paths from it have at most
+//num_vertices edges, so a round past num_vertices + 1 that still changes
+//something means a negative cycle; the return value exceeds
+//num_vertices + 1 exactly then.
+cl_uint cpu_potentials(thread_pool *pool, graph *g, cl_float *potentials, sssp_stats *stats) {
+  cl_uint i, max_rounds = g->num_vertices + 2;
+  cl_uint *preds = (cl_uint *)malloc(sizeof(cl_uint)*(g->num_vertices ? g->num_vertices : 1));
+  cpu_init_distances(pool, g->num_vertices, g->num_vertices, potentials, preds);
+  memset(potentials, 0, sizeof(cl_float)*g->num_vertices);
+  for(i = 0; i < max_rounds; i++) {
+    if(!cpu_update_vertices(pool, g, INFINITY, potentials, preds)) {
+      i++;
+      break;
+    }
+  }
+  free(preds);
+  if(stats) {
+    stats->rounds = i;
+    stats->edges_scanned = (cl_ulong)i*g->num_edges;
+  }
+  return i;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _multi_ctx {
+  graph *g;
+  const cl_uint *sources;
+  cl_uint num_sources;
+  cl_float *distances;
+  cl_uint *preds;
+  cl_uint update;
+} multi_ctx;
+
+static void multi_init_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  multi_ctx *ctx = (multi_ctx *)arg;
+  cl_uint v, b;
+  for(v = begin; v < end; v++) {
+    for(b = 0; b < ctx->num_sources; b++) {
+      ctx->distances[(size_t)v*ctx->num_sources + b] = v == ctx->sources[b] ? 0 : INFINITY;
+      ctx->preds[(size_t)v*ctx->num_sources + b] = v;
+    }
+  }
+}
+
+//update_range for num_sources queries at once: every in-edge is fetched once
+//and relaxed against the whole row of source distances.
+static void multi_update_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  multi_ctx *ctx = (multi_ctx *)arg;
+  edge *edges = ctx->g->edges;
+  vertex *vertices = ctx->g->vertices;
+  cl_uint n = ctx->num_sources;
+  cl_uint v, i, b, did_update = 0;
+  for(v = begin; v < end; v++) {
+    cl_float *row = ctx->distances + (size_t)v*n;
+    cl_uint *pred_row = ctx->preds + (size_t)v*n;
+    cl_uint first = vertices[v].index;
+    cl_uint last = first + vertices[v].num_edges;
+    for(i = first; i < last; i++) {
+      cl_float *from = ctx->distances + (size_t)edges[i].source*n;
+      cl_float weight = edges[i].weight;
+      for(b = 0; b < n; b++) {
+	cl_float temp = load_distance(&from[b]) + weight;
+	if(load_distance(&row[b]) > temp) {
+	  store_distance(&row[b], temp);
+	  pred_row[b] = edges[i].source;
+	  did_update = 1;
+	}
+      }
+    }
+  }
+  if(did_update)
+    __atomic_store_n(&ctx->update, 1, __ATOMIC_RELAXED);
+}
+
+//Bellman-Ford for num_sources sources at once.  distances and preds are
+//num_vertices x num_sources, row-major by vertex.
+cl_uint cpu_multi_bellman_ford(thread_pool *pool, graph *g, const cl_uint *sources,
+			       cl_uint num_sources, cl_float *distances, cl_uint *preds,
+			       sssp_stats *stats) {
+  multi_ctx ctx = {g, sources, num_sources, distances, preds, 0};
+  cl_uint i;
+  thread_pool_for(pool, 0, g->num_vertices, CPU_GRAIN, multi_init_range, &ctx);
+  for(i = 0; i < g->num_vertices; i++) {
+    ctx.update = 0;
+    thread_pool_for(pool, 0, g->num_vertices, CPU_GRAIN, multi_update_range, &ctx);
+    if(!ctx.update) {
+      i++;
+      break;
+    }
+  }
+  if(stats) {
+    stats->rounds = i;
+    stats->edges_scanned = (cl_ulong)i*g->num_edges;
+  }
+  return i;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+#define FRONTIER_FLUSH 256
+
+typedef struct _frontier_ctx {
+  graph *g;
+  cl_float *distances;
+  cl_uint *preds;
+  cl_float bound;
+  cl_uchar *marks;
+  cl_uint *active;
+  cl_uint *next;
+  cl_uint next_count;
+  cl_ulong edges_scanned;
+} frontier_ctx;
+
+//Pulls over the in-edges of every active vertex, like UpdateVertex, and when
+//a distance drops marks the out-neighbours for the next round.  A vertex is
+//queued by whoever flips its mark from 0 to 1; it clears the mark again just
+//before it is evaluated, so a neighbour that changes after that point queues
+//it once more, and one that changes before it is read in this round.
+static void frontier_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  frontier_ctx *ctx = (frontier_ctx *)arg;
+  graph *g = ctx->g;
+  cl_float *distances = ctx->distances;
+  cl_uint queued[FRONTIER_FLUSH];
+  cl_uint num_queued = 0;
+  cl_ulong scanned = 0;
+  cl_uint k, i;
+  for(k = begin; k < end; k++) {
+    cl_uint v = ctx->active[k];
+    __atomic_exchange_n(&ctx->marks[v], 0, __ATOMIC_ACQ_REL);
+    cl_float min = load_distance(&distances[v]);
+    cl_uint pred = ctx->preds[v];
+    cl_uint first = g->vertices[v].index;
+    cl_uint last = first + g->vertices[v].num_edges;
+    int changed = 0;
+    scanned += last - first;
+    for(i = first; i < last; i++) {
+      cl_float temp = load_distance(&distances[g->edges[i].source]);
+      if(temp < INFINITY) {
+	temp = g->edges[i].weight + temp;
+	if(min > temp && temp <= ctx->bound) {
+	  min = temp;
+	  pred = g->edges[i].source;
+	  changed = 1;
+	}
+      }
+    }
+    if(!changed)
+      continue;
+    store_distance(&distances[v], min);
+    ctx->preds[v] = pred;
+    first = g->out_vertices[v].index;
+    last = first + g->out_vertices[v].num_edges;
+    scanned += last - first;
+    for(i = first; i < last; i++) {
+      cl_uint w = g->out_edges[i].dest;
+      if(__atomic_exchange_n(&ctx->marks[w], 1, __ATOMIC_ACQ_REL))
+	continue;
+      if(num_queued == FRONTIER_FLUSH) {
+	cl_uint at = __atomic_fetch_add(&ctx->next_count, num_queued, __ATOMIC_RELAXED);
+	memcpy(ctx->next + at, queued, sizeof(cl_uint)*num_queued);
+	num_queued = 0;
+      }
+      queued[num_queued++] = w;
+    }
+  }
+  if(num_queued) {
+    cl_uint at = __atomic_fetch_add(&ctx->next_count, num_queued, __ATOMIC_RELAXED);
+    memcpy(ctx->next + at, queued, sizeof(cl_uint)*num_queued);
+  }
+  __atomic_fetch_add(&ctx->edges_scanned, scanned, __ATOMIC_RELAXED);
+}
+
+cl_uint cpu_frontier_from(thread_pool *pool, graph *g, const cl_uint *seeds, cl_uint count,
+			  cl_float bound, cl_float *distances, cl_uint *preds, sssp_stats *stats) {
+  cl_uint n = g->num_vertices, rounds = 0;
+  frontier_ctx ctx;
+  ctx.g = g;
+  ctx.distances = distances;
+  ctx.preds = preds;
+  ctx.bound = bound;
+  ctx.marks = (cl_uchar *)calloc(n, sizeof(cl_uchar));
+  ctx.active = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  ctx.next = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  ctx.edges_scanned = 0;
+  if(!ctx.marks || !ctx.active || !ctx.next) {
+    problem("Failed to allocate frontier queues.\n");
+    exit(-1);
+  }
+
+  for(cl_uint i = 0; i < count; i++)
+    ctx.marks[ctx.active[i] = seeds[i]] = 1;
+  while(count && rounds < n) {
+    ctx.next_count = 0;
+    thread_pool_for(pool, 0, count, CPU_GRAIN/4, frontier_range, &ctx);
+    cl_uint *t = ctx.active;
+    ctx.active = ctx.next;
+    ctx.next = t;
+    count = ctx.next_count;
+    rounds++;
+  }
+  if(stats) {
+    stats->rounds = rounds;
+    stats->edges_scanned = ctx.edges_scanned;
+  }
+  free(ctx.marks);
+  free(ctx.active);
+  free(ctx.next);
+  return rounds;
+}
+
+cl_uint cpu_frontier_sssp(thread_pool *pool, graph *g, cl_uint source, cl_float bound,
+			  cl_float *distances, cl_uint *preds, sssp_stats *stats) {
+  cl_uint *seeds = (cl_uint *)malloc(sizeof(cl_uint)*(g->num_vertices ? g->num_vertices : 1));
+  cl_uint count, rounds;
+  cpu_init_distances(pool, g->num_vertices, source, distances, preds);
+  count = seed_frontier(g, source, seeds);
+  rounds = cpu_frontier_from(pool, g, seeds, count, bound, distances, preds, stats);
+  if(stats)
+    stats->edges_scanned += g->out_vertices[source].num_edges;
+  free(seeds);
+  return rounds;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Atomic float min; non-negative floats order like their bit patterns, but a
+//CAS on the float itself keeps that assumption out of the code.
+static inline int relax_distance(cl_float *d, cl_float val) {
+  cl_float cur = load_distance(d);
+  while(val < cur) {
+    if(__atomic_compare_exchange(d, &cur, &val, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+  }
+  return 0;
+}
+
+static inline cl_uint bucket_of(cl_float d, cl_float delta) {
+  cl_float b = d/delta;
+  return b < (cl_float)(CL_UINT_MAX - 1) ? (cl_uint)b : CL_UINT_MAX - 1;
+}
+
+typedef struct _flush_buffer {
+  cl_uint items[FRONTIER_FLUSH];
+  cl_uint count;
+} flush_buffer;
+
+static inline void flush_push(flush_buffer *b, cl_uint *dest, cl_uint *dest_count, cl_uint v) {
+  if(b->count == FRONTIER_FLUSH) {
+    cl_uint at = __atomic_fetch_add(dest_count, b->count, __ATOMIC_RELAXED);
+    memcpy(dest + at, b->items, sizeof(cl_uint)*b->count);
+    b->count = 0;
+  }
+  b->items[b->count++] = v;
+}
+
+static inline void flush_all(flush_buffer *b, cl_uint *dest, cl_uint *dest_count) {
+  if(b->count) {
+    cl_uint at = __atomic_fetch_add(dest_count, b->count, __ATOMIC_RELAXED);
+    memcpy(dest + at, b->items, sizeof(cl_uint)*b->count);
+    b->count = 0;
+  }
+}
+
+//claim[v] packs the level v was first reached at over the pred it was
+//reached from; an atomic min keeps the lowest pred of that level, and
+//whoever takes claim[v] from unclaimed queues v for the next one.
+typedef struct _preds_ctx {
+  graph *g;
+  cl_float *distances;
+  cl_uint *preds;
+  cl_ulong *claim;
+  cl_ulong level;
+  cl_uint *frontier;
+  cl_uint *next;
+  cl_uint next_count;
+} preds_ctx;
+
+static void preds_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  preds_ctx *ctx = (preds_ctx *)arg;
+  graph *g = ctx->g;
+  flush_buffer next;
+  cl_uint k, i;
+  next.count = 0;
+  for(k = begin; k < end; k++) {
+    cl_uint u = ctx->frontier[k];
+    cl_float d = ctx->distances[u];
+    cl_ulong key = (ctx->level + 1) << 32 | u;
+    //u's level is over, so its claim is final.
+    ctx->preds[u] = (cl_uint)ctx->claim[u];
+    for(i = g->out_vertices[u].index; i < g->out_vertices[u].index + g->out_vertices[u].num_edges; i++) {
+      cl_uint v = g->out_edges[i].dest;
+      if(d + g->out_edges[i].weight != ctx->distances[v])
+	continue;
+      cl_ulong cur = __atomic_load_n(&ctx->claim[v], __ATOMIC_RELAXED);
+      while(key < cur) {
+	if(__atomic_compare_exchange_n(&ctx->claim[v], &cur, key, 0, __ATOMIC_RELAXED,
+				       __ATOMIC_RELAXED)) {
+	  if(cur == CL_ULONG_MAX)
+	    flush_push(&next, ctx->next, &ctx->next_count, v);
+	  break;
+	}
+      }
+    }
+  }
+  flush_all(&next, ctx->next, &ctx->next_count);
+}
+
+//Push-style engines only settle distances.  Preds are then read off the
+//tight edges (d[u] + w == d[v]) a level at a time outward from the source,
+//so they form a tree even where zero-weight arcs tie vertices at equal
+//distance.  Requires build_out_edges().
+void cpu_resolve_preds(thread_pool *pool, graph *g, cl_uint source,
+		       cl_float *distances, cl_uint *preds) {
+  cl_uint n = g->num_vertices, count = 1;
+  preds_ctx ctx;
+  ctx.g = g;
+  ctx.distances = distances;
+  ctx.preds = preds;
+  ctx.claim = (cl_ulong *)malloc(sizeof(cl_ulong)*n);
+  ctx.frontier = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  ctx.next = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  if(!ctx.claim || !ctx.frontier || !ctx.next) {
+    problem("Failed to allocate the pred resolution queues.\n");
+    exit(-1);
+  }
+  memset(ctx.claim, 0xff, sizeof(cl_ulong)*n);
+  ctx.claim[source] = source;
+  ctx.frontier[0] = source;
+  for(ctx.level = 0; count; ctx.level++) {
+    ctx.next_count = 0;
+    thread_pool_for(pool, 0, count, CPU_GRAIN/4, preds_range, &ctx);
+    cl_uint *t = ctx.frontier;
+    ctx.frontier = ctx.next;
+    ctx.next = t;
+    count = ctx.next_count;
+  }
+  free(ctx.claim);
+  free(ctx.frontier);
+  free(ctx.next);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _bucket_list {
+  cl_uint *items;
+  cl_uint count;
+  cl_uint capacity;
+} bucket_list;
+
+//Buckets are a ring of num_slots, each split into one list per worker so
+//appends need no synchronisation.  Anything still pending lies less than
+//max_weight/delta + 2 buckets ahead of the current one, so the ring never
+//wraps onto live entries.  Lists may hold stale entries (the vertex has moved
+//to a lower bucket since); they are dropped when the slot is collected.
+typedef struct _delta_ctx {
+  graph *g;
+  cl_float *distances;
+  cl_uint *light;
+  cl_float delta;
+  cl_float bound;
+  cl_uint bucket;
+  cl_uint num_slots;
+  cl_uint num_workers;
+  bucket_list *far;
+  cl_uint *stamp;
+  cl_uint *settled;
+  cl_uint epoch;
+  cl_uint *frontier;
+  cl_uint *next;
+  cl_uint next_count;
+  cl_uint *removed;
+  cl_uint removed_count;
+  cl_ulong edges_scanned;
+} delta_ctx;
+
+static void far_push(delta_ctx *ctx, cl_uint bucket, cl_uint worker, cl_uint v) {
+  bucket_list *l = &ctx->far[(bucket % ctx->num_slots)*ctx->num_workers + worker];
+  if(l->count == l->capacity) {
+    l->capacity = l->capacity ? 2*l->capacity : 1024;
+    l->items = (cl_uint *)realloc(l->items, sizeof(cl_uint)*l->capacity);
+    if(!l->items) {
+      problem("Failed to grow a delta-stepping bucket.\n");
+      exit(-1);
+    }
+  }
+  l->items[l->count++] = v;
+}
+
+static void light_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  delta_ctx *ctx = (delta_ctx *)arg;
+  graph *g = ctx->g;
+  flush_buffer next, removed;
+  cl_ulong scanned = 0;
+  cl_uint k, i;
+  next.count = removed.count = 0;
+  for(k = begin; k < end; k++) {
+    cl_uint u = ctx->frontier[k];
+    cl_float du = load_distance(&ctx->distances[u]);
+    if(bucket_of(du, ctx->delta) != ctx->bucket)
+      continue;
+    if(__atomic_exchange_n(&ctx->settled[u], ctx->bucket + 1, __ATOMIC_RELAXED) != ctx->bucket + 1)
+      flush_push(&removed, ctx->removed, &ctx->removed_count, u);
+    cl_uint first = g->out_vertices[u].index;
+    cl_uint last = first + ctx->light[u];
+    scanned += last - first;
+    for(i = first; i < last; i++) {
+      cl_float nd = du + g->out_edges[i].weight;
+      cl_uint v = g->out_edges[i].dest;
+      if(nd > ctx->bound || !relax_distance(&ctx->distances[v], nd))
+	continue;
+      cl_uint b = bucket_of(nd, ctx->delta);
+      if(b != ctx->bucket)
+	far_push(ctx, b, worker, v);
+      else if(__atomic_exchange_n(&ctx->stamp[v], ctx->epoch, __ATOMIC_RELAXED) != ctx->epoch)
+	flush_push(&next, ctx->next, &ctx->next_count, v);
+    }
+  }
+  flush_all(&next, ctx->next, &ctx->next_count);
+  flush_all(&removed, ctx->removed, &ctx->removed_count);
+  __atomic_fetch_add(&ctx->edges_scanned, scanned, __ATOMIC_RELAXED);
+}
+
+static void heavy_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  delta_ctx *ctx = (delta_ctx *)arg;
+  graph *g = ctx->g;
+  cl_ulong scanned = 0;
+  cl_uint k, i;
+  for(k = begin; k < end; k++) {
+    cl_uint u = ctx->removed[k];
+    cl_float du = load_distance(&ctx->distances[u]);
+    cl_uint first = g->out_vertices[u].index + ctx->light[u];
+    cl_uint last = g->out_vertices[u].index + g->out_vertices[u].num_edges;
+    scanned += last - first;
+    for(i = first; i < last; i++) {
+      cl_float nd = du + g->out_edges[i].weight;
+      cl_uint v = g->out_edges[i].dest;
+      if(nd <= ctx->bound && relax_distance(&ctx->distances[v], nd))
+	far_push(ctx, bucket_of(nd, ctx->delta), worker, v);
+    }
+  }
+  __atomic_fetch_add(&ctx->edges_scanned, scanned, __ATOMIC_RELAXED);
+}
+
+//Gathers the live entries of the current bucket's slot from every worker's
+//list into the frontier.
+static void collect_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  delta_ctx *ctx = (delta_ctx *)arg;
+  flush_buffer next;
+  cl_uint w, k;
+  next.count = 0;
+  for(w = begin; w < end; w++) {
+    bucket_list *l = &ctx->far[(ctx->bucket % ctx->num_slots)*ctx->num_workers + w];
+    for(k = 0; k < l->count; k++) {
+      cl_uint v = l->items[k];
+      if(bucket_of(load_distance(&ctx->distances[v]), ctx->delta) != ctx->bucket)
+	continue;
+      if(__atomic_exchange_n(&ctx->stamp[v], ctx->epoch, __ATOMIC_RELAXED) != ctx->epoch)
+	flush_push(&next, ctx->next, &ctx->next_count, v);
+    }
+    l->count = 0;
+  }
+  flush_all(&next, ctx->next, &ctx->next_count);
+}
+
+static int slot_empty(delta_ctx *ctx, cl_uint bucket) {
+  cl_uint w;
+  for(w = 0; w < ctx->num_workers; w++)
+    if(ctx->far[(bucket % ctx->num_slots)*ctx->num_workers + w].count)
+      return 0;
+  return 1;
+}
+
+cl_uint cpu_delta_stepping(thread_pool *pool, graph *g, cl_uint source, cl_float delta,
+			   cl_float bound, cl_float *distances, cl_uint *preds, sssp_stats *stats) {
+  cl_uint n = g->num_vertices, phases = 0, count, i, k;
+  cl_float max_weight = 0;
+  delta_ctx ctx;
+  //A negative distance has no bucket.
+  if(has_negative_weights(g))
+    return cpu_frontier_sssp(pool, g, source, bound, distances, preds, stats);
+  memset(&ctx, 0, sizeof(ctx));
+  for(i = 0; i < g->num_edges; i++)
+    if(g->edges[i].weight > max_weight)
+      max_weight = g->edges[i].weight;
+  ctx.g = g;
+  ctx.distances = distances;
+  ctx.delta = delta;
+  ctx.bound = bound;
+  ctx.num_workers = thread_pool_size(pool);
+  ctx.num_slots = (cl_uint)(max_weight/delta) + 3;
+  ctx.light = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  ctx.far = (bucket_list *)calloc((size_t)ctx.num_slots*ctx.num_workers, sizeof(bucket_list));
+  ctx.stamp = (cl_uint *)calloc(n, sizeof(cl_uint));
+  ctx.settled = (cl_uint *)calloc(n, sizeof(cl_uint));
+  ctx.frontier = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  ctx.next = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  ctx.removed = (cl_uint *)malloc(sizeof(cl_uint)*n);
+  if(!ctx.light || !ctx.far || !ctx.stamp || !ctx.settled ||
+     !ctx.frontier || !ctx.next || !ctx.removed) {
+    problem("Failed to allocate delta-stepping buckets.\n");
+    exit(-1);
+  }
+  split_light_heavy(g, delta, ctx.light);
+
+  cpu_init_distances(pool, n, source, distances, preds);
+  ctx.frontier[0] = source;
+  count = 1;
+  ctx.bucket = 0;
+  for(;;) {
+    //Light edges can refill the current bucket, so keep going until it drains.
+    ctx.removed_count = 0;
+    while(count) {
+      ctx.epoch++;
+      ctx.next_count = 0;
+      thread_pool_for(pool, 0, count, CPU_GRAIN/4, light_range, &ctx);
+      cl_uint *t = ctx.frontier;
+      ctx.frontier = ctx.next;
+      ctx.next = t;
+      count = ctx.next_count;
+      phases++;
+    }
+    //Everything removed from the bucket is final; heavy edges only reach later buckets.
+    if(ctx.removed_count) {
+      thread_pool_for(pool, 0, ctx.removed_count, CPU_GRAIN/4, heavy_range, &ctx);
+      phases++;
+    }
+    cl_uint base = ctx.bucket;
+    for(k = 1; k < ctx.num_slots && !count; k++) {
+      if(slot_empty(&ctx, base + k))
+	continue;
+      ctx.bucket = base + k;
+      ctx.epoch++;
+      ctx.next_count = 0;
+      thread_pool_for(pool, 0, ctx.num_workers, 1, collect_range, &ctx);
+      cl_uint *t = ctx.frontier;
+      ctx.frontier = ctx.next;
+      ctx.next = t;
+      count = ctx.next_count;
+    }
+    if(!count)
+      break;
+  }
+  cpu_resolve_preds(pool, g, source, distances, preds);
+
+  if(stats) {
+    stats->rounds = phases;
+    stats->edges_scanned = ctx.edges_scanned + g->num_edges;
+  }
+  for(i = 0; i < ctx.num_slots*ctx.num_workers; i++)
+    free(ctx.far[i].items);
+  free(ctx.far);
+  free(ctx.light);
+  free(ctx.stamp);
+  free(ctx.settled);
+  free(ctx.frontier);
+  free(ctx.next);
+  free(ctx.removed);
+  return phases;
+}
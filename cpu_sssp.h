@@ -0,0 +1,35 @@
+#ifndef CPU_SSSP_H
+#define CPU_SSSP_H
+
+#include "sssp.h"
+#include "threadpool.h"
+
+#define CPU_GRAIN 256
+
+void cpu_init_distances(thread_pool *pool, cl_uint num_vertices, cl_uint source,
+			cl_float *distances, cl_uint *preds);
+//The sweep, frontier and delta engines drop every candidate distance over
+//bound, so they stop once nothing under it is left to improve; vertices
+//further away stay unreached.  INFINITY solves the whole graph.
+cl_uint cpu_update_vertices(thread_pool *pool, graph *g, cl_float bound, cl_float *distances,
+			    cl_uint *preds);
+cl_uint cpu_bellman_ford(thread_pool *pool, graph *g, cl_uint source, cl_float bound,
+			 cl_float *distances, cl_uint *preds, sssp_stats *stats);
+cl_uint cpu_potentials(thread_pool *pool, graph *g, cl_float *potentials, sssp_stats *stats);
+cl_uint cpu_multi_bellman_ford(thread_pool *pool, graph *g, const cl_uint *sources,
+			       cl_uint num_sources, cl_float *distances, cl_uint *preds,
+			       sssp_stats *stats);
+cl_uint cpu_frontier_sssp(thread_pool *pool, graph *g, cl_uint source, cl_float bound,
+			  cl_float *distances, cl_uint *preds, sssp_stats *stats);
+//Frontier rounds from whatever distances hold, starting with seeds queued.
+cl_uint cpu_frontier_from(thread_pool *pool, graph *g, const cl_uint *seeds, cl_uint count,
+			  cl_float bound, cl_float *distances, cl_uint *preds, sssp_stats *stats);
+
+//Buckets need non-negative weights; with a negative one this runs frontier
+//rounds instead.
+cl_uint cpu_delta_stepping(thread_pool *pool, graph *g, cl_uint source, cl_float delta,
+			   cl_float bound, cl_float *distances, cl_uint *preds, sssp_stats *stats);
+void cpu_resolve_preds(thread_pool *pool, graph *g, cl_uint source,
+		       cl_float *distances, cl_uint *preds);
+
+#endif
@@ -0,0 +1,267 @@
+#include "csr_cache.h"
+
+/*--------------------------------------------------------------------------------*/
+
+#ifdef __APPLE__
+    #define MTIME(s) ((s).st_mtimespec)
+#else
+    #define MTIME(s) ((s).st_mtim)
+#endif
+
+#define CHECKSUM_BLOCK (1 << 20)
+#define PAGE_ALIGN(x) (((x) + 4095) & ~(cl_ulong)4095)
+
+typedef struct _checksum_ctx {
+  const unsigned char *data;
+  cl_ulong size;
+  cl_ulong *blocks;
+} checksum_ctx;
+
+static inline cl_ulong mix64(cl_ulong h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static void checksum_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  checksum_ctx *ctx = (checksum_ctx *)arg;
+  cl_uint b;
+  for(b = begin; b < end; b++) {
+    cl_ulong at = (cl_ulong)b*CHECKSUM_BLOCK;
+    cl_ulong len = ctx->size - at < CHECKSUM_BLOCK ? ctx->size - at : CHECKSUM_BLOCK;
+    cl_ulong h = mix64(b + 1), i, w;
+    for(i = 0; i + 8 <= len; i += 8) {
+      memcpy(&w, ctx->data + at + i, 8);
+      h = (h ^ mix64(w)) * 0x9e3779b97f4a7c15ULL;
+    }
+    for(; i < len; i++)
+      h = (h ^ ctx->data[at + i]) * 0x100000001b3ULL;
+    ctx->blocks[b] = mix64(h ^ len);
+  }
+}
+
+//Hashes fixed 1MB blocks in parallel and folds them in order, so the result
+//does not depend on the thread count.
+static cl_ulong checksum(const void *data, cl_ulong size, thread_pool *pool) {
+  checksum_ctx ctx;
+  cl_uint i, num_blocks = (cl_uint)((size + CHECKSUM_BLOCK - 1)/CHECKSUM_BLOCK);
+  cl_ulong h = 0;
+  ctx.data = (const unsigned char *)data;
+  ctx.size = size;
+  ctx.blocks = (cl_ulong *)malloc(sizeof(cl_ulong)*(num_blocks ? num_blocks : 1));
+  thread_pool_for(pool, 0, num_blocks, 1, checksum_range, &ctx);
+  for(i = 0; i < num_blocks; i++)
+    h = mix64(h ^ ctx.blocks[i]) + i;
+  free(ctx.blocks);
+  return h;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _pack_ctx {
+  graph *g;
+  cl_uint *offsets;
+  gpu_edge *packed;
+} pack_ctx;
+
+static void pack_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  pack_ctx *ctx = (pack_ctx *)arg;
+  cl_uint v, i;
+  for(v = begin; v < end; v++) {
+    vertex node = ctx->g->vertices[v];
+    ctx->offsets[v] = node.index;
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      ctx->packed[i].source = ctx->g->edges[i].source;
+      ctx->packed[i].weight = ctx->g->edges[i].weight;
+    }
+  }
+}
+
+static void unpack_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  pack_ctx *ctx = (pack_ctx *)arg;
+  cl_uint v, i;
+  for(v = begin; v < end; v++) {
+    cl_uint first = ctx->offsets[v], last = ctx->offsets[v+1];
+    ctx->g->vertices[v].index = first;
+    ctx->g->vertices[v].num_edges = last - first;
+    for(i = first; i < last; i++) {
+      ctx->g->edges[i].source = ctx->packed[i].source;
+      ctx->g->edges[i].dest = v;
+      ctx->g->edges[i].weight = ctx->packed[i].weight;
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int is_csr_cache(const char *filename) {
+  char magic[8];
+  FILE *fh = fopen(filename, "rb");
+  int match;
+  if(!fh)
+    return 0;
+  match = fread(magic, sizeof(magic), 1, fh) == 1 && !memcmp(magic, CSR_MAGIC, sizeof(magic));
+  fclose(fh);
+  return match;
+}
+
+//Writes to a temporary file next to the target and renames it into place,
+//so a crash never leaves a half-written cache behind.
+int write_csr_cache(const char *filename, graph *g, const char *source_file, thread_pool *pool) {
+  struct stat source_stat;
+  char temp_name[PATH_MAX];
+  char source_path[PATH_MAX];
+  csr_header *header;
+  cl_ulong offsets_at = CSR_HEADER_SIZE;
+  cl_ulong edges_at = PAGE_ALIGN(offsets_at + sizeof(cl_uint)*((cl_ulong)g->num_vertices + 1));
+  cl_ulong file_size = edges_at + sizeof(gpu_edge)*(cl_ulong)g->num_edges;
+
+  if(stat(source_file, &source_stat) < 0 || !realpath(source_file, source_path)) {
+    problem("Could not stat %s\n", source_file);
+    return CSR_ERROR;
+  }
+  if(strlen(source_path) >= CSR_SOURCE_PATH_SIZE) {
+    problem("Source path %s is too long to record in a cache\n", source_path);
+    return CSR_ERROR;
+  }
+  snprintf(temp_name, sizeof(temp_name), "%s.tmp.%d", filename, (int)getpid());
+  int fd = open(temp_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0 || ftruncate(fd, (off_t)file_size) < 0) {
+    problem("Could not create %s\n", temp_name);
+    if(fd >= 0) {
+      close(fd);
+      unlink(temp_name);
+    }
+    return CSR_ERROR;
+  }
+  unsigned char *image = (unsigned char *)mmap(NULL, file_size, PROT_READ | PROT_WRITE,
+					       MAP_SHARED, fd, 0);
+  close(fd);
+  if(image == MAP_FAILED) {
+    problem("Could not map %s\n", temp_name);
+    unlink(temp_name);
+    return CSR_ERROR;
+  }
+
+  pack_ctx ctx;
+  ctx.g = g;
+  ctx.offsets = (cl_uint *)(image + offsets_at);
+  ctx.packed = (gpu_edge *)(image + edges_at);
+  thread_pool_for(pool, 0, g->num_vertices, 4096, pack_range, &ctx);
+  ctx.offsets[g->num_vertices] = g->num_edges;
+
+  header = (csr_header *)image;
+  memcpy(header->magic, CSR_MAGIC, sizeof(header->magic));
+  header->version = CSR_VERSION;
+  header->header_size = CSR_HEADER_SIZE;
+  header->num_vertices = g->num_vertices;
+  header->num_edges = g->num_edges;
+  header->offsets_at = offsets_at;
+  header->edges_at = edges_at;
+  header->file_size = file_size;
+  header->source_size = (cl_ulong)source_stat.st_size;
+  header->source_mtime_sec = (cl_long)MTIME(source_stat).tv_sec;
+  header->source_mtime_nsec = (cl_long)MTIME(source_stat).tv_nsec;
+  strcpy(header->source_path, source_path);
+  header->checksum = checksum(image + CSR_HEADER_SIZE, file_size - CSR_HEADER_SIZE, pool);
+
+  int failed = msync(image, file_size, MS_SYNC) < 0;
+  munmap(image, file_size);
+  if(failed || rename(temp_name, filename) < 0) {
+    problem("Could not write %s\n", filename);
+    unlink(temp_name);
+    return CSR_ERROR;
+  }
+  return CSR_OK;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Maps the cache and validates it.  The offsets and packed edges stay in the
+//mapping; edges/vertices are expanded from them for the engines that want the
+//16-byte edge layout.  Returns CSR_STALE when the recorded source file has
+//changed since the cache was written.
+int load_csr_cache(const char *filename, thread_pool *pool, graph *g) {
+  struct stat statbuf, source_stat;
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0 || fstat(fd, &statbuf) < 0) {
+    problem("Could not open graph cache %s\n", filename);
+    if(fd >= 0)
+      close(fd);
+    return CSR_ERROR;
+  }
+  size_t size = (size_t)statbuf.st_size;
+  if(size < CSR_HEADER_SIZE) {
+    problem("%s is too small to be a graph cache\n", filename);
+    close(fd);
+    return CSR_ERROR;
+  }
+  unsigned char *image = (unsigned char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(image == MAP_FAILED) {
+    problem("Could not map graph cache %s\n", filename);
+    return CSR_ERROR;
+  }
+  const csr_header *header = (const csr_header *)image;
+
+  if(memcmp(header->magic, CSR_MAGIC, sizeof(header->magic)) || header->version != CSR_VERSION ||
+     header->header_size != CSR_HEADER_SIZE || header->file_size != size ||
+     header->offsets_at != CSR_HEADER_SIZE ||
+     header->edges_at < header->offsets_at + sizeof(cl_uint)*((cl_ulong)header->num_vertices + 1) ||
+     header->edges_at + sizeof(gpu_edge)*(cl_ulong)header->num_edges != size) {
+    problem("%s is not a version %d graph cache\n", filename, CSR_VERSION);
+    munmap(image, size);
+    return CSR_ERROR;
+  }
+  if(memchr(header->source_path, '\0', CSR_SOURCE_PATH_SIZE) == NULL) {
+    problem("%s has a corrupt header\n", filename);
+    munmap(image, size);
+    return CSR_ERROR;
+  }
+  if(stat(header->source_path, &source_stat) == 0) {
+    if((cl_ulong)source_stat.st_size != header->source_size ||
+       (cl_long)MTIME(source_stat).tv_sec != header->source_mtime_sec ||
+       (cl_long)MTIME(source_stat).tv_nsec != header->source_mtime_nsec) {
+      problem("%s is stale: %s changed since it was converted\n", filename, header->source_path);
+      munmap(image, size);
+      return CSR_STALE;
+    }
+  } else {
+    problem("Warning: cannot check %s for staleness, %s is gone\n", filename, header->source_path);
+  }
+
+  madvise(image, size, MADV_WILLNEED);
+  if(checksum(image + CSR_HEADER_SIZE, size - CSR_HEADER_SIZE, pool) != header->checksum) {
+    problem("%s failed its checksum\n", filename);
+    munmap(image, size);
+    return CSR_ERROR;
+  }
+
+  pack_ctx ctx;
+  memset(g, 0, sizeof(graph));
+  g->num_vertices = header->num_vertices;
+  g->num_edges = header->num_edges;
+  g->mapping = image;
+  g->mapping_size = size;
+  g->offsets = (cl_uint *)(image + header->offsets_at);
+  g->packed_edges = (gpu_edge *)(image + header->edges_at);
+  if(g->offsets[g->num_vertices] != g->num_edges) {
+    problem("%s has inconsistent offsets\n", filename);
+    free_graph(g);
+    return CSR_ERROR;
+  }
+  g->vertices = (vertex *)malloc(sizeof(vertex)*(g->num_vertices ? g->num_vertices : 1));
+  g->edges = (edge *)malloc(sizeof(edge)*(g->num_edges ? g->num_edges : 1));
+  if(!g->vertices || !g->edges) {
+    problem("Failed to allocate the graph.\n");
+    exit(-1);
+  }
+  ctx.g = g;
+  ctx.offsets = g->offsets;
+  ctx.packed = g->packed_edges;
+  thread_pool_for(pool, 0, g->num_vertices, 4096, unpack_range, &ctx);
+  return CSR_OK;
+}
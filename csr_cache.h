@@ -0,0 +1,52 @@
+#ifndef CSR_CACHE_H
+#define CSR_CACHE_H
+
+#include "sssp.h"
+#include "threadpool.h"
+
+/*
+ * Binary graph cache.  Layout, all little-endian host order:
+ *
+ *   [0, CSR_HEADER_SIZE)        csr_header
+ *   [offsets_at, ...)           cl_uint offsets[num_vertices + 1]
+ *   [edges_at, ...)             gpu_edge edges[num_edges], grouped by dest
+ *
+ * Both arrays start on a page boundary so the mapping can be handed to the
+ * device as is.  checksum covers everything after the header; the source_*
+ * fields record the text file the cache was converted from so a cache that
+ * is older than its source is refused rather than silently loaded.
+ */
+
+#define CSR_MAGIC "OPBFCSR"
+#define CSR_VERSION 1
+#define CSR_HEADER_SIZE 4096
+#define CSR_SOURCE_PATH_SIZE 3984
+
+typedef struct _csr_header {
+  char magic[8];
+  cl_uint version;
+  cl_uint header_size;
+  cl_uint num_vertices;
+  cl_uint num_edges;
+  cl_ulong offsets_at;
+  cl_ulong edges_at;
+  cl_ulong file_size;
+  cl_ulong checksum;
+  cl_ulong source_size;
+  cl_long source_mtime_sec;
+  cl_long source_mtime_nsec;
+  cl_ulong reserved[4];
+  char source_path[CSR_SOURCE_PATH_SIZE];
+} csr_header;
+
+typedef char csr_header_size_check[sizeof(csr_header) == CSR_HEADER_SIZE ? 1 : -1];
+
+#define CSR_OK 0
+#define CSR_ERROR -1
+#define CSR_STALE 1
+
+int is_csr_cache(const char *filename);
+int write_csr_cache(const char *filename, graph *g, const char *source_file, thread_pool *pool);
+int load_csr_cache(const char *filename, thread_pool *pool, graph *g);
+
+#endif
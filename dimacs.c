@@ -0,0 +1,439 @@
+#include "dimacs.h"
+#include "reorder.h"
+
+/*--------------------------------------------------------------------------------*/
+
+#define CHUNKS_PER_THREAD 8
+#define MIN_CHUNK_BYTES (1 << 20)
+//Dest vertices per block of the scatter; a chunk keeps a count per block.
+#define SCATTER_BLOCK_SHIFT 12
+
+typedef struct _chunk {
+  const char *begin;
+  const char *end;
+  edge *edges;
+  cl_uint count;
+  cl_uint capacity;
+  cl_uint max_id;
+  int bad_line;
+} chunk;
+
+typedef struct _load_ctx {
+  chunk *chunks;
+  cl_uint num_chunks;
+  cl_uint num_vertices;
+  cl_uint num_blocks;
+  cl_uint *counts;
+  cl_uint *block_counts;        //num_chunks x num_blocks, then each chunk's offsets
+  edge *blocked;                //edges grouped by dest block, file order within one
+  edge *edges;
+  vertex *vertices;
+} load_ctx;
+
+/*--------------------------------------------------------------------------------*/
+
+static inline const char *skip_blanks(const char *p, const char *end) {
+  while(p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  return p;
+}
+
+static inline const char *next_line(const char *p, const char *end) {
+  const char *nl = (const char *)memchr(p, '\n', end - p);
+  return nl ? nl + 1 : end;
+}
+
+static inline const char *parse_uint(const char *p, const char *end, cl_ulong *out) {
+  cl_ulong v = 0;
+  const char *start;
+  p = skip_blanks(p, end);
+  start = p;
+  while(p < end && *p >= '0' && *p <= '9')
+    v = v*10 + (cl_ulong)(*p++ - '0');
+  *out = v;
+  return p == start ? NULL : p;
+}
+
+#define WEIGHT_TOKEN 64
+
+//DIMACS weights are integers, but accept any float, as sscanf("%f") did, so
+//hand-made inputs and negative arcs load.  The weight ends the line; anything
+//but blanks after it is an error rather than silently dropped.
+static inline const char *parse_weight(const char *p, const char *end, cl_float *out) {
+  char token[WEIGHT_TOKEN], *stop;
+  size_t len = 0;
+  p = skip_blanks(p, end);
+  while(p + len < end && p[len] != ' ' && p[len] != '\t' && p[len] != '\r' && p[len] != '\n') {
+    if(++len == WEIGHT_TOKEN)
+      return NULL;
+  }
+  if(len == 0)
+    return NULL;
+  memcpy(token, p, len);
+  token[len] = '\0';
+  *out = strtof(token, &stop);
+  if(*stop)
+    return NULL;
+  p = skip_blanks(p + len, end);
+  while(p < end && *p == '\r')
+    p++;
+  return p == end || *p == '\n' ? p : NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static void parse_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  load_ctx *ctx = (load_ctx *)arg;
+  cl_uint c;
+  for(c = begin; c < end; c++) {
+    chunk *k = &ctx->chunks[c];
+    const char *p = k->begin;
+    while(p < k->end) {
+      if(*p != 'a') {
+	p = next_line(p, k->end);
+	continue;
+      }
+      cl_ulong dest, source;
+      cl_float weight;
+      const char *q = parse_uint(p + 1, k->end, &dest);
+      if(q) q = parse_uint(q, k->end, &source);
+      if(q) q = parse_weight(q, k->end, &weight);
+      if(!q || dest == 0 || source == 0 || dest > CL_UINT_MAX || source > CL_UINT_MAX) {
+	k->bad_line = 1;
+	return;
+      }
+      if(k->count == k->capacity) {
+	k->capacity = k->capacity ? 2*k->capacity : 4096;
+	k->edges = (edge *)realloc(k->edges, sizeof(edge)*k->capacity);
+	if(!k->edges) {
+	  k->bad_line = 1;
+	  return;
+	}
+      }
+      edge *e = &k->edges[k->count++];
+      e->dest = (cl_uint)dest - 1;
+      e->source = (cl_uint)source - 1;
+      e->weight = weight;
+      if(dest > k->max_id) k->max_id = (cl_uint)dest;
+      if(source > k->max_id) k->max_id = (cl_uint)source;
+      p = next_line(q, k->end);
+    }
+  }
+}
+
+static void count_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  load_ctx *ctx = (load_ctx *)arg;
+  cl_uint c, i;
+  for(c = begin; c < end; c++) {
+    cl_uint *blocks = ctx->block_counts + (size_t)c*ctx->num_blocks;
+    for(i = 0; i < ctx->chunks[c].count; i++) {
+      cl_uint d = ctx->chunks[c].edges[i].dest;
+      __atomic_fetch_add(&ctx->counts[d], 1, __ATOMIC_RELAXED);
+      blocks[d >> SCATTER_BLOCK_SHIFT]++;
+    }
+  }
+}
+
+//Chunks are cut in file order and each one writes its edges, in order, from
+//its own offset within every block, so a block holds its edges in file order.
+static void scatter_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  load_ctx *ctx = (load_ctx *)arg;
+  cl_uint c, i;
+  for(c = begin; c < end; c++) {
+    chunk *k = &ctx->chunks[c];
+    cl_uint *offsets = ctx->block_counts + (size_t)c*ctx->num_blocks;
+    for(i = 0; i < k->count; i++)
+      ctx->blocked[offsets[k->edges[i].dest >> SCATTER_BLOCK_SHIFT]++] = k->edges[i];
+    free(k->edges);
+    k->edges = NULL;
+  }
+}
+
+//Counting sort within a block, in one ordered pass, so every dest group
+//keeps file order too and runs are reproducible.
+static void place_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  load_ctx *ctx = (load_ctx *)arg;
+  cl_uint b;
+  for(b = begin; b < end; b++) {
+    cl_uint first = b << SCATTER_BLOCK_SHIFT;
+    cl_uint last = ctx->num_vertices - first > (1u << SCATTER_BLOCK_SHIFT) ?
+      first + (1u << SCATTER_BLOCK_SHIFT) : ctx->num_vertices;
+    cl_uint i = ctx->vertices[first].index;
+    cl_uint stop = ctx->vertices[last-1].index + ctx->vertices[last-1].num_edges;
+    for(; i < stop; i++) {
+      cl_uint d = ctx->blocked[i].dest;
+      ctx->edges[ctx->vertices[d].index + ctx->counts[d]++] = ctx->blocked[i];
+    }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Reads "p sp <vertices> <arcs>" if it comes before the first arc.
+static void parse_header(const char *p, const char *end, cl_ulong *num_vertices, cl_ulong *num_edges) {
+  *num_vertices = *num_edges = 0;
+  while(p < end && *p != 'a') {
+    if(*p == 'p') {
+      const char *q = skip_blanks(p + 1, end);
+      if(end - q > 2 && q[0] == 's' && q[1] == 'p') {
+	q = parse_uint(q + 2, end, num_vertices);
+	if(q)
+	  parse_uint(q, end, num_edges);
+      }
+    }
+    p = next_line(p, end);
+  }
+}
+
+int load_dimacs(const char *filename, thread_pool *pool, graph *g) {
+  struct stat statbuf;
+  int fd = open(filename, O_RDONLY);
+  cl_uint c, v;
+  if(fd < 0 || fstat(fd, &statbuf) < 0) {
+    problem("Could not open graph file %s\n", filename);
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+  size_t size = (size_t)statbuf.st_size;
+  if(size == 0) {
+    problem("Graph file %s is empty\n", filename);
+    close(fd);
+    return -1;
+  }
+  const char *text = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(text == MAP_FAILED) {
+    problem("Could not map graph file %s\n", filename);
+    return -1;
+  }
+  madvise((void *)text, size, MADV_SEQUENTIAL);
+  const char *end = text + size;
+
+  cl_ulong header_vertices, header_edges;
+  parse_header(text, end, &header_vertices, &header_edges);
+
+  //Cut the file into line-aligned chunks, a few per thread for balance.
+  load_ctx ctx;
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.num_chunks = thread_pool_size(pool)*CHUNKS_PER_THREAD;
+  if(size/ctx.num_chunks < MIN_CHUNK_BYTES)
+    ctx.num_chunks = (cl_uint)(size/MIN_CHUNK_BYTES) + 1;
+  ctx.chunks = (chunk *)calloc(ctx.num_chunks, sizeof(chunk));
+  for(c = 0; c < ctx.num_chunks; c++) {
+    const char *b = text + size*c/ctx.num_chunks;
+    if(c > 0 && b[-1] != '\n')
+      b = next_line(b, end);
+    ctx.chunks[c].begin = b;
+    if(c > 0)
+      ctx.chunks[c-1].end = b;
+    //Pre-size from the header so most chunks never reallocate.
+    if(header_edges)
+      ctx.chunks[c].capacity = (cl_uint)(header_edges/ctx.num_chunks + header_edges/(8*ctx.num_chunks) + 16);
+    if(ctx.chunks[c].capacity)
+      ctx.chunks[c].edges = (edge *)malloc(sizeof(edge)*ctx.chunks[c].capacity);
+  }
+  ctx.chunks[ctx.num_chunks-1].end = end;
+
+  thread_pool_for(pool, 0, ctx.num_chunks, 1, parse_range, &ctx);
+  munmap((void *)text, size);
+
+  cl_ulong total = 0;
+  cl_uint max_id = 0;
+  for(c = 0; c < ctx.num_chunks; c++) {
+    if(ctx.chunks[c].bad_line) {
+      problem("Malformed arc line in %s\n", filename);
+      for(v = 0; v < ctx.num_chunks; v++)
+	free(ctx.chunks[v].edges);
+      free(ctx.chunks);
+      return -1;
+    }
+    total += ctx.chunks[c].count;
+    if(ctx.chunks[c].max_id > max_id)
+      max_id = ctx.chunks[c].max_id;
+  }
+  if(total == 0 || total > CL_UINT_MAX || (header_vertices && max_id > header_vertices)) {
+    problem("%s: %llu arcs, largest vertex id %u, header says %llu vertices\n", filename,
+	    (unsigned long long)total, max_id, (unsigned long long)header_vertices);
+    for(v = 0; v < ctx.num_chunks; v++)
+      free(ctx.chunks[v].edges);
+    free(ctx.chunks);
+    return -1;
+  }
+  ctx.num_vertices = header_vertices ? (cl_uint)header_vertices : max_id;
+
+  //Stable counting sort on dest: histograms, prefix sums, a scatter into
+  //dest blocks and a pass within each block.
+  ctx.num_blocks = ((ctx.num_vertices - 1) >> SCATTER_BLOCK_SHIFT) + 1;
+  ctx.counts = (cl_uint *)calloc(ctx.num_vertices, sizeof(cl_uint));
+  ctx.block_counts = (cl_uint *)calloc((size_t)ctx.num_chunks*ctx.num_blocks, sizeof(cl_uint));
+  ctx.vertices = (vertex *)malloc(sizeof(vertex)*ctx.num_vertices);
+  ctx.blocked = (edge *)malloc(sizeof(edge)*total);
+  if(!ctx.counts || !ctx.block_counts || !ctx.vertices || !ctx.blocked) {
+    problem("Failed to allocate the graph.\n");
+    exit(-1);
+  }
+  thread_pool_for(pool, 0, ctx.num_chunks, 1, count_range, &ctx);
+  cl_uint index = 0;
+  for(v = 0; v < ctx.num_vertices; v++) {
+    ctx.vertices[v].index = index;
+    ctx.vertices[v].num_edges = ctx.counts[v];
+    index += ctx.counts[v];
+    ctx.counts[v] = 0;
+  }
+  for(cl_uint b = 0; b < ctx.num_blocks; b++) {
+    index = ctx.vertices[b << SCATTER_BLOCK_SHIFT].index;
+    for(c = 0; c < ctx.num_chunks; c++) {
+      cl_uint *count = &ctx.block_counts[(size_t)c*ctx.num_blocks + b];
+      cl_uint n = *count;
+      *count = index;
+      index += n;
+    }
+  }
+  thread_pool_for(pool, 0, ctx.num_chunks, 1, scatter_range, &ctx);
+  free(ctx.block_counts);
+  free(ctx.chunks);
+  ctx.edges = (edge *)malloc(sizeof(edge)*total);
+  if(!ctx.edges) {
+    problem("Failed to allocate the graph.\n");
+    exit(-1);
+  }
+  thread_pool_for(pool, 0, ctx.num_blocks, 1, place_range, &ctx);
+  free(ctx.blocked);
+  free(ctx.counts);
+
+  memset(g, 0, sizeof(graph));
+  g->num_vertices = ctx.num_vertices;
+  g->num_edges = (cl_uint)total;
+  g->edges = ctx.edges;
+  g->vertices = ctx.vertices;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static inline const char *parse_int(const char *p, const char *end, cl_long *out) {
+  cl_ulong v;
+  int negative;
+  p = skip_blanks(p, end);
+  negative = p < end && *p == '-';
+  p = parse_uint(p + negative, end, &v);
+  *out = negative ? -(cl_long)v : (cl_long)v;
+  return p;
+}
+
+int load_coordinates(const char *filename, graph *g) {
+  struct stat statbuf;
+  int fd = open(filename, O_RDONLY);
+  cl_uint v, seen = 0;
+  if(fd < 0 || fstat(fd, &statbuf) < 0 || statbuf.st_size == 0) {
+    problem("Could not open coordinate file %s\n", filename);
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+  size_t size = (size_t)statbuf.st_size;
+  const char *text = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(text == MAP_FAILED) {
+    problem("Could not map coordinate file %s\n", filename);
+    return -1;
+  }
+  const char *p = text, *end = text + size;
+  cl_int *coords = (cl_int *)malloc(sizeof(cl_int)*2*(g->num_vertices ? g->num_vertices : 1));
+  cl_uchar *have = (cl_uchar *)calloc(g->num_vertices ? g->num_vertices : 1, 1);
+  if(!coords || !have) {
+    problem("Failed to allocate the coordinates.\n");
+    exit(-1);
+  }
+  while(p < end) {
+    if(*p == 'v') {
+      cl_ulong id;
+      cl_long x, y;
+      const char *q = parse_uint(p + 1, end, &id);
+      if(q) q = parse_int(q, end, &x);
+      if(q) q = parse_int(q, end, &y);
+      if(!q || id == 0 || id > g->num_vertices || x < INT_MIN || x > INT_MAX ||
+	 y < INT_MIN || y > INT_MAX) {
+	problem("Malformed vertex line in %s\n", filename);
+	munmap((void *)text, size);
+	free(coords);
+	free(have);
+	return -1;
+      }
+      v = (cl_uint)id - 1;
+      coords[2*v] = (cl_int)x;
+      coords[2*v + 1] = (cl_int)y;
+      seen += !have[v];
+      have[v] = 1;
+    }
+    p = next_line(p, end);
+  }
+  munmap((void *)text, size);
+  free(have);
+  if(seen != g->num_vertices) {
+    problem("%s has coordinates for %u of %u vertices\n", filename, seen, g->num_vertices);
+    free(coords);
+    return -1;
+  }
+  free(g->coords);
+  g->coords = coords;
+  return 0;
+}
+
+int load_weight_updates(const char *filename, graph *g, weight_update **updates, cl_uint *count) {
+  struct stat statbuf;
+  int fd = open(filename, O_RDONLY);
+  cl_uint capacity = 0;
+  if(fd < 0 || fstat(fd, &statbuf) < 0) {
+    problem("Could not open update file %s\n", filename);
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+  *updates = NULL;
+  *count = 0;
+  if(statbuf.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  size_t size = (size_t)statbuf.st_size;
+  const char *text = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(text == MAP_FAILED) {
+    problem("Could not map update file %s\n", filename);
+    return -1;
+  }
+  const char *p = text, *end = text + size;
+  while(p < end) {
+    if(*p == 'a') {
+      cl_ulong dest, source;
+      cl_float weight;
+      const char *q = parse_uint(p + 1, end, &dest);
+      if(q) q = parse_uint(q, end, &source);
+      if(q) q = parse_weight(q, end, &weight);
+      if(!q || dest == 0 || source == 0 || dest > g->num_vertices || source > g->num_vertices) {
+	problem("Malformed arc line in %s\n", filename);
+	munmap((void *)text, size);
+	free(*updates);
+	*updates = NULL;
+	return -1;
+      }
+      if(*count == capacity) {
+	capacity = capacity ? 2*capacity : 1024;
+	*updates = (weight_update *)realloc(*updates, sizeof(weight_update)*capacity);
+	if(!*updates) {
+	  problem("Failed to allocate the updates.\n");
+	  exit(-1);
+	}
+      }
+      weight_update *u = &(*updates)[(*count)++];
+      u->dest = internal_id(g, (cl_uint)dest - 1);
+      u->source = internal_id(g, (cl_uint)source - 1);
+      u->weight = weight;
+    }
+    p = next_line(p, end);
+  }
+  munmap((void *)text, size);
+  return 0;
+}
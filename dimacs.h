@@ -0,0 +1,25 @@
+#ifndef DIMACS_H
+#define DIMACS_H
+
+#include "sssp.h"
+#include "threadpool.h"
+#include "repair.h"
+
+/*
+ * Loads a DIMACS shortest-path (.gr) file straight into the dest-grouped CSR.
+ * The file is mmapped and cut into line-aligned chunks that are parsed in
+ * parallel; a counting sort on dest then places every edge.  "a u v w" is
+ * read the way this solver always has: u is the dest, v the source.
+ * Returns 0 on success, -1 (after reporting the problem) on failure.
+ */
+int load_dimacs(const char *filename, thread_pool *pool, graph *g);
+
+//Reads a DIMACS coordinate (.co) file, "v id x y" per vertex, into
+//g->coords.  Every vertex of g needs a line.  Returns 0 or -1.
+int load_coordinates(const char *filename, graph *g);
+
+//Reads a batch of weight changes, "a u v w" lines read like the graph's, and
+//translates them to internal vertex numbers.  Returns 0 or -1.
+int load_weight_updates(const char *filename, graph *g, weight_update **updates, cl_uint *count);
+
+#endif
@@ -0,0 +1,221 @@
+#include "generate.h"
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _gen_ctx {
+  graph_family family;
+  cl_uint scale;
+  cl_ulong seed;
+  cl_uint num_vertices;
+  cl_uint num_edges;
+  const cl_uint *shuffle;       //rmat relabelling
+  cl_uint width;                //grid columns
+  cl_uint *counts;
+  edge *list;                   //Arcs in generation order.
+  edge *edges;
+  vertex *vertices;
+} gen_ctx;
+
+static inline cl_float random_weight(cl_ulong *state) {
+  return (cl_float)(1 + gen_next(state) % GEN_MAX_WEIGHT);
+}
+
+//A stream per block (or per grid vertex) keyed off the seed.
+static inline cl_ulong stream_state(cl_ulong seed, cl_ulong index) {
+  cl_ulong state = seed ^ (index*0xd1b54a32d192ed03ULL);
+  gen_next(&state);
+  return state;
+}
+
+static void rmat_arc(gen_ctx *ctx, cl_ulong *state, edge *e) {
+  cl_uint source = 0, dest = 0, bit;
+  for(bit = 0; bit < ctx->scale; bit++) {
+    double r = (gen_next(state) >> 11)*(1.0/9007199254740992.0);
+    source <<= 1;
+    dest <<= 1;
+    if(r < 0.57)
+      ;
+    else if(r < 0.76)
+      dest |= 1;
+    else if(r < 0.95)
+      source |= 1;
+    else {
+      source |= 1;
+      dest |= 1;
+    }
+  }
+  e->source = ctx->shuffle[source];
+  e->dest = ctx->shuffle[dest];
+}
+
+static void arcs_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  gen_ctx *ctx = (gen_ctx *)arg;
+  cl_uint b, i;
+  for(b = begin; b < end; b++) {
+    cl_ulong state = stream_state(ctx->seed, b);
+    cl_uint first = b*GEN_BLOCK_EDGES;
+    cl_uint last = ctx->num_edges - first < GEN_BLOCK_EDGES ? ctx->num_edges : first + GEN_BLOCK_EDGES;
+    for(i = first; i < last; i++) {
+      edge *e = &ctx->list[i];
+      if(ctx->family == GEN_RMAT) {
+	rmat_arc(ctx, &state, e);
+      } else {
+	e->source = (cl_uint)(gen_next(&state) % ctx->num_vertices);
+	e->dest = (cl_uint)(gen_next(&state) % ctx->num_vertices);
+      }
+      e->weight = random_weight(&state);
+      __atomic_fetch_add(&ctx->counts[e->dest], 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+static void scatter_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  gen_ctx *ctx = (gen_ctx *)arg;
+  cl_uint i;
+  for(i = begin; i < end; i++) {
+    cl_uint d = ctx->list[i].dest;
+    cl_uint at = __atomic_fetch_add(&ctx->counts[d], 1, __ATOMIC_RELAXED);
+    ctx->edges[ctx->vertices[d].index + at] = ctx->list[i];
+  }
+}
+
+static int compare_edges(const void *a, const void *b) {
+  const edge *x = (const edge *)a, *y = (const edge *)b;
+  if(x->source != y->source)
+    return x->source < y->source ? -1 : 1;
+  return x->weight < y->weight ? -1 : x->weight > y->weight;
+}
+
+//The scatter leaves each group in whatever order the workers got there.
+//Sorting by source, then weight, makes the graph the same for any thread
+//count; qsort keeps R-MAT hubs at d log d.
+static void order_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  gen_ctx *ctx = (gen_ctx *)arg;
+  cl_uint v;
+  for(v = begin; v < end; v++)
+    qsort(ctx->edges + ctx->vertices[v].index, ctx->vertices[v].num_edges, sizeof(edge),
+	  compare_edges);
+}
+
+//Arcs into v from its lattice neighbours, which in row-major numbering are
+//already in source order: up, left, right, down.
+static void grid_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  gen_ctx *ctx = (gen_ctx *)arg;
+  cl_uint v, w = ctx->width, n = ctx->num_vertices;
+  for(v = begin; v < end; v++) {
+    cl_ulong state = stream_state(ctx->seed, v);
+    edge *e = ctx->edges + ctx->vertices[v].index;
+    cl_uint x = v % w;
+    if(v >= w)         { e->source = v - w; e->dest = v; e->weight = random_weight(&state); e++; }
+    if(x > 0)          { e->source = v - 1; e->dest = v; e->weight = random_weight(&state); e++; }
+    if(x + 1 < w)      { e->source = v + 1; e->dest = v; e->weight = random_weight(&state); e++; }
+    if(v + w < n)      { e->source = v + w; e->dest = v; e->weight = random_weight(&state); e++; }
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static void generate_grid(thread_pool *pool, gen_ctx *ctx, graph *g) {
+  cl_uint n = ctx->num_vertices, w = ctx->width, h = n/w, v, index = 0;
+  ctx->vertices = (vertex *)malloc(sizeof(vertex)*n);
+  for(v = 0; v < n; v++) {
+    cl_uint x = v % w, y = v / w;
+    ctx->vertices[v].index = index;
+    ctx->vertices[v].num_edges = (y > 0) + (x > 0) + (x + 1 < w) + (y + 1 < h);
+    index += ctx->vertices[v].num_edges;
+  }
+  ctx->num_edges = index;
+  ctx->edges = (edge *)malloc(sizeof(edge)*(index ? index : 1));
+  g->coords = (cl_int *)malloc(sizeof(cl_int)*2*n);
+  if(!ctx->edges || !g->coords) {
+    problem("Failed to allocate the graph.\n");
+    exit(-1);
+  }
+  thread_pool_for(pool, 0, n, 4096, grid_range, ctx);
+  for(v = 0; v < n; v++) {
+    g->coords[2*v] = (cl_int)(v % w);
+    g->coords[2*v + 1] = (cl_int)(v / w);
+  }
+}
+
+static void generate_arcs(thread_pool *pool, gen_ctx *ctx) {
+  cl_uint n = ctx->num_vertices, v, index = 0;
+  cl_uint *shuffle = NULL;
+  if(ctx->family == GEN_RMAT) {
+    cl_ulong state = stream_state(ctx->seed, CL_UINT_MAX);
+    shuffle = (cl_uint *)malloc(sizeof(cl_uint)*n);
+    for(v = 0; v < n; v++)
+      shuffle[v] = v;
+    for(v = n - 1; v > 0; v--) {
+      cl_uint j = (cl_uint)(gen_next(&state) % (v + 1)), t = shuffle[v];
+      shuffle[v] = shuffle[j];
+      shuffle[j] = t;
+    }
+    ctx->shuffle = shuffle;
+  }
+  ctx->counts = (cl_uint *)calloc(n, sizeof(cl_uint));
+  ctx->list = (edge *)malloc(sizeof(edge)*ctx->num_edges);
+  ctx->edges = (edge *)malloc(sizeof(edge)*ctx->num_edges);
+  ctx->vertices = (vertex *)malloc(sizeof(vertex)*n);
+  if(!ctx->counts || !ctx->list || !ctx->edges || !ctx->vertices) {
+    problem("Failed to allocate the graph.\n");
+    exit(-1);
+  }
+  thread_pool_for(pool, 0, (ctx->num_edges + GEN_BLOCK_EDGES - 1)/GEN_BLOCK_EDGES, 1,
+		  arcs_range, ctx);
+  //Counting sort on dest, as in load_dimacs.
+  for(v = 0; v < n; v++) {
+    ctx->vertices[v].index = index;
+    ctx->vertices[v].num_edges = ctx->counts[v];
+    index += ctx->counts[v];
+    ctx->counts[v] = 0;
+  }
+  thread_pool_for(pool, 0, ctx->num_edges, GEN_BLOCK_EDGES, scatter_range, ctx);
+  thread_pool_for(pool, 0, n, 4096, order_range, ctx);
+  free(ctx->list);
+  free(ctx->counts);
+  free(shuffle);
+}
+
+int generate_graph(thread_pool *pool, graph_family family, cl_uint scale,
+		   cl_uint edge_factor, cl_ulong seed, graph *g) {
+  gen_ctx ctx;
+  if(scale < 1 || scale > GEN_MAX_SCALE ||
+     (family != GEN_GRID && ((cl_ulong)edge_factor << scale) > CL_UINT_MAX)) {
+    problem("Cannot generate a %s graph of scale %u with %u arcs per vertex.\n",
+	    family_name(family), scale, edge_factor);
+    return -1;
+  }
+  memset(&ctx, 0, sizeof(ctx));
+  memset(g, 0, sizeof(graph));
+  ctx.family = family;
+  ctx.scale = scale;
+  ctx.seed = seed;
+  ctx.num_vertices = (cl_uint)1 << scale;
+  ctx.num_edges = edge_factor << scale;
+  ctx.width = (cl_uint)1 << (scale/2);
+  if(family == GEN_GRID)
+    generate_grid(pool, &ctx, g);
+  else
+    generate_arcs(pool, &ctx);
+  g->num_vertices = ctx.num_vertices;
+  g->num_edges = ctx.num_edges;
+  g->edges = ctx.edges;
+  g->vertices = ctx.vertices;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int parse_family(const char *name, graph_family *family) {
+  if(!strcmp(name, "uniform"))     *family = GEN_UNIFORM;
+  else if(!strcmp(name, "rmat"))   *family = GEN_RMAT;
+  else if(!strcmp(name, "grid"))   *family = GEN_GRID;
+  else
+    return -1;
+  return 0;
+}
+
+const char *family_name(graph_family family) {
+  return family == GEN_RMAT ? "rmat" : family == GEN_GRID ? "grid" : "uniform";
+}
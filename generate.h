@@ -0,0 +1,47 @@
+#ifndef GENERATE_H
+#define GENERATE_H
+
+#include "sssp.h"
+#include "threadpool.h"
+
+/*
+ * Seeded synthetic graphs, so runs can be repeated and compared without a
+ * DIMACS file.  scale is log2 of the vertex count.
+ *
+ *   uniform  edge_factor*n arcs between uniformly random vertices
+ *   rmat     edge_factor*n R-MAT arcs (Graph500 a=.57 b=.19 c=.19), with the
+ *            vertices shuffled so the hubs are not all at the low ids
+ *   grid     a 2^(scale/2) x 2^(scale - scale/2) lattice with arcs both ways
+ *            between 4-neighbours and coordinates, road-network-like
+ *
+ * Weights are integers in [1, GEN_MAX_WEIGHT].  The arcs come in blocks of
+ * GEN_BLOCK_EDGES, each from its own stream off the seed, so the graph
+ * depends only on (family, scale, edge_factor, seed) and not on the thread
+ * count.
+ */
+
+#define GEN_EDGE_FACTOR 8
+#define GEN_MAX_WEIGHT 1000
+#define GEN_BLOCK_EDGES 65536
+#define GEN_MAX_SCALE 30
+
+typedef enum { GEN_UNIFORM, GEN_RMAT, GEN_GRID } graph_family;
+
+//One step of splitmix64; also how callers derive their own seeded streams.
+static inline cl_ulong gen_next(cl_ulong *state) {
+  cl_ulong z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30))*0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27))*0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+//Parses "uniform", "rmat" or "grid".  Returns 0 or -1.
+int parse_family(const char *name, graph_family *family);
+const char *family_name(graph_family family);
+
+//Fills g like load_dimacs would (in-edge CSR, groups sorted by source);
+//grid graphs also get coords.  Returns 0, or -1 for a scale out of range.
+int generate_graph(thread_pool *pool, graph_family family, cl_uint scale,
+		   cl_uint edge_factor, cl_ulong seed, graph *g);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "sssp.h"
+
+/*
+ * Indexed binary min-heap of vertices for the Dijkstra-style searches.  The
+ * keys live in the caller's array, so the same heap serves plain distances
+ * (johnson) and distance plus a bound (p2p).  slot[v] is v's place in the
+ * heap, or NOT_QUEUED; it starts all NOT_QUEUED.
+ */
+
+#define NOT_QUEUED CL_UINT_MAX
+
+typedef struct _dijkstra_heap {
+  cl_uint *heap;
+  cl_uint *slot;
+  cl_uint size;
+  cl_ulong edges_scanned;
+} dijkstra_heap;
+
+static inline void sift_up(dijkstra_heap *h, const cl_float *key, cl_uint at) {
+  cl_uint v = h->heap[at];
+  while(at > 0) {
+    cl_uint parent = (at - 1)/2;
+    if(!(key[v] < key[h->heap[parent]]))
+      break;
+    h->heap[at] = h->heap[parent];
+    h->slot[h->heap[at]] = at;
+    at = parent;
+  }
+  h->heap[at] = v;
+  h->slot[v] = at;
+}
+
+//Queues v, or moves it up after its key went down.
+static inline void decrease_key(dijkstra_heap *h, const cl_float *key, cl_uint v) {
+  if(h->slot[v] == NOT_QUEUED) {
+    h->heap[h->size] = v;
+    h->slot[v] = h->size++;
+  }
+  sift_up(h, key, h->slot[v]);
+}
+
+static inline void sift_down(dijkstra_heap *h, const cl_float *key, cl_uint at) {
+  cl_uint v = h->heap[at];
+  for(;;) {
+    cl_uint child = 2*at + 1;
+    if(child >= h->size)
+      break;
+    if(child + 1 < h->size && key[h->heap[child + 1]] < key[h->heap[child]])
+      child++;
+    if(!(key[h->heap[child]] < key[v]))
+      break;
+    h->heap[at] = h->heap[child];
+    h->slot[h->heap[at]] = at;
+    at = child;
+  }
+  h->heap[at] = v;
+  h->slot[v] = at;
+}
+
+//Queues v, or moves it either way after its key changed.
+static inline void update_key(dijkstra_heap *h, const cl_float *key, cl_uint v) {
+  decrease_key(h, key, v);
+  sift_down(h, key, h->slot[v]);
+}
+
+static inline cl_uint pop_min(dijkstra_heap *h, const cl_float *key) {
+  cl_uint top = h->heap[0];
+  h->slot[top] = NOT_QUEUED;
+  if(--h->size == 0)
+    return top;
+  h->heap[0] = h->heap[h->size];
+  sift_down(h, key, 0);
+  return top;
+}
+
+#endif
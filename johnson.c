@@ -0,0 +1,147 @@
+#include "johnson.h"
+#include "cpu_sssp.h"
+#include "opencl_sssp.h"
+#include "heap.h"
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _johnson_ctx {
+  graph *g;
+  const cl_float *potentials;
+  cl_float *weights;            //Reweighted out-edges, parallel to g->out_edges.
+  cl_uint first;                //Source of row 0 of this chunk.
+  cl_float *distances;          //rows x num_vertices
+  cl_uint *preds;
+  dijkstra_heap *heaps;
+} johnson_ctx;
+
+static void dijkstra(johnson_ctx *ctx, dijkstra_heap *h, cl_uint source,
+		     cl_float *distances, cl_uint *preds) {
+  graph *g = ctx->g;
+  cl_uint n = g->num_vertices, v, i;
+  for(v = 0; v < n; v++) {
+    distances[v] = INFINITY;
+    preds[v] = v;
+  }
+  distances[source] = 0;
+  h->heap[0] = source;
+  h->slot[source] = 0;
+  h->size = 1;
+  while(h->size) {
+    cl_uint u = pop_min(h, distances);
+    cl_float du = distances[u];
+    cl_uint first = g->out_vertices[u].index;
+    cl_uint last = first + g->out_vertices[u].num_edges;
+    h->edges_scanned += last - first;
+    for(i = first; i < last; i++) {
+      cl_float nd = du + ctx->weights[i];
+      v = g->out_edges[i].dest;
+      if(nd < distances[v]) {
+	distances[v] = nd;
+	preds[v] = u;
+	decrease_key(h, distances, v);
+      }
+    }
+  }
+  //Undo the reweighting: d(s,v) = d'(s,v) - h(s) + h(v).
+  for(v = 0; v < n; v++)
+    if(distances[v] < INFINITY)
+      distances[v] += ctx->potentials[v] - ctx->potentials[source];
+}
+
+static void dijkstra_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  johnson_ctx *ctx = (johnson_ctx *)arg;
+  size_t n = ctx->g->num_vertices;
+  cl_uint r;
+  for(r = begin; r < end; r++)
+    dijkstra(ctx, &ctx->heaps[worker], ctx->first + r, ctx->distances + r*n, ctx->preds + r*n);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//The potentials come out of Bellman-Ford in floats, so a reweighted edge on
+//a tight path can round to just below zero; Dijkstra needs it at zero.
+static cl_float *reweight(graph *g, const cl_float *potentials) {
+  cl_float *weights = (cl_float *)malloc(sizeof(cl_float)*(g->num_edges ? g->num_edges : 1));
+  cl_uint u, i;
+  if(!weights) {
+    problem("Failed to allocate the reweighted edges.\n");
+    exit(-1);
+  }
+  for(u = 0; u < g->num_vertices; u++) {
+    vertex node = g->out_vertices[u];
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      cl_float w = g->out_edges[i].weight + potentials[u] - potentials[g->out_edges[i].dest];
+      weights[i] = w > 0 ? w : 0;
+    }
+  }
+  return weights;
+}
+
+int johnson_apsp(thread_pool *pool, opencl_env *env, graph *g, cl_uint batch,
+		 johnson_row_fn emit, void *arg, sssp_stats *stats) {
+  cl_uint n = g->num_vertices, workers = thread_pool_size(pool);
+  cl_uint chunk = workers*JOHNSON_ROWS_PER_WORKER, first, r, w;
+  cl_float *potentials = (cl_float *)malloc(sizeof(cl_float)*(n ? n : 1));
+  sssp_stats bf;
+  johnson_ctx ctx;
+
+  if(env)
+    opencl_potentials(env, g, batch, potentials, &bf);
+  else
+    cpu_potentials(pool, g, potentials, &bf);
+  if(bf.rounds > n + 1) {
+    problem("The graph has a negative cycle; shortest paths are undefined.\n");
+    free(potentials);
+    return -1;
+  }
+
+  if(chunk > n)
+    chunk = n ? n : 1;
+  ctx.g = g;
+  ctx.potentials = potentials;
+  ctx.weights = reweight(g, potentials);
+  ctx.distances = (cl_float *)malloc(sizeof(cl_float)*(size_t)chunk*n);
+  ctx.preds = (cl_uint *)malloc(sizeof(cl_uint)*(size_t)chunk*n);
+  ctx.heaps = (dijkstra_heap *)malloc(sizeof(dijkstra_heap)*workers);
+  if(!ctx.distances || !ctx.preds || !ctx.heaps) {
+    problem("Failed to allocate %u rows of %u vertices.\n", chunk, n);
+    exit(-1);
+  }
+  for(w = 0; w < workers; w++) {
+    ctx.heaps[w].heap = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+    ctx.heaps[w].slot = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+    if(!ctx.heaps[w].heap || !ctx.heaps[w].slot) {
+      problem("Failed to allocate the Dijkstra heaps.\n");
+      exit(-1);
+    }
+    for(r = 0; r < n; r++)
+      ctx.heaps[w].slot[r] = NOT_QUEUED;
+    ctx.heaps[w].edges_scanned = 0;
+  }
+
+  for(first = 0; first < n; first += chunk) {
+    cl_uint rows = n - first < chunk ? n - first : chunk;
+    ctx.first = first;
+    thread_pool_for(pool, 0, rows, 1, dijkstra_range, &ctx);
+    for(r = 0; r < rows; r++)
+      emit(arg, first + r, ctx.distances + (size_t)r*n, ctx.preds + (size_t)r*n);
+  }
+
+  if(stats) {
+    stats->rounds = bf.rounds;
+    stats->edges_scanned = bf.edges_scanned;
+    for(w = 0; w < workers; w++)
+      stats->edges_scanned += ctx.heaps[w].edges_scanned;
+  }
+  for(w = 0; w < workers; w++) {
+    free(ctx.heaps[w].heap);
+    free(ctx.heaps[w].slot);
+  }
+  free(ctx.heaps);
+  free(ctx.distances);
+  free(ctx.preds);
+  free(ctx.weights);
+  free(potentials);
+  return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef JOHNSON_H
+#define JOHNSON_H
+
+#include "sssp.h"
+#include "threadpool.h"
+
+/*
+ * Sparse all-pairs shortest paths by Johnson's algorithm.  One Bellman-Ford
+ * pass from a virtual source gives potentials h with w(u,v) + h(u) - h(v) >= 0
+ * on every edge; then each vertex runs Dijkstra over the reweighted out-edge
+ * CSR and shifts its row back.  Sources are taken JOHNSON_ROWS_PER_WORKER per
+ * worker at a time, and finished rows are handed to emit in source order, so
+ * only that many rows are ever held rather than the n x n matrix.
+ */
+
+#define JOHNSON_ROWS_PER_WORKER 4
+
+//Called once per source, in order, with that source's distances and preds.
+typedef void (*johnson_row_fn)(void *arg, cl_uint source, const cl_float *distances,
+			       const cl_uint *preds);
+
+//Needs build_out_edges(g).  The potentials run on env when it is not NULL,
+//the Dijkstra passes always on the pool.  Returns 0, or -1 when the graph
+//has a negative cycle.
+int johnson_apsp(thread_pool *pool, opencl_env *env, graph *g, cl_uint batch,
+		 johnson_row_fn emit, void *arg, sssp_stats *stats);
+
+#endif
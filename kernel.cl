@@ -2,14 +2,40 @@
 #define LWST2 64
 #define MOD2 30
 #define HALF_WARP 16
+#define GROUP_WORK_SIZE 256
 #define MIN(a,b) ((a) > (b) ? (b) : (a))
 
+//Traced runs build with -DCOUNT_UPDATES: the sweep's update flag then
+//counts the vertices that improved instead of just going to 1.
+#ifdef COUNT_UPDATES
+#define MARK_UPDATE(update, slot) atomic_inc(&(update)[slot])
+#else
+#define MARK_UPDATE(update, slot) ((update)[slot] = 1)
+#endif
+
 typedef struct _edge {
   uint source;
   uint dest;
   float weight;
 } __attribute__ ((aligned (16))) edge;
 
+//The host builds with -DWIDE_EDGES to benchmark the old 16-byte layout;
+//otherwise in-edges carry only their source and out-edges only their dest.
+#ifdef WIDE_EDGES
+typedef edge in_edge;
+typedef edge out_edge;
+#else
+typedef struct _in_edge {
+  uint source;
+  float weight;
+} in_edge;
+
+typedef struct _out_edge {
+  uint dest;
+  float weight;
+} out_edge;
+#endif
+
 typedef struct _vertex {
   uint num_edges;
   uint index;
@@ -26,22 +52,37 @@ inline void LoadGlobalToLocali(uint __global *g, uint __local *l, uint width, ui
   l[id] = (id < width) ? g[id] : 0;
 }
 
-__kernel void InitDistances(__global float *distances)
+//Work queues are lists with a flag per vertex that is set while the vertex
+//is queued: whoever flips it appends the vertex, so each is listed once, and
+//the consumer clears it again as it takes the vertex off.
+inline void Enqueue(__global uint *flags, __global uint *list, __global uint *size, uint v) {
+  if(!atomic_xchg(&flags[v], 1))
+    list[atomic_inc(size)] = v;
+}
+
+__kernel void InitDistances(__global float *distances,
+			    __global uint *preds,
+			    uint source,
+			    uint num_vertices)
 {
   uint thread_id = get_global_id(0);
-  if(thread_id != 16)
-    distances[thread_id] = INFINITY;
+  if(thread_id < num_vertices) {
+    distances[thread_id] = thread_id == source ? 0 : INFINITY;
+    preds[thread_id] = thread_id;
+  }
 }
 
 
 __kernel void UpdateVertex(
-			   __global edge *edges,
+			   __global in_edge *edges,
 			   __global float *distances,
 			   __global uint *preds,
 			   __global vertex *vertices,
 			   __global uint *update,
 			   uint num_vertices,
-			   uint num_edges
+			   uint num_edges,
+			   uint slot,
+			   float bound
 )
 {
   uint start = get_group_id(0) * LOCAL_WORK_SIZE;
@@ -49,23 +90,21 @@ __kernel void UpdateVertex(
   uint gid = get_global_id(0);
   uint __local current_edge[LOCAL_WORK_SIZE];
   int __local remaining_edges[LOCAL_WORK_SIZE];
-  edge __local work[LOCAL_WORK_SIZE][HALF_WARP+1];
+  in_edge __local work[LOCAL_WORK_SIZE][HALF_WARP+1];
   vertex __local nodes[LOCAL_WORK_SIZE];
   int loading_id = local_id;
   uint offset = 0;
   uint i;
   float min;
   uint pred;
-  bool __local did_update = 0;
-  bool __local done = 0;
-  if(gid == 0) update[0] = 0;
+  bool did_update = 0;
+  bool __local done;
   if(local_id >= HALF_WARP) {
     loading_id = local_id - (HALF_WARP);
     offset = 1;
   }
   if(gid < num_vertices) {
     nodes[local_id] = vertices[gid];
-    barrier(CLK_LOCAL_MEM_FENCE);
     remaining_edges[local_id] = nodes[local_id].num_edges;
     current_edge[local_id] = nodes[local_id].index;
     min = distances[start+local_id];
@@ -74,6 +113,8 @@ __kernel void UpdateVertex(
     remaining_edges[local_id] = 0;
     min = INFINITY;
   }
+  if(local_id == 0)
+    done = 0;
   barrier(CLK_LOCAL_MEM_FENCE);
   while(!done) {
     for(i = 0; i < LOCAL_WORK_SIZE; i += 2) {
@@ -82,12 +123,13 @@ __kernel void UpdateVertex(
       }
     }
     barrier(CLK_LOCAL_MEM_FENCE);
-    uint max = MIN(HALF_WARP,remaining_edges[local_id]);
+    //A vertex that ran out of edges in an earlier tile has gone negative.
+    uint max = remaining_edges[local_id] > 0 ? MIN(HALF_WARP,remaining_edges[local_id]) : 0;
     for(i = 0; i < max; i++) {
       float temp = distances[work[local_id][i].source];
       if(temp < INFINITY) {
 	temp = work[local_id][i].weight + temp;
-	if(min > temp) {
+	if(min > temp && temp <= bound) {
 	    did_update = 1;
 	    min = temp;
 	    pred = work[local_id][i].source;
@@ -98,6 +140,7 @@ __kernel void UpdateVertex(
     remaining_edges[local_id] -= HALF_WARP;
     if(local_id == 0)
       done = 1;
+    barrier(CLK_LOCAL_MEM_FENCE);
     if(remaining_edges[local_id] > 0)
       done = 0;
     barrier(CLK_LOCAL_MEM_FENCE);
@@ -105,66 +148,735 @@ __kernel void UpdateVertex(
   if(did_update) {
     distances[start+local_id] = min;
     preds[start+local_id] = pred;
-    if(local_id == 0) update[0] = 1;
-  }
-}
-
-#define BLOCK_SIZE 16
-#define index(y, x, the_size) (y*the_size + x)
-
-void __kernel matrix_product(
-			    float __global *matrix,
-			    float __global *results,
-			    uint __global *preds,
-			    int size
-			     ) { 
-  //left matrix is shared_size x height, right matrix is width x shared_size
-  float __local  l_block[BLOCK_SIZE][BLOCK_SIZE], r_block[BLOCK_SIZE][BLOCK_SIZE+1];
-  int __local pr_block[BLOCK_SIZE][BLOCK_SIZE];
-  //The l_block matrix is padded because we will access its elements column wise.
-  //Padding the r_block matrix is unnecessary, since its elements are only accessed by row
-  int i, j, blockR, blockC, r, c;
-  blockC = get_group_id(0) * BLOCK_SIZE;
-  blockR = get_group_id(1) * BLOCK_SIZE;
-  c = get_local_id(0);
-  r = get_local_id(1);
-  float weight;
-  int pred = preds[index(get_global_id(1), get_global_id(0), size)];
-  weight = INFINITY;
-
-
-  for(i = 0; i*BLOCK_SIZE < size; i++) { //try using a variable to store shared_size/16?
-    //load subblock into local memory
-    /*
-    left += BLOCK_SIZE;
-    right += size*BLOCK_SIZE;
-    l_block[r][c] = 
-      matrix[left + r*size + c];
-
-    r_block[r][c] = 
-    matrix[right + r*size + c];*/
-    l_block[r][c] = 
-      *(matrix + (blockR+r)*size + (i * BLOCK_SIZE) + c);
-    r_block[r][c] = 
-      *(matrix + blockC + (i * size * BLOCK_SIZE) + r*size + c);
-    pr_block[r][c] = 
-      *(preds + blockC + (i * size * BLOCK_SIZE) + r*size + c);
-    
+    MARK_UPDATE(update, slot);
+  }
+}
+
+//Binned schedule (see plan_sweep).  UpdateVertex runs a work-group until its
+//biggest vertex is done, so one hub idles the other 31 work-items.  Here
+//low-degree vertices get a work-item each from a list...
+__kernel void UpdateVertexList(
+			       __global in_edge *edges,
+			       __global float *distances,
+			       __global uint *preds,
+			       __global vertex *vertices,
+			       __global uint *update,
+			       __global uint *list,
+			       uint count,
+			       uint slot,
+			       float bound
+)
+{
+  uint id = get_global_id(0);
+  uint i;
+  if(id >= count)
+    return;
+  uint v = list[id];
+  vertex node = vertices[v];
+  float min = distances[v];
+  uint pred = preds[v];
+  bool did_update = 0;
+  for(i = node.index; i < node.index + node.num_edges; i++) {
+    in_edge e = edges[i];
+    float temp = distances[e.source];
+    if(temp < INFINITY) {
+      temp = e.weight + temp;
+      if(min > temp && temp <= bound) {
+	min = temp;
+	pred = e.source;
+	did_update = 1;
+      }
+    }
+  }
+  if(did_update) {
+    distances[v] = min;
+    preds[v] = pred;
+    MARK_UPDATE(update, slot);
+  }
+}
+
+//...and the rest a whole work-group each, which strides over the in-edges
+//and reduces to the best one.  The local size is a power of two, at most
+//GROUP_WORK_SIZE.
+__kernel void UpdateVertexGroup(
+				__global in_edge *edges,
+				__global float *distances,
+				__global uint *preds,
+				__global vertex *vertices,
+				__global uint *update,
+				__global uint *list,
+				uint count,
+				uint slot,
+				float bound
+)
+{
+  uint local_id = get_local_id(0);
+  uint size = get_local_size(0);
+  uint v = list[get_group_id(0)];
+  vertex node = vertices[v];
+  float __local best[GROUP_WORK_SIZE];
+  uint __local best_pred[GROUP_WORK_SIZE];
+  float min = INFINITY;
+  uint pred = v;
+  uint i;
+  for(i = node.index + local_id; i < node.index + node.num_edges; i += size) {
+    in_edge e = edges[i];
+    float temp = distances[e.source] + e.weight;
+    if(min > temp && temp <= bound) {
+      min = temp;
+      pred = e.source;
+    }
+  }
+  best[local_id] = min;
+  best_pred[local_id] = pred;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(i = size/2; i > 0; i >>= 1) {
+    if(local_id < i && best[local_id + i] < best[local_id]) {
+      best[local_id] = best[local_id + i];
+      best_pred[local_id] = best_pred[local_id + i];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if(local_id == 0 && best[0] < distances[v]) {
+    distances[v] = best[0];
+    preds[v] = best_pred[0];
+    MARK_UPDATE(update, slot);
+  }
+}
+
+//Batched queries.  distances and preds are num_vertices x num_sources,
+//row-major by vertex, so a vertex's row is contiguous.
+__kernel void InitDistancesBatch(__global float *distances,
+				 __global uint *preds,
+				 __global uint *sources,
+				 uint num_sources,
+				 uint num_vertices)
+{
+  size_t cell = get_global_id(0);
+  if(cell < (size_t)num_vertices*num_sources) {
+    uint v = cell / num_sources;
+    distances[cell] = v == sources[cell % num_sources] ? 0 : INFINITY;
+    preds[cell] = v;
+  }
+}
+
+//One work-item per vertex: each in-edge is fetched once and relaxed against
+//the source's whole row.  Only v's owner writes v's row.
+__kernel void UpdateVertexBatch(
+				__global in_edge *edges,
+				__global float *distances,
+				__global uint *preds,
+				__global vertex *vertices,
+				__global uint *update,
+				uint num_vertices,
+				uint num_sources,
+				uint slot
+)
+{
+  uint v = get_global_id(0);
+  uint i, b;
+  bool did_update = 0;
+  if(v >= num_vertices)
+    return;
+  vertex node = vertices[v];
+  __global float *row = distances + (size_t)v*num_sources;
+  __global uint *pred_row = preds + (size_t)v*num_sources;
+  for(i = node.index; i < node.index + node.num_edges; i++) {
+    in_edge e = edges[i];
+    __global float *from = distances + (size_t)e.source*num_sources;
+    for(b = 0; b < num_sources; b++) {
+      float temp = from[b] + e.weight;
+      if(row[b] > temp) {
+	row[b] = temp;
+	pred_row[b] = e.source;
+	did_update = 1;
+      }
+    }
+  }
+  if(did_update)
+    MARK_UPDATE(update, slot);
+}
+
+//Frontier mode.  One work-item per active vertex pulls over its in-edges as
+//UpdateVertex does; on a change it queues its out-neighbours for the next
+//round.  v clears its flag before it reads anything, so a neighbour that
+//changes after that point queues it once more.  Every vertex whose distance
+//changes is also listed once in touched_list, so a repair reads back only
+//those.
+__kernel void UpdateFrontier(
+			     __global in_edge *edges,
+			     __global float *distances,
+			     __global uint *preds,
+			     __global vertex *vertices,
+			     __global out_edge *out_edges,
+			     __global vertex *out_vertices,
+			     __global uint *active,
+			     uint active_size,
+			     __global uint *flags,
+			     __global uint *scanned,
+			     uint expand,
+			     float bound,
+			     __global uint *next,
+			     __global uint *next_size,
+			     __global uint *touched,
+			     __global uint *touched_list,
+			     __global uint *touched_size
+)
+{
+  uint gid = get_global_id(0);
+  uint i;
+  if(gid >= active_size)
+    return;
+  uint v = active[gid];
+  atomic_xchg(&flags[v], 0);
+  vertex node = vertices[v];
+  float min = distances[v];
+  uint pred = preds[v];
+  bool did_update = 0;
+  for(i = node.index; i < node.index + node.num_edges; i++) {
+    float temp = distances[edges[i].source];
+    if(temp < INFINITY) {
+      temp = edges[i].weight + temp;
+      if(min > temp && temp <= bound) {
+	did_update = 1;
+	min = temp;
+	pred = edges[i].source;
+      }
+    }
+  }
+  if(!did_update) {
+    atomic_add(scanned, node.num_edges);
+    return;
+  }
+  distances[v] = min;
+  preds[v] = pred;
+  Enqueue(touched, touched_list, touched_size, v);
+  //Without expand the next round pushes from v rather than pulling into
+  //its out-neighbours.
+  if(!expand) {
+    Enqueue(flags, next, next_size, v);
+    atomic_add(scanned, node.num_edges);
+    return;
+  }
+  node = out_vertices[v];
+  for(i = node.index; i < node.index + node.num_edges; i++)
+    Enqueue(flags, next, next_size, out_edges[i].dest);
+  atomic_add(scanned, vertices[v].num_edges + node.num_edges);
+}
+
+//Push rounds: the vertices that changed scatter over their out-edges and
+//queue whatever they improve.  Non-negative float distances order like
+//their bit patterns, so atomic_min on the uint view is an atomic float min.
+//With 64-bit atomics the distance bits and the source go into one ulong
+//instead, so the distance and its pred are won together (ties to the lower
+//source); SettleChanged copies them back into distances/preds.  Without,
+//distances are lowered in place and ResolvePreds fixes the preds once the
+//run is over.
+#ifdef PACKED_ATOMICS
+#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable
+#pragma OPENCL EXTENSION cl_khr_int64_extended_atomics : enable
+#define NO_BEST 0xffffffffffffffffUL
+#endif
+
+__kernel void PushFrontier(
+			   __global out_edge *out_edges,
+			   __global vertex *out_vertices,
+			   __global float *distances,
+			   __global ulong *best,
+			   __global uint *active,
+			   uint active_size,
+			   __global uint *flags,
+			   __global uint *scanned,
+			   float bound,
+			   __global uint *next,
+			   __global uint *next_size
+)
+{
+  uint gid = get_global_id(0);
+  uint i;
+  if(gid >= active_size)
+    return;
+  uint u = active[gid];
+  float du = distances[u];
+  vertex node = out_vertices[u];
+  for(i = node.index; i < node.index + node.num_edges; i++) {
+    uint v = out_edges[i].dest;
+    if(du + out_edges[i].weight > bound)
+      continue;
+    uint nd = as_uint(du + out_edges[i].weight);
+#ifdef PACKED_ATOMICS
+    //distances only change in SettleChanged, so this read is stable.
+    if(nd < as_uint(distances[v])) {
+      ulong packed = ((ulong)nd << 32) | u;
+      if(atom_min(&best[v], packed) > packed)
+	Enqueue(flags, next, next_size, v);
+    }
+#else
+    if(atomic_min((volatile __global uint *)&distances[v], nd) > nd)
+      Enqueue(flags, next, next_size, v);
+#endif
+  }
+  atomic_add(scanned, node.num_edges);
+}
+
+//Takes the queue of changed vertices that the next round pushes from:
+//clears their flags, settles the packed distance/pred each won (leaving
+//best at NO_BEST again) and adds up their out-degrees into frontier_edges
+//for the push/pull choice.
+__kernel void SettleChanged(
+			    __global uint *flags,
+			    __global uint *list,
+			    uint count,
+			    __global vertex *out_vertices,
+			    __global uint *frontier_edges,
+			    __global float *distances,
+			    __global uint *preds,
+			    __global ulong *best,
+			    __global uint *touched,
+			    __global uint *touched_list,
+			    __global uint *touched_size
+)
+{
+  uint gid = get_global_id(0);
+  if(gid >= count)
+    return;
+  uint v = list[gid];
+  flags[v] = 0;
+#ifdef PACKED_ATOMICS
+  ulong packed = best[v];
+  best[v] = NO_BEST;
+  if(packed != NO_BEST && (uint)(packed >> 32) < as_uint(distances[v])) {
+    distances[v] = as_float((uint)(packed >> 32));
+    preds[v] = (uint)packed;
+  }
+#endif
+  Enqueue(touched, touched_list, touched_size, v);
+  atomic_add(frontier_edges, out_vertices[v].num_edges);
+}
+
+//Turns a push frontier back into the pull candidates it would reach.
+__kernel void ExpandFrontier(
+			     __global out_edge *out_edges,
+			     __global vertex *out_vertices,
+			     __global uint *active,
+			     uint active_size,
+			     __global uint *flags,
+			     __global uint *next,
+			     __global uint *next_size
+)
+{
+  uint gid = get_global_id(0);
+  uint i;
+  if(gid >= active_size)
+    return;
+  vertex node = out_vertices[active[gid]];
+  for(i = node.index; i < node.index + node.num_edges; i++)
+    Enqueue(flags, next, next_size, out_edges[i].dest);
+}
+
+//Flags the count vertices of a queue that did not come through Enqueue
+//(the seeds of a run), so UpdateFrontier clears them like any other.
+__kernel void FlagQueued(
+			 __global uint *flags,
+			 __global const uint *list,
+			 uint count
+)
+{
+  uint gid = get_global_id(0);
+  if(gid < count)
+    flags[list[gid]] = 1;
+}
+
+//Repair readback: the distances and preds of the vertices in touched_list,
+//clearing their touched marks for the next repair.
+__kernel void GatherTouched(
+			    __global float *distances,
+			    __global uint *preds,
+			    __global uint *touched,
+			    __global const uint *list,
+			    uint count,
+			    __global float *values,
+			    __global uint *pred_values
+)
+{
+  uint gid = get_global_id(0);
+  if(gid >= count)
+    return;
+  uint v = list[gid];
+  touched[v] = 0;
+  values[gid] = distances[v];
+  pred_values[gid] = preds[v];
+}
+
+//Partitioned sweep: copies out the owned distances other partitions keep
+//as halo, so only those cross to the host between rounds.
+__kernel void GatherDistances(
+			      __global float *distances,
+			      __global const uint *list,
+			      __global float *values,
+			      uint count
+)
+{
+  uint gid = get_global_id(0);
+  if(gid < count)
+    values[gid] = distances[list[gid]];
+}
+
+//Incremental repair.  slots holds num_in in-edge indices, then num_out
+//out-edge indices, each with its new weight.
+__kernel void PatchEdges(
+			 __global in_edge *edges,
+			 __global out_edge *out_edges,
+			 __global const uint *slots,
+			 __global const float *weights,
+			 uint num_in,
+			 uint num_out
+)
+{
+  uint gid = get_global_id(0);
+  if(gid < num_in)
+    edges[slots[gid]].weight = weights[gid];
+  else if(gid < num_in + num_out)
+    out_edges[slots[gid]].weight = weights[gid];
+}
+
+//Drops the vertices whose tree path got longer back to unreached.
+__kernel void ResetVertices(
+			    __global float *distances,
+			    __global uint *preds,
+			    __global const uint *list,
+			    uint count
+)
+{
+  uint gid = get_global_id(0);
+  if(gid < count) {
+    uint v = list[gid];
+    distances[v] = INFINITY;
+    preds[v] = v;
+  }
+}
+
+//Delta-stepping.  Distances only ever shrink, so a CAS loop on the bit
+//pattern gives an atomic float min; preds are resolved once at the end.
+//The buckets are queues: frontier holds the current bucket and next what
+//light edges add back to it; far lists every vertex improved into a later
+//bucket, once while its far flag is set, and removed every vertex taken out
+//of the current one.  A vertex leaves the buckets once, so removed flags are
+//never cleared.  Choosing the next bucket only looks at far.
+inline bool AtomicMinDistance(__global float *d, float val) {
+  float cur = *d;
+  while(val < cur) {
+    uint prev = atomic_cmpxchg((volatile __global uint *)d, as_uint(cur), as_uint(val));
+    if(prev == as_uint(cur))
+      return true;
+    cur = as_float(prev);
+  }
+  return false;
+}
+
+inline uint BucketOf(float d, float delta) {
+  float b = d / delta;
+  return b < 4294967040.0f ? (uint)b : 0xfffffffe;
+}
+
+__kernel void RelaxLight(
+			 __global out_edge *out_edges,
+			 __global vertex *out_vertices,
+			 __global uint *light,
+			 __global float *distances,
+			 __global uint *frontier,
+			 uint frontier_size,
+			 uint bucket,
+			 float delta,
+			 __global uint *next_flags,
+			 __global uint *far_flags,
+			 __global uint *removed_flags,
+			 __global uint *scanned,
+			 float bound,
+			 __global uint *next,
+			 __global uint *next_size,
+			 __global uint *far,
+			 __global uint *far_size,
+			 __global uint *removed,
+			 __global uint *removed_size
+)
+{
+  uint gid = get_global_id(0);
+  uint i;
+  if(gid >= frontier_size)
+    return;
+  uint u = frontier[gid];
+  atomic_xchg(&next_flags[u], 0);
+  float du = distances[u];
+  if(BucketOf(du, delta) != bucket)
+    return;
+  Enqueue(removed_flags, removed, removed_size, u);
+  vertex node = out_vertices[u];
+  for(i = node.index; i < node.index + light[u]; i++) {
+    float nd = du + out_edges[i].weight;
+    uint v = out_edges[i].dest;
+    if(nd <= bound && AtomicMinDistance(&distances[v], nd)) {
+      if(BucketOf(nd, delta) == bucket)
+	Enqueue(next_flags, next, next_size, v);
+      else
+	Enqueue(far_flags, far, far_size, v);
+    }
+  }
+  atomic_add(scanned, light[u]);
+}
+
+__kernel void RelaxHeavy(
+			 __global out_edge *out_edges,
+			 __global vertex *out_vertices,
+			 __global uint *light,
+			 __global float *distances,
+			 __global uint *removed,
+			 uint removed_size,
+			 __global uint *far_flags,
+			 __global uint *scanned,
+			 float bound,
+			 __global uint *far,
+			 __global uint *far_size
+)
+{
+  uint gid = get_global_id(0);
+  uint i;
+  if(gid >= removed_size)
+    return;
+  uint u = removed[gid];
+  float du = distances[u];
+  vertex node = out_vertices[u];
+  for(i = node.index + light[u]; i < node.index + node.num_edges; i++) {
+    float nd = du + out_edges[i].weight;
+    if(nd <= bound && AtomicMinDistance(&distances[out_edges[i].dest], nd))
+      Enqueue(far_flags, far, far_size, out_edges[i].dest);
+  }
+  atomic_add(scanned, node.num_edges - light[u]);
+}
+
+//Entries of far at or below the bucket just finished are stale: the vertex
+//was lowered into a bucket that has been emptied since.
+__kernel void MinBucket(
+			__global float *distances,
+			__global uint *far,
+			uint far_size,
+			float delta,
+			uint bucket,
+			__global uint *min_bucket
+)
+{
+  uint gid = get_global_id(0);
+  if(gid >= far_size)
+    return;
+  uint b = BucketOf(distances[far[gid]], delta);
+  if(b > bucket)
+    atomic_min(min_bucket, b);
+}
+
+//Moves far's entries in bucket into the frontier, keeps the later ones in
+//kept and drops the stale ones.
+__kernel void SelectBucket(
+			   __global float *distances,
+			   __global uint *far,
+			   uint far_size,
+			   float delta,
+			   uint bucket,
+			   __global uint *far_flags,
+			   __global uint *next_flags,
+			   __global uint *frontier,
+			   __global uint *frontier_size,
+			   __global uint *kept,
+			   __global uint *kept_size
+)
+{
+  uint gid = get_global_id(0);
+  if(gid >= far_size)
+    return;
+  uint v = far[gid];
+  uint b = BucketOf(distances[v], delta);
+  if(b > bucket) {
+    kept[atomic_inc(kept_size)] = v;
+    return;
+  }
+  far_flags[v] = 0;
+  if(b == bucket)
+    Enqueue(next_flags, frontier, frontier_size, v);
+}
+
+//Push-style runs only settle distances.  Preds are read off the tight edges
+//(d[u] + w == d[v]) afterwards, a level at a time outward from the source,
+//so that they form a tree even where zero-weight arcs tie vertices at equal
+//distance: whoever claims v first gives it its pred and queues it.
+__kernel void ResolvePreds(
+			   __global out_edge *out_edges,
+			   __global vertex *out_vertices,
+			   __global float *distances,
+			   __global uint *preds,
+			   __global uint *claimed,
+			   __global uint *frontier,
+			   uint frontier_size,
+			   __global uint *next,
+			   __global uint *next_size
+)
+{
+  uint gid = get_global_id(0);
+  uint i;
+  if(gid >= frontier_size)
+    return;
+  uint u = frontier[gid];
+  float du = distances[u];
+  vertex node = out_vertices[u];
+  for(i = node.index; i < node.index + node.num_edges; i++) {
+    uint v = out_edges[i].dest;
+    if(du + out_edges[i].weight == distances[v] && !atomic_xchg(&claimed[v], 1)) {
+      preds[v] = u;
+      next[atomic_inc(next_size)] = v;
+    }
+  }
+}
+
+//Blocked Floyd-Warshall, one APSP_BLOCK x APSP_BLOCK work-group per tile.
+//n is a multiple of APSP_BLOCK.  Round k runs FloydDiagonal, FloydRowColumn
+//and FloydRemaining in that order.
+#define APSP_BLOCK 16
+
+__kernel void FloydDiagonal(__global float *dist,
+			    __global uint *pred,
+			    uint n,
+			    uint k)
+{
+  float __local tile[APSP_BLOCK][APSP_BLOCK];
+  uint __local tile_pred[APSP_BLOCK][APSP_BLOCK];
+  uint r = get_local_id(1), c = get_local_id(0), t;
+  size_t at = (size_t)(k*APSP_BLOCK + r)*n + k*APSP_BLOCK + c;
+  tile[r][c] = dist[at];
+  tile_pred[r][c] = pred[at];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(t = 0; t < APSP_BLOCK; t++) {
+    float cand = tile[r][t] + tile[t][c];
+    uint p = tile_pred[t][c];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(cand < tile[r][c]) {
+      tile[r][c] = cand;
+      tile_pred[r][c] = p;
+    }
     barrier(CLK_LOCAL_MEM_FENCE);
-    
-    for(j = 0; j< BLOCK_SIZE; j++) {
-      int temp = l_block[r][j]+r_block[j][c];
-      if(temp < weight) {
-	weight = temp;
-	pred = pr_block[j][c];
+  }
+  dist[at] = tile[r][c];
+  pred[at] = tile_pred[r][c];
+}
+
+//Group (j, 0) is tile (k, j) in block row k, group (j, 1) tile (j, k) in
+//block column k; both relax through the finished diagonal tile.
+__kernel void FloydRowColumn(__global float *dist,
+			     __global uint *pred,
+			     uint n,
+			     uint k)
+{
+  float __local diag[APSP_BLOCK][APSP_BLOCK];
+  uint __local diag_pred[APSP_BLOCK][APSP_BLOCK];
+  float __local tile[APSP_BLOCK][APSP_BLOCK];
+  uint __local tile_pred[APSP_BLOCK][APSP_BLOCK];
+  uint j = get_group_id(0);
+  bool is_row = get_group_id(1) == 0;
+  uint r = get_local_id(1), c = get_local_id(0), t;
+  if(j == k)
+    return;
+  size_t diag_at = (size_t)(k*APSP_BLOCK + r)*n + k*APSP_BLOCK + c;
+  size_t at = is_row ? (size_t)(k*APSP_BLOCK + r)*n + j*APSP_BLOCK + c
+                     : (size_t)(j*APSP_BLOCK + r)*n + k*APSP_BLOCK + c;
+  diag[r][c] = dist[diag_at];
+  diag_pred[r][c] = pred[diag_at];
+  tile[r][c] = dist[at];
+  tile_pred[r][c] = pred[at];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for(t = 0; t < APSP_BLOCK; t++) {
+    float cand;
+    uint p;
+    if(is_row) {
+      cand = diag[r][t] + tile[t][c];
+      p = tile_pred[t][c];
+    } else {
+      cand = tile[r][t] + diag[t][c];
+      p = diag_pred[t][c];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(cand < tile[r][c]) {
+      tile[r][c] = cand;
+      tile_pred[r][c] = p;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  dist[at] = tile[r][c];
+  pred[at] = tile_pred[r][c];
+}
+
+//Every tile off block row and column k, relaxed through the finished tiles
+//(i, k) and (k, j).  Nothing here depends on this round's own writes.
+__kernel void FloydRemaining(__global float *dist,
+			     __global uint *pred,
+			     uint n,
+			     uint k)
+{
+  float __local column[APSP_BLOCK][APSP_BLOCK];
+  float __local row[APSP_BLOCK][APSP_BLOCK];
+  uint __local row_pred[APSP_BLOCK][APSP_BLOCK];
+  uint i = get_group_id(1), j = get_group_id(0);
+  uint r = get_local_id(1), c = get_local_id(0), t;
+  if(i == k || j == k)
+    return;
+  size_t at = (size_t)(i*APSP_BLOCK + r)*n + j*APSP_BLOCK + c;
+  size_t column_at = (size_t)(i*APSP_BLOCK + r)*n + k*APSP_BLOCK + c;
+  size_t row_at = (size_t)(k*APSP_BLOCK + r)*n + j*APSP_BLOCK + c;
+  column[r][c] = dist[column_at];
+  row[r][c] = dist[row_at];
+  row_pred[r][c] = pred[row_at];
+  barrier(CLK_LOCAL_MEM_FENCE);
+  float best = dist[at];
+  uint p = pred[at];
+  for(t = 0; t < APSP_BLOCK; t++) {
+    float cand = column[r][t] + row[t][c];
+    if(cand < best) {
+      best = cand;
+      p = row_pred[t][c];
+    }
+  }
+  dist[at] = best;
+  pred[at] = p;
+}
+
+//Out-of-core tiles (see apsp_tiled.h): dist = min(dist, column (x) row) for
+//n x n tiles in separate buffers, the path through t taking row's pred.
+//dist must not alias column or row.
+__kernel void FloydProduct(__global float *dist,
+			   __global uint *pred,
+			   __global const float *column,
+			   __global const float *row,
+			   __global const uint *row_pred,
+			   uint n)
+{
+  float __local a[APSP_BLOCK][APSP_BLOCK];
+  float __local b[APSP_BLOCK][APSP_BLOCK];
+  uint __local b_pred[APSP_BLOCK][APSP_BLOCK];
+  uint i = get_global_id(1), j = get_global_id(0);
+  uint r = get_local_id(1), c = get_local_id(0), k, t;
+  size_t at = (size_t)i*n + j;
+  float best = dist[at];
+  uint p = pred[at];
+  for(k = 0; k < n; k += APSP_BLOCK) {
+    a[r][c] = column[(size_t)i*n + k + c];
+    b[r][c] = row[(size_t)(k + r)*n + j];
+    b_pred[r][c] = row_pred[(size_t)(k + r)*n + j];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(t = 0; t < APSP_BLOCK; t++) {
+      float cand = a[r][t] + b[t][c];
+      if(cand < best) {
+	best = cand;
+	p = b_pred[t][c];
       }
     }
-    
-    //Make sure that we are done with the matrices stored in local memory before we enter the next iteration
-    barrier(CLK_LOCAL_MEM_FENCE); 
-  }
-  
-  results[get_global_id(1)*size + get_global_id(0)] = weight;
-  preds[get_global_id(1)*size + get_global_id(0)] = pred;
-  //preds[index(get_global_id(1), get_global_id(0), size)] = pred;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  dist[at] = best;
+  pred[at] = p;
 }
@@ -1,64 +1,31 @@
-#include <fcntl.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <math.h>
-#include <unistd.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <getopt.h>
-#include <time.h>
-#include <sys/time.h>
+#include "sssp.h"
+#include "cpu_sssp.h"
+#include "opencl_sssp.h"
+#include "dimacs.h"
+#include "csr_cache.h"
+#include "server.h"
+#include "apsp.h"
+#include "apsp_tiled.h"
+#include "johnson.h"
+#include "reorder.h"
+#include "generate.h"
+#include "bench.h"
+#include "trace.h"
+#include "repair.h"
+#include "program_cache.h"
+#include "partition.h"
+#include "result.h"
+#include "p2p.h"
+#include "ch.h"
 
 /*--------------------------------------------------------------------------------*/
 
-#ifdef __APPLE__
-    #include <OpenCL/opencl.h>
-    #include <mach/mach_time.h>
-    typedef uint64_t                    time_delta_t;
-    typedef mach_timebase_info_data_t   frequency_t;
-#else
-    #include <CL/cl.h>
-    typedef struct timeval              time_delta_t;
-    typedef double                      frequency_t;
-#endif
-
-/*--------------------------------------------------------------------------------*/
-
-typedef int (*Compare_fn)(const void *, const void *);
-typedef struct _edge {
-  cl_uint source;
-  cl_uint dest;
-  cl_float weight;
-}__attribute__ ((aligned (16))) edge;
-
-typedef struct _gpu_edge {
-  cl_uint source;
-  cl_float weight;
-} gpu_edge;
-
-typedef struct _vertex {
-  cl_uint num_edges;
-  cl_uint index;
-} vertex;
-
-
-
-#define PRINT
-//#define DOMM
-#define LOCAL_WORK_SIZE 32
-#define MAX_RANDOM_FLOAT 10
-#define DEFAULT_NUM_VERTICES 32
-#define DEFAULT_NUM_EDGES 16*DEFAULT_NUM_VERTICES
-
 #define DEFAULT_KERNEL_FILENAME ("kernel.cl")
-#define problem(...) fprintf(stderr, __VA_ARGS__)
-#define BAR "--------------------------------------------------------------------------------\n"
-#define PRINT_ROW_LENGTH 16
+#define DEFAULT_GRAPH_FILENAME ("NewYorkRM")
 
 /*--------------------------------------------------------------------------------*/
 
-static const char*
+const char*
 GetErrorString(cl_int error) {
     switch(error)
     {
@@ -103,6 +70,8 @@ GetErrorString(cl_int error) {
     case(CL_INVALID_BUFFER_SIZE):               return "Invalid buffer size!";
     case(CL_COMPILER_NOT_AVAILABLE):            return "Compiler not available!";
     case(CL_BUILD_PROGRAM_FAILURE):             return "Build failure!";
+    case(CL_DEVICE_PARTITION_FAILED):           return "Device partition failed!";
+    case(CL_INVALID_DEVICE_PARTITION_COUNT):    return "Invalid device partition count!";
     default:                                    return "Unknown error!";
     };
     return "Unknown error";
@@ -157,13 +126,13 @@ void printArray(cl_float *matrix, cl_int num) {
   int i,j;
   for(i = 0; i < num; i += PRINT_ROW_LENGTH) {
     for(j = 0; j < PRINT_ROW_LENGTH; j++) {
-      if(i+j > num)
+      if(i+j >= num)
 	break;
       printf("%4d ", i+j);
     }
     printf("\n");
     for(j = 0; j < PRINT_ROW_LENGTH; j++) {
-      if(i+j > num)
+      if(i+j >= num)
 	break;
       printf("%4.0f ", matrix[i+j]);
     }
@@ -176,13 +145,13 @@ void UIprintArray(cl_uint *matrix, cl_int num) {
   int i,j;
   for(i = 0; i < num; i += PRINT_ROW_LENGTH) {
     for(j = 0; j < PRINT_ROW_LENGTH; j++) {
-      if(i+j > num)
+      if(i+j >= num)
 	break;
       printf("%4d ", i+j);
     }
     printf("\n");
     for(j = 0; j < PRINT_ROW_LENGTH; j++) {
-      if(i+j > num)
+      if(i+j >= num)
 	break;
       printf("%4d ", matrix[i+j]);
     }
@@ -191,120 +160,138 @@ void UIprintArray(cl_uint *matrix, cl_int num) {
   }
 }
 
-void generate_graph(cl_uint *vertex_index, cl_uint *edge_count,
-		    cl_uint *edge_sources, float *edge_weights, cl_uint num_vertices, 
-		    cl_uint num_edges) 
-{
-  cl_uint edges_per_vertex = num_edges/num_vertices;
-  int n = 0;
-  cl_uint i, j;
-  srand(time(NULL));
-  for(i = 0; i < num_vertices; i++) {
-    vertex_index[i] = n;
-    for(j = 0; j < edges_per_vertex; j++) {
-      edge_sources[n+j] = rand() % num_vertices;
-      edge_weights[n+j] = rand() % 1000;
-    }
-    n += j;
-    edge_count[i] = j;
+//Groups a copy of the edges by source with a counting sort.
+void build_out_edges(graph *g) {
+  cl_uint i, n = g->num_vertices;
+  cl_uint *fill = (cl_uint *)calloc(n, sizeof(cl_uint));
+  g->out_vertices = (vertex *)calloc(n, sizeof(vertex));
+  g->out_edges = (edge *)malloc(sizeof(edge)*g->num_edges);
+  if(!fill || !g->out_vertices || !g->out_edges) {
+    problem("Failed to allocate the out-edge CSR.\n");
+    exit(-1);
   }
-  
+  for(i = 0; i < g->num_edges; i++)
+    g->out_vertices[g->edges[i].source].num_edges++;
+  for(i = 1; i < n; i++)
+    g->out_vertices[i].index = g->out_vertices[i-1].index + g->out_vertices[i-1].num_edges;
+  for(i = 0; i < g->num_edges; i++) {
+    cl_uint s = g->edges[i].source;
+    g->out_edges[g->out_vertices[s].index + fill[s]++] = g->edges[i];
+  }
+  free(fill);
 }
 
-void generate_graph2(cl_uint *vertex_index, cl_uint *edge_count,
-		    cl_uint *edge_sources, float *edge_weights, cl_uint num_vertices, 
-		    cl_uint num_edges) 
-{
-  cl_uint edges_per_vertex = num_edges/num_vertices;
-  int n = 0;
-  cl_uint i, j;
-  srand(time(NULL));
-  for(i = 0; i < num_vertices; i++) {
-    vertex_index[i] = n;
-    for(j = 0; j < edges_per_vertex; j++) {
-      edge_sources[n+j] = rand() % num_vertices;
-      edge_weights[n+j] = rand() % 1000;
-    }
-    n += j;
-    edge_count[i] = j;
+void free_graph(graph *g) {
+  free(g->edges);
+  free(g->vertices);
+  free(g->out_edges);
+  free(g->out_vertices);
+  if(g->mapping) {
+    munmap(g->mapping, g->mapping_size);
+  } else {
+    free(g->offsets);
+    free(g->packed_edges);
   }
+  free(g->coords);
+  free(g->new_ids);
+  free(g->old_ids);
+  memset(g, 0, sizeof(graph));
 }
 
-void print_edges(edge *edges, cl_uint num) {
-  cl_uint i,j;
-  for(i = 0; i < num; i += PRINT_ROW_LENGTH) {
-    for(j = 0; j < PRINT_ROW_LENGTH; j++) {
-      if(i+j >= num)
-	break;
-      printf("%7d     ", i+j);
-    }
-    printf("\n");
-    for(j = 0; j < PRINT_ROW_LENGTH; j++) {
-      if(i+j >= num)
-	break;
-      printf("%3u %3u %3.0f|", edges[i+j].dest, edges[i+j].source, edges[i+j].weight);
+//The first frontier round has to look at everything the source reaches
+//directly.  Writes the distinct out-neighbours of source and returns how many;
+//a mark per vertex keeps a hub's parallel arcs from costing O(degree^2).
+cl_uint seed_frontier(graph *g, cl_uint source, cl_uint *frontier) {
+  cl_uint i, count = 0;
+  vertex s = g->out_vertices[source];
+  cl_uchar *seen = (cl_uchar *)calloc(g->num_vertices ? g->num_vertices : 1, 1);
+  if(!seen) {
+    problem("Failed to allocate the frontier marks.\n");
+    exit(-1);
+  }
+  for(i = s.index; i < s.index + s.num_edges; i++) {
+    cl_uint dest = g->out_edges[i].dest;
+    if(!seen[dest]) {
+      seen[dest] = 1;
+      frontier[count++] = dest;
     }
-    printf("\n");
-    printf(BAR);
   }
+  free(seen);
+  return count;
 }
 
-int destcomp(const void *a, const void *b) {
-  edge *f = (edge *) a;
-  edge *s = (edge *) b;
-  return f->dest - s->dest;
+int has_negative_weights(graph *g) {
+  cl_uint i;
+  for(i = 0; i < g->num_edges; i++)
+    if(g->edges[i].weight < 0)
+      return 1;
+  return 0;
 }
 
-cl_uint graph_data_from_file(char *filename, edge **res){
-  FILE *file;
-  char buffer[256];
-  size_t i;
-  edge *edges;
-  file = fopen(filename, "r");
-  buffer[0] = '\0';
-
-  while(buffer[0] != 'a')
-    fgets(buffer, 256, file);
-  for(i = 1; fgets(buffer, 256, file); i++);
-  edges = (edge *)malloc(sizeof(edge)*i);
-  fseek(file, 0, SEEK_SET);
-  while(buffer[0] != 'a')
-    fgets(buffer, 256, file);
-  i = 0;
-  buffer[0] = '\0';
-  while(buffer[0] != 'a')
-    fgets(buffer, 256, file);
-  do {
-    sscanf(buffer, "a %u %u %f", &(edges[i].dest), &(edges[i].source), &(edges[i].weight));
-    edges[i].dest -= 1;
-    edges[i].source -= 1;
-    i++;
-  } while(fgets(buffer, 256, file));
-  mergesort(edges, i, sizeof(edge), destcomp);
-  *res = edges;
-  return i;
+static int floatcomp(const void *a, const void *b) {
+  cl_float f = *(const cl_float *)a, s = *(const cl_float *)b;
+  return (f > s) - (f < s);
 }
 
-cl_uint build_vertex_array(edge *edges, cl_uint edge_count, vertex **v) {
-  cl_uint max = edges[edge_count - 1].dest;
-  vertex *vertices = (vertex *)malloc(sizeof(vertex)*max);
-  cl_uint i,j, last = 0;
-  j = 0;
-  i = edges[j].dest;
-  while(j < edge_count) {
-    while(edges[j].dest == i && j < edge_count) {
-      j++;
+//Meyer and Sanders pick delta around max_weight/degree.  Road graphs have a
+//long tail of ferry and highway arcs that would make that far too coarse, so
+//use the 90th percentile of a weight sample instead of the maximum, and never
+//go below the smallest weight (every bucket would hold a single vertex).
+cl_float default_delta(graph *g) {
+  cl_uint i, n = g->num_edges < DELTA_SAMPLES ? g->num_edges : DELTA_SAMPLES;
+  cl_float degree = g->num_vertices ? (cl_float)g->num_edges/g->num_vertices : 1;
+  cl_float delta, *sample;
+  if(n == 0)
+    return 1;
+  sample = (cl_float *)malloc(sizeof(cl_float)*n);
+  for(i = 0; i < n; i++)
+    sample[i] = g->edges[(cl_ulong)i*g->num_edges/n].weight;
+  qsort(sample, n, sizeof(cl_float), floatcomp);
+  delta = sample[(n - 1)*9/10]/(degree > 1 ? degree : 1);
+  if(delta < sample[0])
+    delta = sample[0];
+  if(delta <= 0)
+    delta = 1;
+  free(sample);
+  return delta;
+}
+
+//Reorders every vertex's out-edges so the light ones (weight <= delta) come
+//first and records how many there are.  Requires build_out_edges().
+void split_light_heavy(graph *g, cl_float delta, cl_uint *light) {
+  cl_uint v, i;
+  edge *heavy = (edge *)malloc(sizeof(edge)*(g->num_edges ? g->num_edges : 1));
+  for(v = 0; v < g->num_vertices; v++) {
+    edge *out = g->out_edges + g->out_vertices[v].index;
+    cl_uint num_light = 0, num_heavy = 0;
+    for(i = 0; i < g->out_vertices[v].num_edges; i++) {
+      if(out[i].weight <= delta)
+	out[num_light++] = out[i];
+      else
+	heavy[num_heavy++] = out[i];
     }
-    vertices[i].num_edges = j - last;
-    vertices[i].index = last;
-    last = j;
-    i = edges[j].dest;
+    memcpy(out + num_light, heavy, sizeof(edge)*num_heavy);
+    light[v] = num_light;
   }
-  *v = vertices;
-  return max;
+  free(heavy);
 }
 
-
+//Fills packed_edges from edges unless the graph already has them (a graph
+//loaded from a binary cache has them mapped in).
+void pack_edges(graph *g) {
+  cl_uint i;
+  if(g->packed_edges)
+    return;
+  g->packed_edges = (gpu_edge *)malloc(sizeof(gpu_edge)*(g->num_edges ? g->num_edges : 1));
+  if(!g->packed_edges) {
+    problem("Failed to allocate the packed edges.\n");
+    exit(-1);
+  }
+  for(i = 0; i < g->num_edges; i++) {
+    g->packed_edges[i].source = g->edges[i].source;
+    g->packed_edges[i].weight = g->edges[i].weight;
+  }
+}
 
 /*--------------------------------------------------------------------------------*/
 
@@ -321,471 +308,1438 @@ struct timeval tv_delta(struct timeval start, struct timeval end){
 
 /*--------------------------------------------------------------------------------*/
 
-cl_int *getMatrixFromFile(char *filename, cl_int *size) {
-  FILE *fh;
-  cl_int *output;
-  int i, matrix_size;
 
-  fh = fopen(filename, "r");
-  if(!fh)
-    problem("file failed to open\n");
+//Finds a device of the requested type on any platform and builds kernel.cl
+//for it with the requested edge layout.  Returns the OpenCL error instead of exiting so that main() can fall
+//back to the CPU engine when there is no GPU.
+cl_int opencl_setup(opencl_env *env, cl_device_type type, const char *kernel_file,
+		    edge_layout layout, trace_file *trace, const char *cache_dir) {
+  cl_int err;
+  cl_uint i, num_platforms = 0;
+  cl_platform_id platforms[16];
+  cl_device_id device;
+
+  //Get device id.
+  err = clGetPlatformIDs(16, platforms, &num_platforms);
+  if(err != CL_SUCCESS)
+    return err;
+  err = CL_DEVICE_NOT_FOUND;
+  for(i = 0; i < num_platforms && err != CL_SUCCESS; i++)
+    err = clGetDeviceIDs(platforms[i], type, 1, &device, NULL);
+  if(err != CL_SUCCESS)
+    return err;
+  return opencl_setup_device(env, device, kernel_file, layout, trace, cache_dir);
+}
+
+//Builds kernel.cl for one device (or sub-device).  With a trace the queue
+//profiles and the sweep kernels count their updates.  With a cache_dir the
+//build is looked up there first and stored there after a source build.
+cl_int opencl_setup_device(opencl_env *env, cl_device_id device, const char *kernel_file,
+			   edge_layout layout, trace_file *trace, const char *cache_dir) {
+  cl_int err;
+  env->device_id = device;
   
-  fscanf(fh, "%d", &matrix_size);
-  *size = matrix_size;
-  output = (cl_int *)malloc(sizeof(cl_int)*matrix_size*matrix_size);
+  //Output the name of our device.
+  cl_char vendor_name[1024];
+  cl_char device_name[1024];
+  err = clGetDeviceInfo(env->device_id, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, NULL);
+  err|= clGetDeviceInfo(env->device_id, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
+  check_failure(err);
+  printf("Using %s %s. \n", vendor_name, device_name);
+  printf(BAR);
+  
+  //Create a context.
+  env->context = clCreateContext(0, 1, &env->device_id, NULL, NULL, &err);
+  check_failure(err);
 
-  if(!output)
-    exit(-1);
-  for(i = 0; i < matrix_size*matrix_size; i++) {
-      fscanf(fh, "%d", &(output[i]));
+  //Create a command queue.
+  env->commands = clCreateCommandQueue(env->context, env->device_id,
+				       trace ? CL_QUEUE_PROFILING_ENABLE : 0, &err);
+  check_failure(err);
+
+  //Load kernel from file into a string.
+  char *source;
+  unsigned long source_length = 0;
+  source = LoadTextFromFile(kernel_file, &source_length);
+  
+  env->layout = layout;
+  env->schedule = SCHEDULE_AUTO;
+  env->trace = trace;
+  //Integrated GPUs and CPU runtimes share host memory: buffers can use the
+  //host arrays directly instead of holding a second copy of the graph.
+  env->zero_copy = CL_FALSE;
+  clGetDeviceInfo(env->device_id, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(env->zero_copy),
+		  &env->zero_copy, NULL);
+  size_t extensions_size = 0;
+  env->packed_atomics = CL_FALSE;
+  if(clGetDeviceInfo(env->device_id, CL_DEVICE_EXTENSIONS, 0, NULL, &extensions_size) == CL_SUCCESS) {
+    char *extensions = (char *)calloc(extensions_size + 1, 1);
+    if(clGetDeviceInfo(env->device_id, CL_DEVICE_EXTENSIONS, extensions_size, extensions,
+		       NULL) == CL_SUCCESS)
+      env->packed_atomics = strstr(extensions, "cl_khr_int64_base_atomics") &&
+	strstr(extensions, "cl_khr_int64_extended_atomics") ? CL_TRUE : CL_FALSE;
+    free(extensions);
+  }
+  env->direction = DIRECTION_AUTO;
+  char options[128];
+  snprintf(options, sizeof(options), "%s%s%s", layout == LAYOUT_WIDE ? "-DWIDE_EDGES " : "",
+	   trace ? "-DCOUNT_UPDATES " : "", env->packed_atomics ? "-DPACKED_ATOMICS" : "");
+  env->program = cache_dir ? load_cached_program(env->context, env->device_id, cache_dir,
+						  source, options) : NULL;
+  if(env->program) {
+    printf("Using cached kernels from %s\n", cache_dir);
+    free(source);
+    return CL_SUCCESS;
   }
-  return output;
-}
 
-cl_float *randomMatrix(int size) {
-  int num = size*size;
-  cl_float *output = (cl_float *)malloc(sizeof(cl_float)*num);
-  int i, j;
-  for(i = 0; i < size; i++) {
-    output[i] = INFINITY;
-  }
-  for(i = 0; i < size; i++) {
-    memmove(output + size*i, output, size*sizeof(cl_float));
-  }
-  srand(time(NULL));
-  for(i = 0; i < size; i++) {
-    for(j = 0; j < size/4; j++) {
-      int index = rand() % size;
-      output[size*i + index] = rand() % 400;
-    }
-    output[size*i + i] = 0;
+  //Create our program.
+  env->program = clCreateProgramWithSource(env->context, 1, (const char **)&source, NULL, &err);
+  check_failure(err);
+  err = clBuildProgram(env->program, 0, NULL, options, NULL, NULL);
+  if (err != CL_SUCCESS) {
+    char buffer[9999];
+    
+    problem("ERROR: Failed to build program executable! %s\n", GetErrorString(err));
+    err = clGetProgramBuildInfo(env->program, env->device_id, CL_PROGRAM_BUILD_LOG,
+				sizeof(buffer), buffer, NULL);
+    check_failure(err);
+    problem("okay...%s\n", buffer);
+    exit(EXIT_FAILURE);
   }
-  return output;
+  if(cache_dir && store_cached_program(env->program, env->device_id, cache_dir, source,
+				       options) == 0)
+    printf("Stored kernels in %s\n", cache_dir);
+  free(source);
+  return CL_SUCCESS;
 }
 
-cl_uint *initPreds(int size) {
-  cl_uint *output = (cl_uint *)malloc(sizeof(cl_uint)*size*size);
-  int i;
-  for(i = 0; i < size*size; i++) {
-    output[i] = i/size + 1;
+void opencl_release(opencl_env *env) {
+  clReleaseProgram(env->program);
+  clReleaseCommandQueue(env->commands);
+  clReleaseContext(env->context);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//A -g argument that is already a binary cache is mapped directly.  With
+//use_cache, <graph>.csr is used when it is current and (re)written otherwise.
+static int load_graph(const char *graph_file, int use_cache, thread_pool *pool, graph *g) {
+  char cache_file[PATH_MAX];
+  if(is_csr_cache(graph_file))
+    return load_csr_cache(graph_file, pool, g) == CSR_OK ? 0 : -1;
+  if(!use_cache)
+    return load_dimacs(graph_file, pool, g);
+  snprintf(cache_file, sizeof(cache_file), "%s.csr", graph_file);
+  if(access(cache_file, R_OK) == 0 && load_csr_cache(cache_file, pool, g) == CSR_OK) {
+    printf("Using graph cache %s\n", cache_file);
+    return 0;
   }
-  return output;
+  if(load_dimacs(graph_file, pool, g))
+    return -1;
+  if(write_csr_cache(cache_file, g, graph_file, pool) == CSR_OK)
+    printf("Wrote graph cache %s\n", cache_file);
+  return 0;
 }
 
-void printMatrix(cl_float *matrix, cl_int rows, cl_int cols) {
-  int i;
-  printf("%4.0f ", (float)-1); 
-  for(i = 0; i < cols; i++)
-    printf("%4.0d ",i+1); 
-  printf("\n");
-  for(i=0; i<cols; i++)
-    printf("_____");
-  printf("____");
-    
-  
-  for(i = 0; i < rows*cols; i++) {
-    if(i % cols == 0) {
-      printf("\n");
-      printf("%4d|", (i/cols + 1));
+typedef enum { ENGINE_AUTO, ENGINE_OPENCL, ENGINE_CPU } engine_t;
+
+//Appends the vertex indices in text, separated by commas or whitespace, to
+//the growing array *sources.  Returns -1 on anything that is not a number.
+static int parse_sources(const char *text, cl_uint **sources, cl_uint *count, cl_uint *capacity) {
+  char *end;
+  while(*text) {
+    if(*text == ',' || *text == ' ' || *text == '\t' || *text == '\n' || *text == '\r') {
+      text++;
+      continue;
+    }
+    unsigned long v = strtoul(text, &end, 10);
+    if(end == text || v > CL_UINT_MAX)
+      return -1;
+    if(*count == *capacity) {
+      *capacity = *capacity ? 2 * *capacity : 64;
+      *sources = (cl_uint *)realloc(*sources, sizeof(cl_uint) * *capacity);
     }
-    if(matrix[i] > 4000000)
-      matrix[i] = INFINITY;
-    printf("%4.0f ", matrix[i]);
+    (*sources)[(*count)++] = (cl_uint)v;
+    text = end;
   }
-  printf("\n");
+  return 0;
 }
 
-void printPreds(cl_uint *matrix, cl_int size) {
-  int i;
-  printf("%4.0f ", (float)-1); 
-  for(i = 0; i < size; i++)
-    printf("%4.0d ", i+1); 
-  printf("\n");
-  for(i=0; i<size; i++)
-    printf("_____");
-  printf("____");
-  for(i = 0; i < size*size; i++) {
-    if(i % size == 0) {
-      printf("\n");
-      printf("%4d|", (i/size + 1));
+static int read_sources_file(const char *filename, cl_uint **sources, cl_uint *count,
+			     cl_uint *capacity) {
+  char line[4096];
+  FILE *fh = fopen(filename, "r");
+  if(!fh) {
+    problem("Could not open sources file %s\n", filename);
+    return -1;
+  }
+  while(fgets(line, sizeof(line), fh)) {
+    if(line[0] == '#')
+      continue;
+    if(parse_sources(line, sources, count, capacity)) {
+      problem("Bad vertex in sources file %s: %s", filename, line);
+      fclose(fh);
+      return -1;
     }
-    printf("%4d ", matrix[i]);
   }
-  printf("\n");
+  fclose(fh);
+  return 0;
 }
 
-cl_float *generate_matrix(cl_uint *vertex_index, cl_uint *edge_count,
-			  cl_uint *edge_sources, float *edge_weights, cl_uint num_vertices, 
-			  cl_uint num_edges) {
-  cl_uint i,j,k;
-  cl_float *output = (cl_float*)malloc(num_vertices*num_vertices*sizeof(cl_float));
-  for(i = 0; i < num_vertices; i++) {
-    output[i] = INFINITY;
-  }
-  for(i = 0; i < num_vertices; i++) {
-    memmove(output + num_vertices*i, output, num_vertices*sizeof(cl_float));
-  }
-  for(i = 0; i < num_vertices; i++) {
-    k = vertex_index[i]; 
-    for(j = 0; j < edge_count[i]; j++) {
-      int source = edge_sources[k+j];
-      float weight = edge_weights[k+j];
-	if(output[source*num_vertices + i] > weight)
-	  output[source*num_vertices + i] = weight;
+//Answers every source in passes of per_pass queries against the resident
+//graph and prints one summary line per source.
+static void run_multi(engine_t engine, opencl_env *env, thread_pool *pool, graph *g,
+		      const cl_uint *sources, cl_uint num_sources, cl_uint per_pass,
+		      cl_uint batch, sssp_stats *total) {
+  size_t cells = (size_t)g->num_vertices*per_pass;
+  cl_float *result = (cl_float *)malloc(sizeof(cl_float)*cells);
+  cl_uint *preds = (cl_uint *)malloc(sizeof(cl_uint)*cells);
+  cl_uint first, b, v;
+  sssp_stats stats;
+  if(!result || !preds) {
+    problem("Failed to allocate results for %u sources.\n", per_pass);
+    exit(-1);
+  }
+  total->rounds = 0;
+  total->edges_scanned = 0;
+  for(first = 0; first < num_sources; first += per_pass) {
+    cl_uint n = num_sources - first < per_pass ? num_sources - first : per_pass;
+    if(engine == ENGINE_OPENCL)
+      opencl_multi_sssp(env, g, sources + first, n, batch, result, preds, &stats);
+    else
+      cpu_multi_bellman_ford(pool, g, sources + first, n, result, preds, &stats);
+    total->rounds += stats.rounds;
+    total->edges_scanned += stats.edges_scanned;
+    for(b = 0; b < n; b++) {
+      cl_uint reached = 0;
+      cl_float farthest = 0;
+      for(v = 0; v < g->num_vertices; v++) {
+	cl_float d = result[(size_t)v*n + b];
+	if(d < INFINITY) {
+	  reached++;
+	  if(d > farthest)
+	    farthest = d;
+	}
+      }
+      printf("Source %u: %u reached, farthest %.0f\n", original_id(g, sources[first + b]),
+	     reached, farthest);
     }
-    output[num_vertices*i + i] = 0;
   }
-  return output;
+  free(result);
+  free(preds);
 }
 
-/*--------------------------------------------------------------------------------*/
-#define BLOCK_SIZE 16
+//Collects the rows johnson_apsp streams out: appends them to out (if any)
+//in file numbering, keeps the head of the requested source's row for
+//printing, and counts the reachable pairs.
+typedef struct _row_sink {
+  graph *g;
+  FILE *out;
+  cl_uint source;
+  cl_float *row;
+  cl_uint *row_preds;
+  cl_float head[64];
+  cl_uint head_preds[64];
+  cl_ulong reached;
+  int failed;
+} row_sink;
+
+static void sink_row(void *arg, cl_uint source, const cl_float *distances, const cl_uint *preds) {
+  row_sink *sink = (row_sink *)arg;
+  cl_uint v, n = sink->g->num_vertices, head = n < 64 ? n : 64;
+  for(v = 0; v < n; v++)
+    sink->reached += distances[v] < INFINITY;
+  if(source != sink->source && !sink->out)
+    return;
+  restore_row(sink->g, distances, preds, sink->row, sink->row_preds);
+  if(source == sink->source) {
+    memcpy(sink->head, sink->row, sizeof(cl_float)*head);
+    memcpy(sink->head_preds, sink->row_preds, sizeof(cl_uint)*head);
+  }
+  if(sink->out && !sink->failed &&
+     (fseeko(sink->out, (off_t)original_id(sink->g, source)*n*sizeof(cl_float), SEEK_SET) ||
+      fwrite(sink->row, sizeof(cl_float), n, sink->out) != n))
+    sink->failed = 1;
+}
 
-cl_float *matrix_multiply(cl_program program, cl_context context, cl_command_queue commands, cl_float *matrix,
-		     cl_uint nv) {
-  cl_int err;
-  cl_kernel kernel;
-  cl_int m_size = nv;
-  kernel = clCreateKernel(program, "matrix_product", &err);
-  check_failure(err);
-  
-  printf(BAR);
-  //Read matrices from file
-  cl_uint *preds_init;
-  cl_mem input;
-  cl_mem input2;
-  cl_mem preds;
-  preds_init = initPreds(m_size);
-   
-  
-#ifdef PRINT
-  if(m_size < 100) {
-    printMatrix(matrix, m_size, m_size);
+//Applies each update file in turn to the solution in result/preds and
+//repairs it in place, on the device when there is one.  The device state
+//is set up once from the initial solution and stays resident between
+//batches.  Returns 0, or -1 if an update file could not be read.
+static int run_repairs(engine_t engine, opencl_env *env, thread_pool *pool, graph *g,
+		       cl_uint source, const char **files, cl_uint num_files,
+		       cl_float *result, cl_uint *preds, trace_file *tracer) {
+  struct timeval start, end, delta;
+  device_sssp ds;
+  cl_uint f;
+  if(!g->out_vertices)
+    build_out_edges(g);
+  if(engine == ENGINE_OPENCL) {
+    opencl_upload_sssp(env, g, &ds);
+    opencl_load_solution(env, &ds, source, result, preds);
+  }
+  for(f = 0; f < num_files; f++) {
+    weight_update *updates;
+    cl_uint count;
+    repair_plan plan;
+    sssp_stats stats;
+    if(load_weight_updates(files[f], g, &updates, &count)) {
+      if(engine == ENGINE_OPENCL)
+	opencl_release_sssp(&ds);
+      return -1;
+    }
+    gettimeofday(&start, NULL);
+    plan_repair(g, source, updates, count, result, preds, &plan);
+    if(engine == ENGINE_OPENCL)
+      opencl_repair_sssp(env, &ds, &plan, result, preds, &stats);
+    else
+      cpu_repair_sssp(pool, g, &plan, result, preds, &stats);
+    gettimeofday(&end, NULL);
+    trace_span(tracer, "repair", start, end);
+    delta = tv_delta(start, end);
+    printf("%s: %u updates, %u edges patched, %u vertices invalidated, %u seeds\n", files[f],
+	   count, plan.num_in, plan.num_invalid, plan.num_seeds);
+    printf("Repair Time: %ld.%06ld, rounds: %u, edges scanned: %llu\n",
+	   (long int)delta.tv_sec, (long int)delta.tv_usec, stats.rounds,
+	   (unsigned long long)stats.edges_scanned);
     printf(BAR);
-    printPreds(preds_init, m_size);
+    free_repair_plan(&plan);
+    free(updates);
   }
-#endif
-  
-  printf("Creating data buffers.\n");
-  printf(BAR);
-  //Create data buffers on the device.
-  input = clCreateBuffer(context, CL_MEM_READ_WRITE,  sizeof(cl_float)*m_size*m_size, NULL, NULL);
+  if(engine == ENGINE_OPENCL)
+    opencl_release_sssp(&ds);
+  return 0;
+}
 
-  input2 = clCreateBuffer(context,  CL_MEM_READ_WRITE,  sizeof(cl_float)*m_size*m_size, NULL, NULL);
-  
-  preds = clCreateBuffer(context, CL_MEM_READ_WRITE,  sizeof(cl_uint)*m_size*m_size, NULL, NULL);
-  
-  if(!input || !input2 || !preds ) {
-    problem("Failed to allocate device memory.\n");
-    exit(-1);
+//Shortest paths from source to each target, in the file's vertex numbers.
+static void print_paths(cl_uint source, const cl_uint *targets, cl_uint num_targets,
+			const cl_float *distances, const cl_uint *preds, cl_uint num_vertices) {
+  cl_uint *path = (cl_uint *)malloc(sizeof(cl_uint)*num_vertices);
+  cl_uint i, k, len;
+  for(i = 0; i < num_targets; i++) {
+    cl_uint target = targets[i];
+    if(target >= num_vertices) {
+      problem("Path target %u is not a vertex; the graph has %u.\n", target, num_vertices);
+      continue;
+    }
+    len = distances[target] < INFINITY ?
+      extract_path(preds, 1, num_vertices, source, target, path) : 0;
+    if(!len) {
+      printf("Path to %u: unreachable\n", target);
+      continue;
+    }
+    printf("Path to %u: distance %g, %u vertices\n", target, distances[target], len);
+    for(k = 0; k < len; k++)
+      printf("%u%s", path[k], k + 1 == len || (k + 1) % PRINT_ROW_LENGTH == 0 ? "\n" : " ");
   }
-  
-  err = 0;
-  printf("Putting data into device memory.\n");
   printf(BAR);
-  //Put data into device Memory.
-  err  =  clEnqueueWriteBuffer(commands, input, CL_TRUE, 0, 
-  		       sizeof(cl_float)*m_size*m_size, matrix, 0, NULL, NULL);
-  err  =  clEnqueueWriteBuffer(commands, preds, CL_TRUE, 0, 
-  		       sizeof(cl_uint)*m_size*m_size, preds_init, 0, NULL, NULL);
-  check_failure(err);
-  
-  printf("Setting Kernel Arguments.\n");
-  printf(BAR);
-  //Set arguments.
-  int i = 0;
-  err  =  clSetKernelArg(kernel, i++, sizeof(cl_mem), &input);
-  err |=  clSetKernelArg(kernel, i++, sizeof(cl_mem), &input2);
-  err |=  clSetKernelArg(kernel, i++, sizeof(cl_mem), &preds);
-  err |=  clSetKernelArg(kernel, i++, sizeof(cl_int), &m_size);
-  check_failure(err);
+  free(path);
+}
 
-  //Determine work group size.
-  size_t global_size[] = {m_size, m_size};
-  size_t local_size[] = {BLOCK_SIZE, BLOCK_SIZE};
-  
-  printf("Running.\n");
-  printf(BAR);
-  clFinish(commands);
-  //Run our program.
+//DIMACS road instances ship X.co next to X.gr.  Returns that name, or NULL
+//when there is no such file.
+static char *sibling_coords(const char *graph_file) {
+  size_t len = strlen(graph_file);
+  char *name = (char *)malloc(len + 4);
+  strcpy(name, graph_file);
+  if(len > 3 && !strcmp(name + len - 3, ".gr"))
+    strcpy(name + len - 3, ".co");
+  else
+    strcat(name, ".co");
+  if(access(name, R_OK)) {
+    free(name);
+    return NULL;
+  }
+  return name;
+}
+
+//Answers every source/target pair with a point-to-point search, through the
+//hierarchy when ch is not NULL.  Sources are internal numbers; targets and
+//everything printed are the file's.
+static int run_p2p(graph *g, p2p_method method, hierarchy *ch, const cl_uint *sources,
+		   cl_uint num_sources, const cl_uint *targets, cl_uint num_targets,
+		   trace_file *tracer) {
   struct timeval start, end, delta;
+  cl_uint n = g->num_vertices, i, j, k, len;
+  cl_uint *path = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+  cl_ulong settled = 0, scanned = 0;
+  sssp_stats stats;
+  p2p_search *s = ch ? NULL : p2p_create(g);
+  if(s && s->negative) {
+    problem("Point-to-point searches need non-negative weights; use -m sweep.\n");
+    p2p_destroy(s);
+    free(path);
+    return -1;
+  }
+  if(s && method == P2P_ASTAR && !g->coords) {
+    problem("A* needs coordinates (--coords); running bidirectional Dijkstra.\n");
+    method = P2P_BIDIRECTIONAL;
+  }
+  if(ch)
+    printf("Contraction Hierarchies\n");
+  else if(method == P2P_ASTAR)
+    printf("A* bound: %g per coordinate unit\n", s->scale);
+  else
+    printf("Bidirectional Dijkstra\n");
+  printf(BAR);
+
   gettimeofday(&start, NULL);
-  int exp = 1;
-  while(exp < m_size) {
-    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global_size, local_size, 0, NULL, NULL);
-    check_failure(err);
-    clFinish(commands);
-    exp = exp*2;
-    i = 0;
-    clSetKernelArg(kernel, i++, sizeof(cl_mem), &input2);
-    clSetKernelArg(kernel, i, sizeof(cl_mem), &input);
-    clFinish(commands);
-    err = clEnqueueNDRangeKernel(commands, kernel, 2, NULL, global_size, local_size, 0, NULL, NULL);
-    clFinish(commands);
-    exp = exp*2;
-    i = 0;
-    clSetKernelArg(kernel, i++, sizeof(cl_mem), &input);
-    clSetKernelArg(kernel, i, sizeof(cl_mem), &input2);
-    printf("%d\n", exp);
-    clFinish(commands);
+  for(i = 0; i < num_sources; i++) {
+    cl_uint source = original_id(g, sources[i]);
+    for(j = 0; j < num_targets; j++) {
+      cl_uint target = targets[j];
+      if(target >= n) {
+	problem("Path target %u is not a vertex; the graph has %u.\n", target, n);
+	continue;
+      }
+      cl_float d = ch ? ch_query(ch, sources[i], internal_id(g, target), path, &len, &stats) :
+	p2p_query(s, method, sources[i], internal_id(g, target), path, &len, &stats);
+      settled += stats.rounds;
+      scanned += stats.edges_scanned;
+      if(!len) {
+	printf("Path %u -> %u: unreachable, %u vertices settled\n", source, target, stats.rounds);
+	continue;
+      }
+      printf("Path %u -> %u: distance %g, %u vertices, %u settled\n", source, target, d, len,
+	     stats.rounds);
+      for(k = 0; k < len; k++)
+	printf("%u%s", original_id(g, path[k]),
+	       k + 1 == len || (k + 1) % PRINT_ROW_LENGTH == 0 ? "\n" : " ");
+    }
   }
   gettimeofday(&end, NULL);
+  trace_span(tracer, "solve", start, end);
   delta = tv_delta(start, end);
-  printf("GPU Time: %ld.%06ld\n", 
-	 (long int)delta.tv_sec, 
-	 (long int)delta.tv_usec);
   printf(BAR);
-  
-  printf("Getting data.\n");
+  printf("CPU Time: %ld.%06ld\n", (long int)delta.tv_sec, (long int)delta.tv_usec);
+  printf("Settled: %llu vertices, edges scanned: %llu\n", (unsigned long long)settled,
+	 (unsigned long long)scanned);
   printf(BAR);
-  //Retrieve and print output.
-  cl_float *result;
-  cl_uint *preds_result;
-  result = (cl_float *)malloc(sizeof(cl_float)*m_size*m_size);
-  preds_result = (cl_uint *)malloc(sizeof(cl_int)*m_size*m_size);
-  err = clEnqueueReadBuffer(commands, input2, CL_TRUE, 0, sizeof(cl_float)*m_size*m_size,
-			    result, 0, NULL, NULL );
-  err = clEnqueueReadBuffer(commands, preds, CL_TRUE, 0, sizeof(cl_uint)*m_size*m_size,
-			    preds_result, 0, NULL, NULL );
-  check_failure(err);
-  
-  /*
-  printMatrix(matrix, m_size, m_size);
-  printf("*\n");
-  printMatrix(right_matrix, m_size, m_size);
-  printf("=\n");
-  printMatrix(result, m_size, m_size);
-  */
-
-  //Do the computation on the CPU to verify.
-  
-#ifdef PRINT
-  if(m_size < 100) {
-    printMatrix(result, m_size, m_size);
+  if(s)
+    p2p_destroy(s);
+  free(path);
+  return 0;
+}
+
+//Loads the hierarchy from ch_file when it is there and current, else builds
+//it and (with ch_file) writes it for the next run.
+static int prepare_hierarchy(graph *g, const char *ch_file, hierarchy *h, trace_file *tracer) {
+  struct timeval start, end, delta;
+  if(ch_file && access(ch_file, R_OK) == 0 && load_hierarchy(ch_file, g, h) == CH_OK) {
+    printf("Using hierarchy %s: %u shortcuts, %u up and %u down arcs\n", ch_file,
+	   h->num_shortcuts, h->num_up, h->num_down);
     printf(BAR);
-    printPreds(preds_result, m_size);
+    return 0;
   }
-#endif
-
-
+  gettimeofday(&start, NULL);
+  if(build_hierarchy(g, h))
+    return -1;
+  gettimeofday(&end, NULL);
+  trace_span(tracer, "preprocess", start, end);
+  delta = tv_delta(start, end);
+  printf("Built hierarchy: %u shortcuts, %u up and %u down arcs in %ld.%06ld\n",
+	 h->num_shortcuts, h->num_up, h->num_down, (long int)delta.tv_sec,
+	 (long int)delta.tv_usec);
+  if(ch_file && write_hierarchy(ch_file, h) == CH_OK)
+    printf("Wrote hierarchy %s\n", ch_file);
   printf(BAR);
-  printf("Cleanup.\n");
-  //Device Cleanup.
-  clReleaseKernel(kernel);
-  clReleaseMemObject(input);
-  clReleaseMemObject(input2);
+  return 0;
+}
 
-  //Memory Cleanup.
-  free(result);
-  free(preds_result);
-  return matrix;
+//The sources x targets distance table, one row per source.
+static int run_table(graph *g, hierarchy *ch, const cl_uint *sources, cl_uint num_sources,
+		     const cl_uint *targets, cl_uint num_targets, trace_file *tracer) {
+  struct timeval start, end, delta;
+  cl_uint *internal = (cl_uint *)malloc(sizeof(cl_uint)*num_targets);
+  cl_float *table = (cl_float *)malloc(sizeof(cl_float)*(size_t)num_sources*num_targets);
+  cl_uint i, j;
+  sssp_stats stats;
+  if(!internal || !table) {
+    problem("A %u x %u table does not fit in memory.\n", num_sources, num_targets);
+    return -1;
+  }
+  for(j = 0; j < num_targets; j++) {
+    if(targets[j] >= g->num_vertices) {
+      problem("Table target %u is not a vertex; the graph has %u.\n", targets[j],
+	      g->num_vertices);
+      free(internal);
+      free(table);
+      return -1;
+    }
+    internal[j] = internal_id(g, targets[j]);
+  }
+  gettimeofday(&start, NULL);
+  ch_table(ch, sources, num_sources, internal, num_targets, table, &stats);
+  gettimeofday(&end, NULL);
+  trace_span(tracer, "solve", start, end);
+  delta = tv_delta(start, end);
+  for(i = 0; i < num_sources; i++) {
+    printf("From %u:\n", original_id(g, sources[i]));
+    for(j = 0; j < num_targets; j++)
+      printf("%g%s", table[(size_t)i*num_targets + j],
+	     j + 1 == num_targets || (j + 1) % PRINT_ROW_LENGTH == 0 ? "\n" : " ");
+  }
+  printf(BAR);
+  printf("CPU Time: %ld.%06ld for %u x %u\n", (long int)delta.tv_sec, (long int)delta.tv_usec,
+	 num_sources, num_targets);
+  printf("Settled: %u vertices, edges scanned: %llu\n", stats.rounds,
+	 (unsigned long long)stats.edges_scanned);
+  printf(BAR);
+  free(internal);
+  free(table);
+  return 0;
 }
 
-/*--------------------------------------------------------------------------------*/
+#define OPT_CONVERT 256
+#define OPT_SERVE 257
+#define OPT_APSP_KERNEL 258
+#define OPT_APSP_BENCH 259
+#define OPT_APSP_OUT 260
+#define OPT_COORDS 261
+#define OPT_SCHEDULE 262
+#define OPT_GENERATE 263
+#define OPT_SEED 264
+#define OPT_EDGE_FACTOR 265
+#define OPT_BENCH 266
+#define OPT_BENCH_FORMAT 267
+#define OPT_BENCH_OUT 268
+#define OPT_SCALES 269
+#define OPT_REPEAT 270
+#define OPT_TRACE 271
+#define OPT_KERNEL_CACHE 272
+#define OPT_UPDATES 273
+#define OPT_PARTITIONS 274
+#define OPT_SPLIT 275
+#define OPT_DEVICE_TYPE 276
+#define OPT_ZERO_COPY 277
+#define OPT_OUT 278
+#define OPT_OUT_FORMAT 279
+#define OPT_PATH 280
+#define OPT_DIRECTION 281
+#define OPT_CH 282
+#define OPT_TABLE 283
+#define OPT_APSP_MATRIX 284
+#define OPT_APSP_MEMORY 285
+#define OPT_BOUND 286
+#define DEFAULT_SOURCES_PER_PASS 64
+#define DEFAULT_BENCH_SCALES "12,14,16"
+typedef enum { MODE_SWEEP, MODE_FRONTIER, MODE_DELTA, MODE_APSP, MODE_JOHNSON, MODE_BIDIR,
+	       MODE_ASTAR, MODE_CH } sssp_mode;
+
+static void usage(const char *name) {
+  problem("usage: %s [-e auto|opencl|cpu] [-m sweep|frontier|delta|apsp|johnson|bidir|astar|ch]\n"
+	  "          [-b rounds] [-d delta] [-g graph] [-c] [--convert out.csr]\n"
+	  "          [-l packed|wide] [-t threads]\n"
+	  "          [-s v,v,...] [-S sources.txt] [-B per_pass] [--serve socket]\n"
+	  "          [--apsp-kernel auto|scalar|avx2|avx512] [--apsp-bench] [--apsp-out rows.bin]\n"
+	  "          [--apsp-matrix file] [--apsp-memory MB]\n"
+	  "          [-o none|rcm|degree|hilbert] [--coords graph.co]\n"
+	  "          [--schedule auto|vertex|binned] [--generate family:scale] [--seed n]\n"
+	  "          [--edge-factor n] [--bench] [--bench-format json|csv] [--bench-out file]\n"
+	  "          [--scales s,s,...] [--repeat n] [--trace trace.json]\n"
+	  "          [--kernel-cache DIR|none] [--updates file]...\n"
+	  "          [--partitions n] [--split auto|numa|equal|devices] [--device-type gpu|cpu|all]\n"
+	  "          [--zero-copy auto|on|off] [--out file] [--out-format text|binary]\n"
+	  "          [--path v,v,...] [--direction auto|pull|push] [--ch file] [--table]\n"
+	  "          [--bound D]\n"
+	  "          [kernel.cl]\n", name);
+  problem("  -e, --engine   where to run the solver (default auto: GPU, else CPU)\n");
+  problem("  -m, --mode     sweep relaxes every vertex each round, frontier only the\n"
+	  "                 out-neighbours of vertices that changed, delta runs\n"
+	  "                 delta-stepping, apsp runs blocked Floyd-Warshall over the\n"
+	  "                 dense matrix and prints the source's row, johnson runs\n"
+	  "                 Johnson's algorithm and streams the rows out without\n"
+	  "                 holding the matrix, bidir and astar answer only the\n"
+	  "                 --path targets with bidirectional Dijkstra or A* over the\n"
+	  "                 coordinates, stopping once each is settled, ch answers\n"
+	  "                 them over a Contraction Hierarchy (default sweep)\n");
+  problem("  -b, --batch    sweep rounds the GPU runs between convergence checks\n"
+	  "                 (default 0: start at 1 and double while still changing)\n");
+  problem("  -d, --delta    delta-stepping bucket width (default: derived from weights)\n");
+  problem("  -g, --graph    DIMACS graph or binary cache to load (default %s)\n",
+	  DEFAULT_GRAPH_FILENAME);
+  problem("  --generate F:S  solve a generated graph instead: family uniform, rmat or\n"
+	  "                 grid with 2^S vertices (see generate.h)\n");
+  problem("  --seed N       generator and benchmark source seed (default %d)\n",
+	  BENCH_DEFAULT_SEED);
+  problem("  --edge-factor N  arcs per vertex for uniform and rmat (default %d)\n",
+	  GEN_EDGE_FACTOR);
+  problem("  -c, --cache    use <graph>.csr, converting the graph when it is missing or stale\n");
+  problem("  --convert OUT  write the graph as a binary cache to OUT and exit\n");
+  problem("  -l, --layout   device edge layout: packed 8-byte edges or the old 16-byte\n"
+	  "                 {source, dest, weight} (default packed)\n");
+  problem("  --schedule     GPU sweep work split: a work-item per vertex, or vertices\n"
+	  "                 binned by in-degree so hubs get a work-group each (default\n"
+	  "                 auto: binned once a vertex has %d or more in-edges)\n", BIN_WARP_DEGREE);
+  problem("  -s, --source   comma-separated source vertex indices (default %d)\n", DEFAULT_SOURCE);
+  problem("  -S, --sources-file  file of source vertex indices, one or more per line\n");
+  problem("  -B, --per-pass sources answered together when there are several; sweep\n"
+	  "                 mode only (default: as many as fit on the device, %d on the CPU)\n",
+	  DEFAULT_SOURCES_PER_PASS);
+  problem("  --serve PATH   keep the graph loaded and answer source/target queries on\n"
+	  "                 the Unix socket PATH (see server.h for the protocol)\n");
+  problem("  --apsp-kernel  CPU tile kernel for apsp mode (default auto: widest the\n"
+	  "                 CPU supports)\n");
+  problem("  --apsp-bench   time every supported CPU apsp kernel on the graph's matrix\n"
+	  "                 against the scalar loop and exit\n");
+  problem("  --apsp-out PATH  write the apsp/johnson distance rows to PATH as raw\n"
+	  "                 floats, n rows of n\n");
+  problem("  --apsp-matrix FILE  keep the apsp distance and pred matrices in FILE,\n"
+	  "                 memory-mapped, instead of in memory (solver vertex order)\n");
+  problem("  --apsp-memory MB  working memory for apsp; a larger matrix is solved in\n"
+	  "                 tiles streamed through it (default: 3/4 of the device's, on\n"
+	  "                 the CPU half of RAM with --apsp-matrix, else unlimited)\n");
+  problem("  -o, --order    renumber vertices for locality before solving: reverse\n"
+	  "                 Cuthill-McKee, by degree, or along a Hilbert curve over\n"
+	  "                 the coordinates; output keeps the file's numbers (default none)\n");
+  problem("  --coords FILE  DIMACS coordinate file for the graph (astar mode looks for\n"
+	  "                 the .co file next to the .gr one by default)\n");
+  problem("  --bench        run every engine, layout and mode over generated graphs of\n"
+	  "                 each family and scale, write the timings and exit\n");
+  problem("  --bench-format json or csv (default json)\n");
+  problem("  --bench-out F  where the results go (default bench.json or bench.csv)\n");
+  problem("  --scales LIST  comma-separated benchmark scales (default %s)\n",
+	  DEFAULT_BENCH_SCALES);
+  problem("  --repeat N     timed runs per benchmark configuration (default %d)\n",
+	  BENCH_DEFAULT_REPEAT);
+  problem("  --trace FILE   profile every device command and write a Chrome trace\n"
+	  "                 (chrome://tracing) with per-round counters to FILE\n");
+  problem("  --updates FILE  after solving, apply the weight changes in FILE (\"a u v w\"\n"
+	  "                 lines) and repair the solution incrementally; may be repeated,\n"
+	  "                 batches are applied in order (single source only)\n");
+  problem("  --kernel-cache DIR  where compiled kernels are kept between runs, or none\n"
+	  "                 (default $XDG_CACHE_HOME/%s or ~/.cache/%s)\n",
+	  PROGRAM_CACHE_SUBDIR, PROGRAM_CACHE_SUBDIR);
+  problem("  --direction    frontier rounds pull into the out-neighbours of what changed,\n"
+	  "                 or push from it with atomic-min (default auto: push while\n"
+	  "                 the frontier's out-edges are under 1/%d of the graph's)\n",
+	  PUSH_DENSITY);
+  problem("  --partitions N  split a single-source sweep over N devices by vertex range,\n"
+	  "                 exchanging boundary distances each round (see partition.h)\n");
+  problem("  --split        where the partitions run: separate devices, sub-devices per\n"
+	  "                 NUMA node, or equal compute-unit shares of the first device\n"
+	  "                 (default auto: devices if there are enough, else NUMA, else equal)\n");
+  problem("  --device-type  OpenCL devices to use (default gpu)\n");
+  problem("  --zero-copy    let device buffers use the host arrays in place instead of\n"
+	  "                 copies (default auto: when the device shares host memory)\n");
+  problem("  --out FILE     write every vertex's distance and pred to FILE (see result.h)\n");
+  problem("  --out-format   text or binary (default text)\n");
+  problem("  --path LIST    print the shortest path to each listed vertex\n");
+  problem("  --bound D      sweep, frontier and delta: settle only the vertices within\n"
+	  "                 distance D of the source, leaving the rest unreached; --out\n"
+	  "                 then lists just those (see result.h)\n");
+  problem("  --ch FILE      ch mode: load the hierarchy from FILE, or build it and write\n"
+	  "                 it there when FILE is missing or was built from another graph\n");
+  problem("  --table        ch mode: print the sources x --path targets distance table\n"
+	  "                 instead of paths\n");
+  problem("  -t, --threads  CPU worker threads for loading and the CPU engine\n"
+	  "                 (default: all cores)\n");
+}
 
 int main(int argc, char **argv) {
   cl_int err;
+  engine_t engine = ENGINE_AUTO;
+  sssp_mode mode = MODE_SWEEP;
+  cl_float bucket_width = 0;
+  cl_uint num_threads = 0;
+  cl_uint batch = 0;
+  cl_uint *sources = NULL, num_sources = 0, sources_capacity = 0, per_pass = 0;
+  const char *kernel_file = DEFAULT_KERNEL_FILENAME;
+  const char *graph_file = DEFAULT_GRAPH_FILENAME;
+  const char *convert_file = NULL;
+  const char *serve_path = NULL;
+  int use_cache = 0;
+  edge_layout layout = LAYOUT_PACKED;
+  apsp_kernel cpu_kernel = APSP_KERNEL_AUTO;
+  int apsp_bench = 0;
+  const char *apsp_out = NULL;
+  const char *apsp_matrix_file = NULL;
+  cl_ulong apsp_memory = 0;
+  cl_float bound = INFINITY;
+  const char *coords_file = NULL;
+  const char *trace_path = NULL;
+  const char *kernel_cache = default_program_cache();
+  const char **update_files = NULL;
+  cl_uint num_update_files = 0;
+  cl_uint num_parts = 1;
+  device_split split = SPLIT_AUTO;
+  cl_device_type device_type = CL_DEVICE_TYPE_GPU;
+  int zero_copy = -1;
+  const char *out_file = NULL;
+  result_format out_format = RESULT_TEXT;
+  cl_uint *targets = NULL, num_targets = 0, targets_capacity = 0;
+  vertex_order order = ORDER_NONE;
+  work_schedule schedule = SCHEDULE_AUTO;
+  frontier_direction direction = DIRECTION_AUTO;
+  const char *ch_file = NULL;
+  int table = 0;
+  graph_family family = GEN_UNIFORM;
+  cl_uint gen_scale = 0, edge_factor = GEN_EDGE_FACTOR;
+  cl_ulong seed = BENCH_DEFAULT_SEED;
+  int bench = 0;
+  bench_config bench_cfg;
+  cl_uint *scales = NULL, num_scales = 0, scales_capacity = 0;
+  memset(&bench_cfg, 0, sizeof(bench_cfg));
+  bench_cfg.repeat = BENCH_DEFAULT_REPEAT;
+  bench_cfg.format = BENCH_JSON;
+
+  static struct option long_options[] = {
+    {"engine",  required_argument, 0, 'e'},
+    {"mode",    required_argument, 0, 'm'},
+    {"batch",   required_argument, 0, 'b'},
+    {"delta",   required_argument, 0, 'd'},
+    {"graph",   required_argument, 0, 'g'},
+    {"cache",   no_argument,       0, 'c'},
+    {"convert", required_argument, 0, OPT_CONVERT},
+    {"serve",   required_argument, 0, OPT_SERVE},
+    {"layout",  required_argument, 0, 'l'},
+    {"source",  required_argument, 0, 's'},
+    {"sources-file", required_argument, 0, 'S'},
+    {"per-pass", required_argument, 0, 'B'},
+    {"apsp-kernel", required_argument, 0, OPT_APSP_KERNEL},
+    {"apsp-bench", no_argument,   0, OPT_APSP_BENCH},
+    {"apsp-out", required_argument, 0, OPT_APSP_OUT},
+    {"apsp-matrix", required_argument, 0, OPT_APSP_MATRIX},
+    {"apsp-memory", required_argument, 0, OPT_APSP_MEMORY},
+    {"bound",   required_argument, 0, OPT_BOUND},
+    {"order",   required_argument, 0, 'o'},
+    {"coords",  required_argument, 0, OPT_COORDS},
+    {"schedule", required_argument, 0, OPT_SCHEDULE},
+    {"generate", required_argument, 0, OPT_GENERATE},
+    {"seed",    required_argument, 0, OPT_SEED},
+    {"edge-factor", required_argument, 0, OPT_EDGE_FACTOR},
+    {"bench",   no_argument,       0, OPT_BENCH},
+    {"bench-format", required_argument, 0, OPT_BENCH_FORMAT},
+    {"bench-out", required_argument, 0, OPT_BENCH_OUT},
+    {"scales",  required_argument, 0, OPT_SCALES},
+    {"repeat",  required_argument, 0, OPT_REPEAT},
+    {"trace",   required_argument, 0, OPT_TRACE},
+    {"kernel-cache", required_argument, 0, OPT_KERNEL_CACHE},
+    {"updates", required_argument, 0, OPT_UPDATES},
+    {"partitions", required_argument, 0, OPT_PARTITIONS},
+    {"split",   required_argument, 0, OPT_SPLIT},
+    {"device-type", required_argument, 0, OPT_DEVICE_TYPE},
+    {"zero-copy", required_argument, 0, OPT_ZERO_COPY},
+    {"out",     required_argument, 0, OPT_OUT},
+    {"out-format", required_argument, 0, OPT_OUT_FORMAT},
+    {"path",    required_argument, 0, OPT_PATH},
+    {"direction", required_argument, 0, OPT_DIRECTION},
+    {"ch",      required_argument, 0, OPT_CH},
+    {"table",   no_argument,       0, OPT_TABLE},
+    {"threads", required_argument, 0, 't'},
+    {"help",    no_argument,       0, 'h'},
+    {0, 0, 0, 0}
+  };
+  int opt;
+  while((opt = getopt_long(argc, argv, "e:m:b:d:g:cl:s:S:B:o:t:h", long_options, NULL)) != -1) {
+    switch(opt) {
+    case 'e':
+      if(!strcmp(optarg, "auto"))         engine = ENGINE_AUTO;
+      else if(!strcmp(optarg, "opencl"))  engine = ENGINE_OPENCL;
+      else if(!strcmp(optarg, "cpu"))     engine = ENGINE_CPU;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case 'm':
+      if(!strcmp(optarg, "sweep"))          mode = MODE_SWEEP;
+      else if(!strcmp(optarg, "frontier"))  mode = MODE_FRONTIER;
+      else if(!strcmp(optarg, "delta"))     mode = MODE_DELTA;
+      else if(!strcmp(optarg, "apsp"))      mode = MODE_APSP;
+      else if(!strcmp(optarg, "johnson"))   mode = MODE_JOHNSON;
+      else if(!strcmp(optarg, "bidir"))     mode = MODE_BIDIR;
+      else if(!strcmp(optarg, "astar"))     mode = MODE_ASTAR;
+      else if(!strcmp(optarg, "ch"))        mode = MODE_CH;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case 'b':
+      batch = (cl_uint)strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      bucket_width = strtof(optarg, NULL);
+      break;
+    case 'g':
+      graph_file = optarg;
+      break;
+    case 'c':
+      use_cache = 1;
+      break;
+    case OPT_CONVERT:
+      convert_file = optarg;
+      break;
+    case OPT_SERVE:
+      serve_path = optarg;
+      break;
+    case 'l':
+      if(!strcmp(optarg, "packed"))       layout = LAYOUT_PACKED;
+      else if(!strcmp(optarg, "wide"))    layout = LAYOUT_WIDE;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_APSP_KERNEL:
+      if(!strcmp(optarg, "auto"))         cpu_kernel = APSP_KERNEL_AUTO;
+      else if(!strcmp(optarg, "scalar"))  cpu_kernel = APSP_KERNEL_SCALAR;
+      else if(!strcmp(optarg, "avx2"))    cpu_kernel = APSP_KERNEL_AVX2;
+      else if(!strcmp(optarg, "avx512"))  cpu_kernel = APSP_KERNEL_AVX512;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      if(!apsp_kernel_supported(cpu_kernel)) {
+	problem("This CPU does not support the %s kernel.\n", optarg);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_APSP_BENCH:
+      apsp_bench = 1;
+      break;
+    case OPT_APSP_OUT:
+      apsp_out = optarg;
+      break;
+    case OPT_APSP_MATRIX:
+      apsp_matrix_file = optarg;
+      break;
+    case OPT_APSP_MEMORY:
+      apsp_memory = (cl_ulong)strtoull(optarg, NULL, 10) << 20;
+      if(!apsp_memory) {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_BOUND: {
+      char *end;
+      bound = strtof(optarg, &end);
+      if(end == optarg || *end || !(bound >= 0)) {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    }
+    case 'o':
+      if(!strcmp(optarg, "none"))         order = ORDER_NONE;
+      else if(!strcmp(optarg, "rcm"))     order = ORDER_RCM;
+      else if(!strcmp(optarg, "degree"))  order = ORDER_DEGREE;
+      else if(!strcmp(optarg, "hilbert")) order = ORDER_HILBERT;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_COORDS:
+      coords_file = optarg;
+      break;
+    case OPT_SCHEDULE:
+      if(!strcmp(optarg, "auto"))         schedule = SCHEDULE_AUTO;
+      else if(!strcmp(optarg, "vertex"))  schedule = SCHEDULE_VERTEX;
+      else if(!strcmp(optarg, "binned"))  schedule = SCHEDULE_BINNED;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_GENERATE: {
+      char name[16];
+      if(sscanf(optarg, "%15[a-z]:%u", name, &gen_scale) != 2 || parse_family(name, &family)) {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    }
+    case OPT_SEED:
+      seed = strtoull(optarg, NULL, 10);
+      break;
+    case OPT_EDGE_FACTOR:
+      edge_factor = (cl_uint)strtoul(optarg, NULL, 10);
+      break;
+    case OPT_BENCH:
+      bench = 1;
+      break;
+    case OPT_BENCH_FORMAT:
+      if(!strcmp(optarg, "json"))         bench_cfg.format = BENCH_JSON;
+      else if(!strcmp(optarg, "csv"))     bench_cfg.format = BENCH_CSV;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_BENCH_OUT:
+      bench_cfg.out_file = optarg;
+      break;
+    case OPT_SCALES:
+      if(parse_sources(optarg, &scales, &num_scales, &scales_capacity)) {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_REPEAT:
+      bench_cfg.repeat = (cl_uint)strtoul(optarg, NULL, 10);
+      if(!bench_cfg.repeat) {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_TRACE:
+      trace_path = optarg;
+      break;
+    case OPT_KERNEL_CACHE:
+      kernel_cache = strcmp(optarg, "none") ? optarg : NULL;
+      break;
+    case OPT_UPDATES:
+      update_files = (const char **)realloc(update_files, sizeof(char *)*(num_update_files + 1));
+      update_files[num_update_files++] = optarg;
+      break;
+    case OPT_PARTITIONS:
+      num_parts = (cl_uint)strtoul(optarg, NULL, 10);
+      if(num_parts < 1 || num_parts > MAX_PARTITIONS) {
+	problem("--partitions takes 1 to %d.\n", MAX_PARTITIONS);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_SPLIT:
+      if(!strcmp(optarg, "auto"))          split = SPLIT_AUTO;
+      else if(!strcmp(optarg, "numa"))     split = SPLIT_NUMA;
+      else if(!strcmp(optarg, "equal"))    split = SPLIT_EQUAL;
+      else if(!strcmp(optarg, "devices"))  split = SPLIT_DEVICES;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_DEVICE_TYPE:
+      if(!strcmp(optarg, "gpu"))           device_type = CL_DEVICE_TYPE_GPU;
+      else if(!strcmp(optarg, "cpu"))      device_type = CL_DEVICE_TYPE_CPU;
+      else if(!strcmp(optarg, "all"))      device_type = CL_DEVICE_TYPE_ALL;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_ZERO_COPY:
+      if(!strcmp(optarg, "auto"))          zero_copy = -1;
+      else if(!strcmp(optarg, "on"))       zero_copy = 1;
+      else if(!strcmp(optarg, "off"))      zero_copy = 0;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_DIRECTION:
+      if(!strcmp(optarg, "auto"))          direction = DIRECTION_AUTO;
+      else if(!strcmp(optarg, "pull"))     direction = DIRECTION_PULL;
+      else if(!strcmp(optarg, "push"))     direction = DIRECTION_PUSH;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_CH:
+      ch_file = optarg;
+      break;
+    case OPT_TABLE:
+      table = 1;
+      break;
+    case OPT_OUT:
+      out_file = optarg;
+      break;
+    case OPT_OUT_FORMAT:
+      if(!strcmp(optarg, "text"))          out_format = RESULT_TEXT;
+      else if(!strcmp(optarg, "binary"))   out_format = RESULT_BINARY;
+      else {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case OPT_PATH:
+      if(parse_sources(optarg, &targets, &num_targets, &targets_capacity)) {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case 's':
+      if(parse_sources(optarg, &sources, &num_sources, &sources_capacity)) {
+	usage(argv[0]);
+	return EXIT_FAILURE;
+      }
+      break;
+    case 'S':
+      if(read_sources_file(optarg, &sources, &num_sources, &sources_capacity))
+	return EXIT_FAILURE;
+      break;
+    case 'B':
+      per_pass = (cl_uint)strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      num_threads = (cl_uint)strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+  if(optind < argc)
+    kernel_file = argv[optind];
 
-  //Get device id.
-  cl_device_id device_id;
-  cl_platform_id platform = 0;
-  err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_GPU , 1, &device_id, NULL);
-  check_failure(err);
-  
-  //Output the name of our device.
-  cl_char vendor_name[1024];
-  cl_char device_name[1024];
-  err = clGetDeviceInfo(device_id, CL_DEVICE_VENDOR, sizeof(vendor_name), vendor_name, NULL);
-  err|= clGetDeviceInfo(device_id, CL_DEVICE_NAME, sizeof(device_name), device_name, NULL);
-  check_failure(err);
-  printf("Using %s %s. \n", vendor_name, device_name);
-  printf(BAR);
-  
-  //Create a context.
-  cl_context context;
-  context = clCreateContext(0, 1, &device_id, NULL, NULL, &err);
-  check_failure(err);
+  graph g;
+  struct timeval start, end, delta;
+  thread_pool *pool = thread_pool_create(num_threads);
+  if(convert_file) {
+    if(load_dimacs(graph_file, pool, &g) || write_csr_cache(convert_file, &g, graph_file, pool))
+      return EXIT_FAILURE;
+    printf("Wrote %u vertices, %u edges to %s\n", g.num_vertices, g.num_edges, convert_file);
+    free_graph(&g);
+    thread_pool_destroy(pool);
+    return 0;
+  }
 
-  //Create a command queue.
-  cl_command_queue commands;
-  commands = clCreateCommandQueue(context, device_id, 0, &err);
-  check_failure(err);
+  if(bench) {
+    if(!num_scales)
+      parse_sources(DEFAULT_BENCH_SCALES, &scales, &num_scales, &scales_capacity);
+    bench_cfg.pool = pool;
+    bench_cfg.kernel_file = engine == ENGINE_CPU ? NULL : kernel_file;
+    bench_cfg.kernel_cache = kernel_cache;
+    bench_cfg.scales = scales;
+    bench_cfg.num_scales = num_scales;
+    bench_cfg.edge_factor = edge_factor;
+    bench_cfg.seed = seed;
+    if(!bench_cfg.out_file)
+      bench_cfg.out_file = bench_cfg.format == BENCH_CSV ? "bench.csv" : "bench.json";
+    err = run_bench(&bench_cfg);
+    thread_pool_destroy(pool);
+    free(scales);
+    free(sources);
+    return err ? EXIT_FAILURE : 0;
+  }
 
-  //Load kernel from file into a string.
-  char *source;
-  unsigned long source_length = 0;
-  if(argc < 2) {
-    source = LoadTextFromFile(DEFAULT_KERNEL_FILENAME, &source_length);
-  } else {
-    source = LoadTextFromFile(argv[1], &source_length);
+  int p2p = mode == MODE_BIDIR || mode == MODE_ASTAR || mode == MODE_CH;
+  if(p2p) {
+    if(!num_targets) {
+      problem("-m %s answers the --path targets; give some.\n",
+	      mode == MODE_ASTAR ? "astar" : mode == MODE_CH ? "ch" : "bidir");
+      return EXIT_FAILURE;
+    }
+    if(engine == ENGINE_OPENCL)
+      problem("Point-to-point searches run on the CPU.\n");
+    engine = ENGINE_CPU;
   }
-  
-  //Create our kernel.
-  cl_program program;
-  cl_kernel update_vertex_kernel;
-  cl_kernel init_distances_kernel;
-  program = clCreateProgramWithSource(context, 1, (const char **)&source, NULL, &err);
-  check_failure(err);
-  err = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-  if (err != CL_SUCCESS) {
-    char buffer[9999];
-    
-    problem("ERROR: Failed to build program executable! %s\n", GetErrorString(err));
-    err = clGetProgramBuildInfo(program, device_id, CL_PROGRAM_BUILD_LOG,
-				sizeof(buffer), buffer, NULL);
-    check_failure(err);
-    problem("okay...%s\n", buffer);
+  trace_file *tracer = NULL;
+  if(trace_path && !(tracer = trace_open(trace_path)))
+    return EXIT_FAILURE;
+  if(bound < INFINITY && ((mode != MODE_SWEEP && mode != MODE_FRONTIER && mode != MODE_DELTA) ||
+			  num_sources > 1 || serve_path || apsp_bench || num_update_files ||
+			  num_parts > 1)) {
+    problem("--bound takes a single-source sweep, frontier or delta solve, without --updates\n"
+	    "or --partitions.\n");
     return EXIT_FAILURE;
   }
-  update_vertex_kernel = clCreateKernel(program, "UpdateVertex", &err);
-  init_distances_kernel = clCreateKernel(program, "InitDistances", &err);
-  check_failure(err);
-  
-  //
-
-  edge *edges;
-  vertex *vertices;
-  char name[] = "NewYorkRM";
-  
-  cl_uint num_edges = graph_data_from_file(name, &edges);
-  cl_uint num_vertices  = build_vertex_array(edges, num_edges, &vertices);
-  cl_float *distances = (cl_float *)malloc(sizeof(cl_float)*num_vertices);
-  
-  cl_mem _edges;
-  cl_mem _vertices;
-  cl_mem _distances;
-  cl_mem _update;
-  cl_mem _preds;
-  
-
-  
-  
-  printf("Creating data buffers.\n");
-  printf(BAR);
-  //Create data buffers on the device.
-  
-  
-  _distances    = clCreateBuffer(context, CL_MEM_READ_WRITE,
-				 sizeof(cl_float)*num_vertices, NULL, NULL);
-  _preds        = clCreateBuffer(context, CL_MEM_READ_WRITE,
-				 sizeof(cl_uint)*num_vertices, NULL, NULL);
-  _edges        = clCreateBuffer(context,  CL_MEM_READ_ONLY,
-				 sizeof(edge)*num_edges,   NULL, NULL);
-  _vertices     = clCreateBuffer(context,  CL_MEM_READ_ONLY,
-				 sizeof(vertex)*num_vertices, NULL, NULL);
-  _update       = clCreateBuffer(context, CL_MEM_READ_WRITE,
-				 sizeof(cl_uint), NULL, NULL);
-
-  
-  if(!_vertices || !_edges || !_distances || !_update) {
-    problem("Failed to allocate device memory.\n");
-    exit(-1);
+  if(num_parts > 1 && (mode != MODE_SWEEP || num_sources > 1 || serve_path || apsp_bench ||
+		     num_update_files || engine == ENGINE_CPU)) {
+    problem("--partitions splits a single-source OpenCL sweep.\n");
+    return EXIT_FAILURE;
+  }
+  opencl_env env;
+  device_set devices;
+  if(engine != ENGINE_CPU && num_parts > 1) {
+    err = opencl_partition_setup(&devices, device_type, num_parts, split, kernel_file, layout,
+				 kernel_cache);
+    if(err != CL_SUCCESS) {
+      if(engine == ENGINE_OPENCL)
+	check_failure(err);
+      problem("Could not set up %u OpenCL partitions (%s), falling back to the CPU engine.\n",
+	      num_parts, GetErrorString(err));
+      engine = ENGINE_CPU;
+      num_parts = 1;
+    } else {
+      engine = ENGINE_OPENCL;
+      printf("Running %u partitions.\n", num_parts);
+      printf(BAR);
+    }
+  } else if(engine != ENGINE_CPU) {
+    err = opencl_setup(&env, device_type, kernel_file, layout, tracer, kernel_cache);
+    if(err != CL_SUCCESS) {
+      if(engine == ENGINE_OPENCL)
+	check_failure(err);
+      problem("No OpenCL GPU available (%s), falling back to the CPU engine.\n",
+	      GetErrorString(err));
+      engine = ENGINE_CPU;
+    } else {
+      engine = ENGINE_OPENCL;
+      env.schedule = schedule;
+      env.direction = direction;
+      if(zero_copy >= 0)
+	env.zero_copy = zero_copy ? CL_TRUE : CL_FALSE;
+      printf("Edge layout: %s, %u bytes per edge.\n", layout == LAYOUT_WIDE ? "wide" : "packed",
+	     (unsigned)(layout == LAYOUT_WIDE ? sizeof(edge) : sizeof(gpu_edge)));
+      printf("Buffers: %s\n", env.zero_copy ? "zero-copy, host arrays used in place" :
+	     "copied to the device");
+      printf(BAR);
+    }
   }
-  
-  printf("Putting data into device memory.\n");
-  printf(BAR);
-  //Put data into device Memory.
-  err  =  clEnqueueWriteBuffer(commands, _edges, CL_TRUE, 0, 
-			       sizeof(edge)*num_edges , edges, 0, NULL, NULL);
-  err |=  clEnqueueWriteBuffer(commands, _vertices, CL_TRUE, 0,
-			       sizeof(vertex)*num_vertices, vertices, 0, NULL, NULL);
-
-  check_failure(err);
-
-
-  
-  int a = 0;
-  printf("Setting Kernel Arguments.\n");
-  printf(BAR);
-  //Set arguments.
-  err  =  clSetKernelArg(init_distances_kernel, 0, sizeof(cl_mem), &_distances);
-
-
-  err  =  clSetKernelArg(update_vertex_kernel, a++, sizeof(cl_mem), &_edges);
-  err |=  clSetKernelArg(update_vertex_kernel, a++, sizeof(cl_mem), &_distances);
-  err |=  clSetKernelArg(update_vertex_kernel, a++, sizeof(cl_mem), &_preds);
-  err |=  clSetKernelArg(update_vertex_kernel, a++, sizeof(cl_mem), &_vertices);
-  err |=  clSetKernelArg(update_vertex_kernel, a++, sizeof(cl_mem), &_update);
-  err |=  clSetKernelArg(update_vertex_kernel, a++, sizeof(cl_uint), &num_vertices);
-  err |=  clSetKernelArg(update_vertex_kernel, a++, sizeof(cl_uint), &num_edges);
-  
-  check_failure(err);
 
-  clFinish(commands);
-  printf("Running.\n");
+  gettimeofday(&start, NULL);
+  if(gen_scale) {
+    if(generate_graph(pool, family, gen_scale, edge_factor, seed, &g))
+      return EXIT_FAILURE;
+  } else if(load_graph(graph_file, use_cache, pool, &g)) {
+    return EXIT_FAILURE;
+  }
+  gettimeofday(&end, NULL);
+  trace_span(tracer, "load", start, end);
+  delta = tv_delta(start, end);
+  printf("%s %u vertices, %u edges in %ld.%06ld\n", gen_scale ? "Generated" : "Loaded",
+	 g.num_vertices, g.num_edges, (long int)delta.tv_sec, (long int)delta.tv_usec);
   printf(BAR);
-  
-  size_t global[] = {num_vertices + LOCAL_WORK_SIZE - (num_vertices % LOCAL_WORK_SIZE)};
-  size_t local[] = {LOCAL_WORK_SIZE};
-  //Run our program.
-
+  char *found_coords = NULL;
+  if(!coords_file && mode == MODE_ASTAR && !gen_scale)
+    coords_file = found_coords = sibling_coords(graph_file);
+  if(coords_file && load_coordinates(coords_file, &g))
+    return EXIT_FAILURE;
+  free(found_coords);
+  if(order != ORDER_NONE) {
+    gettimeofday(&start, NULL);
+    if(reorder_graph(pool, &g, order))
+      return EXIT_FAILURE;
+    gettimeofday(&end, NULL);
+    trace_span(tracer, "reorder", start, end);
+    delta = tv_delta(start, end);
+    printf("Reordered vertices (%s) in %ld.%06ld\n",
+	   order == ORDER_RCM ? "rcm" : order == ORDER_DEGREE ? "degree" : "hilbert",
+	   (long int)delta.tv_sec, (long int)delta.tv_usec);
+    printf(BAR);
+  }
+  if(serve_path) {
+    server_config config;
+    config.socket_path = serve_path;
+    config.env = engine == ENGINE_OPENCL ? &env : NULL;
+    config.pool = pool;
+    config.g = &g;
+    config.max_sources = per_pass ? per_pass : DEFAULT_SOURCES_PER_PASS;
+    if(engine == ENGINE_OPENCL && config.max_sources > opencl_max_sources(&env, &g))
+      config.max_sources = opencl_max_sources(&env, &g);
+    config.batch = batch;
+    err = run_server(&config);
+    trace_close(tracer);
+    if(engine == ENGINE_OPENCL)
+      opencl_release(&env);
+    thread_pool_destroy(pool);
+    free_graph(&g);
+    free(sources);
+    return err ? EXIT_FAILURE : 0;
+  }
+  if(num_sources == 0) {
+    sources = (cl_uint *)malloc(sizeof(cl_uint));
+    sources[num_sources++] = DEFAULT_SOURCE;
+  }
+  for(cl_uint i = 0; i < num_sources; i++) {
+    if(sources[i] >= g.num_vertices) {
+      problem("Source %u is not a vertex; the graph has %u.\n", sources[i], g.num_vertices);
+      return EXIT_FAILURE;
+    }
+    sources[i] = internal_id(&g, sources[i]);
+  }
+  cl_uint source = sources[0];
+  if(num_parts > g.num_vertices) {
+    problem("%u partitions for %u vertices.\n", num_parts, g.num_vertices);
+    return EXIT_FAILURE;
+  }
+  if(num_update_files && (num_sources > 1 || mode == MODE_APSP || mode == MODE_JOHNSON ||
+			  apsp_bench || p2p))
+    problem("--updates repairs a single-source solution; ignoring it.\n");
+  if(out_file && p2p)
+    problem("--out takes a single-source solution; ignoring it.\n");
+  if((table || ch_file) && mode != MODE_CH)
+    problem("--table and --ch go with -m ch; ignoring them.\n");
+  if((out_file || num_targets) && !p2p && (num_sources > 1 || mode == MODE_APSP ||
+					    mode == MODE_JOHNSON || apsp_bench))
+    problem("--out and --path take a single-source solution; ignoring them.\n");
+  if((apsp_matrix_file || apsp_memory) && (mode != MODE_APSP || apsp_bench))
+    problem("--apsp-matrix and --apsp-memory go with -m apsp; ignoring them.\n");
+  if(mode == MODE_APSP || apsp_bench) {
+    cl_uint n = g.num_vertices;
+    apsp_matrix matrix;
+    if(apsp_matrix_alloc(&matrix, n, apsp_bench ? NULL : apsp_matrix_file) < 0)
+      return EXIT_FAILURE;
+    cl_float *dist = matrix.dist;
+    cl_uint *pred = matrix.pred;
+    apsp_init(pool, &g, dist, pred);
+    if(apsp_bench) {
+      err = apsp_benchmark(pool, n, dist, pred);
+    } else {
+      cl_ulong budget = apsp_memory, max_alloc;
+      cl_uint tile, row_tiles;
+      if(engine == ENGINE_OPENCL) {
+	cl_ulong device_memory = opencl_apsp_memory(&env, &max_alloc);
+	if(!budget)
+	  budget = device_memory;
+	tile = apsp_tile_size(n, budget, max_alloc, APSP_BLOCK, &row_tiles);
+      } else {
+	if(!budget)
+	  budget = apsp_matrix_file ? host_apsp_memory() : CL_ULONG_MAX;
+	tile = apsp_tile_size(n, budget, budget, APSP_CPU_BLOCK, &row_tiles);
+	printf("CPU kernel: %s\n", apsp_kernel_name(apsp_select_kernel(cpu_kernel)));
+      }
+      if(tile)
+	printf("Out of core: %u x %u tiles, %u row tiles held\n", tile, tile, row_tiles);
+      if(engine != ENGINE_OPENCL || tile)
+	printf(BAR);
+      tiled_stats tiled;
+      gettimeofday(&start, NULL);
+      if(tile)
+	tiled_floyd_warshall(pool, engine == ENGINE_OPENCL ? &env : NULL, cpu_kernel, n, dist,
+			     pred, tile, row_tiles, &tiled);
+      else if(engine == ENGINE_OPENCL)
+	opencl_floyd_warshall(&env, n, dist, pred);
+      else
+	cpu_floyd_warshall(pool, cpu_kernel, n, dist, pred);
+      gettimeofday(&end, NULL);
+      trace_span(tracer, "solve", start, end);
+      delta = tv_delta(start, end);
+      cl_float *row = (cl_float *)malloc(sizeof(cl_float)*n);
+      cl_uint *row_preds = (cl_uint *)malloc(sizeof(cl_uint)*n);
+      restore_row(&g, dist + (size_t)source*n, pred + (size_t)source*n, row, row_preds);
+      printArray(row, n < 64 ? n : 64);
+      UIprintArray(row_preds, n < 64 ? n : 64);
+      printf("%s Time: %ld.%06ld\n", engine == ENGINE_OPENCL ? "GPU" : "CPU",
+	     (long int)delta.tv_sec, (long int)delta.tv_usec);
+      if(tile)
+	printf("Tile traffic: %.2f GB\n", tiled.bytes_moved*1e-9);
+      err = 0;
+      if(apsp_out) {
+	FILE *out = fopen(apsp_out, "wb");
+	cl_uint i;
+	for(i = 0; out && !err && i < n; i++) {
+	  cl_uint at = internal_id(&g, i);
+	  restore_row(&g, dist + (size_t)at*n, pred + (size_t)at*n, row, NULL);
+	  if(fwrite(row, sizeof(cl_float), n, out) != n)
+	    err = -1;
+	}
+	if(!out || (fclose(out) && !err))
+	  err = -1;
+	if(err)
+	  problem("Could not write %s\n", apsp_out);
+      }
+      free(row);
+      free(row_preds);
+    }
+    printf(BAR);
+    trace_close(tracer);
+    if(engine == ENGINE_OPENCL)
+      opencl_release(&env);
+    thread_pool_destroy(pool);
+    free_graph(&g);
+    free(sources);
+    apsp_matrix_free(&matrix);
+    return err ? EXIT_FAILURE : 0;
+  }
+  if(mode == MODE_JOHNSON) {
+    row_sink sink;
+    sssp_stats stats;
+    memset(&sink, 0, sizeof(sink));
+    sink.g = &g;
+    sink.source = source;
+    sink.row = (cl_float *)malloc(sizeof(cl_float)*g.num_vertices);
+    sink.row_preds = (cl_uint *)malloc(sizeof(cl_uint)*g.num_vertices);
+    if(apsp_out && !(sink.out = fopen(apsp_out, "wb"))) {
+      problem("Could not create %s\n", apsp_out);
+      return EXIT_FAILURE;
+    }
+    build_out_edges(&g);
+    gettimeofday(&start, NULL);
+    err = johnson_apsp(pool, engine == ENGINE_OPENCL ? &env : NULL, &g, batch, sink_row, &sink,
+		       &stats);
+    gettimeofday(&end, NULL);
+    trace_span(tracer, "solve", start, end);
+    delta = tv_delta(start, end);
+    if(sink.out && fclose(sink.out))
+      sink.failed = 1;
+    if(sink.failed) {
+      problem("Could not write %s\n", apsp_out);
+      err = -1;
+    }
+    if(!err) {
+      printArray(sink.head, g.num_vertices < 64 ? g.num_vertices : 64);
+      UIprintArray(sink.head_preds, g.num_vertices < 64 ? g.num_vertices : 64);
+      printf("%s Time: %ld.%06ld\n", engine == ENGINE_OPENCL ? "GPU" : "CPU",
+	     (long int)delta.tv_sec, (long int)delta.tv_usec);
+      printf("Reweighting rounds: %u, edges scanned: %llu, reachable pairs: %llu\n",
+	     stats.rounds, (unsigned long long)stats.edges_scanned,
+	     (unsigned long long)sink.reached);
+      printf(BAR);
+    }
+    trace_close(tracer);
+    if(engine == ENGINE_OPENCL)
+      opencl_release(&env);
+    thread_pool_destroy(pool);
+    free_graph(&g);
+    free(sources);
+    free(sink.row);
+    free(sink.row_preds);
+    return err ? EXIT_FAILURE : 0;
+  }
+  if(p2p) {
+    hierarchy ch;
+    build_out_edges(&g);
+    if(mode == MODE_CH) {
+      err = prepare_hierarchy(&g, ch_file, &ch, tracer);
+      if(!err) {
+	if(table)
+	  err = run_table(&g, &ch, sources, num_sources, targets, num_targets, tracer);
+	else
+	  err = run_p2p(&g, P2P_BIDIRECTIONAL, &ch, sources, num_sources, targets, num_targets,
+			tracer);
+	free_hierarchy(&ch);
+      }
+    } else {
+      err = run_p2p(&g, mode == MODE_ASTAR ? P2P_ASTAR : P2P_BIDIRECTIONAL, NULL, sources,
+		    num_sources, targets, num_targets, tracer);
+    }
+    trace_close(tracer);
+    thread_pool_destroy(pool);
+    free_graph(&g);
+    free(sources);
+    free(targets);
+    return err ? EXIT_FAILURE : 0;
+  }
+  if(num_sources > 1) {
+    if(mode != MODE_SWEEP)
+      problem("Several sources are answered together in sweep mode.\n");
+    if(!per_pass)
+      per_pass = engine == ENGINE_OPENCL ? opencl_max_sources(&env, &g) : DEFAULT_SOURCES_PER_PASS;
+    if(per_pass > num_sources)
+      per_pass = num_sources;
+    printf("Answering %u sources, %u per pass.\n", num_sources, per_pass);
+    printf(BAR);
+    sssp_stats stats;
+    gettimeofday(&start, NULL);
+    run_multi(engine, &env, pool, &g, sources, num_sources, per_pass, batch, &stats);
+    gettimeofday(&end, NULL);
+    trace_span(tracer, "solve", start, end);
+    delta = tv_delta(start, end);
+    printf(BAR);
+    printf("%s Time: %ld.%06ld\n", engine == ENGINE_OPENCL ? "GPU" : "CPU",
+	   (long int)delta.tv_sec, (long int)delta.tv_usec);
+    printf("Rounds: %u, edges scanned: %llu\n", stats.rounds,
+	   (unsigned long long)stats.edges_scanned);
+    printf(BAR);
+    trace_close(tracer);
+    if(engine == ENGINE_OPENCL)
+      opencl_release(&env);
+    thread_pool_destroy(pool);
+    free_graph(&g);
+    free(sources);
+    return 0;
+  }
+  if(mode == MODE_DELTA && has_negative_weights(&g)) {
+    problem("Delta-stepping needs non-negative weights; use -m frontier or sweep.\n");
+    return EXIT_FAILURE;
+  }
+  //A path may climb past the bound and come back under it on a negative arc.
+  if(bound < INFINITY && has_negative_weights(&g)) {
+    problem("--bound needs non-negative weights.\n");
+    return EXIT_FAILURE;
+  }
+  if(mode != MODE_SWEEP)
+    build_out_edges(&g);
+  if(mode == MODE_DELTA) {
+    if(bucket_width <= 0)
+      bucket_width = default_delta(&g);
+    printf("Delta: %g\n", bucket_width);
+    printf(BAR);
+  }
+  cl_float *result = (cl_float *)malloc(sizeof(cl_float)*g.num_vertices);
+  cl_uint *preds = (cl_uint *)malloc(sizeof(cl_uint)*g.num_vertices);
+  sssp_stats stats;
 
-  clEnqueueNDRangeKernel(commands, init_distances_kernel, 1, NULL, global, NULL, 0, NULL, NULL);
-  cl_float *result;
-  result = (cl_float *)malloc(sizeof(cl_float)*num_vertices); 
-  clFinish(commands);
-  cl_uint i;
-  cl_uint update;
-  cl_uint *preds = (cl_uint *)malloc(sizeof(cl_uint)*num_vertices);
-  struct timeval start, end, delta;
   gettimeofday(&start, NULL);
-  for(i = 0; i < num_vertices; i++) {
-    /*
-    err = clEnqueueReadBuffer(commands, _distances, CL_TRUE, 0, sizeof(cl_float)*128,
-			      result, 0, NULL, NULL );
-    err = clEnqueueReadBuffer(commands, _preds, CL_TRUE, 0, sizeof(cl_float)*128,
-			      preds, 0, NULL, NULL );
-    clFinish(commands);
-    //    printArray(result, 64);
-    //UIprintArray(preds, 64);
-    */
-    err = clEnqueueNDRangeKernel(commands, update_vertex_kernel, 1, NULL, global, local, 0, NULL, NULL);
-    clFinish(commands);
-    err = clEnqueueReadBuffer(commands, _update, CL_TRUE, 0, sizeof(cl_uint),
-			      &update, 0, NULL, NULL );
-    clFinish(commands);
-    printf("Round %d, update: %d \n", i, update);
-    if(!update) break;
-  }
-  err = clEnqueueReadBuffer(commands, _distances, CL_TRUE, 0, sizeof(cl_float)*num_vertices,
-				result, 0, NULL, NULL );
-  clFinish(commands);
-  printArray(result, 64);
-  check_failure(err);
-  clFinish(commands);
+  if(num_parts > 1) {
+    opencl_partitioned_sssp(&devices, &g, source, result, preds, &stats);
+  } else if(engine == ENGINE_OPENCL) {
+    if(mode == MODE_FRONTIER)
+      opencl_frontier_sssp(&env, &g, source, bound, result, preds, &stats);
+    else if(mode == MODE_DELTA)
+      opencl_delta_stepping(&env, &g, source, bucket_width, bound, result, preds, &stats);
+    else
+      opencl_sssp(&env, &g, source, batch, bound, result, preds, &stats);
+  } else {
+    printf("Using %u CPU threads.\n", thread_pool_size(pool));
+    printf(BAR);
+    if(mode == MODE_FRONTIER)
+      cpu_frontier_sssp(pool, &g, source, bound, result, preds, &stats);
+    else if(mode == MODE_DELTA)
+      cpu_delta_stepping(pool, &g, source, bucket_width, bound, result, preds, &stats);
+    else
+      cpu_bellman_ford(pool, &g, source, bound, result, preds, &stats);
+  }
   gettimeofday(&end, NULL);
+  trace_span(tracer, "solve", start, end);
   delta = tv_delta(start, end);
-  printf("GPU Time: %ld.%06ld\n", 
+  if(num_update_files) {
+    if(run_repairs(engine, &env, pool, &g, source, update_files, num_update_files, result, preds,
+		   tracer))
+      return EXIT_FAILURE;
+  }
+  gettimeofday(&start, NULL);
+  if(g.old_ids) {
+    cl_float *restored = (cl_float *)malloc(sizeof(cl_float)*g.num_vertices);
+    cl_uint *restored_preds = (cl_uint *)malloc(sizeof(cl_uint)*g.num_vertices);
+    restore_row(&g, result, preds, restored, restored_preds);
+    free(result);
+    free(preds);
+    result = restored;
+    preds = restored_preds;
+  }
+  printArray(result, g.num_vertices < 64 ? g.num_vertices : 64);
+  UIprintArray(preds, g.num_vertices < 64 ? g.num_vertices : 64);
+  if(bound < INFINITY) {
+    reached_vertex *reached = (reached_vertex *)malloc(sizeof(reached_vertex)*g.num_vertices);
+    cl_uint num_reached = collect_reached(result, preds, g.num_vertices, reached);
+    printf("Reached %u vertices within %g\n", num_reached, bound);
+    printf(BAR);
+    if(out_file) {
+      if(write_reached(out_file, out_format, original_id(&g, source), bound, reached,
+		       num_reached))
+	return EXIT_FAILURE;
+      printf("Wrote %u reached vertices to %s\n", num_reached, out_file);
+      printf(BAR);
+    }
+    free(reached);
+  } else if(out_file) {
+    if(write_result(out_file, out_format, original_id(&g, source), result, preds, g.num_vertices))
+      return EXIT_FAILURE;
+    printf("Wrote %u distances and preds to %s\n", g.num_vertices, out_file);
+    printf(BAR);
+  }
+  if(num_targets)
+    print_paths(original_id(&g, source), targets, num_targets, result, preds, g.num_vertices);
+  gettimeofday(&end, NULL);
+  trace_span(tracer, "output", start, end);
+  printf("%s Time: %ld.%06ld\n", engine == ENGINE_OPENCL ? "GPU" : "CPU",
 	 (long int)delta.tv_sec, 
 	 (long int)delta.tv_usec);
+  printf("Rounds: %u, edges scanned: %llu\n", stats.rounds,
+	 (unsigned long long)stats.edges_scanned);
   printf(BAR);
-  
-  printf("Getting data.\n");
-  printf(BAR);
-  //Retrieve and print output.
-  err = clEnqueueReadBuffer(commands, _distances, CL_TRUE, 0, sizeof(cl_float)*num_vertices,
-			    result, 0, NULL, NULL );
-  //printArray(result, num_vertices);
-  check_failure(err);
-  
-  
 
-  //Do the computation on the CPU to verify.
   printf("Cleanup.\n");
-  //Device Cleanup.
-  clReleaseProgram(program);
-  clReleaseKernel(update_vertex_kernel);
-  clReleaseKernel(init_distances_kernel);
-  clReleaseCommandQueue(commands);
-  clReleaseContext(context);
-  clReleaseMemObject(_distances);
-  clReleaseMemObject(_vertices);
-  clReleaseMemObject(_edges);
+  trace_close(tracer);
+  if(num_parts > 1)
+    opencl_partition_release(&devices);
+  else if(engine == ENGINE_OPENCL)
+    opencl_release(&env);
 
   //Memory Cleanup.
-  free(edges);
-  free(vertices);
-  free(distances);  
+  thread_pool_destroy(pool);
+  free_graph(&g);
+  free(result);
+  free(preds);
+  free(sources);
+  free(update_files);
+  free(targets);
   
   return 0;
 }
@@ -0,0 +1,1446 @@
+#include "opencl_sssp.h"
+#include "trace.h"
+
+/*--------------------------------------------------------------------------------*/
+
+//Host arrays the kernels only read.  With env->zero_copy the buffer wraps
+//the array in place (it must then outlive the buffer); otherwise it is
+//copied in at creation.
+static cl_mem input_buffer(opencl_env *env, size_t size, const void *host) {
+  return clCreateBuffer(env->context, CL_MEM_READ_ONLY |
+			(env->zero_copy ? CL_MEM_USE_HOST_PTR : CL_MEM_COPY_HOST_PTR),
+			size, (void *)host, NULL);
+}
+
+//Edge arrays a device_sssp keeps for repairs.  PatchEdges writes them while
+//plan_repair patches the host graph, so they are writable copies that never
+//wrap the host array, zero_copy or not.
+static cl_mem patched_buffer(opencl_env *env, size_t size, const void *host) {
+  return clCreateBuffer(env->context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, size,
+			(void *)host, NULL);
+}
+
+//Result buffers.  With env->zero_copy the caller's array is the buffer and
+//fetch_output only maps it to synchronise; otherwise it is read back.
+static cl_mem output_buffer(opencl_env *env, size_t size, void *host) {
+  if(env->zero_copy)
+    return clCreateBuffer(env->context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, size, host, NULL);
+  return clCreateBuffer(env->context, CL_MEM_READ_WRITE, size, NULL, NULL);
+}
+
+static cl_int fetch_output(opencl_env *env, cl_mem buffer, size_t size, void *host,
+			   cl_event *event) {
+  cl_int err;
+  if(!env->zero_copy)
+    return clEnqueueReadBuffer(env->commands, buffer, CL_TRUE, 0, size, host, 0, NULL, event);
+  void *mapped = clEnqueueMapBuffer(env->commands, buffer, CL_TRUE, CL_MAP_READ, 0, size, 0, NULL,
+				    event, &err);
+  if(err != CL_SUCCESS)
+    return err;
+  //The map is of host itself unless the runtime kept a shadow copy.
+  if(mapped != host)
+    memcpy(host, mapped, size);
+  return clEnqueueUnmapMemObject(env->commands, buffer, mapped, 0, NULL, NULL);
+}
+
+//Edge buffers in env->layout.  The packed in-edges stay on the graph for the
+//next run (a graph loaded from a binary cache already has them mapped in);
+//the out-edges are packed on the fly since delta-stepping reorders them,
+//straight into mapped device memory when it is shared with the host.  With
+//patched they come from patched_buffer instead.
+static cl_mem create_in_edges(opencl_env *env, graph *g, int patched) {
+  cl_mem (*create)(opencl_env *, size_t, const void *) = patched ? patched_buffer : input_buffer;
+  if(env->layout == LAYOUT_WIDE)
+    return create(env, sizeof(edge)*g->num_edges, g->edges);
+  pack_edges(g);
+  return create(env, sizeof(gpu_edge)*g->num_edges, g->packed_edges);
+}
+
+static cl_mem create_out_edges(opencl_env *env, graph *g, int patched) {
+  size_t size = sizeof(gpu_out_edge)*g->num_edges;
+  cl_mem (*create)(opencl_env *, size_t, const void *) = patched ? patched_buffer : input_buffer;
+  gpu_out_edge *packed;
+  cl_uint i;
+  cl_mem buffer = NULL;
+  cl_int err;
+  if(env->layout == LAYOUT_WIDE)
+    return create(env, sizeof(edge)*g->num_edges, g->out_edges);
+  if(env->zero_copy && !patched) {
+    buffer = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, size, NULL,
+			    NULL);
+    if(!buffer)
+      return NULL;
+    packed = (gpu_out_edge *)clEnqueueMapBuffer(env->commands, buffer, CL_TRUE,
+						 CL_MAP_WRITE_INVALIDATE_REGION, 0, size, 0, NULL,
+						 NULL, &err);
+    check_failure(err);
+  } else {
+    packed = (gpu_out_edge *)malloc(size);
+  }
+  for(i = 0; i < g->num_edges; i++) {
+    packed[i].dest = g->out_edges[i].dest;
+    packed[i].weight = g->out_edges[i].weight;
+  }
+  if(env->zero_copy && !patched) {
+    check_failure(clEnqueueUnmapMemObject(env->commands, buffer, packed, 0, NULL, NULL));
+    return buffer;
+  }
+  buffer = create(env, size, packed);
+  free(packed);
+  return buffer;
+}
+
+//Modelled global traffic for pulling over edges in-edges of vertices: the
+//edge records, a distance gather per edge, and per vertex its record,
+//distance and pred plus per_vertex more (see trace.h).
+static cl_ulong sweep_bytes(opencl_env *env, cl_ulong vertices, cl_ulong edges, size_t per_vertex) {
+  size_t edge_size = env->layout == LAYOUT_WIDE ? sizeof(edge) : sizeof(gpu_edge);
+  return edges*(edge_size + sizeof(cl_float)) +
+    vertices*(sizeof(vertex) + sizeof(cl_float) + sizeof(cl_uint) + per_vertex);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//One kernel launch of a sweep round.  Every sweep kernel takes the round's
+//update slot as argument 7 and the distance bound as 8.  name, edges and
+//bytes are for the trace.
+typedef struct _sweep_launch {
+  cl_kernel kernel;
+  size_t global;
+  size_t local;
+  const char *name;
+  cl_ulong edges;
+  cl_ulong bytes;
+} sweep_launch;
+
+//ends[j] is round j's last launch when tracing, else NULL.
+typedef struct _sweep_batch {
+  cl_uint flags[MAX_BATCH];
+  cl_event ends[MAX_BATCH];
+  cl_uint size;
+  cl_uint first_round;
+  cl_event done;
+} sweep_batch;
+
+//Queues k rounds of the launches, round j setting flag half*MAX_BATCH + j,
+//followed by a non-blocking read of those flags that signals b->done.
+static void enqueue_sweep_batch(opencl_env *env, const sweep_launch *launches,
+				cl_uint num_launches, cl_mem update, sweep_batch *b, int half,
+				cl_uint k, cl_uint first_round) {
+  static const cl_uint zeros[MAX_BATCH] = {0};
+  cl_command_queue commands = env->commands;
+  size_t at = sizeof(cl_uint)*half*MAX_BATCH;
+  cl_uint j, l, slot;
+  cl_event *ev = NULL;
+  cl_int err;
+  //Clear the flags from the host; a reset inside the kernel races with
+  //groups that have already finished.
+  err = clEnqueueWriteBuffer(commands, update, CL_FALSE, at, sizeof(cl_uint)*k, zeros, 0, NULL,
+			     trace_event(env->trace, "ClearFlags", first_round, sizeof(cl_uint)*k));
+  for(j = 0; j < k; j++) {
+    slot = half*MAX_BATCH + j;
+    for(l = 0; l < num_launches; l++) {
+      ev = trace_event(env->trace, launches[l].name, first_round + j, 0);
+      err |= clSetKernelArg(launches[l].kernel, 7, sizeof(cl_uint), &slot);
+      err |= clEnqueueNDRangeKernel(commands, launches[l].kernel, 1, NULL, &launches[l].global,
+				    &launches[l].local, 0, NULL, ev);
+    }
+    b->ends[j] = ev ? *ev : NULL;
+    if(b->ends[j])
+      clRetainEvent(b->ends[j]);
+  }
+  err |= clEnqueueReadBuffer(commands, update, CL_FALSE, at, sizeof(cl_uint)*k, b->flags,
+			     0, NULL, &b->done);
+  check_failure(err);
+  b->size = k;
+  b->first_round = first_round;
+}
+
+//One counter sample per round of a finished batch.
+static void trace_sweep_batch(opencl_env *env, const sweep_launch *launches,
+			      cl_uint num_launches, sweep_batch *b) {
+  cl_ulong edges = 0, bytes = 0;
+  cl_uint j, l;
+  if(!env->trace)
+    return;
+  for(l = 0; l < num_launches; l++) {
+    edges += launches[l].edges;
+    bytes += launches[l].bytes;
+  }
+  for(j = 0; j < b->size; j++)
+    trace_round(env->trace, b->ends[j], "sweep", b->first_round + j, b->flags[j], edges, bytes);
+}
+
+//Rounds are enqueued in batches, each with its own update flag.  While the
+//host waits for one batch's flags the next batch is already queued behind
+//it; rounds past convergence change nothing, so overshooting is harmless.
+//Returns the rounds up to and including the first quiet one and stores how
+//many were enqueued in total.
+static cl_uint run_sweep(opencl_env *env, const sweep_launch *launches,
+			 cl_uint num_launches, cl_mem update, cl_uint max_rounds, cl_uint batch,
+			 cl_uint *total) {
+  sweep_batch batches[2];
+  cl_uint k = batch ? (batch < MAX_BATCH ? batch : MAX_BATCH) : 1;
+  cl_uint enqueued, base = 0, rounds = 0, j;
+  int cur = 0, have_next;
+  cl_int err;
+  if(k > max_rounds)
+    k = max_rounds;
+  enqueue_sweep_batch(env, launches, num_launches, update, &batches[0], 0, k, 0);
+  enqueued = k;
+  for(;;) {
+    //Busy batches grow the next one so long runs pay for fewer checks.
+    if(!batch && k < MAX_BATCH)
+      k *= 2;
+    if(k > max_rounds - enqueued)
+      k = max_rounds - enqueued;
+    have_next = k > 0;
+    if(have_next) {
+      enqueue_sweep_batch(env, launches, num_launches, update, &batches[!cur], !cur, k, enqueued);
+      enqueued += k;
+    }
+    err = clWaitForEvents(1, &batches[cur].done);
+    check_failure(err);
+    clReleaseEvent(batches[cur].done);
+    trace_sweep_batch(env, launches, num_launches, &batches[cur]);
+    for(j = 0; j < batches[cur].size && batches[cur].flags[j]; j++);
+    if(j < batches[cur].size) {
+      rounds = base + j + 1;
+      break;
+    }
+    base += batches[cur].size;
+    if(!have_next) {
+      rounds = base;
+      break;
+    }
+    cur = !cur;
+  }
+  if(have_next) {
+    clWaitForEvents(1, &batches[!cur].done);
+    clReleaseEvent(batches[!cur].done);
+    trace_sweep_batch(env, launches, num_launches, &batches[!cur]);
+  }
+  *total = enqueued;
+  return rounds;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//The single-source sweep round, scheduled per env->schedule.  The vertex
+//schedule is UpdateVertex over everything.  The binned one splits the
+//vertices by in-degree into up to three lists, one launch each:
+//a work-item per vertex below BIN_WARP_DEGREE in-edges, a LOCAL_WORK_SIZE
+//work-group per vertex below BIN_GROUP_DEGREE, and a GROUP_WORK_SIZE
+//work-group per vertex above that.  Vertices with no in-edges are left out.
+typedef struct _sweep_plan {
+  sweep_launch launches[3];
+  cl_uint num_launches;
+  cl_mem lists[3];
+  cl_uint bin_sizes[3];
+  work_schedule schedule;
+} sweep_plan;
+
+//Auto picks the binned schedule as soon as one vertex would keep a
+//work-group busy for more than a couple of HALF_WARP tiles.
+static work_schedule resolve_schedule(opencl_env *env, graph *g) {
+  cl_uint v;
+  if(env->schedule != SCHEDULE_AUTO)
+    return env->schedule;
+  for(v = 0; v < g->num_vertices; v++)
+    if(g->vertices[v].num_edges >= BIN_WARP_DEGREE)
+      return SCHEDULE_BINNED;
+  return SCHEDULE_VERTEX;
+}
+
+static cl_kernel sweep_kernel(opencl_env *env, const char *name, cl_mem edges, cl_mem distances,
+			      cl_mem preds, cl_mem vertices, cl_mem update, const void *arg5,
+			      size_t arg5_size, cl_uint arg6, cl_float bound) {
+  cl_int err;
+  cl_kernel kernel = clCreateKernel(env->program, name, &err);
+  check_failure(err);
+  err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &edges);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &distances);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &preds);
+  err |= clSetKernelArg(kernel, 3, sizeof(cl_mem), &vertices);
+  err |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &update);
+  err |= clSetKernelArg(kernel, 5, arg5_size, arg5);
+  err |= clSetKernelArg(kernel, 6, sizeof(cl_uint), &arg6);
+  err |= clSetKernelArg(kernel, 8, sizeof(cl_float), &bound);
+  check_failure(err);
+  return kernel;
+}
+
+static void plan_sweep(opencl_env *env, graph *g, cl_mem edges, cl_mem distances, cl_mem preds,
+		       cl_mem vertices, cl_mem update, cl_float bound, sweep_plan *plan) {
+  static const char *bin_kernels[] = {"UpdateVertexList", "UpdateVertexGroup", "UpdateVertexGroup"};
+  cl_uint n = g->num_vertices, v, b;
+  memset(plan, 0, sizeof(sweep_plan));
+  plan->schedule = resolve_schedule(env, g);
+  if(plan->schedule == SCHEDULE_VERTEX) {
+    plan->launches[0].kernel = sweep_kernel(env, "UpdateVertex", edges, distances, preds, vertices,
+					    update, &n, sizeof(cl_uint), g->num_edges, bound);
+    plan->launches[0].global = n + LOCAL_WORK_SIZE - (n % LOCAL_WORK_SIZE);
+    plan->launches[0].local = LOCAL_WORK_SIZE;
+    plan->launches[0].name = "UpdateVertex";
+    plan->launches[0].edges = g->num_edges;
+    plan->launches[0].bytes = sweep_bytes(env, n, g->num_edges, 0);
+    plan->num_launches = 1;
+    return;
+  }
+
+  cl_uint *lists[3];
+  cl_ulong bin_edges[3] = {0, 0, 0};
+  for(b = 0; b < 3; b++)
+    lists[b] = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+  for(v = 0; v < n; v++) {
+    cl_uint degree = g->vertices[v].num_edges;
+    if(degree == 0)
+      continue;
+    b = degree < BIN_WARP_DEGREE ? 0 : degree < BIN_GROUP_DEGREE ? 1 : 2;
+    lists[b][plan->bin_sizes[b]++] = v;
+    bin_edges[b] += degree;
+  }
+  for(b = 0; b < 3; b++) {
+    cl_uint count = plan->bin_sizes[b];
+    if(count == 0)
+      continue;
+    plan->lists[b] = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				    sizeof(cl_uint)*count, lists[b], NULL);
+    if(!plan->lists[b]) {
+      problem("Failed to allocate device memory.\n");
+      exit(-1);
+    }
+    sweep_launch *l = &plan->launches[plan->num_launches++];
+    l->kernel = sweep_kernel(env, bin_kernels[b], edges, distances, preds, vertices, update,
+			     &plan->lists[b], sizeof(cl_mem), count, bound);
+    l->name = bin_kernels[b];
+    l->edges = bin_edges[b];
+    l->bytes = sweep_bytes(env, count, bin_edges[b], sizeof(cl_uint));
+    if(b == 0) {
+      l->local = LOCAL_WORK_SIZE;
+      l->global = count + LOCAL_WORK_SIZE - (count % LOCAL_WORK_SIZE);
+    } else {
+      size_t most = LOCAL_WORK_SIZE;
+      if(b == 2) {
+	//The reduction needs a power of two no larger than the device allows.
+	cl_int err = clGetKernelWorkGroupInfo(l->kernel, env->device_id, CL_KERNEL_WORK_GROUP_SIZE,
+					      sizeof(most), &most, NULL);
+	check_failure(err);
+	if(most > GROUP_WORK_SIZE)
+	  most = GROUP_WORK_SIZE;
+	while(most & (most - 1))
+	  most &= most - 1;
+      }
+      l->local = most;
+      l->global = (size_t)count*most;
+    }
+  }
+  for(b = 0; b < 3; b++)
+    free(lists[b]);
+}
+
+static void release_sweep_plan(sweep_plan *plan) {
+  cl_uint i;
+  for(i = 0; i < plan->num_launches; i++)
+    clReleaseKernel(plan->launches[i].kernel);
+  for(i = 0; i < 3; i++)
+    if(plan->lists[i])
+      clReleaseMemObject(plan->lists[i]);
+}
+
+cl_uint opencl_sssp(opencl_env *env, graph *g, cl_uint source, cl_uint batch, cl_float bound,
+		    cl_float *result, cl_uint *preds, sssp_stats *stats) {
+  cl_int err;
+  cl_command_queue commands = env->commands;
+  cl_uint num_vertices = g->num_vertices;
+  cl_uint num_edges = g->num_edges;
+  cl_kernel init_distances_kernel;
+  sweep_plan plan;
+  init_distances_kernel = clCreateKernel(env->program, "InitDistances", &err);
+  check_failure(err);
+  
+  cl_mem _edges;
+  cl_mem _vertices;
+  cl_mem _distances;
+  cl_mem _update;
+  cl_mem _preds;
+  
+  printf("Creating data buffers.\n");
+  printf(BAR);
+  //Create data buffers on the device.
+  _distances    = output_buffer(env, sizeof(cl_float)*num_vertices, result);
+  _preds        = output_buffer(env, sizeof(cl_uint)*num_vertices, preds);
+  _edges        = create_in_edges(env, g, 0);
+  _vertices     = input_buffer(env, sizeof(vertex)*num_vertices, g->vertices);
+  _update       = clCreateBuffer(env->context, CL_MEM_READ_WRITE,
+				 sizeof(cl_uint)*2*MAX_BATCH, NULL, NULL);
+
+  if(!_vertices || !_edges || !_distances || !_preds || !_update) {
+    problem("Failed to allocate device memory.\n");
+    exit(-1);
+  }
+  
+  int a = 0;
+  printf("Setting Kernel Arguments.\n");
+  printf(BAR);
+  //Set arguments.
+  err  =  clSetKernelArg(init_distances_kernel, a++, sizeof(cl_mem), &_distances);
+  err |=  clSetKernelArg(init_distances_kernel, a++, sizeof(cl_mem), &_preds);
+  err |=  clSetKernelArg(init_distances_kernel, a++, sizeof(cl_uint), &source);
+  err |=  clSetKernelArg(init_distances_kernel, a++, sizeof(cl_uint), &num_vertices);
+  check_failure(err);
+  plan_sweep(env, g, _edges, _distances, _preds, _vertices, _update, bound, &plan);
+  if(plan.schedule == SCHEDULE_BINNED)
+    printf("Binned schedule: %u vertices per work-item, %u per warp, %u per work-group.\n",
+	   plan.bin_sizes[0], plan.bin_sizes[1], plan.bin_sizes[2]);
+
+  printf("Running.\n");
+  printf(BAR);
+  
+  size_t global[] = {num_vertices + LOCAL_WORK_SIZE - (num_vertices % LOCAL_WORK_SIZE)};
+  //Run our program.
+  err = clEnqueueNDRangeKernel(commands, init_distances_kernel, 1, NULL, global, NULL, 0, NULL,
+			       trace_event(env->trace, "InitDistances", 0, 0));
+  check_failure(err);
+
+  cl_uint enqueued;
+  cl_uint rounds = run_sweep(env, plan.launches, plan.num_launches, _update, num_vertices,
+			     batch, &enqueued);
+  printf("Converged after %u rounds, %u enqueued.\n", rounds, enqueued);
+  printf(BAR);
+  
+  printf("Getting data.\n");
+  printf(BAR);
+  //Retrieve output.
+  err  = fetch_output(env, _distances, sizeof(cl_float)*num_vertices, result,
+		      trace_event(env->trace, "ReadDistances", rounds, sizeof(cl_float)*num_vertices));
+  err |= fetch_output(env, _preds, sizeof(cl_uint)*num_vertices, preds,
+		      trace_event(env->trace, "ReadPreds", rounds, sizeof(cl_uint)*num_vertices));
+  check_failure(err);
+  clFinish(commands);
+  trace_flush(env->trace);
+
+  if(stats) {
+    stats->rounds = rounds;
+    stats->edges_scanned = (cl_ulong)enqueued*num_edges;
+  }
+
+  //Device Cleanup.
+  release_sweep_plan(&plan);
+  clReleaseKernel(init_distances_kernel);
+  clReleaseMemObject(_distances);
+  clReleaseMemObject(_preds);
+  clReleaseMemObject(_update);
+  clReleaseMemObject(_vertices);
+  clReleaseMemObject(_edges);
+  return rounds;
+}
+
+//cpu_potentials on the device: the UpdateVertex sweep with every distance
+//starting at 0, as if from a virtual source joined to all vertices.
+cl_uint opencl_potentials(opencl_env *env, graph *g, cl_uint batch, cl_float *potentials,
+			  sssp_stats *stats) {
+  cl_int err;
+  cl_command_queue commands = env->commands;
+  cl_uint num_vertices = g->num_vertices;
+  cl_uint num_edges = g->num_edges;
+  cl_uint no_source = num_vertices;
+  cl_kernel init_distances_kernel;
+  sweep_plan plan;
+  init_distances_kernel = clCreateKernel(env->program, "InitDistances", &err);
+  check_failure(err);
+
+  cl_mem _edges, _vertices, _distances, _update, _preds;
+  _distances = clCreateBuffer(env->context, CL_MEM_READ_WRITE,
+			      sizeof(cl_float)*num_vertices, NULL, NULL);
+  _preds     = clCreateBuffer(env->context, CL_MEM_READ_WRITE,
+			      sizeof(cl_uint)*num_vertices, NULL, NULL);
+  _edges     = create_in_edges(env, g, 0);
+  _vertices  = input_buffer(env, sizeof(vertex)*num_vertices, g->vertices);
+  _update    = clCreateBuffer(env->context, CL_MEM_READ_WRITE,
+			      sizeof(cl_uint)*2*MAX_BATCH, NULL, NULL);
+  if(!_vertices || !_edges || !_distances || !_preds || !_update) {
+    problem("Failed to allocate device memory.\n");
+    exit(-1);
+  }
+
+  int a = 0;
+  err  = clSetKernelArg(init_distances_kernel, a++, sizeof(cl_mem), &_distances);
+  err |= clSetKernelArg(init_distances_kernel, a++, sizeof(cl_mem), &_preds);
+  err |= clSetKernelArg(init_distances_kernel, a++, sizeof(cl_uint), &no_source);
+  err |= clSetKernelArg(init_distances_kernel, a++, sizeof(cl_uint), &num_vertices);
+  check_failure(err);
+  plan_sweep(env, g, _edges, _distances, _preds, _vertices, _update, INFINITY, &plan);
+
+  size_t global[] = {num_vertices + LOCAL_WORK_SIZE - (num_vertices % LOCAL_WORK_SIZE)};
+  //InitDistances with no source resets the preds; the zeros go in after it.
+  memset(potentials, 0, sizeof(cl_float)*num_vertices);
+  err  = clEnqueueNDRangeKernel(commands, init_distances_kernel, 1, NULL, global, NULL, 0, NULL,
+				trace_event(env->trace, "InitDistances", 0, 0));
+  err |= clEnqueueWriteBuffer(commands, _distances, CL_FALSE, 0, sizeof(cl_float)*num_vertices,
+			      potentials, 0, NULL,
+			      trace_event(env->trace, "WriteDistances", 0, sizeof(cl_float)*num_vertices));
+  check_failure(err);
+
+  cl_uint enqueued;
+  cl_uint rounds = run_sweep(env, plan.launches, plan.num_launches, _update,
+			     num_vertices + 2, batch, &enqueued);
+  err = clEnqueueReadBuffer(commands, _distances, CL_TRUE, 0, sizeof(cl_float)*num_vertices,
+			    potentials, 0, NULL,
+			    trace_event(env->trace, "ReadDistances", rounds, sizeof(cl_float)*num_vertices));
+  check_failure(err);
+  trace_flush(env->trace);
+  if(stats) {
+    stats->rounds = rounds;
+    stats->edges_scanned = (cl_ulong)enqueued*num_edges;
+  }
+
+  release_sweep_plan(&plan);
+  clReleaseKernel(init_distances_kernel);
+  clReleaseMemObject(_distances);
+  clReleaseMemObject(_preds);
+  clReleaseMemObject(_update);
+  clReleaseMemObject(_vertices);
+  clReleaseMemObject(_edges);
+  return rounds;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Largest number of sources whose num_vertices x B distance and pred matrices
+//fit next to the graph in (most of) the device's memory.
+cl_uint opencl_max_sources(opencl_env *env, graph *g) {
+  cl_ulong global_mem, max_alloc;
+  cl_int err;
+  err  = clGetDeviceInfo(env->device_id, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(global_mem), &global_mem, NULL);
+  err |= clGetDeviceInfo(env->device_id, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(max_alloc), &max_alloc, NULL);
+  check_failure(err);
+  cl_ulong graph_bytes = (cl_ulong)g->num_edges*(env->layout == LAYOUT_WIDE ? sizeof(edge) : sizeof(gpu_edge)) +
+    (cl_ulong)g->num_vertices*sizeof(vertex);
+  cl_ulong usable = global_mem/4*3;
+  cl_ulong row_bytes = (cl_ulong)g->num_vertices*sizeof(cl_float);
+  if(usable <= graph_bytes || row_bytes == 0)
+    return 1;
+  cl_ulong fit = (usable - graph_bytes)/(2*row_bytes);
+  if(fit > max_alloc/row_bytes)
+    fit = max_alloc/row_bytes;
+  return fit < 1 ? 1 : fit > CL_UINT_MAX ? CL_UINT_MAX : (cl_uint)fit;
+}
+
+//Uploads the in-edge CSR once and builds the batched kernels so that any
+//number of opencl_multi_query calls can reuse them.
+void opencl_upload_graph(opencl_env *env, graph *g, device_graph *dg) {
+  cl_int err;
+  dg->num_vertices = g->num_vertices;
+  dg->num_edges = g->num_edges;
+  dg->edges = create_in_edges(env, g, 0);
+  dg->vertices = input_buffer(env, sizeof(vertex)*g->num_vertices, g->vertices);
+  dg->update = clCreateBuffer(env->context, CL_MEM_READ_WRITE, sizeof(cl_uint)*2*MAX_BATCH, NULL, NULL);
+  if(!dg->edges || !dg->vertices || !dg->update) {
+    problem("Failed to allocate device memory.\n");
+    exit(-1);
+  }
+  dg->init_kernel = clCreateKernel(env->program, "InitDistancesBatch", &err);
+  check_failure(err);
+  dg->update_kernel = clCreateKernel(env->program, "UpdateVertexBatch", &err);
+  check_failure(err);
+}
+
+void opencl_release_graph(device_graph *dg) {
+  clReleaseKernel(dg->init_kernel);
+  clReleaseKernel(dg->update_kernel);
+  clReleaseMemObject(dg->edges);
+  clReleaseMemObject(dg->vertices);
+  clReleaseMemObject(dg->update);
+}
+
+//Sweep mode for num_sources sources in one pass: UpdateVertexBatch relaxes
+//each in-edge it fetches against every source's distance, so the edge stream
+//is read once per round however many queries ride along.  result and preds
+//are num_vertices x num_sources, row-major by vertex.
+cl_uint opencl_multi_query(opencl_env *env, device_graph *dg, const cl_uint *sources,
+			   cl_uint num_sources, cl_uint batch, cl_float *result, cl_uint *preds,
+			   sssp_stats *stats) {
+  cl_int err;
+  cl_command_queue commands = env->commands;
+  cl_context context = env->context;
+  cl_uint num_vertices = dg->num_vertices;
+  size_t cells = (size_t)num_vertices*num_sources;
+
+  cl_mem _distances, _preds, _sources;
+  _distances = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float)*cells, NULL, NULL);
+  _preds     = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint)*cells, NULL, NULL);
+  _sources   = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			      sizeof(cl_uint)*num_sources, (void *)sources, NULL);
+  if(!_distances || !_preds || !_sources) {
+    problem("Failed to allocate device memory for %u sources.\n", num_sources);
+    exit(-1);
+  }
+
+  int a = 0;
+  err  = clSetKernelArg(dg->init_kernel, a++, sizeof(cl_mem), &_distances);
+  err |= clSetKernelArg(dg->init_kernel, a++, sizeof(cl_mem), &_preds);
+  err |= clSetKernelArg(dg->init_kernel, a++, sizeof(cl_mem), &_sources);
+  err |= clSetKernelArg(dg->init_kernel, a++, sizeof(cl_uint), &num_sources);
+  err |= clSetKernelArg(dg->init_kernel, a++, sizeof(cl_uint), &num_vertices);
+
+  a = 0;
+  err |= clSetKernelArg(dg->update_kernel, a++, sizeof(cl_mem), &dg->edges);
+  err |= clSetKernelArg(dg->update_kernel, a++, sizeof(cl_mem), &_distances);
+  err |= clSetKernelArg(dg->update_kernel, a++, sizeof(cl_mem), &_preds);
+  err |= clSetKernelArg(dg->update_kernel, a++, sizeof(cl_mem), &dg->vertices);
+  err |= clSetKernelArg(dg->update_kernel, a++, sizeof(cl_mem), &dg->update);
+  err |= clSetKernelArg(dg->update_kernel, a++, sizeof(cl_uint), &num_vertices);
+  err |= clSetKernelArg(dg->update_kernel, a++, sizeof(cl_uint), &num_sources);
+  check_failure(err);
+
+  size_t init_global[] = {cells + LOCAL_WORK_SIZE - (cells % LOCAL_WORK_SIZE)};
+  sweep_launch launch;
+  launch.kernel = dg->update_kernel;
+  launch.global = num_vertices + LOCAL_WORK_SIZE - (num_vertices % LOCAL_WORK_SIZE);
+  launch.local = LOCAL_WORK_SIZE;
+  launch.name = "UpdateVertexBatch";
+  launch.edges = dg->num_edges;
+  //Every edge reads the source's whole row; every vertex its own row twice.
+  launch.bytes = sweep_bytes(env, num_vertices, dg->num_edges, 0) +
+    (cl_ulong)dg->num_edges*sizeof(cl_float)*(num_sources - 1) +
+    (cl_ulong)num_vertices*(sizeof(cl_float) + sizeof(cl_uint))*(num_sources - 1);
+  err = clEnqueueNDRangeKernel(commands, dg->init_kernel, 1, NULL, init_global, NULL, 0, NULL,
+			       trace_event(env->trace, "InitDistancesBatch", 0, 0));
+  check_failure(err);
+
+  cl_uint enqueued;
+  cl_uint rounds = run_sweep(env, &launch, 1, dg->update, num_vertices, batch, &enqueued);
+
+  err  = clEnqueueReadBuffer(commands, _distances, CL_TRUE, 0, sizeof(cl_float)*cells,
+			     result, 0, NULL,
+			     trace_event(env->trace, "ReadDistances", rounds, sizeof(cl_float)*cells));
+  err |= clEnqueueReadBuffer(commands, _preds, CL_TRUE, 0, sizeof(cl_uint)*cells,
+			     preds, 0, NULL,
+			     trace_event(env->trace, "ReadPreds", rounds, sizeof(cl_uint)*cells));
+  check_failure(err);
+  trace_flush(env->trace);
+
+  if(stats) {
+    stats->rounds = rounds;
+    stats->edges_scanned = (cl_ulong)enqueued*dg->num_edges;
+  }
+
+  clReleaseMemObject(_distances);
+  clReleaseMemObject(_preds);
+  clReleaseMemObject(_sources);
+  return rounds;
+}
+
+cl_uint opencl_multi_sssp(opencl_env *env, graph *g, const cl_uint *sources, cl_uint num_sources,
+			  cl_uint batch, cl_float *result, cl_uint *preds, sssp_stats *stats) {
+  device_graph dg;
+  cl_uint rounds;
+  opencl_upload_graph(env, g, &dg);
+  rounds = opencl_multi_query(env, &dg, sources, num_sources, batch, result, preds, stats);
+  opencl_release_graph(&dg);
+  return rounds;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Frontier mode: UpdateFrontier pulls only over the vertices in ds->active
+//and queues the out-neighbours of whatever changed straight into ds->next,
+//so a round costs its frontier and not the graph.  The only per-round
+//readback is the queue length.  The state lives in a device_sssp so that
+//repairs can pick it up again.
+void opencl_upload_sssp(opencl_env *env, graph *g, device_sssp *ds) {
+  cl_int err;
+  cl_context context = env->context;
+  cl_uint num_vertices = g->num_vertices;
+  const cl_float unbounded = INFINITY;
+  ds->num_vertices = num_vertices;
+  ds->num_edges = g->num_edges;
+  ds->init_kernel = clCreateKernel(env->program, "InitDistances", &err);
+  check_failure(err);
+  ds->update_kernel = clCreateKernel(env->program, "UpdateFrontier", &err);
+  check_failure(err);
+  ds->flag_kernel = clCreateKernel(env->program, "FlagQueued", &err);
+  check_failure(err);
+  ds->patch_kernel = clCreateKernel(env->program, "PatchEdges", &err);
+  check_failure(err);
+  ds->reset_kernel = clCreateKernel(env->program, "ResetVertices", &err);
+  check_failure(err);
+  ds->push_kernel = clCreateKernel(env->program, "PushFrontier", &err);
+  check_failure(err);
+  ds->changed_kernel = clCreateKernel(env->program, "SettleChanged", &err);
+  check_failure(err);
+  ds->expand_kernel = clCreateKernel(env->program, "ExpandFrontier", &err);
+  check_failure(err);
+  ds->resolve_kernel = clCreateKernel(env->program, "ResolvePreds", &err);
+  check_failure(err);
+  ds->gather_kernel = clCreateKernel(env->program, "GatherTouched", &err);
+  check_failure(err);
+  ds->source = 0;
+  ds->push = !has_negative_weights(g);
+
+  cl_uint *host_flags = (cl_uint *)calloc(num_vertices ? num_vertices : 1, sizeof(cl_uint));
+  ds->distances    = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float)*num_vertices, NULL, NULL);
+  ds->preds        = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint)*num_vertices, NULL, NULL);
+  ds->edges        = create_in_edges(env, g, 1);
+  ds->vertices     = input_buffer(env, sizeof(vertex)*num_vertices, g->vertices);
+  ds->out_edges    = create_out_edges(env, g, 1);
+  ds->out_vertices = input_buffer(env, sizeof(vertex)*num_vertices, g->out_vertices);
+  ds->flags        = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+				    sizeof(cl_uint)*num_vertices, host_flags, NULL);
+  ds->active       = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint)*num_vertices, NULL, NULL);
+  ds->next         = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint)*num_vertices, NULL, NULL);
+  ds->count        = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  ds->scanned      = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+				    sizeof(cl_uint), host_flags, NULL);
+  ds->best         = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_ulong)*
+				    (env->packed_atomics && num_vertices ? num_vertices : 1), NULL, NULL);
+  ds->frontier_edges = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  ds->touched      = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+				    sizeof(cl_uint)*num_vertices, host_flags, NULL);
+  ds->touched_list = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint)*num_vertices, NULL, NULL);
+  ds->touched_count = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+				     sizeof(cl_uint), host_flags, NULL);
+  free(host_flags);
+  if(!ds->distances || !ds->preds || !ds->edges || !ds->vertices || !ds->out_edges ||
+     !ds->out_vertices || !ds->flags || !ds->active || !ds->next || !ds->count || !ds->scanned ||
+     !ds->best || !ds->frontier_edges || !ds->touched || !ds->touched_list || !ds->touched_count) {
+    problem("Failed to allocate device memory.\n");
+    exit(-1);
+  }
+  //SettleChanged puts every entry back to NO_BEST, so this holds from here on.
+  if(env->packed_atomics) {
+    const cl_ulong none = CL_ULONG_MAX;
+    err = clEnqueueFillBuffer(env->commands, ds->best, &none, sizeof(none), 0,
+			      sizeof(cl_ulong)*num_vertices, 0, NULL, NULL);
+    check_failure(err);
+  }
+
+  int a = 0;
+  err  = clSetKernelArg(ds->init_kernel, a++, sizeof(cl_mem), &ds->distances);
+  err |= clSetKernelArg(ds->init_kernel, a++, sizeof(cl_mem), &ds->preds);
+
+  a = 0;
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->edges);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->distances);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->preds);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->vertices);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->out_edges);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->out_vertices);
+  a += 2; //The queue and its length change every round.
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->flags);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->scanned);
+  a++; //expand too.
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_float), &unbounded);
+  a++; //next
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->count);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->touched);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->touched_list);
+  err |= clSetKernelArg(ds->update_kernel, a++, sizeof(cl_mem), &ds->touched_count);
+
+  err |= clSetKernelArg(ds->flag_kernel, 0, sizeof(cl_mem), &ds->flags);
+
+  a = 0;
+  err |= clSetKernelArg(ds->patch_kernel, a++, sizeof(cl_mem), &ds->edges);
+  err |= clSetKernelArg(ds->patch_kernel, a++, sizeof(cl_mem), &ds->out_edges);
+
+  a = 0;
+  err |= clSetKernelArg(ds->reset_kernel, a++, sizeof(cl_mem), &ds->distances);
+  err |= clSetKernelArg(ds->reset_kernel, a++, sizeof(cl_mem), &ds->preds);
+
+  a = 0;
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_mem), &ds->out_edges);
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_mem), &ds->out_vertices);
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_mem), &ds->distances);
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_mem), &ds->best);
+  a += 2; //active, active_size
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_mem), &ds->flags);
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_mem), &ds->scanned);
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_float), &unbounded);
+  a++; //next
+  err |= clSetKernelArg(ds->push_kernel, a++, sizeof(cl_mem), &ds->count);
+
+  a = 0;
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->flags);
+  a += 2; //list, count
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->out_vertices);
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->frontier_edges);
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->distances);
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->preds);
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->best);
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->touched);
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->touched_list);
+  err |= clSetKernelArg(ds->changed_kernel, a++, sizeof(cl_mem), &ds->touched_count);
+
+  a = 0;
+  err |= clSetKernelArg(ds->expand_kernel, a++, sizeof(cl_mem), &ds->out_edges);
+  err |= clSetKernelArg(ds->expand_kernel, a++, sizeof(cl_mem), &ds->out_vertices);
+  a += 2; //active, active_size
+  err |= clSetKernelArg(ds->expand_kernel, a++, sizeof(cl_mem), &ds->flags);
+  a++; //next
+  err |= clSetKernelArg(ds->expand_kernel, a++, sizeof(cl_mem), &ds->count);
+
+  a = 0;
+  err |= clSetKernelArg(ds->resolve_kernel, a++, sizeof(cl_mem), &ds->out_edges);
+  err |= clSetKernelArg(ds->resolve_kernel, a++, sizeof(cl_mem), &ds->out_vertices);
+  err |= clSetKernelArg(ds->resolve_kernel, a++, sizeof(cl_mem), &ds->distances);
+  err |= clSetKernelArg(ds->resolve_kernel, a++, sizeof(cl_mem), &ds->preds);
+
+  a = 0;
+  err |= clSetKernelArg(ds->gather_kernel, a++, sizeof(cl_mem), &ds->distances);
+  err |= clSetKernelArg(ds->gather_kernel, a++, sizeof(cl_mem), &ds->preds);
+  err |= clSetKernelArg(ds->gather_kernel, a++, sizeof(cl_mem), &ds->touched);
+  err |= clSetKernelArg(ds->gather_kernel, a++, sizeof(cl_mem), &ds->touched_list);
+  check_failure(err);
+}
+
+void opencl_release_sssp(device_sssp *ds) {
+  clReleaseKernel(ds->init_kernel);
+  clReleaseKernel(ds->update_kernel);
+  clReleaseKernel(ds->flag_kernel);
+  clReleaseKernel(ds->patch_kernel);
+  clReleaseKernel(ds->reset_kernel);
+  clReleaseKernel(ds->push_kernel);
+  clReleaseKernel(ds->changed_kernel);
+  clReleaseKernel(ds->expand_kernel);
+  clReleaseKernel(ds->resolve_kernel);
+  clReleaseKernel(ds->gather_kernel);
+  clReleaseMemObject(ds->distances);
+  clReleaseMemObject(ds->preds);
+  clReleaseMemObject(ds->edges);
+  clReleaseMemObject(ds->vertices);
+  clReleaseMemObject(ds->out_edges);
+  clReleaseMemObject(ds->out_vertices);
+  clReleaseMemObject(ds->flags);
+  clReleaseMemObject(ds->active);
+  clReleaseMemObject(ds->next);
+  clReleaseMemObject(ds->count);
+  clReleaseMemObject(ds->scanned);
+  clReleaseMemObject(ds->best);
+  clReleaseMemObject(ds->frontier_edges);
+  clReleaseMemObject(ds->touched);
+  clReleaseMemObject(ds->touched_list);
+  clReleaseMemObject(ds->touched_count);
+}
+
+void opencl_load_solution(opencl_env *env, device_sssp *ds, cl_uint source,
+			  const cl_float *distances, const cl_uint *preds) {
+  cl_uint n = ds->num_vertices;
+  cl_int err;
+  ds->source = source;
+  err  = clEnqueueWriteBuffer(env->commands, ds->distances, CL_TRUE, 0, sizeof(cl_float)*n,
+			      distances, 0, NULL,
+			      trace_event(env->trace, "WriteDistances", 0, sizeof(cl_float)*n));
+  err |= clEnqueueWriteBuffer(env->commands, ds->preds, CL_TRUE, 0, sizeof(cl_uint)*n,
+			      preds, 0, NULL,
+			      trace_event(env->trace, "WritePreds", 0, sizeof(cl_uint)*n));
+  check_failure(err);
+}
+
+//ResolvePreds from source one level per launch, with queue and next as
+//scratch.  resolve has its edge, distance and pred arguments set already;
+//claimed must be all zero, and is zeroed again afterwards.
+static void resolve_preds(opencl_env *env, cl_kernel resolve, cl_uint source, cl_uint num_vertices,
+			  cl_mem claimed, cl_mem queue, cl_mem next, cl_mem count, cl_uint phase) {
+  cl_command_queue commands = env->commands;
+  const cl_uint zero = 0, one = 1;
+  size_t local[] = {LOCAL_WORK_SIZE};
+  size_t global[1];
+  cl_uint size = 1;
+  cl_int err;
+  err  = clEnqueueWriteBuffer(commands, claimed, CL_FALSE, sizeof(cl_uint)*source, sizeof(cl_uint),
+			      &one, 0, NULL, NULL);
+  err |= clEnqueueWriteBuffer(commands, queue, CL_FALSE, 0, sizeof(cl_uint), &source, 0, NULL, NULL);
+  err |= clSetKernelArg(resolve, 4, sizeof(cl_mem), &claimed);
+  err |= clSetKernelArg(resolve, 8, sizeof(cl_mem), &count);
+  check_failure(err);
+  while(size) {
+    global[0] = size + LOCAL_WORK_SIZE - (size % LOCAL_WORK_SIZE);
+    err  = clSetKernelArg(resolve, 5, sizeof(cl_mem), &queue);
+    err |= clSetKernelArg(resolve, 6, sizeof(cl_uint), &size);
+    err |= clSetKernelArg(resolve, 7, sizeof(cl_mem), &next);
+    err |= clEnqueueWriteBuffer(commands, count, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+    err |= clEnqueueNDRangeKernel(commands, resolve, 1, NULL, global, local, 0, NULL,
+				  trace_event(env->trace, "ResolvePreds", phase, 0));
+    err |= clEnqueueReadBuffer(commands, count, CL_TRUE, 0, sizeof(cl_uint), &size, 0, NULL, NULL);
+    check_failure(err);
+    cl_mem t = queue;
+    queue = next;
+    next = t;
+  }
+  err = clEnqueueFillBuffer(commands, claimed, &zero, sizeof(zero), 0, sizeof(cl_uint)*num_vertices,
+			    0, NULL, NULL);
+  check_failure(err);
+}
+
+//Whether the next round pushes, from the size of its frontier against the
+//whole: out-edges for a push frontier, vertices for a pull one.
+static int push_next(opencl_env *env, device_sssp *ds, cl_ulong size, cl_ulong total) {
+  if(!ds->push || env->direction == DIRECTION_PULL)
+    return 0;
+  if(env->direction == DIRECTION_PUSH)
+    return 1;
+  return size*PUSH_DENSITY < total;
+}
+
+//Frontier rounds from the count pull candidates already in ds->active;
+//returns the rounds run and adds the edges scanned to *scanned.  A pull
+//round (UpdateFrontier) queues the next round's candidates, or, when that
+//round should push, just the vertices that changed.  A push round
+//(PushFrontier) queues the vertices it changed.  A queue of changed
+//vertices goes through SettleChanged, and one that has grown too dense to
+//push from is expanded back into pull candidates.  Nothing here looks at
+//vertices outside the queues.  The seeds are flagged first: one left clear
+//could be queued into next both before and after its own work-item clears
+//it.
+static cl_uint frontier_rounds(opencl_env *env, device_sssp *ds, cl_uint count, cl_ulong *scanned) {
+  cl_command_queue commands = env->commands;
+  cl_uint num_vertices = ds->num_vertices, rounds = 0, pushes = 0;
+  cl_uint frontier_edges = 0;
+  const cl_uint zero = 0;
+  size_t local[] = {LOCAL_WORK_SIZE};
+  size_t frontier_global[1];
+  int pushing = 0;
+  cl_int err;
+  if(count) {
+    frontier_global[0] = count + LOCAL_WORK_SIZE - (count % LOCAL_WORK_SIZE);
+    err  = clSetKernelArg(ds->flag_kernel, 1, sizeof(cl_mem), &ds->active);
+    err |= clSetKernelArg(ds->flag_kernel, 2, sizeof(cl_uint), &count);
+    err |= clEnqueueNDRangeKernel(commands, ds->flag_kernel, 1, NULL, frontier_global, local, 0, NULL,
+				  trace_event(env->trace, "FlagQueued", 0, 0));
+    check_failure(err);
+  }
+  while(count && rounds < num_vertices) {
+    cl_uint round_scanned, active = count, expand = 1;
+    cl_event *end;
+    cl_mem t;
+    frontier_global[0] = count + LOCAL_WORK_SIZE - (count % LOCAL_WORK_SIZE);
+    err = clEnqueueWriteBuffer(commands, ds->count, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+    if(pushing && !push_next(env, ds, frontier_edges, ds->num_edges)) {
+      err |= clSetKernelArg(ds->expand_kernel, 2, sizeof(cl_mem), &ds->active);
+      err |= clSetKernelArg(ds->expand_kernel, 3, sizeof(cl_uint), &count);
+      err |= clSetKernelArg(ds->expand_kernel, 5, sizeof(cl_mem), &ds->next);
+      err |= clEnqueueNDRangeKernel(commands, ds->expand_kernel, 1, NULL, frontier_global, local,
+				    0, NULL, trace_event(env->trace, "ExpandFrontier", rounds, 0));
+      err |= clEnqueueReadBuffer(commands, ds->count, CL_TRUE, 0, sizeof(cl_uint), &count, 0, NULL, NULL);
+      check_failure(err);
+      t = ds->active;
+      ds->active = ds->next;
+      ds->next = t;
+      *scanned += frontier_edges;
+      pushing = 0;
+      continue;
+    }
+    if(pushing) {
+      err |= clSetKernelArg(ds->push_kernel, 4, sizeof(cl_mem), &ds->active);
+      err |= clSetKernelArg(ds->push_kernel, 5, sizeof(cl_uint), &count);
+      err |= clSetKernelArg(ds->push_kernel, 9, sizeof(cl_mem), &ds->next);
+      end = trace_event(env->trace, "PushFrontier", rounds, 0);
+      err |= clEnqueueNDRangeKernel(commands, ds->push_kernel, 1, NULL, frontier_global, local, 0,
+				    NULL, end);
+      expand = 0;
+      pushes++;
+    } else {
+      expand = !push_next(env, ds, count, num_vertices);
+      err |= clSetKernelArg(ds->update_kernel, 6, sizeof(cl_mem), &ds->active);
+      err |= clSetKernelArg(ds->update_kernel, 7, sizeof(cl_uint), &count);
+      err |= clSetKernelArg(ds->update_kernel, 10, sizeof(cl_uint), &expand);
+      err |= clSetKernelArg(ds->update_kernel, 12, sizeof(cl_mem), &ds->next);
+      end = trace_event(env->trace, "UpdateFrontier", rounds, 0);
+      err |= clEnqueueNDRangeKernel(commands, ds->update_kernel, 1, NULL, frontier_global, local,
+				    0, NULL, end);
+    }
+    err |= clEnqueueReadBuffer(commands, ds->count, CL_TRUE, 0, sizeof(cl_uint), &count, 0, NULL, NULL);
+    check_failure(err);
+    t = ds->active;
+    ds->active = ds->next;
+    ds->next = t;
+    if(!expand && count) {
+      frontier_global[0] = count + LOCAL_WORK_SIZE - (count % LOCAL_WORK_SIZE);
+      err  = clSetKernelArg(ds->changed_kernel, 1, sizeof(cl_mem), &ds->active);
+      err |= clSetKernelArg(ds->changed_kernel, 2, sizeof(cl_uint), &count);
+      err |= clEnqueueWriteBuffer(commands, ds->frontier_edges, CL_FALSE, 0, sizeof(cl_uint), &zero,
+				  0, NULL, NULL);
+      end = trace_event(env->trace, "SettleChanged", rounds, 0);
+      err |= clEnqueueNDRangeKernel(commands, ds->changed_kernel, 1, NULL, frontier_global, local,
+				    0, NULL, end);
+      err |= clEnqueueReadBuffer(commands, ds->frontier_edges, CL_FALSE, 0, sizeof(cl_uint),
+				 &frontier_edges, 0, NULL, NULL);
+    }
+    err |= clEnqueueReadBuffer(commands, ds->scanned, CL_TRUE, 0, sizeof(cl_uint), &round_scanned, 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(commands, ds->scanned, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+    check_failure(err);
+    if(end) {
+      clRetainEvent(*end);
+      trace_round(env->trace, *end, pushing ? "push" : "frontier", rounds, active, round_scanned,
+		  sweep_bytes(env, active, round_scanned, pushing ? 0 : sizeof(cl_uint)));
+    }
+    pushing = !expand;
+    *scanned += round_scanned;
+    rounds++;
+  }
+  //The queues are empty again, so flags is all zero and can do for claimed.
+  if(pushes && !env->packed_atomics)
+    resolve_preds(env, ds->resolve_kernel, ds->source, num_vertices, ds->flags, ds->active,
+		  ds->next, ds->count, rounds);
+  return rounds;
+}
+
+static void read_solution(opencl_env *env, device_sssp *ds, cl_uint rounds,
+			  cl_float *result, cl_uint *preds) {
+  cl_uint n = ds->num_vertices;
+  cl_int err;
+  err  = clEnqueueReadBuffer(env->commands, ds->distances, CL_TRUE, 0, sizeof(cl_float)*n,
+			     result, 0, NULL,
+			     trace_event(env->trace, "ReadDistances", rounds, sizeof(cl_float)*n));
+  err |= clEnqueueReadBuffer(env->commands, ds->preds, CL_TRUE, 0, sizeof(cl_uint)*n,
+			     preds, 0, NULL,
+			     trace_event(env->trace, "ReadPreds", rounds, sizeof(cl_uint)*n));
+  check_failure(err);
+  clFinish(env->commands);
+  trace_flush(env->trace);
+}
+
+//Brings result/preds up to date with a repair: the invalidated vertices
+//drop to unreached, then whatever the rounds changed since the last call is
+//gathered into the (by now idle) queues and read back.
+static void read_touched(opencl_env *env, device_sssp *ds, const repair_plan *plan, cl_uint rounds,
+			 cl_float *result, cl_uint *preds) {
+  cl_command_queue commands = env->commands;
+  const cl_uint zero = 0;
+  size_t local[] = {LOCAL_WORK_SIZE};
+  size_t global[1];
+  cl_uint count, k;
+  cl_int err;
+  for(k = 0; k < plan->num_invalid; k++) {
+    result[plan->invalid[k]] = INFINITY;
+    preds[plan->invalid[k]] = plan->invalid[k];
+  }
+  err = clEnqueueReadBuffer(commands, ds->touched_count, CL_TRUE, 0, sizeof(cl_uint), &count, 0,
+			    NULL, NULL);
+  check_failure(err);
+  if(count) {
+    cl_uint *list = (cl_uint *)malloc(sizeof(cl_uint)*count);
+    cl_float *values = (cl_float *)malloc(sizeof(cl_float)*count);
+    cl_uint *pred_values = (cl_uint *)malloc(sizeof(cl_uint)*count);
+    if(!list || !values || !pred_values) {
+      problem("Failed to allocate the repair readback.\n");
+      exit(-1);
+    }
+    global[0] = count + LOCAL_WORK_SIZE - (count % LOCAL_WORK_SIZE);
+    err  = clSetKernelArg(ds->gather_kernel, 4, sizeof(cl_uint), &count);
+    err |= clSetKernelArg(ds->gather_kernel, 5, sizeof(cl_mem), &ds->active);
+    err |= clSetKernelArg(ds->gather_kernel, 6, sizeof(cl_mem), &ds->next);
+    err |= clEnqueueNDRangeKernel(commands, ds->gather_kernel, 1, NULL, global, local, 0, NULL,
+				  trace_event(env->trace, "GatherTouched", rounds, 0));
+    err |= clEnqueueReadBuffer(commands, ds->touched_list, CL_TRUE, 0, sizeof(cl_uint)*count, list,
+			       0, NULL, NULL);
+    err |= clEnqueueReadBuffer(commands, ds->active, CL_TRUE, 0, sizeof(cl_float)*count, values,
+			       0, NULL,
+			       trace_event(env->trace, "ReadDistances", rounds, sizeof(cl_float)*count));
+    err |= clEnqueueReadBuffer(commands, ds->next, CL_TRUE, 0, sizeof(cl_uint)*count, pred_values,
+			       0, NULL,
+			       trace_event(env->trace, "ReadPreds", rounds, sizeof(cl_uint)*count));
+    check_failure(err);
+    for(k = 0; k < count; k++) {
+      result[list[k]] = values[k];
+      preds[list[k]] = pred_values[k];
+    }
+    free(list);
+    free(values);
+    free(pred_values);
+  }
+  err = clEnqueueWriteBuffer(commands, ds->touched_count, CL_TRUE, 0, sizeof(cl_uint), &zero, 0,
+			     NULL, NULL);
+  check_failure(err);
+  clFinish(commands);
+  trace_flush(env->trace);
+}
+
+cl_uint opencl_frontier_sssp(opencl_env *env, graph *g, cl_uint source, cl_float bound,
+			     cl_float *result, cl_uint *preds, sssp_stats *stats) {
+  cl_int err;
+  cl_uint num_vertices = g->num_vertices;
+  device_sssp ds;
+
+  printf("Creating data buffers.\n");
+  printf(BAR);
+  opencl_upload_sssp(env, g, &ds);
+  ds.source = source;
+
+  printf("Putting data into device memory.\n");
+  printf(BAR);
+  cl_uint *seed = (cl_uint *)malloc(sizeof(cl_uint)*(num_vertices ? num_vertices : 1));
+  cl_uint count = seed_frontier(g, source, seed);
+  err = CL_SUCCESS;
+  if(count)
+    err = clEnqueueWriteBuffer(env->commands, ds.active, CL_TRUE, 0, sizeof(cl_uint)*count, seed, 0, NULL, NULL);
+  err |= clSetKernelArg(ds.init_kernel, 2, sizeof(cl_uint), &source);
+  err |= clSetKernelArg(ds.init_kernel, 3, sizeof(cl_uint), &num_vertices);
+  err |= clSetKernelArg(ds.update_kernel, 11, sizeof(cl_float), &bound);
+  err |= clSetKernelArg(ds.push_kernel, 8, sizeof(cl_float), &bound);
+  check_failure(err);
+  free(seed);
+
+  printf("Running.\n");
+  printf(BAR);
+  size_t global[] = {num_vertices + LOCAL_WORK_SIZE - (num_vertices % LOCAL_WORK_SIZE)};
+  err = clEnqueueNDRangeKernel(env->commands, ds.init_kernel, 1, NULL, global, NULL, 0, NULL,
+			       trace_event(env->trace, "InitDistances", 0, 0));
+  check_failure(err);
+  cl_ulong scanned = g->out_vertices[source].num_edges;
+  cl_uint rounds = frontier_rounds(env, &ds, count, &scanned);
+
+  printf("Getting data.\n");
+  printf(BAR);
+  read_solution(env, &ds, rounds, result, preds);
+
+  if(stats) {
+    stats->rounds = rounds;
+    stats->edges_scanned = scanned;
+  }
+  opencl_release_sssp(&ds);
+  return rounds;
+}
+
+//Patches the weights into both device edge arrays, drops the invalidated
+//vertices back to unreached and runs frontier rounds from the seeds.  Only
+//the plan crosses the bus on the way in, and only the vertices the repair
+//changed on the way out, so result and preds must hold the solution the
+//device has.
+cl_uint opencl_repair_sssp(opencl_env *env, device_sssp *ds, const repair_plan *plan,
+			   cl_float *result, cl_uint *preds, sssp_stats *stats) {
+  cl_command_queue commands = env->commands;
+  cl_context context = env->context;
+  cl_uint num_patches = plan->num_in + plan->num_out;
+  size_t local[] = {LOCAL_WORK_SIZE};
+  size_t global[1];
+  cl_int err = CL_SUCCESS;
+  cl_mem _slots = NULL, _weights = NULL, _invalid = NULL;
+
+  for(cl_uint k = 0; k < num_patches; k++)
+    if(plan->weights[k] < 0)
+      ds->push = CL_FALSE;
+  //Without packed atomics push rounds leave the preds to ResolvePreds, a
+  //pass over the whole tree; pull rounds keep them as they go.
+  if(!env->packed_atomics)
+    ds->push = CL_FALSE;
+  if(num_patches) {
+    _slots   = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			      sizeof(cl_uint)*num_patches, plan->slots, &err);
+    check_failure(err);
+    _weights = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			      sizeof(cl_float)*num_patches, plan->weights, &err);
+    check_failure(err);
+    global[0] = num_patches + LOCAL_WORK_SIZE - (num_patches % LOCAL_WORK_SIZE);
+    err  = clSetKernelArg(ds->patch_kernel, 2, sizeof(cl_mem), &_slots);
+    err |= clSetKernelArg(ds->patch_kernel, 3, sizeof(cl_mem), &_weights);
+    err |= clSetKernelArg(ds->patch_kernel, 4, sizeof(cl_uint), &plan->num_in);
+    err |= clSetKernelArg(ds->patch_kernel, 5, sizeof(cl_uint), &plan->num_out);
+    err |= clEnqueueNDRangeKernel(commands, ds->patch_kernel, 1, NULL, global, local, 0, NULL,
+				  trace_event(env->trace, "PatchEdges", 0, 0));
+    check_failure(err);
+  }
+  if(plan->num_invalid) {
+    _invalid = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			      sizeof(cl_uint)*plan->num_invalid, plan->invalid, &err);
+    check_failure(err);
+    global[0] = plan->num_invalid + LOCAL_WORK_SIZE - (plan->num_invalid % LOCAL_WORK_SIZE);
+    err  = clSetKernelArg(ds->reset_kernel, 2, sizeof(cl_mem), &_invalid);
+    err |= clSetKernelArg(ds->reset_kernel, 3, sizeof(cl_uint), &plan->num_invalid);
+    err |= clEnqueueNDRangeKernel(commands, ds->reset_kernel, 1, NULL, global, local, 0, NULL,
+				  trace_event(env->trace, "ResetVertices", 0, 0));
+    check_failure(err);
+  }
+  if(plan->num_seeds) {
+    err = clEnqueueWriteBuffer(commands, ds->active, CL_FALSE, 0, sizeof(cl_uint)*plan->num_seeds,
+			       plan->seeds, 0, NULL,
+			       trace_event(env->trace, "WriteSeeds", 0, sizeof(cl_uint)*plan->num_seeds));
+    check_failure(err);
+  }
+
+  cl_ulong scanned = 0;
+  cl_uint rounds = frontier_rounds(env, ds, plan->num_seeds, &scanned);
+  read_touched(env, ds, plan, rounds, result, preds);
+  if(stats) {
+    stats->rounds = rounds;
+    stats->edges_scanned = scanned;
+  }
+  if(_slots)
+    clReleaseMemObject(_slots);
+  if(_weights)
+    clReleaseMemObject(_weights);
+  if(_invalid)
+    clReleaseMemObject(_invalid);
+  return rounds;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Delta-stepping with light/heavy edges.  The buckets are device queues (see
+//RelaxLight): the current one drains through _frontier/_next, and
+//MinBucket/SelectBucket pick the next one out of _far, which lists only the
+//vertices still pending in later buckets.  No step looks at all n.
+cl_uint opencl_delta_stepping(opencl_env *env, graph *g, cl_uint source, cl_float delta,
+			      cl_float bound, cl_float *result, cl_uint *preds, sssp_stats *stats) {
+  cl_int err;
+  cl_command_queue commands = env->commands;
+  cl_context context = env->context;
+  cl_uint num_vertices = g->num_vertices;
+  cl_uint num_edges = g->num_edges;
+  cl_kernel init_distances_kernel, relax_light_kernel, relax_heavy_kernel;
+  cl_kernel min_bucket_kernel, select_bucket_kernel, resolve_preds_kernel;
+  if(has_negative_weights(g))
+    return opencl_frontier_sssp(env, g, source, bound, result, preds, stats);
+  init_distances_kernel = clCreateKernel(env->program, "InitDistances", &err);
+  check_failure(err);
+  relax_light_kernel = clCreateKernel(env->program, "RelaxLight", &err);
+  check_failure(err);
+  relax_heavy_kernel = clCreateKernel(env->program, "RelaxHeavy", &err);
+  check_failure(err);
+  min_bucket_kernel = clCreateKernel(env->program, "MinBucket", &err);
+  check_failure(err);
+  select_bucket_kernel = clCreateKernel(env->program, "SelectBucket", &err);
+  check_failure(err);
+  resolve_preds_kernel = clCreateKernel(env->program, "ResolvePreds", &err);
+  check_failure(err);
+
+  cl_uint *light = (cl_uint *)malloc(sizeof(cl_uint)*num_vertices);
+  split_light_heavy(g, delta, light);
+
+  cl_mem _out_edges, _out_vertices, _light;
+  cl_mem _distances, _preds, _frontier, _next, _removed, _far, _kept;
+  cl_mem _next_flags, _far_flags, _removed_flags;
+  cl_mem _next_size, _far_size, _removed_size, _kept_size, _bucket, _scanned;
+
+  printf("Creating data buffers.\n");
+  printf(BAR);
+  size_t list_size = sizeof(cl_uint)*(num_vertices ? num_vertices : 1);
+  _distances     = output_buffer(env, sizeof(cl_float)*num_vertices, result);
+  _preds         = output_buffer(env, sizeof(cl_uint)*num_vertices, preds);
+  _out_edges     = create_out_edges(env, g, 0);
+  _out_vertices  = input_buffer(env, sizeof(vertex)*num_vertices, g->out_vertices);
+  _light         = input_buffer(env, sizeof(cl_uint)*num_vertices, light);
+  _frontier      = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _next          = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _removed       = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _far           = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _kept          = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _next_flags    = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _far_flags     = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _removed_flags = clCreateBuffer(context, CL_MEM_READ_WRITE, list_size, NULL, NULL);
+  _next_size     = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  _far_size      = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  _removed_size  = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  _kept_size     = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  _bucket        = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  _scanned       = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  if(!_distances || !_preds || !_out_edges || !_out_vertices || !_light || !_frontier ||
+     !_next || !_removed || !_far || !_kept || !_next_flags || !_far_flags || !_removed_flags ||
+     !_next_size || !_far_size || !_removed_size || !_kept_size || !_bucket || !_scanned) {
+    problem("Failed to allocate device memory.\n");
+    exit(-1);
+  }
+
+  printf("Putting data into device memory.\n");
+  printf(BAR);
+  const cl_uint zero = 0;
+  err  = clEnqueueFillBuffer(commands, _next_flags, &zero, sizeof(zero), 0, list_size, 0, NULL, NULL);
+  err |= clEnqueueFillBuffer(commands, _far_flags, &zero, sizeof(zero), 0, list_size, 0, NULL, NULL);
+  err |= clEnqueueFillBuffer(commands, _removed_flags, &zero, sizeof(zero), 0, list_size, 0, NULL, NULL);
+  err |= clEnqueueWriteBuffer(commands, _frontier, CL_TRUE, 0, sizeof(cl_uint), &source, 0, NULL, NULL);
+  err |= clEnqueueWriteBuffer(commands, _far_size, CL_TRUE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+  err |= clEnqueueWriteBuffer(commands, _removed_size, CL_TRUE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+  err |= clEnqueueWriteBuffer(commands, _scanned, CL_TRUE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+  check_failure(err);
+
+  int a = 0;
+  printf("Setting Kernel Arguments.\n");
+  printf(BAR);
+  err  = clSetKernelArg(init_distances_kernel, a++, sizeof(cl_mem), &_distances);
+  err |= clSetKernelArg(init_distances_kernel, a++, sizeof(cl_mem), &_preds);
+  err |= clSetKernelArg(init_distances_kernel, a++, sizeof(cl_uint), &source);
+  err |= clSetKernelArg(init_distances_kernel, a++, sizeof(cl_uint), &num_vertices);
+
+  a = 0;
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_out_edges);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_out_vertices);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_light);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_distances);
+  a += 3; //frontier, frontier_size and bucket change every launch.
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_float), &delta);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_next_flags);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_far_flags);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_removed_flags);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_scanned);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_float), &bound);
+  a++; //next too.
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_next_size);
+  a++; //far
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_far_size);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_removed);
+  err |= clSetKernelArg(relax_light_kernel, a++, sizeof(cl_mem), &_removed_size);
+
+  a = 0;
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_out_edges);
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_out_vertices);
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_light);
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_distances);
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_removed);
+  a++; //removed_size
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_far_flags);
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_scanned);
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_float), &bound);
+  a++; //far
+  err |= clSetKernelArg(relax_heavy_kernel, a++, sizeof(cl_mem), &_far_size);
+
+  a = 0;
+  err |= clSetKernelArg(min_bucket_kernel, a++, sizeof(cl_mem), &_distances);
+  a += 2; //far, far_size
+  err |= clSetKernelArg(min_bucket_kernel, a++, sizeof(cl_float), &delta);
+  a++; //bucket
+  err |= clSetKernelArg(min_bucket_kernel, a++, sizeof(cl_mem), &_bucket);
+
+  a = 0;
+  err |= clSetKernelArg(select_bucket_kernel, a++, sizeof(cl_mem), &_distances);
+  a += 2; //far, far_size
+  err |= clSetKernelArg(select_bucket_kernel, a++, sizeof(cl_float), &delta);
+  a++; //bucket
+  err |= clSetKernelArg(select_bucket_kernel, a++, sizeof(cl_mem), &_far_flags);
+  err |= clSetKernelArg(select_bucket_kernel, a++, sizeof(cl_mem), &_next_flags);
+  a++; //frontier
+  err |= clSetKernelArg(select_bucket_kernel, a++, sizeof(cl_mem), &_next_size);
+  a++; //kept
+  err |= clSetKernelArg(select_bucket_kernel, a++, sizeof(cl_mem), &_kept_size);
+
+  a = 0;
+  err |= clSetKernelArg(resolve_preds_kernel, a++, sizeof(cl_mem), &_out_edges);
+  err |= clSetKernelArg(resolve_preds_kernel, a++, sizeof(cl_mem), &_out_vertices);
+  err |= clSetKernelArg(resolve_preds_kernel, a++, sizeof(cl_mem), &_distances);
+  err |= clSetKernelArg(resolve_preds_kernel, a++, sizeof(cl_mem), &_preds);
+  check_failure(err);
+
+  printf("Running.\n");
+  printf(BAR);
+  size_t global[] = {num_vertices + LOCAL_WORK_SIZE - (num_vertices % LOCAL_WORK_SIZE)};
+  size_t local[] = {LOCAL_WORK_SIZE};
+  size_t queue_global[1];
+  err = clEnqueueNDRangeKernel(commands, init_distances_kernel, 1, NULL, global, NULL, 0, NULL,
+			       trace_event(env->trace, "InitDistances", 0, 0));
+  check_failure(err);
+
+  cl_uint phases = 0, count = 1, bucket = 0, far_count, removed_count;
+  cl_mem t;
+  for(;;) {
+    while(count) {
+      queue_global[0] = count + LOCAL_WORK_SIZE - (count % LOCAL_WORK_SIZE);
+      err  = clSetKernelArg(relax_light_kernel, 4, sizeof(cl_mem), &_frontier);
+      err |= clSetKernelArg(relax_light_kernel, 5, sizeof(cl_uint), &count);
+      err |= clSetKernelArg(relax_light_kernel, 6, sizeof(cl_uint), &bucket);
+      err |= clSetKernelArg(relax_light_kernel, 13, sizeof(cl_mem), &_next);
+      err |= clSetKernelArg(relax_light_kernel, 15, sizeof(cl_mem), &_far);
+      err |= clEnqueueWriteBuffer(commands, _next_size, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+      err |= clEnqueueNDRangeKernel(commands, relax_light_kernel, 1, NULL, queue_global, local, 0, NULL,
+				    trace_event(env->trace, "RelaxLight", phases, 0));
+      err |= clEnqueueReadBuffer(commands, _next_size, CL_TRUE, 0, sizeof(cl_uint), &count, 0, NULL, NULL);
+      check_failure(err);
+      t = _frontier;
+      _frontier = _next;
+      _next = t;
+      phases++;
+    }
+    err = clEnqueueReadBuffer(commands, _removed_size, CL_TRUE, 0, sizeof(cl_uint), &removed_count,
+			      0, NULL, NULL);
+    check_failure(err);
+    if(removed_count) {
+      queue_global[0] = removed_count + LOCAL_WORK_SIZE - (removed_count % LOCAL_WORK_SIZE);
+      err  = clSetKernelArg(relax_heavy_kernel, 5, sizeof(cl_uint), &removed_count);
+      err |= clSetKernelArg(relax_heavy_kernel, 9, sizeof(cl_mem), &_far);
+      err |= clEnqueueNDRangeKernel(commands, relax_heavy_kernel, 1, NULL, queue_global, local, 0, NULL,
+				    trace_event(env->trace, "RelaxHeavy", phases, 0));
+      err |= clEnqueueWriteBuffer(commands, _removed_size, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+      check_failure(err);
+      phases++;
+    }
+    err = clEnqueueReadBuffer(commands, _far_size, CL_TRUE, 0, sizeof(cl_uint), &far_count, 0, NULL, NULL);
+    check_failure(err);
+    if(!far_count)
+      break;
+    const cl_uint none = CL_UINT_MAX;
+    queue_global[0] = far_count + LOCAL_WORK_SIZE - (far_count % LOCAL_WORK_SIZE);
+    err  = clSetKernelArg(min_bucket_kernel, 1, sizeof(cl_mem), &_far);
+    err |= clSetKernelArg(min_bucket_kernel, 2, sizeof(cl_uint), &far_count);
+    err |= clSetKernelArg(min_bucket_kernel, 4, sizeof(cl_uint), &bucket);
+    err |= clEnqueueWriteBuffer(commands, _bucket, CL_FALSE, 0, sizeof(cl_uint), &none, 0, NULL, NULL);
+    err |= clEnqueueNDRangeKernel(commands, min_bucket_kernel, 1, NULL, queue_global, local, 0, NULL,
+				  trace_event(env->trace, "MinBucket", phases, 0));
+    err |= clEnqueueReadBuffer(commands, _bucket, CL_TRUE, 0, sizeof(cl_uint), &bucket, 0, NULL, NULL);
+    check_failure(err);
+    if(bucket == CL_UINT_MAX)
+      break;
+    err  = clSetKernelArg(select_bucket_kernel, 1, sizeof(cl_mem), &_far);
+    err |= clSetKernelArg(select_bucket_kernel, 2, sizeof(cl_uint), &far_count);
+    err |= clSetKernelArg(select_bucket_kernel, 4, sizeof(cl_uint), &bucket);
+    err |= clSetKernelArg(select_bucket_kernel, 7, sizeof(cl_mem), &_frontier);
+    err |= clSetKernelArg(select_bucket_kernel, 9, sizeof(cl_mem), &_kept);
+    err |= clEnqueueWriteBuffer(commands, _next_size, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+    err |= clEnqueueWriteBuffer(commands, _kept_size, CL_FALSE, 0, sizeof(cl_uint), &zero, 0, NULL, NULL);
+    err |= clEnqueueNDRangeKernel(commands, select_bucket_kernel, 1, NULL, queue_global, local, 0, NULL,
+				  trace_event(env->trace, "SelectBucket", phases, 0));
+    err |= clEnqueueCopyBuffer(commands, _kept_size, _far_size, 0, 0, sizeof(cl_uint), 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(commands, _next_size, CL_TRUE, 0, sizeof(cl_uint), &count, 0, NULL, NULL);
+    check_failure(err);
+    t = _far;
+    _far = _kept;
+    _kept = t;
+  }
+  //Every queue has drained, so _next_flags is all zero again.
+  resolve_preds(env, resolve_preds_kernel, source, num_vertices, _next_flags, _frontier, _next,
+		_next_size, phases);
+
+  printf("Getting data.\n");
+  printf(BAR);
+  cl_uint scanned;
+  err  = fetch_output(env, _distances, sizeof(cl_float)*num_vertices, result,
+		      trace_event(env->trace, "ReadDistances", phases, sizeof(cl_float)*num_vertices));
+  err |= fetch_output(env, _preds, sizeof(cl_uint)*num_vertices, preds,
+		      trace_event(env->trace, "ReadPreds", phases, sizeof(cl_uint)*num_vertices));
+  err |= clEnqueueReadBuffer(commands, _scanned, CL_TRUE, 0, sizeof(cl_uint), &scanned, 0, NULL, NULL);
+  check_failure(err);
+  clFinish(commands);
+  trace_flush(env->trace);
+
+  if(stats) {
+    stats->rounds = phases;
+    stats->edges_scanned = (cl_ulong)scanned + num_edges;
+  }
+
+  //Device Cleanup.
+  clReleaseKernel(init_distances_kernel);
+  clReleaseKernel(relax_light_kernel);
+  clReleaseKernel(relax_heavy_kernel);
+  clReleaseKernel(min_bucket_kernel);
+  clReleaseKernel(select_bucket_kernel);
+  clReleaseKernel(resolve_preds_kernel);
+  clReleaseMemObject(_distances);
+  clReleaseMemObject(_preds);
+  clReleaseMemObject(_out_edges);
+  clReleaseMemObject(_out_vertices);
+  clReleaseMemObject(_light);
+  clReleaseMemObject(_frontier);
+  clReleaseMemObject(_next);
+  clReleaseMemObject(_removed);
+  clReleaseMemObject(_far);
+  clReleaseMemObject(_kept);
+  clReleaseMemObject(_next_flags);
+  clReleaseMemObject(_far_flags);
+  clReleaseMemObject(_removed_flags);
+  clReleaseMemObject(_next_size);
+  clReleaseMemObject(_far_size);
+  clReleaseMemObject(_removed_size);
+  clReleaseMemObject(_kept_size);
+  clReleaseMemObject(_bucket);
+  clReleaseMemObject(_scanned);
+  free(light);
+  return phases;
+}
@@ -0,0 +1,99 @@
+#ifndef OPENCL_SSSP_H
+#define OPENCL_SSSP_H
+
+#include "sssp.h"
+#include "repair.h"
+
+//Most sweep rounds enqueued between convergence checks.
+#define MAX_BATCH 64
+
+//Binned schedule: in-degree below which a vertex gets one work-item, then
+//below which it gets a LOCAL_WORK_SIZE work-group; above that a work-group
+//of up to GROUP_WORK_SIZE (as in kernel.cl).
+#define BIN_WARP_DEGREE 32
+#define BIN_GROUP_DEGREE 1024
+#define GROUP_WORK_SIZE 256
+
+//Frontier mode pushes while the changed vertices' out-edges are under
+//1/PUSH_DENSITY of the graph's, and pulls above that.
+#define PUSH_DENSITY 16
+
+//batch is the number of sweep rounds per convergence check, 0 to adapt it.
+//bound as in cpu_sssp.h.
+cl_uint opencl_sssp(opencl_env *env, graph *g, cl_uint source, cl_uint batch, cl_float bound,
+		    cl_float *result, cl_uint *preds, sssp_stats *stats);
+//Bellman-Ford potentials for Johnson's reweighting; see cpu_potentials.
+cl_uint opencl_potentials(opencl_env *env, graph *g, cl_uint batch, cl_float *potentials,
+			  sssp_stats *stats);
+//The in-edge CSR and batched kernels, kept on the device between queries.
+typedef struct _device_graph {
+  cl_uint num_vertices;
+  cl_uint num_edges;
+  cl_mem edges;
+  cl_mem vertices;
+  cl_mem update;
+  cl_kernel init_kernel;
+  cl_kernel update_kernel;
+} device_graph;
+
+cl_uint opencl_max_sources(opencl_env *env, graph *g);
+void opencl_upload_graph(opencl_env *env, graph *g, device_graph *dg);
+void opencl_release_graph(device_graph *dg);
+cl_uint opencl_multi_query(opencl_env *env, device_graph *dg, const cl_uint *sources,
+			   cl_uint num_sources, cl_uint batch, cl_float *result, cl_uint *preds,
+			   sssp_stats *stats);
+cl_uint opencl_multi_sssp(opencl_env *env, graph *g, const cl_uint *sources, cl_uint num_sources,
+			  cl_uint batch, cl_float *result, cl_uint *preds, sssp_stats *stats);
+//bound as in cpu_sssp.h; INFINITY solves the whole graph.
+cl_uint opencl_frontier_sssp(opencl_env *env, graph *g, cl_uint source, cl_float bound,
+			     cl_float *result, cl_uint *preds, sssp_stats *stats);
+
+//A frontier-mode solution kept on the device with both CSRs, so that weight
+//updates can be patched in and repaired (see repair.h).
+typedef struct _device_sssp {
+  cl_uint num_vertices;
+  cl_uint num_edges;
+  cl_mem edges;
+  cl_mem vertices;
+  cl_mem out_edges;
+  cl_mem out_vertices;
+  cl_mem distances;
+  cl_mem preds;
+  cl_mem flags;                 //Set while the vertex is queued.
+  cl_mem active;                //This round's queue; swapped with next.
+  cl_mem next;
+  cl_mem count;                 //Length of next.
+  cl_mem scanned;
+  cl_mem best;                  //Packed distance/pred per vertex (env->packed_atomics).
+  cl_mem frontier_edges;
+  cl_mem touched;               //Vertices changed since the last repair readback,
+  cl_mem touched_list;          //listed once each.
+  cl_mem touched_count;
+  cl_uint source;
+  cl_bool push;                 //No negative weights, so push rounds may run.
+  cl_kernel init_kernel;
+  cl_kernel update_kernel;
+  cl_kernel flag_kernel;
+  cl_kernel patch_kernel;
+  cl_kernel reset_kernel;
+  cl_kernel push_kernel;
+  cl_kernel changed_kernel;
+  cl_kernel expand_kernel;
+  cl_kernel resolve_kernel;
+  cl_kernel gather_kernel;
+} device_sssp;
+
+//Requires build_out_edges().
+void opencl_upload_sssp(opencl_env *env, graph *g, device_sssp *ds);
+void opencl_release_sssp(device_sssp *ds);
+//Starts the device state from a solution for source found by any engine.
+void opencl_load_solution(opencl_env *env, device_sssp *ds, cl_uint source,
+			  const cl_float *distances, const cl_uint *preds);
+cl_uint opencl_repair_sssp(opencl_env *env, device_sssp *ds, const repair_plan *plan,
+			   cl_float *result, cl_uint *preds, sssp_stats *stats);
+
+//As cpu_delta_stepping, frontier rounds when some weight is negative.
+cl_uint opencl_delta_stepping(opencl_env *env, graph *g, cl_uint source, cl_float delta,
+			      cl_float bound, cl_float *result, cl_uint *preds, sssp_stats *stats);
+
+#endif
@@ -0,0 +1,213 @@
+#include "p2p.h"
+#include "result.h"
+
+/*--------------------------------------------------------------------------------*/
+
+//Distances are float sums along a path and can come out a few ulps under
+//the exact length, so the bound is kept a little below the weight ratio.
+#define BOUND_SLACK 0.999
+
+static void alloc_side(p2p_side *side, cl_uint n, int own_keys) {
+  cl_uint v, size = n ? n : 1;
+  side->dist = (cl_float *)malloc(sizeof(cl_float)*size);
+  side->key = own_keys ? (cl_float *)malloc(sizeof(cl_float)*size) : side->dist;
+  side->pred = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  side->touched = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  side->heap.heap = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  side->heap.slot = (cl_uint *)malloc(sizeof(cl_uint)*size);
+  if(!side->dist || !side->key || !side->pred || !side->touched || !side->heap.heap ||
+     !side->heap.slot) {
+    problem("Failed to allocate the point-to-point search.\n");
+    exit(-1);
+  }
+  for(v = 0; v < n; v++) {
+    side->dist[v] = INFINITY;
+    side->key[v] = INFINITY;
+    side->pred[v] = v;
+    side->heap.slot[v] = NOT_QUEUED;
+  }
+  side->num_touched = 0;
+  side->heap.size = 0;
+  side->heap.edges_scanned = 0;
+}
+
+static void free_side(p2p_side *side) {
+  if(side->key != side->dist)
+    free(side->key);
+  free(side->dist);
+  free(side->pred);
+  free(side->touched);
+  free(side->heap.heap);
+  free(side->heap.slot);
+}
+
+//Puts back only what the last query wrote.
+static void reset_side(p2p_side *side) {
+  cl_uint k;
+  for(k = 0; k < side->num_touched; k++) {
+    cl_uint v = side->touched[k];
+    side->dist[v] = INFINITY;
+    side->key[v] = INFINITY;
+    side->pred[v] = v;
+    side->heap.slot[v] = NOT_QUEUED;
+  }
+  side->num_touched = 0;
+  side->heap.size = 0;
+  side->heap.edges_scanned = 0;
+}
+
+static inline void reach(p2p_side *side, cl_uint v, cl_float d, cl_uint pred) {
+  if(side->dist[v] == INFINITY)
+    side->touched[side->num_touched++] = v;
+  side->dist[v] = d;
+  side->pred[v] = pred;
+}
+
+static inline cl_float bound(const p2p_search *s, cl_uint v, cl_uint target) {
+  const cl_int *c = s->g->coords;
+  double dx = (double)c[2*v] - c[2*target], dy = (double)c[2*v + 1] - c[2*target + 1];
+  return (cl_float)(s->scale*sqrt(dx*dx + dy*dy));
+}
+
+/*--------------------------------------------------------------------------------*/
+
+p2p_search *p2p_create(graph *g) {
+  p2p_search *s = (p2p_search *)calloc(1, sizeof(p2p_search));
+  double ratio = INFINITY;
+  cl_uint u, i;
+  if(!s) {
+    problem("Failed to allocate the point-to-point search.\n");
+    exit(-1);
+  }
+  s->g = g;
+  alloc_side(&s->forward, g->num_vertices, 1);
+  alloc_side(&s->backward, g->num_vertices, 0);
+  for(u = 0; u < g->num_vertices; u++) {
+    vertex node = g->out_vertices[u];
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      cl_uint v = g->out_edges[i].dest;
+      cl_float w = g->out_edges[i].weight;
+      if(w < 0)
+	s->negative = 1;
+      if(!g->coords)
+	continue;
+      double dx = (double)g->coords[2*u] - g->coords[2*v];
+      double dy = (double)g->coords[2*u + 1] - g->coords[2*v + 1];
+      double length = sqrt(dx*dx + dy*dy);
+      if(length > 0 && w/length < ratio)
+	ratio = w/length;
+    }
+  }
+  //Every edge costs at least scale per unit of length, so by the triangle
+  //inequality no path to the target is shorter than scale times the
+  //straight line.
+  s->scale = g->coords && ratio < INFINITY ? ratio*BOUND_SLACK : 0;
+  return s;
+}
+
+void p2p_destroy(p2p_search *s) {
+  free_side(&s->forward);
+  free_side(&s->backward);
+  free(s);
+}
+
+//Returns the length of the shortest path and sets meet to a vertex on it
+//that both sides reached.
+static cl_float bidirectional(p2p_search *s, cl_uint source, cl_uint target, cl_uint *meet,
+			      cl_uint *settled) {
+  graph *g = s->g;
+  p2p_side *f = &s->forward, *b = &s->backward;
+  cl_float best = INFINITY;
+  cl_uint i;
+  reach(f, source, 0, source);
+  decrease_key(&f->heap, f->dist, source);
+  reach(b, target, 0, target);
+  decrease_key(&b->heap, b->dist, target);
+  if(source == target) {
+    *meet = source;
+    return 0;
+  }
+  while(f->heap.size && b->heap.size) {
+    cl_float top_f = f->dist[f->heap.heap[0]], top_b = b->dist[b->heap.heap[0]];
+    if(top_f + top_b >= best)
+      break;
+    int forward = top_f <= top_b;
+    p2p_side *side = forward ? f : b, *other = forward ? b : f;
+    const edge *edges = forward ? g->out_edges : g->edges;
+    cl_uint u = pop_min(&side->heap, side->dist);
+    cl_float du = side->dist[u];
+    vertex node = forward ? g->out_vertices[u] : g->vertices[u];
+    (*settled)++;
+    side->heap.edges_scanned += node.num_edges;
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      cl_uint v = forward ? edges[i].dest : edges[i].source;
+      cl_float nd = du + edges[i].weight;
+      if(nd < side->dist[v]) {
+	reach(side, v, nd, u);
+	decrease_key(&side->heap, side->dist, v);
+      }
+      if(other->dist[v] < INFINITY && side->dist[v] + other->dist[v] < best) {
+	best = side->dist[v] + other->dist[v];
+	*meet = v;
+      }
+    }
+  }
+  return best;
+}
+
+//A vertex settled through a path the bound favoured too much is reopened
+//when a shorter one turns up, so rounding in the bound costs work, never
+//correctness.
+static cl_float astar(p2p_search *s, cl_uint source, cl_uint target, cl_uint *settled) {
+  graph *g = s->g;
+  p2p_side *f = &s->forward;
+  cl_uint i;
+  reach(f, source, 0, source);
+  f->key[source] = bound(s, source, target);
+  decrease_key(&f->heap, f->key, source);
+  while(f->heap.size) {
+    cl_uint u = pop_min(&f->heap, f->key);
+    cl_float du = f->dist[u];
+    vertex node = g->out_vertices[u];
+    (*settled)++;
+    if(u == target)
+      return du;
+    f->heap.edges_scanned += node.num_edges;
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      cl_uint v = g->out_edges[i].dest;
+      cl_float nd = du + g->out_edges[i].weight;
+      if(nd < f->dist[v]) {
+	reach(f, v, nd, u);
+	f->key[v] = nd + bound(s, v, target);
+	decrease_key(&f->heap, f->key, v);
+      }
+    }
+  }
+  return INFINITY;
+}
+
+cl_float p2p_query(p2p_search *s, p2p_method method, cl_uint source, cl_uint target,
+		   cl_uint *path, cl_uint *path_length, sssp_stats *stats) {
+  cl_uint n = s->g->num_vertices, settled = 0, meet = target, len = 0;
+  cl_float distance;
+  reset_side(&s->forward);
+  reset_side(&s->backward);
+  if(method == P2P_ASTAR && s->g->coords)
+    distance = astar(s, source, target, &settled);
+  else
+    distance = bidirectional(s, source, target, &meet, &settled);
+
+  if(distance < INFINITY) {
+    len = extract_path(s->forward.pred, 1, n, source, meet, path);
+    while(len && meet != target && len < n) {
+      meet = s->backward.pred[meet];
+      path[len++] = meet;
+    }
+  }
+  *path_length = len;
+  if(stats) {
+    stats->rounds = settled;
+    stats->edges_scanned = s->forward.heap.edges_scanned + s->backward.heap.edges_scanned;
+  }
+  return distance;
+}
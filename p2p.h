@@ -0,0 +1,55 @@
+#ifndef P2P_H
+#define P2P_H
+
+#include "sssp.h"
+#include "heap.h"
+
+/*
+ * Point-to-point queries.  Instead of the whole single-source tree these
+ * settle vertices in distance order and stop as soon as the target's
+ * distance is known:
+ *
+ *   bidir  Dijkstra forward from the source over the out-edge CSR and
+ *          backward from the target over the in-edge CSR, which is already
+ *          the reverse graph.  Each step advances the side with the nearer
+ *          queue top; the search stops once the two tops add up to the
+ *          shortest meeting seen so far.
+ *   astar  Dijkstra from the source keyed by distance plus a lower bound on
+ *          what is left: the straight-line distance to the target times the
+ *          smallest weight per coordinate unit over all edges, which never
+ *          overestimates.  Stops when the target comes off the queue.
+ *
+ * Both need non-negative weights.  A query only resets what it touched, so
+ * its cost follows its own search space rather than the graph's size.
+ */
+
+typedef enum { P2P_BIDIRECTIONAL, P2P_ASTAR } p2p_method;
+
+typedef struct _p2p_side {
+  cl_float *dist;
+  cl_float *key;                //dist plus the bound; astar only, else dist
+  cl_uint *pred;                //forward: previous vertex, backward: next one
+  cl_uint *touched;
+  cl_uint num_touched;
+  dijkstra_heap heap;
+} p2p_side;
+
+typedef struct _p2p_search {
+  graph *g;
+  p2p_side forward;
+  p2p_side backward;
+  double scale;                 //astar bound per coordinate unit; 0 without coords
+  int negative;                 //some weight is negative
+} p2p_search;
+
+//Needs build_out_edges(g).  Picks up g->coords for the astar bound.
+p2p_search *p2p_create(graph *g);
+void p2p_destroy(p2p_search *s);
+
+//Returns the source -> target distance, INFINITY when unreachable.  path
+//(room for num_vertices) gets source ... target and path_length its count,
+//0 when unreachable.  stats->rounds counts settled vertices.
+cl_float p2p_query(p2p_search *s, p2p_method method, cl_uint source, cl_uint target,
+		   cl_uint *path, cl_uint *path_length, sssp_stats *stats);
+
+#endif
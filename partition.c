@@ -0,0 +1,461 @@
+#include "partition.h"
+
+/*--------------------------------------------------------------------------------*/
+
+static int uintcomp(const void *a, const void *b) {
+  cl_uint f = *(const cl_uint *)a, s = *(const cl_uint *)b;
+  return (f > s) - (f < s);
+}
+
+//Splits device into num_parts sub-devices.  NUMA nodes are used when there
+//are exactly as many as partitions (or when asked for); otherwise the
+//compute units are shared out equally and any spare sub-devices released.
+static cl_int split_device(cl_device_id device, cl_uint num_parts, device_split split,
+			   cl_device_id *out, cl_uint *num_out) {
+  cl_device_id subs[MAX_PARTITIONS];
+  cl_uint n = 0, units, i;
+  cl_int err;
+  if(split != SPLIT_EQUAL) {
+    cl_device_partition_property numa[] = {CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+					   CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0};
+    err = clCreateSubDevices(device, numa, MAX_PARTITIONS, subs, &n);
+    if(err == CL_SUCCESS && n == num_parts) {
+      memcpy(out, subs, sizeof(cl_device_id)*n);
+      *num_out = n;
+      printf("Split the device into %u NUMA sub-devices.\n", n);
+      return CL_SUCCESS;
+    }
+    for(i = 0; err == CL_SUCCESS && i < n; i++)
+      clReleaseDevice(subs[i]);
+    if(split == SPLIT_NUMA) {
+      if(err == CL_SUCCESS)
+	problem("The device has %u NUMA nodes, not %u.\n", n, num_parts);
+      return err == CL_SUCCESS ? CL_DEVICE_PARTITION_FAILED : err;
+    }
+  }
+  err = clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, NULL);
+  if(err != CL_SUCCESS)
+    return err;
+  if(units < num_parts) {
+    problem("The device has %u compute units, too few for %u partitions.\n", units, num_parts);
+    return CL_DEVICE_PARTITION_FAILED;
+  }
+  cl_device_partition_property equally[] = {CL_DEVICE_PARTITION_EQUALLY,
+					     (cl_device_partition_property)(units/num_parts), 0};
+  err = clCreateSubDevices(device, equally, MAX_PARTITIONS, subs, &n);
+  if(err != CL_SUCCESS)
+    return err;
+  if(n < num_parts) {
+    for(i = 0; i < n; i++)
+      clReleaseDevice(subs[i]);
+    return CL_DEVICE_PARTITION_FAILED;
+  }
+  for(i = num_parts; i < n; i++)
+    clReleaseDevice(subs[i]);
+  memcpy(out, subs, sizeof(cl_device_id)*num_parts);
+  *num_out = num_parts;
+  printf("Split the device into %u sub-devices of %u compute units.\n", num_parts,
+	 units/num_parts);
+  return CL_SUCCESS;
+}
+
+cl_int opencl_partition_setup(device_set *set, cl_device_type type, cl_uint num_parts,
+			      device_split split, const char *kernel_file, edge_layout layout,
+			      const char *cache_dir) {
+  cl_platform_id platforms[16];
+  cl_device_id devices[MAX_PARTITIONS];
+  cl_uint num_platforms = 0, num_devices = 0, found, i;
+  cl_int err;
+  memset(set, 0, sizeof(device_set));
+  err = clGetPlatformIDs(16, platforms, &num_platforms);
+  if(err != CL_SUCCESS)
+    return err;
+  for(i = 0; i < num_platforms && num_devices < MAX_PARTITIONS; i++)
+    if(clGetDeviceIDs(platforms[i], type, MAX_PARTITIONS - num_devices, devices + num_devices,
+		      &found) == CL_SUCCESS)
+      num_devices += found;
+  if(num_devices == 0)
+    return CL_DEVICE_NOT_FOUND;
+
+  if(split == SPLIT_DEVICES || (split == SPLIT_AUTO && num_devices >= num_parts)) {
+    if(num_devices < num_parts) {
+      problem("Found %u devices for %u partitions.\n", num_devices, num_parts);
+      return CL_DEVICE_NOT_FOUND;
+    }
+  } else {
+    err = split_device(devices[0], num_parts, split, set->sub_devices, &set->num_sub_devices);
+    if(err != CL_SUCCESS)
+      return err;
+    memcpy(devices, set->sub_devices, sizeof(cl_device_id)*num_parts);
+  }
+  for(i = 0; i < num_parts; i++) {
+    err = opencl_setup_device(&set->envs[i], devices[i], kernel_file, layout, NULL, cache_dir);
+    if(err != CL_SUCCESS) {
+      opencl_partition_release(set);
+      return err;
+    }
+    set->num_devices++;
+  }
+  return CL_SUCCESS;
+}
+
+void opencl_partition_release(device_set *set) {
+  cl_uint i;
+  for(i = 0; i < set->num_devices; i++)
+    opencl_release(&set->envs[i]);
+  for(i = 0; i < set->num_sub_devices; i++)
+    clReleaseDevice(set->sub_devices[i]);
+  set->num_devices = 0;
+  set->num_sub_devices = 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Edges before vertex v plus v itself: the balance weight of [0, v).
+static inline cl_ulong balance_weight(graph *g, cl_uint v) {
+  return (cl_ulong)(v < g->num_vertices ? g->vertices[v].index : g->num_edges) + v;
+}
+
+static inline cl_uint edge_start(graph *g, cl_uint v) {
+  return v < g->num_vertices ? g->vertices[v].index : g->num_edges;
+}
+
+//crossing[x] = edges with one end below x and the other at or above it.
+static cl_uint *crossing_counts(graph *g) {
+  cl_uint n = g->num_vertices, i;
+  cl_uint *crossing = (cl_uint *)calloc(n + 1, sizeof(cl_uint));
+  if(!crossing) {
+    problem("Failed to allocate the partition plan.\n");
+    exit(-1);
+  }
+  for(i = 0; i < g->num_edges; i++) {
+    cl_uint a = g->edges[i].source, b = g->edges[i].dest;
+    if(a == b)
+      continue;
+    if(a > b) {
+      cl_uint t = a;
+      a = b;
+      b = t;
+    }
+    crossing[a + 1]++;
+    if(b + 1 <= n)
+      crossing[b + 1]--;
+  }
+  for(i = 1; i <= n; i++)
+    crossing[i] += crossing[i - 1];
+  return crossing;
+}
+
+cl_ulong plan_partitions(graph *g, cl_uint num_parts, partition *parts) {
+  cl_uint n = g->num_vertices, bounds[MAX_PARTITIONS + 1], k, p, i;
+  cl_ulong total = balance_weight(g, n), cut = 0;
+  cl_uint *crossing = crossing_counts(g);
+  cl_uint *seen = (cl_uint *)calloc(n ? n : 1, sizeof(cl_uint));
+  cl_uchar *needed = (cl_uchar *)calloc(n ? n : 1, sizeof(cl_uchar));
+  if(!seen || !needed) {
+    problem("Failed to allocate the partition plan.\n");
+    exit(-1);
+  }
+
+  bounds[0] = 0;
+  bounds[num_parts] = n;
+  for(k = 1; k < num_parts; k++) {
+    cl_ulong target = total*k/num_parts;
+    cl_uint lo = bounds[k - 1] + 1, hi = n - (num_parts - k), ideal, span, best, x;
+    //First vertex at which [0, x) reaches the target weight.
+    cl_uint a = lo, b = hi;
+    while(a < b) {
+      cl_uint mid = a + (b - a)/2;
+      if(balance_weight(g, mid) < target)
+	a = mid + 1;
+      else
+	b = mid;
+    }
+    ideal = a;
+    span = n/num_parts/PARTITION_WINDOW;
+    if(ideal > lo + span)
+      lo = ideal - span;
+    if(ideal + span < hi)
+      hi = ideal + span;
+    best = ideal;
+    for(x = lo; x <= hi; x++) {
+      cl_uint d = x > ideal ? x - ideal : ideal - x, db = best > ideal ? best - ideal : ideal - best;
+      if(crossing[x] < crossing[best] || (crossing[x] == crossing[best] && d < db))
+	best = x;
+    }
+    bounds[k] = best;
+  }
+  free(crossing);
+
+  for(p = 0; p < num_parts; p++) {
+    partition *part = &parts[p];
+    cl_uint last = bounds[p + 1], capacity = 0;
+    memset(part, 0, sizeof(partition));
+    part->first = bounds[p];
+    part->count = last - part->first;
+    part->num_edges = edge_start(g, last) - edge_start(g, part->first);
+    for(i = edge_start(g, part->first); i < edge_start(g, last); i++) {
+      cl_uint s = g->edges[i].source;
+      if(s >= part->first && s < last)
+	continue;
+      cut++;
+      if(seen[s] == p + 1)
+	continue;
+      seen[s] = p + 1;
+      needed[s] = 1;
+      if(part->num_halo == capacity) {
+	capacity = capacity ? 2*capacity : 256;
+	part->halo = (cl_uint *)realloc(part->halo, sizeof(cl_uint)*capacity);
+	if(!part->halo) {
+	  problem("Failed to allocate the partition plan.\n");
+	  exit(-1);
+	}
+      }
+      part->halo[part->num_halo++] = s;
+    }
+    qsort(part->halo, part->num_halo, sizeof(cl_uint), uintcomp);
+  }
+  for(p = 0; p < num_parts; p++) {
+    partition *part = &parts[p];
+    for(i = 0; i < part->count; i++)
+      part->num_send += needed[part->first + i];
+    part->send = (cl_uint *)malloc(sizeof(cl_uint)*(part->num_send ? part->num_send : 1));
+    part->num_send = 0;
+    for(i = 0; i < part->count; i++)
+      if(needed[part->first + i])
+	part->send[part->num_send++] = i;
+  }
+  free(seen);
+  free(needed);
+  return cut;
+}
+
+void free_partitions(partition *parts, cl_uint num_parts) {
+  cl_uint p;
+  for(p = 0; p < num_parts; p++) {
+    free(parts[p].halo);
+    free(parts[p].send);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Local number of global vertex v in part.
+static inline cl_uint local_id(const partition *part, cl_uint v) {
+  if(v >= part->first && v < part->first + part->count)
+    return v - part->first;
+  const cl_uint *at = (const cl_uint *)bsearch(&v, part->halo, part->num_halo, sizeof(cl_uint),
+					       uintcomp);
+  return part->count + (cl_uint)(at - part->halo);
+}
+
+static cl_mem local_edges(opencl_env *env, graph *g, const partition *part) {
+  cl_uint i, base = edge_start(g, part->first), m = part->num_edges;
+  size_t size = env->layout == LAYOUT_WIDE ? sizeof(edge) : sizeof(gpu_edge);
+  void *local = malloc(size*(m ? m : 1));
+  cl_mem buffer;
+  for(i = 0; i < m; i++) {
+    const edge *e = &g->edges[base + i];
+    if(env->layout == LAYOUT_WIDE) {
+      edge *w = (edge *)local + i;
+      w->source = local_id(part, e->source);
+      w->dest = e->dest - part->first;
+      w->weight = e->weight;
+    } else {
+      gpu_edge *w = (gpu_edge *)local + i;
+      w->source = local_id(part, e->source);
+      w->weight = e->weight;
+    }
+  }
+  buffer = clCreateBuffer(env->context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+			  size*(m ? m : 1), local, NULL);
+  free(local);
+  return buffer;
+}
+
+static void upload_partition(opencl_env *env, graph *g, partition *part, cl_uint source) {
+  cl_context context = env->context;
+  cl_uint slots = part->count + part->num_halo, i, base = edge_start(g, part->first);
+  cl_float *distances = (cl_float *)malloc(sizeof(cl_float)*(slots ? slots : 1));
+  cl_uint *preds = (cl_uint *)malloc(sizeof(cl_uint)*(part->count ? part->count : 1));
+  vertex *vertices = (vertex *)malloc(sizeof(vertex)*(part->count ? part->count : 1));
+  cl_uint zero = 0, slot = 0;
+  cl_float unbounded = INFINITY;
+  cl_int err;
+  for(i = 0; i < slots; i++)
+    distances[i] = INFINITY;
+  if((source >= part->first && source < part->first + part->count) ||
+     bsearch(&source, part->halo, part->num_halo, sizeof(cl_uint), uintcomp))
+    distances[local_id(part, source)] = 0;
+  for(i = 0; i < part->count; i++) {
+    preds[i] = i;
+    vertices[i].num_edges = g->vertices[part->first + i].num_edges;
+    vertices[i].index = g->vertices[part->first + i].index - base;
+  }
+
+  part->edges     = local_edges(env, g, part);
+  part->vertices  = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				   sizeof(vertex)*(part->count ? part->count : 1), vertices, NULL);
+  part->distances = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+				   sizeof(cl_float)*(slots ? slots : 1), distances, NULL);
+  part->preds     = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+				   sizeof(cl_uint)*(part->count ? part->count : 1), preds, NULL);
+  part->update    = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint), NULL, NULL);
+  part->send_ids  = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+				   sizeof(cl_uint)*(part->num_send ? part->num_send : 1), part->send,
+				   NULL);
+  part->send_values = clCreateBuffer(context, CL_MEM_READ_WRITE,
+				     sizeof(cl_float)*(part->num_send ? part->num_send : 1), NULL, NULL);
+  free(distances);
+  free(preds);
+  free(vertices);
+  if(!part->edges || !part->vertices || !part->distances || !part->preds || !part->update ||
+     !part->send_ids || !part->send_values) {
+    problem("Failed to allocate device memory for a partition.\n");
+    exit(-1);
+  }
+
+  part->update_kernel = clCreateKernel(env->program, "UpdateVertex", &err);
+  check_failure(err);
+  part->gather_kernel = clCreateKernel(env->program, "GatherDistances", &err);
+  check_failure(err);
+  int a = 0;
+  err  = clSetKernelArg(part->update_kernel, a++, sizeof(cl_mem), &part->edges);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_mem), &part->distances);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_mem), &part->preds);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_mem), &part->vertices);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_mem), &part->update);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_uint), &part->count);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_uint), &part->num_edges);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_uint), &slot);
+  err |= clSetKernelArg(part->update_kernel, a++, sizeof(cl_float), &unbounded);
+  a = 0;
+  err |= clSetKernelArg(part->gather_kernel, a++, sizeof(cl_mem), &part->distances);
+  err |= clSetKernelArg(part->gather_kernel, a++, sizeof(cl_mem), &part->send_ids);
+  err |= clSetKernelArg(part->gather_kernel, a++, sizeof(cl_mem), &part->send_values);
+  err |= clSetKernelArg(part->gather_kernel, a++, sizeof(cl_uint), &part->num_send);
+  err |= clEnqueueWriteBuffer(env->commands, part->update, CL_TRUE, 0, sizeof(cl_uint), &zero,
+			      0, NULL, NULL);
+  check_failure(err);
+}
+
+static void release_partition(partition *part) {
+  clReleaseKernel(part->update_kernel);
+  clReleaseKernel(part->gather_kernel);
+  clReleaseMemObject(part->edges);
+  clReleaseMemObject(part->vertices);
+  clReleaseMemObject(part->distances);
+  clReleaseMemObject(part->preds);
+  clReleaseMemObject(part->update);
+  clReleaseMemObject(part->send_ids);
+  clReleaseMemObject(part->send_values);
+}
+
+//Every device runs its round, then the boundary distances go through the
+//host into the halo slots for the next one.  Rounds are enqueued on all
+//devices before waiting on any, so they run side by side.
+cl_uint opencl_partitioned_sssp(device_set *set, graph *g, cl_uint source, cl_float *result,
+				cl_uint *preds, sssp_stats *stats) {
+  cl_uint num_parts = set->num_devices, n = g->num_vertices, p, i, rounds = 0;
+  partition parts[MAX_PARTITIONS];
+  cl_uint flags[MAX_PARTITIONS];
+  cl_float *sent[MAX_PARTITIONS], *received[MAX_PARTITIONS];
+  cl_float *boundary = (cl_float *)malloc(sizeof(cl_float)*(n ? n : 1));
+  cl_ulong exchanged = 0;
+  const cl_uint zero = 0;
+  size_t local[] = {LOCAL_WORK_SIZE};
+  cl_int err;
+
+  cl_ulong cut = plan_partitions(g, num_parts, parts);
+  for(p = 0; p < num_parts; p++)
+    printf("Partition %u: vertices [%u, %u), %u in-edges, %u halo, %u sent\n", p,
+	   parts[p].first, parts[p].first + parts[p].count, parts[p].num_edges, parts[p].num_halo,
+	   parts[p].num_send);
+  printf("Cut edges: %llu of %u\n", (unsigned long long)cut, g->num_edges);
+  printf(BAR);
+  for(p = 0; p < num_parts; p++) {
+    upload_partition(&set->envs[p], g, &parts[p], source);
+    sent[p] = (cl_float *)malloc(sizeof(cl_float)*(parts[p].num_send ? parts[p].num_send : 1));
+    received[p] = (cl_float *)malloc(sizeof(cl_float)*(parts[p].num_halo ? parts[p].num_halo : 1));
+  }
+
+  while(rounds < n) {
+    cl_uint any = 0;
+    for(p = 0; p < num_parts; p++) {
+      partition *part = &parts[p];
+      cl_command_queue commands = set->envs[p].commands;
+      size_t global[] = {part->count + LOCAL_WORK_SIZE - (part->count % LOCAL_WORK_SIZE)};
+      err  = clEnqueueWriteBuffer(commands, part->update, CL_FALSE, 0, sizeof(cl_uint), &zero,
+				  0, NULL, NULL);
+      err |= clEnqueueNDRangeKernel(commands, part->update_kernel, 1, NULL, global, local, 0, NULL,
+				    NULL);
+      err |= clEnqueueReadBuffer(commands, part->update, CL_FALSE, 0, sizeof(cl_uint), &flags[p],
+				 0, NULL, NULL);
+      if(part->num_send) {
+	global[0] = part->num_send + LOCAL_WORK_SIZE - (part->num_send % LOCAL_WORK_SIZE);
+	err |= clEnqueueNDRangeKernel(commands, part->gather_kernel, 1, NULL, global, local, 0,
+				      NULL, NULL);
+	err |= clEnqueueReadBuffer(commands, part->send_values, CL_FALSE, 0,
+				   sizeof(cl_float)*part->num_send, sent[p], 0, NULL, NULL);
+      }
+      check_failure(err);
+      clFlush(commands);
+    }
+    for(p = 0; p < num_parts; p++) {
+      check_failure(clFinish(set->envs[p].commands));
+      any |= flags[p];
+    }
+    rounds++;
+    if(!any)
+      break;
+    for(p = 0; p < num_parts; p++)
+      for(i = 0; i < parts[p].num_send; i++)
+	boundary[parts[p].first + parts[p].send[i]] = sent[p][i];
+    for(p = 0; p < num_parts; p++) {
+      partition *part = &parts[p];
+      if(!part->num_halo)
+	continue;
+      for(i = 0; i < part->num_halo; i++)
+	received[p][i] = boundary[part->halo[i]];
+      err = clEnqueueWriteBuffer(set->envs[p].commands, part->distances, CL_FALSE,
+				 sizeof(cl_float)*part->count, sizeof(cl_float)*part->num_halo,
+				 received[p], 0, NULL, NULL);
+      check_failure(err);
+      exchanged += part->num_halo;
+    }
+  }
+
+  cl_uint *local_preds = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+  for(p = 0; p < num_parts; p++) {
+    partition *part = &parts[p];
+    cl_command_queue commands = set->envs[p].commands;
+    if(!part->count)
+      continue;
+    err  = clEnqueueReadBuffer(commands, part->distances, CL_TRUE, 0,
+			       sizeof(cl_float)*part->count, result + part->first, 0, NULL, NULL);
+    err |= clEnqueueReadBuffer(commands, part->preds, CL_TRUE, 0, sizeof(cl_uint)*part->count,
+			       local_preds + part->first, 0, NULL, NULL);
+    check_failure(err);
+    for(i = 0; i < part->count; i++) {
+      cl_uint pred = local_preds[part->first + i];
+      preds[part->first + i] = pred < part->count ? part->first + pred :
+	part->halo[pred - part->count];
+    }
+  }
+  printf("Rounds: %u, halo distances exchanged: %llu\n", rounds, (unsigned long long)exchanged);
+  printf(BAR);
+
+  if(stats) {
+    stats->rounds = rounds;
+    stats->edges_scanned = (cl_ulong)rounds*g->num_edges;
+  }
+  for(p = 0; p < num_parts; p++) {
+    release_partition(&parts[p]);
+    free(sent[p]);
+    free(received[p]);
+  }
+  free_partitions(parts, num_parts);
+  free(local_preds);
+  free(boundary);
+  return rounds;
+}
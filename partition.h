@@ -0,0 +1,72 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "sssp.h"
+
+/*
+ * Sweep mode split over several devices.  Each partition owns a contiguous
+ * range of vertices with their in-edges and runs UpdateVertex on its own
+ * device.  Its buffers are numbered locally: the owned vertices first,
+ * then one halo slot per outside vertex its in-edges read.  Between
+ * rounds the boundary distances each partition owns are gathered, read
+ * back and written into the halo slots of the partitions that read them.
+ * The run stops after a round in which no partition changed anything.
+ *
+ * Ranges are balanced on in-edges, then each boundary moves within
+ * PARTITION_WINDOW of its range to wherever the fewest edges cross it.
+ * Vertex order matters for the cut, so -o rcm (or hilbert) helps.
+ *
+ * Devices are every device of the requested type.  With fewer of those
+ * than partitions, the first one is split with clCreateSubDevices: by NUMA
+ * node, else into equal compute-unit shares.  A CPU OpenCL runtime split
+ * this way runs the whole scheme on one machine.
+ */
+
+#define MAX_PARTITIONS 64
+//A boundary moves at most 1/PARTITION_WINDOW of its partition's vertices.
+#define PARTITION_WINDOW 8
+
+typedef enum { SPLIT_AUTO, SPLIT_NUMA, SPLIT_EQUAL, SPLIT_DEVICES } device_split;
+
+typedef struct _partition {
+  cl_uint first;                //Owned global vertices [first, first + count).
+  cl_uint count;
+  cl_uint num_edges;            //In-edges of the owned vertices.
+  cl_uint *halo;                //Global ids of the halo slots, ascending.
+  cl_uint num_halo;
+  cl_uint *send;                //Owned local ids some other partition reads.
+  cl_uint num_send;
+  cl_mem edges;
+  cl_mem vertices;
+  cl_mem distances;             //count + num_halo
+  cl_mem preds;
+  cl_mem update;
+  cl_mem send_ids;
+  cl_mem send_values;
+  cl_kernel update_kernel;
+  cl_kernel gather_kernel;
+} partition;
+
+typedef struct _device_set {
+  cl_uint num_devices;
+  opencl_env envs[MAX_PARTITIONS];
+  cl_device_id sub_devices[MAX_PARTITIONS]; //Released with the set.
+  cl_uint num_sub_devices;
+} device_set;
+
+//Sets up num_parts devices of type (see above).  Returns the OpenCL error
+//if there are not enough devices and none can be split.
+cl_int opencl_partition_setup(device_set *set, cl_device_type type, cl_uint num_parts,
+			      device_split split, const char *kernel_file, edge_layout layout,
+			      const char *cache_dir);
+void opencl_partition_release(device_set *set);
+
+//Host side: ranges, halos and send lists for num_parts partitions.
+//Returns the number of edges that cross partitions.
+cl_ulong plan_partitions(graph *g, cl_uint num_parts, partition *parts);
+void free_partitions(partition *parts, cl_uint num_parts);
+
+cl_uint opencl_partitioned_sssp(device_set *set, graph *g, cl_uint source, cl_float *result,
+				cl_uint *preds, sssp_stats *stats);
+
+#endif
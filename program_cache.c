@@ -0,0 +1,171 @@
+#include "program_cache.h"
+
+#include <errno.h>
+
+/*--------------------------------------------------------------------------------*/
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define INFO_SIZE 1024
+
+static cl_ulong hash_bytes(cl_ulong h, const void *data, size_t size) {
+  const unsigned char *p = (const unsigned char *)data;
+  size_t i;
+  for(i = 0; i < size; i++)
+    h = (h ^ p[i])*0x100000001b3ULL;
+  return h;
+}
+
+//The key text; the caller frees it.
+static char *program_key(cl_device_id device, const char *source, const char *options) {
+  char vendor[INFO_SIZE], name[INFO_SIZE], driver[INFO_SIZE];
+  size_t length = strlen(source), size;
+  cl_int err;
+  err  = clGetDeviceInfo(device, CL_DEVICE_VENDOR, sizeof(vendor), vendor, NULL);
+  err |= clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, NULL);
+  err |= clGetDeviceInfo(device, CL_DRIVER_VERSION, sizeof(driver), driver, NULL);
+  if(err != CL_SUCCESS)
+    return NULL;
+  size = 3*INFO_SIZE + strlen(options) + 128;
+  char *key = (char *)malloc(size);
+  snprintf(key, size, "vendor=%s\ndevice=%s\ndriver=%s\noptions=%s\nsource=%016llx/%llu\n",
+	   vendor, name, driver, options,
+	   (unsigned long long)hash_bytes(FNV_OFFSET, source, length), (unsigned long long)length);
+  return key;
+}
+
+static void entry_path(char *path, size_t size, const char *dir, const char *key) {
+  snprintf(path, size, "%s/%016llx.clbin", dir,
+	   (unsigned long long)hash_bytes(FNV_OFFSET, key, strlen(key)));
+}
+
+//mkdir -p.
+static int make_dirs(const char *dir) {
+  char path[PATH_MAX];
+  char *p;
+  snprintf(path, sizeof(path), "%s", dir);
+  for(p = path + 1; *p; p++) {
+    if(*p != '/')
+      continue;
+    *p = 0;
+    if(mkdir(path, 0755) && errno != EEXIST)
+      return -1;
+    *p = '/';
+  }
+  return mkdir(path, 0755) && errno != EEXIST ? -1 : 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+const char *default_program_cache(void) {
+  static char path[PATH_MAX];
+  const char *base = getenv("XDG_CACHE_HOME");
+  if(base && *base) {
+    snprintf(path, sizeof(path), "%s/%s", base, PROGRAM_CACHE_SUBDIR);
+    return path;
+  }
+  base = getenv("HOME");
+  if(!base || !*base)
+    return NULL;
+  snprintf(path, sizeof(path), "%s/.cache/%s", base, PROGRAM_CACHE_SUBDIR);
+  return path;
+}
+
+cl_program load_cached_program(cl_context context, cl_device_id device, const char *dir,
+			       const char *source, const char *options) {
+  char path[PATH_MAX];
+  program_header header;
+  struct stat statbuf;
+  cl_program program = NULL;
+  unsigned char *data = NULL;
+  char *key = program_key(device, source, options);
+  FILE *in = NULL;
+  if(!key)
+    return NULL;
+  entry_path(path, sizeof(path), dir, key);
+  in = fopen(path, "rb");
+  if(!in || fstat(fileno(in), &statbuf) || fread(&header, sizeof(header), 1, in) != 1)
+    goto miss;
+  if(memcmp(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic)) ||
+     header.version != PROGRAM_CACHE_VERSION || header.key_size != strlen(key) ||
+     header.binary_size == 0 ||
+     (cl_ulong)statbuf.st_size != sizeof(header) + header.key_size + header.binary_size)
+    goto miss;
+  data = (unsigned char *)malloc(header.key_size + header.binary_size);
+  if(!data || fread(data, header.key_size + header.binary_size, 1, in) != 1 ||
+     memcmp(data, key, header.key_size) ||
+     hash_bytes(FNV_OFFSET, data, header.key_size + header.binary_size) != header.checksum)
+    goto miss;
+
+  {
+    const unsigned char *binary = data + header.key_size;
+    size_t binary_size = (size_t)header.binary_size;
+    cl_int status, err;
+    program = clCreateProgramWithBinary(context, 1, &device, &binary_size, &binary, &status, &err);
+    if(err != CL_SUCCESS || status != CL_SUCCESS) {
+      if(program)
+	clReleaseProgram(program);
+      program = NULL;
+    } else if(clBuildProgram(program, 1, &device, options, NULL, NULL) != CL_SUCCESS) {
+      clReleaseProgram(program);
+      program = NULL;
+    }
+  }
+ miss:
+  if(in)
+    fclose(in);
+  free(data);
+  free(key);
+  return program;
+}
+
+int store_cached_program(cl_program program, cl_device_id device, const char *dir,
+			 const char *source, const char *options) {
+  char path[PATH_MAX], temp[PATH_MAX + 32];
+  program_header header;
+  size_t binary_size = 0;
+  unsigned char *binary = NULL;
+  char *key = program_key(device, source, options);
+  FILE *out = NULL;
+  int err = -1;
+  if(!key || clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(binary_size),
+			      &binary_size, NULL) != CL_SUCCESS || binary_size == 0)
+    goto done;
+  binary = (unsigned char *)malloc(binary_size);
+  if(!binary || clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(binary), &binary,
+				 NULL) != CL_SUCCESS)
+    goto done;
+  if(make_dirs(dir)) {
+    problem("Could not create the kernel cache %s\n", dir);
+    goto done;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+  header.version = PROGRAM_CACHE_VERSION;
+  header.key_size = (cl_uint)strlen(key);
+  header.binary_size = binary_size;
+  header.checksum = hash_bytes(hash_bytes(FNV_OFFSET, key, header.key_size), binary, binary_size);
+  entry_path(path, sizeof(path), dir, key);
+  snprintf(temp, sizeof(temp), "%s.%d.tmp", path, (int)getpid());
+  out = fopen(temp, "wb");
+  if(!out ||
+     fwrite(&header, sizeof(header), 1, out) != 1 ||
+     fwrite(key, header.key_size, 1, out) != 1 ||
+     fwrite(binary, binary_size, 1, out) != 1) {
+    problem("Could not write %s\n", temp);
+    if(out)
+      fclose(out);
+    unlink(temp);
+    goto done;
+  }
+  if(fclose(out) || rename(temp, path)) {
+    problem("Could not write %s\n", path);
+    unlink(temp);
+    goto done;
+  }
+  err = 0;
+ done:
+  free(binary);
+  free(key);
+  return err;
+}
@@ -0,0 +1,46 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include "sssp.h"
+
+/*
+ * Compiled kernel cache.  A build of kernel.cl is keyed on everything that
+ * can change the binary: device vendor and name, driver version, build
+ * options (-DWIDE_EDGES, -DCOUNT_UPDATES, ...) and a hash of the source.
+ * Each entry is <dir>/<hash of key>.clbin:
+ *
+ *   program_header
+ *   char key[key_size]          the key text, compared in full on load
+ *   unsigned char binary[binary_size]
+ *
+ * checksum covers key and binary.  Anything that does not match, does not
+ * verify or does not build is treated as a miss, and the caller builds from
+ * source and stores over it.  Entries are written to a temporary file and
+ * renamed, so concurrent runs never see half of one.
+ */
+
+#define PROGRAM_CACHE_MAGIC "OPBFBIN"
+#define PROGRAM_CACHE_VERSION 1
+#define PROGRAM_CACHE_SUBDIR "opencl-sssp"
+
+typedef struct _program_header {
+  char magic[8];
+  cl_uint version;
+  cl_uint key_size;
+  cl_ulong binary_size;
+  cl_ulong checksum;
+} program_header;
+
+//$XDG_CACHE_HOME/opencl-sssp, else ~/.cache/opencl-sssp; NULL without either.
+const char *default_program_cache(void);
+
+//The cached program for source built with options, already built for the
+//device, or NULL on a miss.
+cl_program load_cached_program(cl_context context, cl_device_id device, const char *dir,
+			       const char *source, const char *options);
+//Stores a program just built from source.  Returns 0, or -1 (after saying
+//why) if the entry could not be written.
+int store_cached_program(cl_program program, cl_device_id device, const char *dir,
+			 const char *source, const char *options);
+
+#endif
@@ -0,0 +1,244 @@
+#include "reorder.h"
+
+/*--------------------------------------------------------------------------------*/
+
+static int keycomp(const void *a, const void *b) {
+  cl_ulong f = *(const cl_ulong *)a, s = *(const cl_ulong *)b;
+  return (f > s) - (f < s);
+}
+
+//Keys carry the vertex in their low 32 bits, so sorting them is stable and
+//the vertex comes straight back out.
+static void order_by_key(cl_ulong *keys, cl_uint n, cl_uint *old_ids) {
+  cl_uint i;
+  qsort(keys, n, sizeof(cl_ulong), keycomp);
+  for(i = 0; i < n; i++)
+    old_ids[i] = (cl_uint)keys[i];
+}
+
+static inline cl_uint total_degree(const graph *g, cl_uint v) {
+  return g->vertices[v].num_edges + g->out_vertices[v].num_edges;
+}
+
+static void degree_order(graph *g, cl_uint *old_ids) {
+  cl_uint v, n = g->num_vertices;
+  cl_ulong *keys = (cl_ulong *)malloc(sizeof(cl_ulong)*(n ? n : 1));
+  for(v = 0; v < n; v++)
+    keys[v] = (cl_ulong)(CL_UINT_MAX - total_degree(g, v)) << 32 | v;
+  order_by_key(keys, n, old_ids);
+  free(keys);
+}
+
+//Each component starts from its lowest-degree vertex, a cheap stand-in for
+//a peripheral one.  Edges count in both directions.
+static void rcm_order(graph *g, cl_uint *old_ids) {
+  cl_uint n = g->num_vertices, head = 0, tail = 0, next_start = 0, v, i, j;
+  cl_ulong *starts = (cl_ulong *)malloc(sizeof(cl_ulong)*(n ? n : 1));
+  cl_uchar *seen = (cl_uchar *)calloc(n ? n : 1, 1);
+  for(v = 0; v < n; v++)
+    starts[v] = (cl_ulong)total_degree(g, v) << 32 | v;
+  qsort(starts, n, sizeof(cl_ulong), keycomp);
+  while(tail < n) {
+    if(head == tail) {
+      while(seen[(cl_uint)starts[next_start]])
+	next_start++;
+      v = (cl_uint)starts[next_start];
+      seen[v] = 1;
+      old_ids[tail++] = v;
+    }
+    cl_uint u = old_ids[head++], added = tail;
+    for(i = 0; i < 2; i++) {
+      vertex node = i ? g->out_vertices[u] : g->vertices[u];
+      edge *edges = i ? g->out_edges : g->edges;
+      for(j = node.index; j < node.index + node.num_edges; j++) {
+	v = i ? edges[j].dest : edges[j].source;
+	if(!seen[v]) {
+	  seen[v] = 1;
+	  old_ids[tail++] = v;
+	}
+      }
+    }
+    //Neighbours by increasing degree; the lists are short.
+    for(i = added + 1; i < tail; i++) {
+      v = old_ids[i];
+      for(j = i; j > added && total_degree(g, old_ids[j-1]) > total_degree(g, v); j--)
+	old_ids[j] = old_ids[j-1];
+      old_ids[j] = v;
+    }
+  }
+  for(i = 0; i < n/2; i++) {
+    v = old_ids[i];
+    old_ids[i] = old_ids[n - 1 - i];
+    old_ids[n - 1 - i] = v;
+  }
+  free(starts);
+  free(seen);
+}
+
+//Position of (x, y) on the order-16 Hilbert curve.
+static cl_ulong hilbert_index(cl_uint x, cl_uint y) {
+  cl_ulong d = 0;
+  cl_uint s, rx, ry, t;
+  for(s = 1 << 15; s > 0; s >>= 1) {
+    rx = (x & s) > 0;
+    ry = (y & s) > 0;
+    d += (cl_ulong)s*s*((3*rx) ^ ry);
+    if(!ry) {
+      if(rx) {
+	x = 0xffff - x;
+	y = 0xffff - y;
+      }
+      t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+static void hilbert_order(graph *g, cl_uint *old_ids) {
+  cl_uint v, n = g->num_vertices;
+  cl_long min_x = INT_MAX, max_x = INT_MIN, min_y = INT_MAX, max_y = INT_MIN;
+  cl_ulong *keys = (cl_ulong *)malloc(sizeof(cl_ulong)*(n ? n : 1));
+  for(v = 0; v < n; v++) {
+    cl_long x = g->coords[2*v], y = g->coords[2*v + 1];
+    if(x < min_x) min_x = x;
+    if(x > max_x) max_x = x;
+    if(y < min_y) min_y = y;
+    if(y > max_y) max_y = y;
+  }
+  cl_ulong span_x = max_x > min_x ? max_x - min_x : 1;
+  cl_ulong span_y = max_y > min_y ? max_y - min_y : 1;
+  for(v = 0; v < n; v++) {
+    cl_uint x = (cl_uint)((g->coords[2*v] - min_x)*0xffff/span_x);
+    cl_uint y = (cl_uint)((g->coords[2*v + 1] - min_y)*0xffff/span_y);
+    keys[v] = hilbert_index(x, y) << 32 | v;
+  }
+  order_by_key(keys, n, old_ids);
+  free(keys);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+typedef struct _permute_ctx {
+  graph *g;
+  const cl_uint *old_ids;
+  const cl_uint *new_ids;
+  vertex *vertices;
+  edge *edges;
+} permute_ctx;
+
+//Copies old vertex old_ids[v]'s in-edges to new vertex v, renumbered and
+//sorted by source again like the loader leaves them.
+static void permute_range(void *arg, cl_uint begin, cl_uint end, cl_uint worker) {
+  permute_ctx *ctx = (permute_ctx *)arg;
+  graph *g = ctx->g;
+  cl_uint v, i, j;
+  for(v = begin; v < end; v++) {
+    vertex from = g->vertices[ctx->old_ids[v]];
+    edge *group = ctx->edges + ctx->vertices[v].index;
+    for(i = 0; i < from.num_edges; i++) {
+      edge e = g->edges[from.index + i];
+      e.source = ctx->new_ids[e.source];
+      e.dest = v;
+      for(j = i; j > 0 && (e.source < group[j-1].source ||
+			   (e.source == group[j-1].source && e.weight < group[j-1].weight)); j--)
+	group[j] = group[j-1];
+      group[j] = e;
+    }
+  }
+}
+
+int reorder_graph(thread_pool *pool, graph *g, vertex_order order) {
+  cl_uint n = g->num_vertices, v, index = 0;
+  permute_ctx ctx;
+  if(order == ORDER_NONE)
+    return 0;
+  if(order == ORDER_HILBERT && !g->coords) {
+    problem("Hilbert ordering needs vertex coordinates.\n");
+    return -1;
+  }
+  if(!g->out_edges)
+    build_out_edges(g);
+
+  cl_uint *old_ids = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+  cl_uint *new_ids = (cl_uint *)malloc(sizeof(cl_uint)*(n ? n : 1));
+  ctx.vertices = (vertex *)malloc(sizeof(vertex)*(n ? n : 1));
+  ctx.edges = (edge *)malloc(sizeof(edge)*(g->num_edges ? g->num_edges : 1));
+  if(!old_ids || !new_ids || !ctx.vertices || !ctx.edges) {
+    problem("Failed to allocate the reordered graph.\n");
+    exit(-1);
+  }
+  if(order == ORDER_RCM)
+    rcm_order(g, old_ids);
+  else if(order == ORDER_DEGREE)
+    degree_order(g, old_ids);
+  else
+    hilbert_order(g, old_ids);
+  for(v = 0; v < n; v++)
+    new_ids[old_ids[v]] = v;
+
+  for(v = 0; v < n; v++) {
+    ctx.vertices[v].index = index;
+    ctx.vertices[v].num_edges = g->vertices[old_ids[v]].num_edges;
+    index += ctx.vertices[v].num_edges;
+  }
+  ctx.g = g;
+  ctx.old_ids = old_ids;
+  ctx.new_ids = new_ids;
+  thread_pool_for(pool, 0, n, 1024, permute_range, &ctx);
+
+  if(g->coords) {
+    cl_int *coords = (cl_int *)malloc(sizeof(cl_int)*2*(n ? n : 1));
+    for(v = 0; v < n; v++) {
+      coords[2*v] = g->coords[2*old_ids[v]];
+      coords[2*v + 1] = g->coords[2*old_ids[v] + 1];
+    }
+    free(g->coords);
+    g->coords = coords;
+  }
+  //Compose with an earlier renumbering so the ids still lead back to the file.
+  if(g->old_ids) {
+    for(v = 0; v < n; v++)
+      old_ids[v] = g->old_ids[old_ids[v]];
+    for(v = 0; v < n; v++)
+      new_ids[old_ids[v]] = v;
+    free(g->old_ids);
+    free(g->new_ids);
+  }
+
+  free(g->edges);
+  free(g->vertices);
+  free(g->out_edges);
+  free(g->out_vertices);
+  if(g->mapping) {
+    munmap(g->mapping, g->mapping_size);
+    g->mapping = NULL;
+    g->mapping_size = 0;
+  } else {
+    free(g->offsets);
+    free(g->packed_edges);
+  }
+  g->edges = ctx.edges;
+  g->vertices = ctx.vertices;
+  g->out_edges = NULL;
+  g->out_vertices = NULL;
+  g->offsets = NULL;
+  g->packed_edges = NULL;
+  g->old_ids = old_ids;
+  g->new_ids = new_ids;
+  return 0;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void restore_row(const graph *g, const cl_float *distances, const cl_uint *preds,
+		 cl_float *out_distances, cl_uint *out_preds) {
+  cl_uint v, n = g->num_vertices;
+  for(v = 0; v < n; v++) {
+    cl_uint at = internal_id(g, v);
+    out_distances[v] = distances[at];
+    if(out_preds)
+      out_preds[v] = original_id(g, preds[at]);
+  }
+}
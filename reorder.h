@@ -0,0 +1,41 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include "sssp.h"
+#include "threadpool.h"
+
+/*
+ * Vertex renumbering for locality.  UpdateVertex gathers the distance of
+ * every in-neighbour, so the closer neighbours' numbers are, the more of
+ * those reads share cache lines.
+ *
+ *   rcm      reverse Cuthill-McKee: breadth-first from a low-degree vertex,
+ *            neighbours by increasing degree, then reversed
+ *   degree   highest total degree first, so the hubs share lines
+ *   hilbert  by position along a Hilbert curve over the coordinates
+ *
+ * The engines only ever see the new numbers.  Sources coming in and
+ * vertices going out are translated with internal_id/original_id.
+ */
+
+typedef enum { ORDER_NONE, ORDER_RCM, ORDER_DEGREE, ORDER_HILBERT } vertex_order;
+
+//Renumbers g in place (edges, vertices, coords) and records the mapping.
+//Any cached packed/out-edge layouts are dropped to be rebuilt.  Returns 0,
+//or -1 for hilbert without coordinates.
+int reorder_graph(thread_pool *pool, graph *g, vertex_order order);
+
+//Copies a result row from internal to file numbering: out[v] is the value
+//for file vertex v, and preds are translated too.  out_preds may be NULL.
+void restore_row(const graph *g, const cl_float *distances, const cl_uint *preds,
+		 cl_float *out_distances, cl_uint *out_preds);
+
+static inline cl_uint internal_id(const graph *g, cl_uint v) {
+  return g->new_ids ? g->new_ids[v] : v;
+}
+
+static inline cl_uint original_id(const graph *g, cl_uint v) {
+  return g->old_ids ? g->old_ids[v] : v;
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include "repair.h"
+#include "cpu_sssp.h"
+#include "reorder.h"
+
+/*--------------------------------------------------------------------------------*/
+
+#define MARK_INVALID 1
+#define MARK_SEED 2
+
+typedef struct _uint_list {
+  cl_uint *items;
+  cl_uint count;
+  cl_uint capacity;
+} uint_list;
+
+static void append(uint_list *l, cl_uint v) {
+  if(l->count == l->capacity) {
+    l->capacity = l->capacity ? 2*l->capacity : 256;
+    l->items = (cl_uint *)realloc(l->items, sizeof(cl_uint)*l->capacity);
+    if(!l->items) {
+      problem("Failed to allocate the repair plan.\n");
+      exit(-1);
+    }
+  }
+  l->items[l->count++] = v;
+}
+
+//A graph mapped from a binary cache is read-only; the mapping is private,
+//so making it writable only copies the pages that get patched.
+static void unprotect_packed(graph *g) {
+  if(g->mapping && mprotect(g->mapping, g->mapping_size, PROT_READ | PROT_WRITE)) {
+    problem("Could not make the graph cache mapping writable.\n");
+    exit(-1);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+void plan_repair(graph *g, cl_uint source, const weight_update *updates, cl_uint count,
+		 const cl_float *distances, const cl_uint *preds, repair_plan *plan) {
+  uint_list in_slots = {NULL, 0, 0}, out_slots = {NULL, 0, 0};
+  uint_list invalid = {NULL, 0, 0}, seeds = {NULL, 0, 0};
+  cl_float *in_weights = NULL, *out_weights = NULL;
+  cl_uchar *marks = (cl_uchar *)calloc(g->num_vertices ? g->num_vertices : 1, 1);
+  cl_uint k, i, j;
+  int writable = 0;
+  if(!marks) {
+    problem("Failed to allocate the repair plan.\n");
+    exit(-1);
+  }
+
+  for(k = 0; k < count; k++) {
+    cl_uint u = updates[k].source, v = updates[k].dest;
+    cl_float w = updates[k].weight;
+    vertex node = g->vertices[v];
+    int found = 0;
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      if(g->edges[i].source != u)
+	continue;
+      found = 1;
+      cl_float old = g->edges[i].weight;
+      if(old == w)
+	continue;
+      g->edges[i].weight = w;
+      if(g->packed_edges) {
+	if(!writable)
+	  unprotect_packed(g);
+	writable = 1;
+	g->packed_edges[i].weight = w;
+      }
+      append(&in_slots, i);
+      in_weights = (cl_float *)realloc(in_weights, sizeof(cl_float)*in_slots.capacity);
+      in_weights[in_slots.count - 1] = w;
+      if(v == source || marks[v] == MARK_INVALID)
+	continue;
+      if(w > old && preds[v] == u) {
+	marks[v] = MARK_INVALID;
+	append(&invalid, v);
+      } else if(w < old && !marks[v] && distances[u] + w < distances[v]) {
+	marks[v] = MARK_SEED;
+	append(&seeds, v);
+      }
+    }
+    if(!found) {
+      problem("No arc %u -> %u, update ignored.\n", original_id(g, u) + 1, original_id(g, v) + 1);
+      continue;
+    }
+    node = g->out_vertices[u];
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      if(g->out_edges[i].dest != v || g->out_edges[i].weight == w)
+	continue;
+      g->out_edges[i].weight = w;
+      append(&out_slots, i);
+      out_weights = (cl_float *)realloc(out_weights, sizeof(cl_float)*out_slots.capacity);
+      out_weights[out_slots.count - 1] = w;
+    }
+  }
+
+  //Everything hanging below an invalidated vertex in the pred tree loses
+  //its path too.  Children are found over out-edges, so this costs the
+  //subtree's degree, not the graph's size.
+  for(k = 0; k < invalid.count; k++) {
+    cl_uint x = invalid.items[k];
+    vertex node = g->out_vertices[x];
+    for(i = node.index; i < node.index + node.num_edges; i++) {
+      cl_uint y = g->out_edges[i].dest;
+      if(y == source || y == x || marks[y] == MARK_INVALID || preds[y] != x)
+	continue;
+      marks[y] = MARK_INVALID;
+      append(&invalid, y);
+    }
+  }
+  for(k = 0; k < invalid.count; k++)
+    append(&seeds, invalid.items[k]);
+  //A vertex seeded by a decrease and then invalidated is in there twice.
+  for(k = 0, j = 0; k < seeds.count; k++) {
+    cl_uint v = seeds.items[k];
+    if(marks[v] == MARK_INVALID && k < seeds.count - invalid.count)
+      continue;
+    seeds.items[j++] = v;
+  }
+  seeds.count = j;
+  free(marks);
+
+  plan->num_in = in_slots.count;
+  plan->num_out = out_slots.count;
+  plan->slots = (cl_uint *)malloc(sizeof(cl_uint)*(plan->num_in + plan->num_out + 1));
+  plan->weights = (cl_float *)malloc(sizeof(cl_float)*(plan->num_in + plan->num_out + 1));
+  if(!plan->slots || !plan->weights) {
+    problem("Failed to allocate the repair plan.\n");
+    exit(-1);
+  }
+  if(plan->num_in) {
+    memcpy(plan->slots, in_slots.items, sizeof(cl_uint)*plan->num_in);
+    memcpy(plan->weights, in_weights, sizeof(cl_float)*plan->num_in);
+  }
+  if(plan->num_out) {
+    memcpy(plan->slots + plan->num_in, out_slots.items, sizeof(cl_uint)*plan->num_out);
+    memcpy(plan->weights + plan->num_in, out_weights, sizeof(cl_float)*plan->num_out);
+  }
+  plan->invalid = invalid.items;
+  plan->num_invalid = invalid.count;
+  plan->seeds = seeds.items;
+  plan->num_seeds = seeds.count;
+  free(in_slots.items);
+  free(out_slots.items);
+  free(in_weights);
+  free(out_weights);
+}
+
+void free_repair_plan(repair_plan *plan) {
+  free(plan->slots);
+  free(plan->weights);
+  free(plan->invalid);
+  free(plan->seeds);
+  memset(plan, 0, sizeof(repair_plan));
+}
+
+cl_uint cpu_repair_sssp(thread_pool *pool, graph *g, const repair_plan *plan,
+			cl_float *distances, cl_uint *preds, sssp_stats *stats) {
+  cl_uint k;
+  for(k = 0; k < plan->num_invalid; k++) {
+    distances[plan->invalid[k]] = INFINITY;
+    preds[plan->invalid[k]] = plan->invalid[k];
+  }
+  return cpu_frontier_from(pool, g, plan->seeds, plan->num_seeds, INFINITY, distances, preds,
+			   stats);
+}
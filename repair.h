@@ -0,0 +1,48 @@
+#ifndef REPAIR_H
+#define REPAIR_H
+
+#include "sssp.h"
+#include "threadpool.h"
+
+/*
+ * Incremental repair of a single-source solution after edge weight changes.
+ * plan_repair patches the host graph and works out what the change can
+ * touch, from the distances and preds it invalidates:
+ *
+ *   decrease  u->v got shorter and now beats v's distance: v is a seed
+ *   increase  u->v is v's tree edge: v and everything below it in the
+ *             pred tree lose their paths, are reset to unreached and seeded
+ *
+ * The engines then run frontier rounds from the seeds only, so the work
+ * follows the changed region rather than the graph.  Non-tree increases
+ * change nothing.  Parallel arcs u->v all take the new weight.
+ */
+
+//One changed arc, in internal vertex numbers (see load_weight_updates).
+typedef struct _weight_update {
+  cl_uint source;
+  cl_uint dest;
+  cl_float weight;
+} weight_update;
+
+typedef struct _repair_plan {
+  cl_uint *slots;               //num_in in-edge slots, then num_out out-edge slots
+  cl_float *weights;            //their new weights
+  cl_uint num_in;
+  cl_uint num_out;
+  cl_uint *invalid;             //vertices reset to unreached
+  cl_uint num_invalid;
+  cl_uint *seeds;               //the first frontier
+  cl_uint num_seeds;
+} repair_plan;
+
+//Patches g (in-edges, packed in-edges and out-edges; requires
+//build_out_edges) and plans the repair of the solution in distances/preds.
+void plan_repair(graph *g, cl_uint source, const weight_update *updates, cl_uint count,
+		 const cl_float *distances, const cl_uint *preds, repair_plan *plan);
+void free_repair_plan(repair_plan *plan);
+
+cl_uint cpu_repair_sssp(thread_pool *pool, graph *g, const repair_plan *plan,
+			cl_float *distances, cl_uint *preds, sssp_stats *stats);
+
+#endif
@@ -0,0 +1,162 @@
+#include "result.h"
+
+/*--------------------------------------------------------------------------------*/
+
+//Longest "v distance pred\n" line: two 10-digit ids and a %.9g float.
+#define RESULT_LINE 48
+
+static int write_text(FILE *out, cl_uint source, const cl_float *distances, const cl_uint *preds,
+		      cl_uint n) {
+  char *buffer = (char *)malloc(RESULT_LINE*RESULT_CHUNK);
+  cl_uint v, end;
+  if(!buffer)
+    return -1;
+  if(fprintf(out, "c sssp source %u vertices %u\n", source, n) < 0) {
+    free(buffer);
+    return -1;
+  }
+  for(v = 0; v < n; v = end) {
+    size_t used = 0;
+    end = n - v > RESULT_CHUNK ? v + RESULT_CHUNK : n;
+    for(cl_uint u = v; u < end; u++) {
+      if(distances[u] < INFINITY)
+	used += snprintf(buffer + used, RESULT_LINE, "%u %.9g %u\n", u, distances[u], preds[u]);
+      else
+	used += snprintf(buffer + used, RESULT_LINE, "%u inf %u\n", u, preds[u]);
+    }
+    if(fwrite(buffer, used, 1, out) != 1) {
+      free(buffer);
+      return -1;
+    }
+  }
+  free(buffer);
+  return 0;
+}
+
+static int write_binary(FILE *out, cl_uint source, const cl_float *distances, const cl_uint *preds,
+			cl_uint n) {
+  result_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RESULT_MAGIC, sizeof(RESULT_MAGIC));
+  header.version = RESULT_VERSION;
+  header.num_vertices = n;
+  header.source = source;
+  if(fwrite(&header, sizeof(header), 1, out) != 1)
+    return -1;
+  if(n && (fwrite(distances, sizeof(cl_float), n, out) != n ||
+	   fwrite(preds, sizeof(cl_uint), n, out) != n))
+    return -1;
+  return 0;
+}
+
+int write_result(const char *filename, result_format format, cl_uint source,
+		 const cl_float *distances, const cl_uint *preds, cl_uint num_vertices) {
+  FILE *out = fopen(filename, format == RESULT_BINARY ? "wb" : "w");
+  int err;
+  if(!out) {
+    problem("Could not create %s\n", filename);
+    return -1;
+  }
+  if(format == RESULT_BINARY)
+    err = write_binary(out, source, distances, preds, num_vertices);
+  else
+    err = write_text(out, source, distances, preds, num_vertices);
+  if(fclose(out))
+    err = -1;
+  if(err)
+    problem("Could not write %s\n", filename);
+  return err;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static int write_reached_text(FILE *out, cl_uint source, cl_float bound,
+			      const reached_vertex *reached, cl_uint count) {
+  char *buffer = (char *)malloc(RESULT_LINE*RESULT_CHUNK);
+  cl_uint k, end;
+  if(!buffer)
+    return -1;
+  if(fprintf(out, "c sssp source %u bound %.9g reached %u\n", source, bound, count) < 0) {
+    free(buffer);
+    return -1;
+  }
+  for(k = 0; k < count; k = end) {
+    size_t used = 0;
+    end = count - k > RESULT_CHUNK ? k + RESULT_CHUNK : count;
+    for(cl_uint i = k; i < end; i++)
+      used += snprintf(buffer + used, RESULT_LINE, "%u %.9g %u\n", reached[i].vertex,
+		       reached[i].distance, reached[i].pred);
+    if(fwrite(buffer, used, 1, out) != 1) {
+      free(buffer);
+      return -1;
+    }
+  }
+  free(buffer);
+  return 0;
+}
+
+int write_reached(const char *filename, result_format format, cl_uint source, cl_float bound,
+		  const reached_vertex *reached, cl_uint count) {
+  FILE *out = fopen(filename, format == RESULT_BINARY ? "wb" : "w");
+  int err = 0;
+  if(!out) {
+    problem("Could not create %s\n", filename);
+    return -1;
+  }
+  if(format == RESULT_BINARY) {
+    reached_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, REACHED_MAGIC, sizeof(REACHED_MAGIC));
+    header.version = RESULT_VERSION;
+    header.count = count;
+    header.source = source;
+    header.bound = bound;
+    if(fwrite(&header, sizeof(header), 1, out) != 1 ||
+       (count && fwrite(reached, sizeof(reached_vertex), count, out) != count))
+      err = -1;
+  } else {
+    err = write_reached_text(out, source, bound, reached, count);
+  }
+  if(fclose(out))
+    err = -1;
+  if(err)
+    problem("Could not write %s\n", filename);
+  return err;
+}
+
+cl_uint collect_reached(const cl_float *distances, const cl_uint *preds, cl_uint num_vertices,
+			reached_vertex *reached) {
+  cl_uint v, count = 0;
+  for(v = 0; v < num_vertices; v++) {
+    if(!(distances[v] < INFINITY))
+      continue;
+    reached[count].vertex = v;
+    reached[count].distance = distances[v];
+    reached[count].pred = preds[v];
+    count++;
+  }
+  return count;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+cl_uint extract_path(const cl_uint *preds, size_t stride, cl_uint num_vertices, cl_uint source,
+		     cl_uint target, cl_uint *path) {
+  cl_uint v = target, len = 0, i;
+  path[len++] = v;
+  while(v != source && len < num_vertices) {
+    cl_uint pred = preds[(size_t)v*stride];
+    if(pred == v)
+      return 0;
+    v = pred;
+    path[len++] = v;
+  }
+  if(v != source)
+    return 0;
+  for(i = 0; i < len/2; i++) {
+    v = path[i];
+    path[i] = path[len - 1 - i];
+    path[len - 1 - i] = v;
+  }
+  return len;
+}
@@ -0,0 +1,73 @@
+#ifndef RESULT_H
+#define RESULT_H
+
+#include "sssp.h"
+
+/*
+ * Single-source results on their way out.  write_result streams a solution
+ * (in the file's vertex numbers, after restore_row) to disk:
+ *
+ *   text    a "c" comment line, then "v distance pred" per vertex with the
+ *           same 0-based ids as -s; unreached vertices read "v inf v"
+ *   binary  result_header, then num_vertices cl_float distances, then
+ *           num_vertices cl_uint preds, host byte order
+ *
+ * A distance-bounded solve (--bound) writes only the vertices it reached,
+ * with write_reached:
+ *
+ *   text    "c sssp source S bound B reached K", then "v distance pred" for
+ *           each reached vertex in vertex order
+ *   binary  reached_header, then count reached_vertex records
+ *
+ * extract_path walks preds back from a target.  preds may be one column of
+ * a multi-source block, stride apart (see server.c).
+ */
+
+#define RESULT_MAGIC "SSSPRES"
+#define REACHED_MAGIC "SSSPRCH"
+#define RESULT_VERSION 1
+//Vertices formatted per write in text mode.
+#define RESULT_CHUNK 4096
+
+typedef enum { RESULT_TEXT, RESULT_BINARY } result_format;
+
+typedef struct _result_header {
+  char magic[8];
+  cl_uint version;
+  cl_uint num_vertices;
+  cl_uint source;
+  cl_uint reserved;
+} result_header;
+
+typedef struct _reached_header {
+  char magic[8];
+  cl_uint version;
+  cl_uint count;
+  cl_uint source;
+  cl_float bound;
+} reached_header;
+
+typedef struct _reached_vertex {
+  cl_uint vertex;
+  cl_float distance;
+  cl_uint pred;
+} reached_vertex;
+
+//0 on success; otherwise the problem has been reported.
+int write_result(const char *filename, result_format format, cl_uint source,
+		 const cl_float *distances, const cl_uint *preds, cl_uint num_vertices);
+int write_reached(const char *filename, result_format format, cl_uint source, cl_float bound,
+		  const reached_vertex *reached, cl_uint count);
+
+//Fills reached (room for num_vertices) with every vertex at a finite
+//distance, in vertex order, and returns how many there are.
+cl_uint collect_reached(const cl_float *distances, const cl_uint *preds, cl_uint num_vertices,
+			reached_vertex *reached);
+
+//Fills path with source ... target and returns its length, or 0 if target
+//is unreached or its pred chain does not lead back to source.  path needs
+//room for num_vertices entries.
+cl_uint extract_path(const cl_uint *preds, size_t stride, cl_uint num_vertices, cl_uint source,
+		     cl_uint target, cl_uint *path);
+
+#endif
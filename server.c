@@ -0,0 +1,379 @@
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "cpu_sssp.h"
+#include "reorder.h"
+#include "result.h"
+
+/*--------------------------------------------------------------------------------*/
+
+#define ACCEPT_POLL_MS 200
+
+//A connection is shared by its reader thread and every request of it still
+//in the queue; whoever drops the last reference closes it.
+typedef struct _connection {
+  int fd;
+  cl_uint refs;
+  struct _connection *next;
+} connection;
+
+typedef struct _request {
+  connection *conn;
+  cl_uint source;
+  cl_uint target;
+  cl_uint status;
+  struct timeval arrived;
+  struct _request *next;
+} request;
+
+typedef struct _server {
+  server_config *config;
+  int listen_fd;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  request *head;
+  request *tail;
+  connection *connections;
+  cl_uint readers;
+  int stopping;
+} server;
+
+typedef struct _reader_arg {
+  server *s;
+  connection *conn;
+} reader_arg;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int sig) {
+  stop_requested = 1;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+static int read_full(int fd, void *buffer, size_t size) {
+  char *p = (char *)buffer;
+  while(size) {
+    ssize_t n = read(fd, p, size);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+static int write_full(int fd, const void *buffer, size_t size) {
+  const char *p = (const char *)buffer;
+  while(size) {
+    ssize_t n = write(fd, p, size);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+      return -1;
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+//Caller holds s->lock.
+static void release_connection(server *s, connection *conn) {
+  connection **link;
+  if(--conn->refs)
+    return;
+  for(link = &s->connections; *link != conn; link = &(*link)->next);
+  *link = conn->next;
+  close(conn->fd);
+  free(conn);
+}
+
+static void push_request(server *s, connection *conn, cl_uint source, cl_uint target,
+			 cl_uint status) {
+  request *r = (request *)malloc(sizeof(request));
+  r->conn = conn;
+  r->source = source;
+  r->target = target;
+  r->status = status;
+  r->next = NULL;
+  gettimeofday(&r->arrived, NULL);
+  pthread_mutex_lock(&s->lock);
+  conn->refs++;
+  if(s->tail)
+    s->tail->next = r;
+  else
+    s->head = r;
+  s->tail = r;
+  pthread_cond_signal(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void *reader_main(void *arg) {
+  reader_arg *a = (reader_arg *)arg;
+  server *s = a->s;
+  connection *conn = a->conn;
+  graph *g = s->config->g;
+  cl_uint words[3];
+  free(a);
+  while(read_full(conn->fd, words, sizeof(words)) == 0) {
+    if(words[0] != SERVER_MAGIC) {
+      push_request(s, conn, 0, 0, SERVER_BAD_REQUEST);
+      break;
+    }
+    //Queries use the file's vertex numbers; out-of-range ones stay as they
+    //are for build_response to reject.
+    if(words[1] < g->num_vertices)
+      words[1] = internal_id(g, words[1]);
+    if(words[2] < g->num_vertices)
+      words[2] = internal_id(g, words[2]);
+    push_request(s, conn, words[1], words[2], SERVER_OK);
+  }
+  pthread_mutex_lock(&s->lock);
+  release_connection(s, conn);
+  s->readers--;
+  pthread_cond_broadcast(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+static void *accept_main(void *arg) {
+  server *s = (server *)arg;
+  struct pollfd pfd;
+  pfd.fd = s->listen_fd;
+  pfd.events = POLLIN;
+  while(!stop_requested) {
+    if(poll(&pfd, 1, ACCEPT_POLL_MS) <= 0)
+      continue;
+    int fd = accept(s->listen_fd, NULL, NULL);
+    if(fd < 0)
+      continue;
+    connection *conn = (connection *)malloc(sizeof(connection));
+    reader_arg *a = (reader_arg *)malloc(sizeof(reader_arg));
+    pthread_t thread;
+    conn->fd = fd;
+    conn->refs = 1;
+    a->s = s;
+    a->conn = conn;
+    pthread_mutex_lock(&s->lock);
+    conn->next = s->connections;
+    s->connections = conn;
+    s->readers++;
+    pthread_mutex_unlock(&s->lock);
+    if(pthread_create(&thread, NULL, reader_main, a)) {
+      pthread_mutex_lock(&s->lock);
+      s->readers--;
+      release_connection(s, conn);
+      pthread_mutex_unlock(&s->lock);
+      free(a);
+      continue;
+    }
+    pthread_detach(thread);
+  }
+  pthread_mutex_lock(&s->lock);
+  s->stopping = 1;
+  pthread_cond_broadcast(&s->ready);
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+/*--------------------------------------------------------------------------------*/
+
+//Detaches the longest prefix of the queue that needs at most max_sources
+//distinct sources and writes those sources out.  Caller holds s->lock.
+static request *take_batch(server *s, cl_uint *sources, cl_uint *num_sources) {
+  request *first = s->head, *last = NULL, *r;
+  cl_uint n = 0, i;
+  for(r = s->head; r; last = r, r = r->next) {
+    if(r->status != SERVER_OK || r->source >= s->config->g->num_vertices)
+      continue;
+    for(i = 0; i < n && sources[i] != r->source; i++);
+    if(i == n) {
+      if(n == s->config->max_sources)
+	break;
+      sources[n++] = r->source;
+    }
+  }
+  s->head = r;
+  if(!r)
+    s->tail = NULL;
+  if(last)
+    last->next = NULL;
+  *num_sources = n;
+  return first;
+}
+
+//Fills response with status, distance, path_length and the path, and
+//returns its length in words.
+static cl_uint build_response(server *s, request *r, const cl_uint *sources, cl_uint n,
+			      const cl_float *result, const cl_uint *preds, cl_uint *response) {
+  cl_uint num_vertices = s->config->g->num_vertices;
+  cl_uint col, len = 0, i;
+  cl_float d = INFINITY;
+  cl_uint *path = response + 3;
+  response[0] = r->status;
+  if(r->status == SERVER_OK && (r->source >= num_vertices || r->target >= num_vertices))
+    response[0] = SERVER_BAD_VERTEX;
+  if(response[0] == SERVER_OK) {
+    for(col = 0; sources[col] != r->source; col++);
+    d = result[(size_t)r->target*n + col];
+    if(d < INFINITY)
+      len = extract_path(preds + col, n, num_vertices, r->source, r->target, path);
+    if(!len)
+      response[0] = SERVER_UNREACHABLE;
+  }
+  for(i = 0; i < len; i++)
+    path[i] = original_id(s->config->g, path[i]);
+  memcpy(&response[1], &d, sizeof(cl_float));
+  response[2] = len;
+  return len + 3;
+}
+
+static void serve(server *s) {
+  server_config *config = s->config;
+  graph *g = config->g;
+  size_t cells = (size_t)g->num_vertices*config->max_sources;
+  cl_float *result = (cl_float *)malloc(sizeof(cl_float)*cells);
+  cl_uint *preds = (cl_uint *)malloc(sizeof(cl_uint)*cells);
+  cl_uint *sources = (cl_uint *)malloc(sizeof(cl_uint)*config->max_sources);
+  cl_uint *response = (cl_uint *)malloc(sizeof(cl_uint)*((size_t)g->num_vertices + 3));
+  device_graph dg;
+  if(!result || !preds || !sources || !response) {
+    problem("Failed to allocate results for %u sources.\n", config->max_sources);
+    exit(-1);
+  }
+  if(config->env)
+    opencl_upload_graph(config->env, g, &dg);
+
+  for(;;) {
+    request *batch, *r;
+    cl_uint n, count = 0;
+    sssp_stats stats;
+    struct timeval start, end, delta, latency, worst;
+    pthread_mutex_lock(&s->lock);
+    while(!s->head && !s->stopping)
+      pthread_cond_wait(&s->ready, &s->lock);
+    if(s->stopping) {
+      pthread_mutex_unlock(&s->lock);
+      break;
+    }
+    batch = take_batch(s, sources, &n);
+    pthread_mutex_unlock(&s->lock);
+
+    gettimeofday(&start, NULL);
+    end = start;
+    stats.rounds = 0;
+    if(n && config->env)
+      opencl_multi_query(config->env, &dg, sources, n, config->batch, result, preds, &stats);
+    else if(n)
+      cpu_multi_bellman_ford(config->pool, g, sources, n, result, preds, &stats);
+    worst.tv_sec = worst.tv_usec = 0;
+    while(batch) {
+      r = batch;
+      batch = r->next;
+      cl_uint words = build_response(s, r, sources, n, result, preds, response);
+      write_full(r->conn->fd, response, sizeof(cl_uint)*words);
+      gettimeofday(&end, NULL);
+      latency = tv_delta(r->arrived, end);
+      if(latency.tv_sec > worst.tv_sec ||
+	 (latency.tv_sec == worst.tv_sec && latency.tv_usec > worst.tv_usec))
+	worst = latency;
+      pthread_mutex_lock(&s->lock);
+      release_connection(s, r->conn);
+      pthread_mutex_unlock(&s->lock);
+      free(r);
+      count++;
+    }
+    delta = tv_delta(start, end);
+    printf("%u queries, %u sources, %u rounds in %ld.%06ld, worst latency %ld.%06ld\n",
+	   count, n, stats.rounds, (long int)delta.tv_sec, (long int)delta.tv_usec,
+	   (long int)worst.tv_sec, (long int)worst.tv_usec);
+    fflush(stdout);
+  }
+
+  if(config->env)
+    opencl_release_graph(&dg);
+  free(result);
+  free(preds);
+  free(sources);
+  free(response);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+int run_server(server_config *config) {
+  struct sockaddr_un addr;
+  struct sigaction action;
+  pthread_t acceptor;
+  server s;
+  connection *conn;
+  request *r;
+
+  if(strlen(config->socket_path) >= sizeof(addr.sun_path)) {
+    problem("Socket path %s is too long\n", config->socket_path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, config->socket_path);
+  s.listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(config->socket_path);
+  if(s.listen_fd < 0 || bind(s.listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+     listen(s.listen_fd, 64) < 0) {
+    problem("Could not listen on %s\n", config->socket_path);
+    if(s.listen_fd >= 0)
+      close(s.listen_fd);
+    return -1;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  s.config = config;
+  s.head = s.tail = NULL;
+  s.connections = NULL;
+  s.readers = 0;
+  s.stopping = 0;
+  pthread_mutex_init(&s.lock, NULL);
+  pthread_cond_init(&s.ready, NULL);
+  printf("Serving %u vertices on %s, up to %u sources per pass.\n",
+	 config->g->num_vertices, config->socket_path, config->max_sources);
+  printf(BAR);
+  fflush(stdout);
+
+  if(pthread_create(&acceptor, NULL, accept_main, &s)) {
+    problem("Could not start the server\n");
+    close(s.listen_fd);
+    unlink(config->socket_path);
+    return -1;
+  }
+  serve(&s);
+  pthread_join(acceptor, NULL);
+  close(s.listen_fd);
+  unlink(config->socket_path);
+
+  //Unblock the readers and wait for them before the queue goes away.
+  pthread_mutex_lock(&s.lock);
+  for(conn = s.connections; conn; conn = conn->next)
+    shutdown(conn->fd, SHUT_RDWR);
+  while(s.readers)
+    pthread_cond_wait(&s.ready, &s.lock);
+  while((r = s.head)) {
+    s.head = r->next;
+    release_connection(&s, r->conn);
+    free(r);
+  }
+  pthread_mutex_unlock(&s.lock);
+  pthread_mutex_destroy(&s.lock);
+  pthread_cond_destroy(&s.ready);
+  printf("Server stopped.\n");
+  return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "sssp.h"
+#include "threadpool.h"
+#include "opencl_sssp.h"
+
+/*
+ * Query server.  The graph is loaded and (for OpenCL) uploaded once, then
+ * source/target queries arrive over a Unix domain socket.  Every message is
+ * a sequence of host-order 32-bit words:
+ *
+ *   request:   SERVER_MAGIC, source, target
+ *   response:  status, distance (float bits), path_length, path[path_length]
+ *
+ * path runs from source to target and is empty unless status is
+ * SERVER_OK.  A connection may pipeline any number of requests; responses
+ * come back in request order.  Requests from all connections are queued and
+ * answered together, up to max_sources distinct sources per pass.
+ */
+
+#define SERVER_MAGIC 0x50535353 //"SSSP"
+
+#define SERVER_OK 0
+#define SERVER_BAD_VERTEX 1
+#define SERVER_UNREACHABLE 2
+#define SERVER_BAD_REQUEST 3
+
+typedef struct _server_config {
+  const char *socket_path;
+  opencl_env *env;              //NULL to answer on the CPU.
+  thread_pool *pool;
+  graph *g;
+  cl_uint max_sources;
+  cl_uint batch;                //Sweep rounds per convergence check.
+} server_config;
+
+//Runs until SIGINT/SIGTERM.  Returns 0, or -1 if the socket could not be set up.
+int run_server(server_config *config);
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef SSSP_H
+#define SSSP_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/mman.h>
+
+/*--------------------------------------------------------------------------------*/
+
+#ifdef __APPLE__
+    #include <OpenCL/opencl.h>
+    #include <mach/mach_time.h>
+    typedef uint64_t                    time_delta_t;
+    typedef mach_timebase_info_data_t   frequency_t;
+#else
+    #include <CL/cl.h>
+    typedef struct timeval              time_delta_t;
+    typedef double                      frequency_t;
+#endif
+
+/*--------------------------------------------------------------------------------*/
+
+typedef int (*Compare_fn)(const void *, const void *);
+typedef struct _edge {
+  cl_uint source;
+  cl_uint dest;
+  cl_float weight;
+}__attribute__ ((aligned (16))) edge;
+
+//Compact device layouts: UpdateVertex never reads dest, and the out-edge
+//kernels never read source, so each side only ships the end it uses.
+typedef struct _gpu_edge {
+  cl_uint source;
+  cl_float weight;
+} gpu_edge;
+
+typedef struct _gpu_out_edge {
+  cl_uint dest;
+  cl_float weight;
+} gpu_out_edge;
+
+typedef enum { LAYOUT_PACKED, LAYOUT_WIDE } edge_layout;
+
+//How the sweep spreads vertices over work-items: one each, or binned by
+//in-degree so hubs get a whole work-group (see opencl_sssp.c).
+typedef enum { SCHEDULE_AUTO, SCHEDULE_VERTEX, SCHEDULE_BINNED } work_schedule;
+
+//Whether frontier rounds pull into the out-neighbours of what changed or
+//push from it with atomics; auto picks per round by frontier size.
+typedef enum { DIRECTION_AUTO, DIRECTION_PULL, DIRECTION_PUSH } frontier_direction;
+
+typedef struct _vertex {
+  cl_uint num_edges;
+  cl_uint index;
+} vertex;
+
+//In-edge CSR: edges are grouped by dest and vertices[v] indexes v's group.
+//The frontier modes also need the reverse (out-edge) CSR, grouped by source;
+//it is only built on demand and is NULL otherwise.
+//offsets/packed_edges are the same in-edge CSR in the binary cache layout
+//(v's edges are [offsets[v], offsets[v+1])); when the graph came from a
+//cache they point into its mapping.
+//coords holds x, y per vertex when a coordinate file was loaded.  After
+//reorder_graph, new_ids/old_ids map between the file's vertex numbers and
+//the internal ones; both are NULL while the two agree.
+typedef struct _graph {
+  cl_uint num_vertices;
+  cl_uint num_edges;
+  edge *edges;
+  vertex *vertices;
+  edge *out_edges;
+  vertex *out_vertices;
+  cl_uint *offsets;
+  gpu_edge *packed_edges;
+  void *mapping;
+  size_t mapping_size;
+  cl_int *coords;
+  cl_uint *new_ids;
+  cl_uint *old_ids;
+} graph;
+
+typedef struct _sssp_stats {
+  cl_uint rounds;
+  cl_ulong edges_scanned;
+} sssp_stats;
+
+//Chrome trace of device commands and host phases (see trace.h).
+typedef struct _trace_file trace_file;
+
+//Everything main() needs to launch kernels on one device.  trace is NULL
+//unless profiling was asked for.
+typedef struct _opencl_env {
+  cl_device_id device_id;
+  cl_context context;
+  cl_command_queue commands;
+  cl_program program;
+  edge_layout layout;
+  work_schedule schedule;
+  trace_file *trace;
+  cl_bool zero_copy;            //Wrap host arrays in place rather than copying (see opencl_sssp.c).
+  cl_bool packed_atomics;       //64-bit atom_min, for push rounds that keep their preds.
+  frontier_direction direction;
+} opencl_env;
+
+/*--------------------------------------------------------------------------------*/
+
+#define LOCAL_WORK_SIZE 32
+#define DEFAULT_SOURCE 16
+#define DELTA_SAMPLES 65536
+
+#define problem(...) fprintf(stderr, __VA_ARGS__)
+#define BAR "--------------------------------------------------------------------------------\n"
+#define PRINT_ROW_LENGTH 16
+
+/*--------------------------------------------------------------------------------*/
+
+void check_failure(cl_int err);
+const char *GetErrorString(cl_int error);
+cl_int opencl_setup(opencl_env *env, cl_device_type type, const char *kernel_file,
+		    edge_layout layout, trace_file *trace, const char *cache_dir);
+cl_int opencl_setup_device(opencl_env *env, cl_device_id device, const char *kernel_file,
+			   edge_layout layout, trace_file *trace, const char *cache_dir);
+void opencl_release(opencl_env *env);
+void printArray(cl_float *matrix, cl_int num);
+void UIprintArray(cl_uint *matrix, cl_int num);
+struct timeval tv_delta(struct timeval start, struct timeval end);
+
+void build_out_edges(graph *g);
+void free_graph(graph *g);
+cl_uint seed_frontier(graph *g, cl_uint source, cl_uint *frontier);
+int has_negative_weights(graph *g);
+cl_float default_delta(graph *g);
+void split_light_heavy(graph *g, cl_float delta, cl_uint *light);
+void pack_edges(graph *g);
+
+#endif
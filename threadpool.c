@@ -0,0 +1,202 @@
+#include <pthread.h>
+#include <stdint.h>
+#include "threadpool.h"
+
+/*--------------------------------------------------------------------------------*/
+
+//A worker's remaining range, lo in the low word and hi in the high word, so
+//the owner and thieves can both claim pieces of it with a single CAS.
+typedef struct _worker_range {
+  uint64_t bounds;
+  char pad[64 - sizeof(uint64_t)];
+} worker_range;
+
+struct _thread_pool {
+  cl_uint num_threads;
+  pthread_t *threads;
+  worker_range *ranges;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t finish;
+  unsigned long generation;
+  cl_uint running;
+  int shutdown;
+
+  range_fn fn;
+  void *ctx;
+  cl_uint grain;
+};
+
+typedef struct _worker_arg {
+  thread_pool *pool;
+  cl_uint id;
+} worker_arg;
+
+#define PACK(lo, hi) (((uint64_t)(hi) << 32) | (uint64_t)(lo))
+#define LO(b) ((cl_uint)((b) & 0xffffffffu))
+#define HI(b) ((cl_uint)((b) >> 32))
+
+/*--------------------------------------------------------------------------------*/
+
+static int take_own(thread_pool *pool, cl_uint id, cl_uint *begin, cl_uint *end) {
+  uint64_t *bounds = &pool->ranges[id].bounds;
+  uint64_t b = __atomic_load_n(bounds, __ATOMIC_ACQUIRE);
+  for(;;) {
+    cl_uint lo = LO(b), hi = HI(b);
+    if(lo >= hi)
+      return 0;
+    cl_uint n = hi - lo < pool->grain ? hi - lo : pool->grain;
+    if(__atomic_compare_exchange_n(bounds, &b, PACK(lo + n, hi), 0,
+				   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      *begin = lo;
+      *end = lo + n;
+      return 1;
+    }
+  }
+}
+
+static int steal(thread_pool *pool, cl_uint id) {
+  cl_uint i;
+  for(i = 1; i < pool->num_threads; i++) {
+    uint64_t *bounds = &pool->ranges[(id + i) % pool->num_threads].bounds;
+    uint64_t b = __atomic_load_n(bounds, __ATOMIC_ACQUIRE);
+    for(;;) {
+      cl_uint lo = LO(b), hi = HI(b);
+      if(lo >= hi)
+	break;
+      cl_uint mid = hi - lo <= pool->grain ? lo : lo + (hi - lo)/2;
+      if(__atomic_compare_exchange_n(bounds, &b, PACK(lo, mid), 0,
+				     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+	__atomic_store_n(&pool->ranges[id].bounds, PACK(mid, hi), __ATOMIC_RELEASE);
+	return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+static void run_tasks(thread_pool *pool, cl_uint id) {
+  cl_uint begin, end;
+  for(;;) {
+    if(take_own(pool, id, &begin, &end))
+      pool->fn(pool->ctx, begin, end, id);
+    else if(!steal(pool, id))
+      return;
+  }
+}
+
+static void *worker_main(void *arg) {
+  thread_pool *pool = ((worker_arg *)arg)->pool;
+  cl_uint id = ((worker_arg *)arg)->id;
+  unsigned long seen = 0;
+  free(arg);
+  for(;;) {
+    pthread_mutex_lock(&pool->lock);
+    while(pool->generation == seen && !pool->shutdown)
+      pthread_cond_wait(&pool->start, &pool->lock);
+    if(pool->shutdown) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool, id);
+
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->running == 0)
+      pthread_cond_signal(&pool->finish);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/*--------------------------------------------------------------------------------*/
+
+cl_uint default_thread_count(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (cl_uint)n : 1;
+}
+
+thread_pool *thread_pool_create(cl_uint num_threads) {
+  thread_pool *pool = (thread_pool *)calloc(1, sizeof(thread_pool));
+  cl_uint i;
+  if(!pool)
+    return NULL;
+  if(num_threads == 0)
+    num_threads = default_thread_count();
+  pool->num_threads = num_threads;
+  pool->threads = (pthread_t *)malloc(sizeof(pthread_t)*num_threads);
+  if(posix_memalign((void **)&pool->ranges, 64, sizeof(worker_range)*num_threads)) {
+    free(pool->threads);
+    free(pool);
+    return NULL;
+  }
+  memset(pool->ranges, 0, sizeof(worker_range)*num_threads);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->finish, NULL);
+  for(i = 1; i < num_threads; i++) {
+    worker_arg *arg = (worker_arg *)malloc(sizeof(worker_arg));
+    arg->pool = pool;
+    arg->id = i;
+    pthread_create(&pool->threads[i], NULL, worker_main, arg);
+  }
+  return pool;
+}
+
+void thread_pool_destroy(thread_pool *pool) {
+  cl_uint i;
+  if(!pool)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+  for(i = 1; i < pool->num_threads; i++)
+    pthread_join(pool->threads[i], NULL);
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->finish);
+  free(pool->ranges);
+  free(pool->threads);
+  free(pool);
+}
+
+cl_uint thread_pool_size(thread_pool *pool) {
+  return pool->num_threads;
+}
+
+void thread_pool_for(thread_pool *pool, cl_uint begin, cl_uint end, cl_uint grain,
+		     range_fn fn, void *ctx) {
+  cl_uint i, n = pool->num_threads;
+  cl_uint span = end > begin ? end - begin : 0;
+  if(span == 0)
+    return;
+  if(grain == 0)
+    grain = 1;
+  if(n == 1 || span <= grain) {
+    fn(ctx, begin, end, 0);
+    return;
+  }
+  for(i = 0; i < n; i++) {
+    cl_uint lo = begin + (cl_uint)((uint64_t)span*i/n);
+    cl_uint hi = begin + (cl_uint)((uint64_t)span*(i + 1)/n);
+    pool->ranges[i].bounds = PACK(lo, hi);
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->grain = grain;
+  pool->running = n - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  run_tasks(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while(pool->running)
+    pthread_cond_wait(&pool->finish, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,23 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "sssp.h"
+
+/*
+ * Persistent worker pool for the CPU engines. thread_pool_for splits
+ * [begin, end) into one contiguous range per worker; a worker eats its own
+ * range grain vertices at a time from the front and, once empty, steals the
+ * back half of somebody else's.  The calling thread is worker 0.
+ */
+
+typedef void (*range_fn)(void *ctx, cl_uint begin, cl_uint end, cl_uint worker);
+typedef struct _thread_pool thread_pool;
+
+thread_pool *thread_pool_create(cl_uint num_threads);
+void thread_pool_destroy(thread_pool *pool);
+cl_uint thread_pool_size(thread_pool *pool);
+void thread_pool_for(thread_pool *pool, cl_uint begin, cl_uint end, cl_uint grain,
+		     range_fn fn, void *ctx);
+cl_uint default_thread_count(void);
+
+#endif
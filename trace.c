@@ -0,0 +1,172 @@
+#include "trace.h"
+
+/*--------------------------------------------------------------------------------*/
+
+#define HOST_PID 0
+#define DEVICE_PID 1
+
+typedef struct _pending_event {
+  cl_event event;
+  const char *name;
+  cl_uint round;
+  cl_ulong bytes;
+  double host_us;               //When it was enqueued (or the counter posted).
+  int counter;
+  cl_long vertices;
+  cl_ulong edges;
+} pending_event;
+
+struct _trace_file {
+  FILE *out;
+  struct timeval start;
+  pending_event *pending;
+  cl_uint num_pending;
+  int written;
+  int have_offset;
+  double device_offset;         //Host microseconds at device time 0.
+};
+
+static double host_now(trace_file *t) {
+  struct timeval now, delta;
+  gettimeofday(&now, NULL);
+  delta = tv_delta(t->start, now);
+  return delta.tv_sec*1e6 + delta.tv_usec;
+}
+
+//Opens the next record; the caller writes the rest of the object.
+static FILE *record(trace_file *t) {
+  fprintf(t->out, "%s\n", t->written ? "," : "");
+  t->written = 1;
+  return t->out;
+}
+
+static void write_counters(trace_file *t, const pending_event *p, double ts) {
+  FILE *out = record(t);
+  fprintf(out, "{\"name\": \"%s\", \"ph\": \"C\", \"pid\": %d, \"ts\": %.3f, \"args\": {",
+	  p->name, DEVICE_PID, ts);
+  if(p->vertices >= 0)
+    fprintf(out, "\"vertices\": %lld, ", (long long)p->vertices);
+  fprintf(out, "\"edges\": %llu, \"bytes\": %llu}}", (unsigned long long)p->edges,
+	  (unsigned long long)p->bytes);
+}
+
+static void write_event(trace_file *t, pending_event *p) {
+  cl_ulong queued, submit, start, end;
+  cl_int err;
+  err  = clWaitForEvents(1, &p->event);
+  err |= clGetEventProfilingInfo(p->event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued, NULL);
+  err |= clGetEventProfilingInfo(p->event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit, NULL);
+  err |= clGetEventProfilingInfo(p->event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL);
+  err |= clGetEventProfilingInfo(p->event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL);
+  clReleaseEvent(p->event);
+  if(err != CL_SUCCESS)
+    return;
+  if(!t->have_offset) {
+    t->device_offset = p->host_us - queued*1e-3;
+    t->have_offset = 1;
+  }
+  if(p->counter) {
+    write_counters(t, p, t->device_offset + end*1e-3);
+    return;
+  }
+  FILE *out = record(t);
+  fprintf(out, "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": 0, "
+	  "\"ts\": %.3f, \"dur\": %.3f, \"args\": {\"round\": %u, \"bytes\": %llu, "
+	  "\"queued_ns\": %llu, \"submit_ns\": %llu, \"start_ns\": %llu, \"end_ns\": %llu}}",
+	  p->name, p->bytes ? "transfer" : "kernel", DEVICE_PID, t->device_offset + start*1e-3,
+	  (end - start)*1e-3, p->round, (unsigned long long)p->bytes,
+	  (unsigned long long)queued, (unsigned long long)submit, (unsigned long long)start,
+	  (unsigned long long)end);
+}
+
+/*--------------------------------------------------------------------------------*/
+
+trace_file *trace_open(const char *filename) {
+  trace_file *t = (trace_file *)calloc(1, sizeof(trace_file));
+  t->pending = (pending_event *)malloc(sizeof(pending_event)*TRACE_MAX_PENDING);
+  t->out = fopen(filename, "w");
+  if(!t->out) {
+    problem("Could not create %s\n", filename);
+    free(t->pending);
+    free(t);
+    return NULL;
+  }
+  gettimeofday(&t->start, NULL);
+  fprintf(t->out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  fprintf(record(t), "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+	  "\"args\": {\"name\": \"host\"}}", HOST_PID);
+  fprintf(record(t), "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+	  "\"args\": {\"name\": \"device\"}}", DEVICE_PID);
+  return t;
+}
+
+void trace_close(trace_file *t) {
+  if(!t)
+    return;
+  trace_flush(t);
+  fprintf(t->out, "\n]}\n");
+  if(fclose(t->out))
+    problem("Could not write the trace.\n");
+  free(t->pending);
+  free(t);
+}
+
+cl_event *trace_event(trace_file *t, const char *name, cl_uint round, cl_ulong bytes) {
+  if(!t)
+    return NULL;
+  if(t->num_pending == TRACE_MAX_PENDING)
+    trace_flush(t);
+  pending_event *p = &t->pending[t->num_pending++];
+  memset(p, 0, sizeof(pending_event));
+  p->name = name;
+  p->round = round;
+  p->bytes = bytes;
+  p->host_us = host_now(t);
+  return &p->event;
+}
+
+void trace_round(trace_file *t, cl_event end, const char *name, cl_uint round,
+		 cl_long vertices, cl_ulong edges, cl_ulong bytes) {
+  pending_event p;
+  if(!t)
+    return;
+  memset(&p, 0, sizeof(pending_event));
+  p.event = end;
+  p.name = name;
+  p.round = round;
+  p.bytes = bytes;
+  p.host_us = host_now(t);
+  p.counter = 1;
+  p.vertices = vertices;
+  p.edges = edges;
+  if(!end) {
+    write_counters(t, &p, p.host_us);
+    return;
+  }
+  if(t->num_pending == TRACE_MAX_PENDING)
+    trace_flush(t);
+  t->pending[t->num_pending++] = p;
+}
+
+void trace_span(trace_file *t, const char *name, struct timeval start, struct timeval end) {
+  struct timeval from, length;
+  if(!t)
+    return;
+  from = tv_delta(t->start, start);
+  length = tv_delta(start, end);
+  fprintf(record(t), "{\"name\": \"%s\", \"cat\": \"host\", \"ph\": \"X\", \"pid\": %d, "
+	  "\"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}", name, HOST_PID,
+	  from.tv_sec*1e6 + from.tv_usec, length.tv_sec*1e6 + length.tv_usec);
+}
+
+void trace_flush(trace_file *t) {
+  cl_uint i;
+  if(!t)
+    return;
+  //An enqueue that failed left its event NULL; check_failure exits on those
+  //anyway, but don't trip over one here.
+  for(i = 0; i < t->num_pending; i++)
+    if(t->pending[i].event)
+      write_event(t, &t->pending[i]);
+  t->num_pending = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "sssp.h"
+
+/*
+ * Chrome trace output (chrome://tracing or ui.perfetto.dev).  With a trace
+ * open, opencl_setup makes a profiling queue, and every enqueue that asks
+ * for trace_event(env->trace, ...) gets recorded: its span runs from
+ * CL_PROFILING_COMMAND_START to END on the device row, and the args keep
+ * the raw queued/submit/start/end nanoseconds.  Device times are shifted
+ * onto the host clock at the first command, so host spans (load, solve,
+ * output) line up with them.
+ *
+ * Per-round counters come out as counter tracks at the end of the round's
+ * last kernel:
+ *
+ *   vertices  sweep: vertices whose distance improved (the program is then
+ *             built with -DCOUNT_UPDATES, so the update flags count);
+ *             frontier: vertices in the round's frontier
+ *   edges     edges relaxed
+ *   bytes     modelled global memory traffic: every edge record, one
+ *             distance gather per edge, and each vertex's record, distance
+ *             and pred; no credit for caches
+ *
+ * Events are collected TRACE_MAX_PENDING at a time and written once they
+ * complete, so tracing adds a wait at most that often.
+ */
+
+#define TRACE_MAX_PENDING 4096
+
+//NULL (after reporting the problem) if filename cannot be created.
+trace_file *trace_open(const char *filename);
+//Writes everything still pending and closes the file.  t may be NULL.
+void trace_close(trace_file *t);
+
+//Returns where the enqueue should store its event, or NULL (no event) when
+//t is NULL.  name must outlive the trace (a literal); bytes is the size of
+//a transfer, 0 for kernels.
+cl_event *trace_event(trace_file *t, const char *name, cl_uint round, cl_ulong bytes);
+//Counters for one round, stamped at end's completion, or now if end is
+//NULL.  Takes over the caller's reference to end.  vertices < 0 is left out.
+void trace_round(trace_file *t, cl_event end, const char *name, cl_uint round,
+		 cl_long vertices, cl_ulong edges, cl_ulong bytes);
+//A host-side span.
+void trace_span(trace_file *t, const char *name, struct timeval start, struct timeval end);
+//Waits for every pending event and writes it out.
+void trace_flush(trace_file *t);
+
+#endif